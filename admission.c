@@ -0,0 +1,142 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions create the processes and pipes
+ * of a pipeline without giving up at the first failure
+ *
+ * fork() fails with EAGAIN once the user hits RLIMIT_NPROC
+ * (or the system runs out of pids) and with ENOMEM under
+ * memory pressure, and pipe() fails with ENFILE when the
+ * system runs out of files; all of these tend to pass, so
+ * the shell reaps the background jobs that have exited
+ * (a zombie still counts against RLIMIT_NPROC) and
+ * tries again after a wait that doubles each time, up to
+ * ADMISSION_MAX_TRIES tries
+ *
+ * once a launch had to wait the shell keeps pacing the
+ * launches after it by the wait that worked, halving it
+ * each time a launch goes through on its first try, so a
+ * batch of jobs slows down to what the limits allow
+ * instead of hitting them over and over
+ *
+ * EMFILE (the shell's own descriptors) will not change
+ * by waiting so it is not retried
+ */
+
+/* allow us to use 'nanosleep' */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "jobs.h"
+#include "admission.h"
+
+#define MICROSECONDS_PER_SECOND 1000000L
+#define NANOSECONDS_PER_MICROSECOND 1000L
+
+/*
+ * the wait before every launch, zero until
+ * a launch has had to wait
+ */
+static long launch_delay_us = 0;
+
+/*
+ * define prototypes
+ */
+static void sleep_microseconds(long microseconds);
+static int is_temporary(int error);
+static void pace_launch(void);
+static long next_backoff(long backoff_us);
+
+/*
+ * sleeps for a number of microseconds
+ */
+static void sleep_microseconds(long microseconds) {
+  struct timespec wait, remaining;
+
+  wait.tv_sec = microseconds / MICROSECONDS_PER_SECOND;
+  wait.tv_nsec = (microseconds % MICROSECONDS_PER_SECOND) *
+    NANOSECONDS_PER_MICROSECOND;
+  while (nanosleep(&wait, &remaining) != 0 && errno == EINTR) {
+    wait = remaining;
+  }
+}
+
+/*
+ * checks if an error from fork() or pipe() may pass
+ */
+static int is_temporary(int error) {
+  return (error == EAGAIN || error == ENOMEM || error == ENFILE);
+}
+
+/*
+ * waits before a launch if the last launches had to
+ */
+static void pace_launch(void) {
+  if (launch_delay_us > 0) sleep_microseconds(launch_delay_us);
+}
+
+/*
+ * gets the wait after one that did not work
+ */
+static long next_backoff(long backoff_us) {
+  backoff_us *= 2;
+
+  return (backoff_us > ADMISSION_MAX_BACKOFF_US) ?
+    ADMISSION_MAX_BACKOFF_US : backoff_us;
+}
+
+/*
+ * forks like fork() but waits out a shortage of processes
+ * or memory, returns NOT_ADMITTED (with errno set) if the
+ * shortage did not pass
+ */
+pid_t admit_fork(void) {
+  long backoff_us = ADMISSION_FIRST_BACKOFF_US;
+  pid_t pid;
+  int tries;
+
+  pace_launch();
+  for (tries = 1; ; tries++) {
+    pid = fork();
+    if (pid >= 0) break;
+    if (!is_temporary(errno) || tries == ADMISSION_MAX_TRIES) {
+      return NOT_ADMITTED;
+    }
+
+    reap_background_jobs();
+    sleep_microseconds(backoff_us);
+    launch_delay_us = backoff_us;
+    backoff_us = next_backoff(backoff_us);
+  }
+
+  /* only the shell keeps the pacing */
+  if (pid > 0 && tries == 1) launch_delay_us /= 2;
+
+  return pid;
+}
+
+/*
+ * creates a pipe like pipe() but waits out a shortage of
+ * files, returns NOT_ADMITTED (with errno set) if the
+ * shortage did not pass
+ */
+int admit_pipe(int fds[2]) {
+  long backoff_us = ADMISSION_FIRST_BACKOFF_US;
+  int tries;
+
+  for (tries = 1; pipe(fds) != 0; tries++) {
+    if (!is_temporary(errno) || tries == ADMISSION_MAX_TRIES) {
+      return NOT_ADMITTED;
+    }
+    sleep_microseconds(backoff_us);
+    backoff_us = next_backoff(backoff_us);
+  }
+
+  return ADMITTED;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <sys/types.h>
+
+/*
+ * how hard the shell tries to start a stage before
+ * it gives up on the pipeline, the waits between tries
+ * double from the first backoff up to the last one
+ */
+#define ADMISSION_MAX_TRIES 12
+#define ADMISSION_FIRST_BACKOFF_US 1000L
+#define ADMISSION_MAX_BACKOFF_US 256000L
+
+#define ADMITTED 0
+#define NOT_ADMITTED -1
+
+/*
+ * define functions for creating processes and
+ * pipes in a way that waits out a shortage
+ */
+pid_t admit_fork(void);
+int admit_pipe(int fds[2]);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions pin the stages of a
+ * pipeline to cpus with sched_setaffinity()
+ *
+ * a stage can be pinned by hand with "pin CPUS cmd"
+ * where CPUS is a list like "0-3,6" or the shell can
+ * do it automatically ("set -o autopin") in which case
+ * adjacent stages are put on cores that share the same
+ * last level cache so the data going through the pipe
+ * between them stays in that cache
+ *
+ * the topology is read from /sys/devices/system/cpu
+ * the first time it is needed and then kept
+ */
+
+/* allow us to use 'sched_setaffinity' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "pshell.h"
+#include "affinity.h"
+
+#define CPU_SYSFS_PATH "/sys/devices/system/cpu"
+#define MAX_SYSFS_PATH_SIZE 128
+#define MAX_SYSFS_VALUE_SIZE 64
+
+/*
+ * the caches of a cpu are index0, index1, ... and the
+ * highest level one is the last level cache
+ */
+#define MAX_CACHE_INDEX 16
+
+#define TOPOLOGY_NOT_LOADED 0
+#define TOPOLOGY_LOADED 1
+
+typedef struct cpu_placement {
+  int cpu;
+  int cache_group;
+  int is_hyperthread;
+} Cpu_placement;
+
+/*
+ * the usable cpus ordered so that cpus sharing a last
+ * level cache are next to each other and each physical
+ * core comes before its hyperthread siblings
+ *
+ * group_starts holds the index where each
+ * last level cache group begins
+ */
+static int topology_state = TOPOLOGY_NOT_LOADED;
+static int *ordered_cpus = NULL;
+static int num_ordered_cpus = 0;
+static int *group_starts = NULL;
+static int num_groups = 0;
+static int next_group = 0;
+
+/*
+ * define prototypes
+ */
+static int parse_cpu_list(char *cpu_list, cpu_set_t *cpu_set);
+static int read_sysfs_value(char *path, char *value);
+static int read_first_cpu(char *path);
+static int find_cache_group(int cpu);
+static int compare_placements(const void *a, const void *b);
+static void load_topology(void);
+
+/*
+ * parses a list of cpus like "0-3,6,8-9" into a cpu set
+ */
+static int parse_cpu_list(char *cpu_list, cpu_set_t *cpu_set) {
+  char *curr, *end;
+  long first, last, cpu;
+
+  CPU_ZERO(cpu_set);
+  curr = cpu_list;
+  while (*curr != '\0' && *curr != '\n') {
+    first = strtol(curr, &end, 10);
+    if (end == curr || first < 0 || first >= CPU_SETSIZE) {
+      return CPU_LIST_NOT_PARSED;
+    }
+    last = first;
+    curr = end;
+    if (*curr == '-') {
+      curr++;
+      last = strtol(curr, &end, 10);
+      if (end == curr || last < first || last >= CPU_SETSIZE) {
+        return CPU_LIST_NOT_PARSED;
+      }
+      curr = end;
+    }
+    for (cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, cpu_set);
+    }
+    if (*curr == ',') {
+      curr++;
+    } else if (*curr != '\0' && *curr != '\n') {
+      return CPU_LIST_NOT_PARSED;
+    }
+  }
+
+  return (CPU_COUNT(cpu_set) > 0) ? CPU_LIST_PARSED : CPU_LIST_NOT_PARSED;
+}
+
+/*
+ * checks if a cpu list can be used with "pin"
+ */
+int is_valid_cpu_list(char *cpu_list) {
+  cpu_set_t cpu_set;
+
+  if (cpu_list == NULL) return 0;
+
+  return (parse_cpu_list(cpu_list, &cpu_set) == CPU_LIST_PARSED);
+}
+
+/*
+ * pins the current process to a list of cpus
+ */
+void apply_cpu_list(char *cpu_list) {
+  cpu_set_t cpu_set;
+
+  if (cpu_list == NULL ||
+    parse_cpu_list(cpu_list, &cpu_set) != CPU_LIST_PARSED) {
+    return;
+  }
+
+  if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+    fprintf(stderr, "non fatal error - could not pin to cpus %s\n", cpu_list);
+    fprintf(stderr, "sched_setaffinity() failed with %d\n", errno);
+  }
+}
+
+/*
+ * pins the current process to a single cpu
+ */
+void apply_cpu(int cpu) {
+  cpu_set_t cpu_set;
+
+  if (cpu == NO_CPU) return;
+
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+}
+
+/*
+ * reads the first line of a sysfs file
+ */
+static int read_sysfs_value(char *path, char *value) {
+  FILE *file;
+
+  file = fopen(path, "r");
+  if (file == NULL) return 0;
+
+  if (fgets(value, MAX_SYSFS_VALUE_SIZE, file) == NULL) {
+    fclose(file);
+    return 0;
+  }
+  fclose(file);
+
+  return 1;
+}
+
+/*
+ * reads the lowest cpu in a sysfs cpu list file
+ */
+static int read_first_cpu(char *path) {
+  char value[MAX_SYSFS_VALUE_SIZE];
+  char *end;
+  long cpu;
+
+  if (!read_sysfs_value(path, value)) return NO_CPU;
+
+  cpu = strtol(value, &end, 10);
+  if (end == value) return NO_CPU;
+
+  return cpu;
+}
+
+/*
+ * gets an id for the last level cache of a cpu, which
+ * is the lowest numbered cpu that shares that cache
+ */
+static int find_cache_group(int cpu) {
+  char path[MAX_SYSFS_PATH_SIZE];
+  char value[MAX_SYSFS_VALUE_SIZE];
+  int i, level, highest_level = 0, cache_group = NO_CPU;
+
+  for (i = 0; i < MAX_CACHE_INDEX; i++) {
+    sprintf(path, CPU_SYSFS_PATH "/cpu%d/cache/index%d/level", cpu, i);
+    if (!read_sysfs_value(path, value)) break;
+
+    level = atoi(value);
+    if (level > highest_level) {
+      sprintf(path, CPU_SYSFS_PATH "/cpu%d/cache/index%d/shared_cpu_list",
+        cpu, i);
+      cache_group = read_first_cpu(path);
+      highest_level = level;
+    }
+  }
+
+  /* without cache information every cpu is in one group */
+  return (cache_group == NO_CPU) ? 0 : cache_group;
+}
+
+/*
+ * orders cpus by last level cache, then physical
+ * cores before hyperthreads, then by number
+ */
+static int compare_placements(const void *a, const void *b) {
+  const Cpu_placement *first = a, *second = b;
+
+  if (first->cache_group != second->cache_group) {
+    return first->cache_group - second->cache_group;
+  }
+  if (first->is_hyperthread != second->is_hyperthread) {
+    return first->is_hyperthread - second->is_hyperthread;
+  }
+
+  return first->cpu - second->cpu;
+}
+
+/*
+ * reads the cache topology of the cpus the shell
+ * is allowed to run on
+ */
+static void load_topology(void) {
+  char path[MAX_SYSFS_PATH_SIZE];
+  cpu_set_t allowed;
+  Cpu_placement *placements;
+  int cpu, i, count, first_sibling;
+
+  topology_state = TOPOLOGY_LOADED;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+
+  count = CPU_COUNT(&allowed);
+  placements = malloc(sizeof(Cpu_placement) * count);
+  MEM_CHECK(placements);
+
+  i = 0;
+  for (cpu = 0; cpu < CPU_SETSIZE && i < count; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+
+    placements[i].cpu = cpu;
+    placements[i].cache_group = find_cache_group(cpu);
+    sprintf(path, CPU_SYSFS_PATH "/cpu%d/topology/thread_siblings_list", cpu);
+    first_sibling = read_first_cpu(path);
+    placements[i].is_hyperthread = (first_sibling != NO_CPU &&
+      first_sibling != cpu);
+    i++;
+  }
+  qsort(placements, count, sizeof(Cpu_placement), compare_placements);
+
+  ordered_cpus = malloc(sizeof(int) * count);
+  MEM_CHECK(ordered_cpus);
+  group_starts = malloc(sizeof(int) * count);
+  MEM_CHECK(group_starts);
+  for (i = 0; i < count; i++) {
+    ordered_cpus[i] = placements[i].cpu;
+    if (i == 0 || placements[i].cache_group != placements[i - 1].cache_group) {
+      group_starts[num_groups++] = i;
+    }
+  }
+  num_ordered_cpus = count;
+
+  free(placements);
+}
+
+/*
+ * chooses a cpu for each stage of a pipeline so that
+ * adjacent stages share a last level cache
+ *
+ * each pipeline starts at the next cache group so that
+ * pipelines running at the same time are spread out
+ */
+void choose_pipeline_cpus(int *cpus, int num_stages) {
+  int i, start;
+
+  if (topology_state == TOPOLOGY_NOT_LOADED) load_topology();
+
+  if (num_ordered_cpus == 0) {
+    for (i = 0; i < num_stages; i++) {
+      cpus[i] = NO_CPU;
+    }
+    return;
+  }
+
+  start = group_starts[next_group];
+  next_group = (next_group + 1) % num_groups;
+  for (i = 0; i < num_stages; i++) {
+    cpus[i] = ordered_cpus[(start + i) % num_ordered_cpus];
+  }
+}
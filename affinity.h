@@ -0,0 +1,24 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#define PIN_KEYWORD "pin"
+
+#define NO_CPU -1
+
+#define CPU_LIST_PARSED 0
+#define CPU_LIST_NOT_PARSED 1
+
+/*
+ * define functions for pinning the stages
+ * of a pipeline to cpus
+ */
+int is_valid_cpu_list(char *cpu_list);
+void apply_cpu_list(char *cpu_list);
+void choose_pipeline_cpus(int *cpus, int num_stages);
+void apply_cpu(int cpu);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions count the allocations of the
+ * shell when it is built with "make alloc" (pshell-alloc.x)
+ *
+ * every malloc(), calloc(), realloc() and free() of the shell is
+ * replaced by the versions here (see alloc-count.h) which
+ * keep a small header in front of each block with its size
+ * and its call site, so the shell can report after each
+ * line how many allocations the line made, how many bytes
+ * they were and how many bytes were live at once, and at
+ * exit which call sites allocated the most and which
+ * blocks were never freed
+ *
+ * the shell only allocates from its main thread
+ * so none of this takes a lock
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alloc-count.h"
+
+/*
+ * this file calls the real functions
+ */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+#define SITE_TABLE_SIZE 1024
+#define OTHER_SITE_LINE 0
+#define SITE_NAME_SIZE 256
+
+/*
+ * the counts for one file:line that allocates
+ */
+typedef struct alloc_site {
+  char *file;
+  int line;
+  unsigned long allocations;
+  unsigned long bytes;
+  unsigned long live_blocks;
+  unsigned long live_bytes;
+} Alloc_site;
+
+/*
+ * the header in front of every block, the union
+ * keeps the block after it aligned for anything
+ */
+typedef union alloc_header {
+  struct {
+    size_t size;
+    Alloc_site *site;
+  } info;
+  long double align_long_double;
+  void *align_pointer;
+} Alloc_header;
+
+static Alloc_site sites[SITE_TABLE_SIZE];
+static Alloc_site sorted_sites[SITE_TABLE_SIZE];
+static Alloc_site other_site = {"(other)", OTHER_SITE_LINE, 0, 0, 0, 0};
+
+static unsigned long live_bytes = 0;
+static unsigned long peak_live_bytes = 0;
+
+static unsigned long line_number = 0;
+static unsigned long line_allocations = 0;
+static unsigned long line_bytes = 0;
+static unsigned long line_peak_live_bytes = 0;
+
+static pid_t shell_pid = 0;
+
+/*
+ * define prototypes
+ */
+static Alloc_site *find_site(char *file, int line);
+static void count_allocation(Alloc_header *header, size_t size,
+  Alloc_site *site);
+static void count_free(Alloc_header *header);
+static int compare_sites(const void *first, const void *second);
+static void report_allocations_at_exit(void);
+
+/*
+ * finds (or adds) the counts for a call site, the
+ * file names are the same string for every call
+ * from one file so they are compared as pointers
+ */
+static Alloc_site *find_site(char *file, int line) {
+  unsigned long hash;
+  int i, probe;
+
+  hash = ((unsigned long) file >> 4) * 31 + line;
+  for (probe = 0; probe < SITE_TABLE_SIZE; probe++) {
+    i = (hash + probe) % SITE_TABLE_SIZE;
+    if (sites[i].file == NULL) {
+      sites[i].file = file;
+      sites[i].line = line;
+      return &sites[i];
+    }
+    if (sites[i].file == file && sites[i].line == line) return &sites[i];
+  }
+
+  return &other_site;
+}
+
+/*
+ * counts a block that was just allocated
+ */
+static void count_allocation(Alloc_header *header, size_t size,
+  Alloc_site *site) {
+  header->info.size = size;
+  header->info.site = site;
+
+  site->allocations++;
+  site->bytes += size;
+  site->live_blocks++;
+  site->live_bytes += size;
+
+  line_allocations++;
+  line_bytes += size;
+  live_bytes += size;
+  if (live_bytes > peak_live_bytes) peak_live_bytes = live_bytes;
+  if (live_bytes > line_peak_live_bytes) line_peak_live_bytes = live_bytes;
+}
+
+/*
+ * counts a block that is about to be freed
+ */
+static void count_free(Alloc_header *header) {
+  header->info.site->live_blocks--;
+  header->info.site->live_bytes -= header->info.size;
+  live_bytes -= header->info.size;
+}
+
+void *counting_malloc(size_t size, char *file, int line) {
+  Alloc_header *header;
+
+  header = malloc(sizeof(Alloc_header) + size);
+  if (header == NULL) return NULL;
+  count_allocation(header, size, find_site(file, line));
+
+  return header + 1;
+}
+
+void *counting_calloc(size_t count, size_t size, char *file, int line) {
+  void *pointer;
+
+  if (size != 0 && count > (size_t) -1 / size) return NULL;
+
+  pointer = counting_malloc(count * size, file, line);
+  if (pointer != NULL) memset(pointer, 0, count * size);
+
+  return pointer;
+}
+
+void *counting_realloc(void *pointer, size_t size, char *file, int line) {
+  Alloc_header *header;
+
+  if (pointer == NULL) return counting_malloc(size, file, line);
+
+  /* a realloc() counts as a free of the old block
+   * and an allocation of the new one at this site */
+  header = (Alloc_header *) pointer - 1;
+  count_free(header);
+  header = realloc(header, sizeof(Alloc_header) + size);
+  if (header == NULL) return NULL;
+  count_allocation(header, size, find_site(file, line));
+
+  return header + 1;
+}
+
+void counting_free(void *pointer) {
+  Alloc_header *header;
+
+  if (pointer == NULL) return;
+
+  header = (Alloc_header *) pointer - 1;
+  count_free(header);
+  free(header);
+}
+
+/*
+ * prints what the last line allocated and
+ * starts counting for the next one
+ */
+void report_line_allocations(void) {
+  line_number++;
+  fprintf(stderr, "alloc - line %lu: %lu allocations, %lu bytes, "
+    "%lu bytes live at most (%lu live now)\n", line_number, line_allocations,
+    line_bytes, line_peak_live_bytes, live_bytes);
+
+  line_allocations = 0;
+  line_bytes = 0;
+  line_peak_live_bytes = live_bytes;
+}
+
+/*
+ * orders call sites by how many allocations they made
+ */
+static int compare_sites(const void *first, const void *second) {
+  const Alloc_site *first_site = first, *second_site = second;
+
+  if (first_site->allocations != second_site->allocations) {
+    return (first_site->allocations < second_site->allocations) ? 1 : -1;
+  }
+  if (first_site->file == NULL || second_site->file == NULL) {
+    return (first_site->file == NULL) - (second_site->file == NULL);
+  }
+
+  return strcmp(first_site->file, second_site->file);
+}
+
+/*
+ * prints the allocations of every call site and the
+ * blocks that were never freed when the shell exits
+ * (the children it forks inherit this and say nothing)
+ */
+static void report_allocations_at_exit(void) {
+  char site_name[SITE_NAME_SIZE];
+  unsigned long total_allocations = 0, leaked_blocks = 0;
+  int i;
+
+  if (getpid() != shell_pid) return;
+
+  /* the blocks point at the table so a copy is sorted */
+  memcpy(sorted_sites, sites, sizeof(sites));
+  qsort(sorted_sites, SITE_TABLE_SIZE, sizeof(Alloc_site), compare_sites);
+
+  fprintf(stderr, "alloc - %-28s %12s %14s %10s %12s\n", "call site",
+    "allocations", "bytes", "leaked", "leaked bytes");
+  for (i = 0; i < SITE_TABLE_SIZE && sorted_sites[i].file != NULL; i++) {
+    sprintf(site_name, "%.200s:%d", sorted_sites[i].file,
+      sorted_sites[i].line);
+    fprintf(stderr, "alloc - %-28s %12lu %14lu %10lu %12lu\n",
+      site_name, sorted_sites[i].allocations,
+      sorted_sites[i].bytes, sorted_sites[i].live_blocks,
+      sorted_sites[i].live_bytes);
+    total_allocations += sorted_sites[i].allocations;
+    leaked_blocks += sorted_sites[i].live_blocks;
+  }
+  if (other_site.allocations > 0) {
+    fprintf(stderr, "alloc - %-28s %12lu %14lu %10lu %12lu\n",
+      other_site.file, other_site.allocations, other_site.bytes,
+      other_site.live_blocks, other_site.live_bytes);
+    total_allocations += other_site.allocations;
+    leaked_blocks += other_site.live_blocks;
+  }
+
+  fprintf(stderr, "alloc - %lu allocations, %lu bytes live at most, "
+    "%lu blocks (%lu bytes) still allocated at exit\n", total_allocations,
+    peak_live_bytes, leaked_blocks, live_bytes);
+}
+
+/*
+ * starts reporting the allocations of the shell
+ */
+void init_alloc_count(void) {
+  shell_pid = getpid();
+  atexit(report_allocations_at_exit);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef ALLOC_COUNT_H
+#define ALLOC_COUNT_H
+
+/*
+ * this header is only used by "make alloc", which forces
+ * it into every file with "-include alloc-count.h" so that
+ * each malloc(), calloc(), realloc() and free() in the shell
+ * goes through the counting versions tagged with its call
+ * site (the shell has no strdup(), which would get past them)
+ *
+ * <stdlib.h> has to be read before the macros exist or its
+ * own declarations of malloc() and free() would be replaced
+ */
+#include <stdlib.h>
+
+void *counting_malloc(size_t size, char *file, int line);
+void *counting_calloc(size_t count, size_t size, char *file, int line);
+void *counting_realloc(void *pointer, size_t size, char *file, int line);
+void counting_free(void *pointer);
+
+/*
+ * define functions for reporting what was allocated
+ */
+void init_alloc_count(void);
+void report_line_allocations(void);
+
+#define malloc(size) counting_malloc((size), __FILE__, __LINE__)
+#define calloc(count, size) \
+  counting_calloc((count), (size), __FILE__, __LINE__)
+#define realloc(pointer, size) \
+  counting_realloc((pointer), (size), __FILE__, __LINE__)
+#define free(pointer) counting_free(pointer)
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions handle the "batch" prefix
+ * which runs a command whose arguments are too big
+ * to exec() all at once (execve() fails with E2BIG
+ * once they pass ARG_MAX) as a few commands that
+ * each get as many of the arguments as will fit:
+ *
+ *   batch -P 4 rm -f *.o
+ *
+ * runs "rm -f ..." once per batch, up to 4 batches
+ * at a time, the leading "-x" options (or the first
+ * N arguments with "-k N") go to every batch
+ *
+ * the batches are run by the child that was forked for
+ * the command, which exits with the status of the first
+ * batch that failed (or 0 if they all succeeded)
+ */
+
+/* allow us to use 'execvpe' */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "process-helper.h"
+#include "arg-batch.h"
+#include "metrics.h"
+#include "admission.h"
+
+/*
+ * room left under ARG_MAX for anything the kernel
+ * counts that is not in argv or envp (the same
+ * headroom that POSIX asks xargs to leave)
+ */
+#define ARG_MAX_HEADROOM 2048
+
+#define END_OF_OPTIONS "--"
+
+/*
+ * define prototypes
+ */
+static int parse_bounded_number(char *value, int min, int max, int *number);
+static long string_cost(char *string);
+static long array_cost(char **strings, int num_strings);
+static int count_kept_arguments(Arg_batch *batch, char **arguments,
+  int num_args);
+static pid_t start_batch(char *program, char **batch_arguments,
+  char **envp);
+static int wait_for_batch(int *status);
+
+/*
+ * initializes the batching of a command to not batched
+ */
+void init_arg_batch(Arg_batch *batch) {
+  if (batch == NULL) return;
+
+  batch->jobs = BATCH_NOT_SET;
+  batch->keep = BATCH_KEEP_OPTIONS;
+}
+
+/*
+ * checks if a command was given the "batch" prefix
+ */
+int is_batched(Arg_batch *batch) {
+  if (batch == NULL) return 0;
+
+  return (batch->jobs != BATCH_NOT_SET);
+}
+
+/*
+ * reads a number from min to max
+ */
+static int parse_bounded_number(char *value, int min, int max, int *number) {
+  char *end;
+  long parsed;
+
+  errno = 0;
+  parsed = strtol(value, &end, 10);
+  if (errno != 0 || end == value || *end != '\0' || parsed < min ||
+    parsed > max) {
+    return BATCH_NOT_PARSED;
+  }
+  *number = parsed;
+
+  return BATCH_PARSED;
+}
+
+/*
+ * parses one "-x value" option of "batch"
+ */
+int parse_batch_option(char *option, char *value, Arg_batch *batch) {
+  if (option == NULL || value == NULL || batch == NULL) {
+    return BATCH_NOT_PARSED;
+  }
+
+  if (strcmp(option, BATCH_JOBS_OPTION) == 0) {
+    return parse_bounded_number(value, 1, MAX_BATCH_JOBS, &batch->jobs);
+  } else if (strcmp(option, BATCH_KEEP_OPTION) == 0) {
+    return parse_bounded_number(value, 0, INT_MAX, &batch->keep);
+  }
+
+  return BATCH_NOT_PARSED;
+}
+
+/*
+ * gets how much of ARG_MAX a string uses up,
+ * the kernel counts its pointer along with it
+ */
+static long string_cost(char *string) {
+  return strlen(string) + NUL_TERM_SIZE + sizeof(char *);
+}
+
+/*
+ * gets how much of ARG_MAX an array of strings uses
+ * up, counting the NULL pointer that ends it
+ */
+static long array_cost(char **strings, int num_strings) {
+  long cost = sizeof(char *);
+  int i;
+
+  for (i = 0; i < num_strings; i++) {
+    cost += string_cost(strings[i]);
+  }
+
+  return cost;
+}
+
+/*
+ * gets how many arguments (after the program)
+ * are given to every batch
+ */
+static int count_kept_arguments(Arg_batch *batch, char **arguments,
+  int num_args) {
+  int keep;
+
+  if (batch->keep != BATCH_KEEP_OPTIONS) {
+    return (batch->keep < num_args) ? batch->keep : num_args;
+  }
+
+  /* the leading options, up to and including a "--" */
+  for (keep = 0; keep < num_args && arguments[keep][0] == '-'; keep++) {
+    if (strcmp(arguments[keep], END_OF_OPTIONS) == 0) return keep + 1;
+  }
+
+  return keep;
+}
+
+/*
+ * forks a child to exec one batch, returns NOT_ADMITTED
+ * if there was no process to be had for it
+ */
+static pid_t start_batch(char *program, char **batch_arguments,
+  char **envp) {
+  pid_t pid;
+
+  pid = admit_fork();
+  if (pid == 0) {
+    execvpe(program, batch_arguments, envp);
+    count_metric(COUNTER_EXEC_FAILURES);
+    fprintf(stderr, "non fatal error - could not run a batch of %s\n",
+      program);
+    fprintf(stderr, "strerror() says the problem is \"%s\"\n",
+      strerror(errno));
+    exit(EXIT_COULD_NOT_EXEC);
+  } else if (pid < 0) {
+    fprintf(stderr, "non fatal error - could not create child process\n");
+    fprintf(stderr, "fork() failed with %d\n", errno);
+  }
+
+  return pid;
+}
+
+/*
+ * waits for any batch to finish and gets its exit status
+ */
+static int wait_for_batch(int *status) {
+  int wait_status;
+
+  while (wait(&wait_status) < 0) {
+    if (errno != EINTR) return 0;
+  }
+
+  if (WIFEXITED(wait_status)) {
+    *status = WEXITSTATUS(wait_status);
+  } else if (WIFSIGNALED(wait_status)) {
+    *status = STATUS_SIGNAL_OFFSET + WTERMSIG(wait_status);
+  } else {
+    *status = wait_status;
+  }
+
+  return 1;
+}
+
+/*
+ * runs a command (arguments[0] is the program and the
+ * array ends with NULL) in as few batches as fit under
+ * ARG_MAX with the given environment, this only returns
+ * if the whole command fits in one exec() after all so
+ * the caller can exec it as usual and otherwise exits
+ * with the status of the first batch that failed, a
+ * batch that could not be forked stops the rest from
+ * starting once the ones running are done
+ */
+void exec_batches(Arg_batch *batch, char *program, char **arguments,
+  char **envp) {
+  char **batch_arguments;
+  long budget, fixed_cost, cost;
+  int num_args, num_envs, keep, first, last, i;
+  int running = 0, status, result = EXIT_SUCCESS;
+
+  for (num_args = 0; arguments[num_args] != NULL; num_args++);
+  for (num_envs = 0; envp[num_envs] != NULL; num_envs++);
+
+  budget = sysconf(_SC_ARG_MAX) - ARG_MAX_HEADROOM -
+    array_cost(envp, num_envs);
+  if (array_cost(arguments, num_args) <= budget) return;
+
+  /* the program and the kept arguments go to every batch */
+  keep = 1 + count_kept_arguments(batch, arguments + 1, num_args - 1);
+  fixed_cost = array_cost(arguments, keep);
+
+  /* one more for the NULL that ends the array */
+  batch_arguments = malloc(sizeof(char *) * (num_args + 1));
+  MEM_CHECK(batch_arguments);
+  memcpy(batch_arguments, arguments, sizeof(char *) * keep);
+
+  for (first = keep; first < num_args; first = last) {
+    /* every batch gets at least one argument even if it
+     * is too big on its own so exec() reports the error */
+    cost = fixed_cost + string_cost(arguments[first]);
+    for (last = first + 1; last < num_args; last++) {
+      if (cost + string_cost(arguments[last]) > budget) break;
+      cost += string_cost(arguments[last]);
+    }
+
+    if (running == batch->jobs && wait_for_batch(&status)) {
+      running--;
+      if (result == EXIT_SUCCESS) result = status;
+    }
+
+    for (i = first; i < last; i++) {
+      batch_arguments[keep + i - first] = arguments[i];
+    }
+    batch_arguments[keep + last - first] = NULL;
+    if (start_batch(program, batch_arguments, envp) < 0) {
+      if (result == EXIT_SUCCESS) result = EXIT_COULD_NOT_FORK;
+      break;
+    }
+    running++;
+  }
+
+  while (running > 0 && wait_for_batch(&status)) {
+    running--;
+    if (result == EXIT_SUCCESS) result = status;
+  }
+
+  free(batch_arguments);
+  exit(result);
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef ARG_BATCH_H
+#define ARG_BATCH_H
+
+#include "pshell-structs.h"
+
+#define BATCH_KEYWORD "batch"
+
+/*
+ * the options understood by "batch"
+ *
+ * -P -> how many batches may run at once (1 to 1024)
+ * -k -> how many of the first arguments go to every batch
+ */
+#define BATCH_JOBS_OPTION "-P"
+#define BATCH_KEEP_OPTION "-k"
+
+#define MAX_BATCH_JOBS 1024
+
+#define BATCH_PARSED 0
+#define BATCH_NOT_PARSED 1
+
+/*
+ * define functions for splitting the arguments
+ * of a command into batches that fit in ARG_MAX
+ */
+void init_arg_batch(Arg_batch *batch);
+int is_batched(Arg_batch *batch);
+int parse_batch_option(char *option, char *value, Arg_batch *batch);
+void exec_batches(Arg_batch *batch, char *program, char **arguments,
+  char **envp);
+
+#endif
@@ -0,0 +1,354 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "arg-batch.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pshell-structs.h"
+#include "arg-batch.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * what the child exits with when exec_batches()
+ * returns because the command fit in one exec()
+ */
+#define EXIT_NOT_BATCHED 100
+#define EXIT_FAILED_BATCH 5
+
+/*
+ * enough arguments of this size to need
+ * at least two batches under ARG_MAX
+ */
+#define ARGUMENT_SIZE 100
+#define PATH_SIZE 256
+#define BATCH_MARKER "batch"
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static void make_script(char *path, char *body);
+static char **make_arguments(char *program, char **kept, int num_kept,
+  int num_args);
+static void free_arguments(char **arguments);
+static int run_batches(Arg_batch *batch, char *program, char **arguments);
+static char *read_output(void);
+static void test_options(void);
+static void test_one_exec(void);
+static void test_in_order(int num_args);
+static void test_in_parallel(int num_args);
+static void test_failed_batch(int num_args);
+
+/*
+ * the script each batch runs and where its output goes
+ */
+static char directory[] = "/tmp/pshell-batch-XXXXXX";
+static char echo_script[PATH_SIZE], fail_script[PATH_SIZE];
+static char output_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+static void make_script(char *path, char *body) {
+  FILE *script;
+
+  script = fopen(path, "w");
+  if (script == NULL) fail("Could not make a script!");
+  fprintf(script, "#!/bin/sh\n%s\n", body);
+  fclose(script);
+  chmod(path, 0700);
+}
+
+/*
+ * builds a NULL terminated argv of the program, the kept
+ * arguments and num_args numbered arguments padded out
+ * to ARGUMENT_SIZE
+ */
+static char **make_arguments(char *program, char **kept, int num_kept,
+  int num_args) {
+  char **arguments;
+  int i, total;
+
+  total = 1 + num_kept + num_args;
+  arguments = malloc(sizeof(char *) * (total + 1));
+  if (arguments == NULL) fail("Out of memory!");
+
+  arguments[0] = strdup(program);
+  for (i = 0; i < num_kept; i++) arguments[1 + i] = strdup(kept[i]);
+  for (i = 0; i < num_args; i++) {
+    arguments[1 + num_kept + i] = malloc(ARGUMENT_SIZE + 1);
+    if (arguments[1 + num_kept + i] == NULL) fail("Out of memory!");
+    memset(arguments[1 + num_kept + i], 'x', ARGUMENT_SIZE);
+    sprintf(arguments[1 + num_kept + i], "%07d", i);
+    arguments[1 + num_kept + i][7] = 'x';
+    arguments[1 + num_kept + i][ARGUMENT_SIZE] = '\0';
+  }
+  arguments[total] = NULL;
+
+  return arguments;
+}
+
+static void free_arguments(char **arguments) {
+  int i;
+
+  for (i = 0; arguments[i] != NULL; i++) free(arguments[i]);
+  free(arguments);
+}
+
+/*
+ * runs exec_batches() in a child with its output sent
+ * to the output file and gets the exit status of it
+ */
+static int run_batches(Arg_batch *batch, char *program, char **arguments) {
+  pid_t pid;
+  int fd, status;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0) _exit(TEST_FAILED);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    exec_batches(batch, program, arguments, environ);
+    _exit(EXIT_NOT_BATCHED);
+  } else if (pid < 0) {
+    fail("Could not fork!");
+  }
+
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+    fail("Batches did not exit!");
+  }
+
+  return WEXITSTATUS(status);
+}
+
+/*
+ * gets everything the batches printed
+ */
+static char *read_output(void) {
+  struct stat output_stat;
+  char *output;
+  int fd;
+
+  fd = open(output_path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &output_stat) != 0) fail("No output!");
+  output = malloc(output_stat.st_size + 1);
+  if (output == NULL) fail("Out of memory!");
+  if (read(fd, output, output_stat.st_size) != output_stat.st_size) {
+    fail("Could not read the output!");
+  }
+  output[output_stat.st_size] = '\0';
+  close(fd);
+
+  return output;
+}
+
+/*
+ * checks the options "batch" takes and the values
+ * that are out of their range
+ */
+static void test_options(void) {
+  Arg_batch batch;
+
+  printf("Testing the options of batch\n");
+  init_arg_batch(&batch);
+  if (is_batched(&batch)) fail("Batched before any option!");
+  if (parse_batch_option("-P", "4", &batch) != BATCH_PARSED ||
+    batch.jobs != 4 || !is_batched(&batch) ||
+    parse_batch_option("-k", "2", &batch) != BATCH_PARSED ||
+    batch.keep != 2) {
+    fail("Options not parsed as expected!");
+  }
+  if (parse_batch_option("-P", "0", &batch) != BATCH_NOT_PARSED ||
+    parse_batch_option("-P", "1025", &batch) != BATCH_NOT_PARSED ||
+    parse_batch_option("-k", "-1", &batch) != BATCH_NOT_PARSED ||
+    parse_batch_option("-k", "2x", &batch) != BATCH_NOT_PARSED ||
+    parse_batch_option("-z", "1", &batch) != BATCH_NOT_PARSED) {
+    fail("Bad options were parsed!");
+  }
+  printf("Options as expected!\n");
+}
+
+/*
+ * checks that a command which fits in one
+ * exec() is handed back to the caller
+ */
+static void test_one_exec(void) {
+  Arg_batch batch;
+  char **arguments;
+
+  printf("Testing a command that fits in one exec()\n");
+  init_arg_batch(&batch);
+  batch.jobs = 1;
+  arguments = make_arguments(echo_script, NULL, 0, 10);
+  if (run_batches(&batch, echo_script, arguments) != EXIT_NOT_BATCHED) {
+    fail("Command was split up!");
+  }
+  printf("One exec() as expected!\n");
+  free_arguments(arguments);
+}
+
+/*
+ * checks that one batch at a time gets every argument
+ * once and in order with the leading options in front
+ * of each batch
+ */
+static void test_in_order(int num_args) {
+  char *options[] = {"-x", "--"};
+  Arg_batch batch;
+  char **arguments, *output, *line, *end;
+  int num_batches = 0, next = 0, position = 0;
+
+  printf("Testing %d arguments one batch at a time\n", num_args);
+  init_arg_batch(&batch);
+  batch.jobs = 1;
+  arguments = make_arguments(echo_script, options, 2, num_args);
+  if (run_batches(&batch, echo_script, arguments) != EXIT_SUCCESS) {
+    fail("Batches failed!");
+  }
+
+  output = read_output();
+  for (line = output; *line != '\0'; line = end + 1) {
+    end = strchr(line, '\n');
+    if (end == NULL) fail("Output cut short!");
+    *end = '\0';
+    if (strcmp(line, BATCH_MARKER) == 0) {
+      num_batches++;
+      position = 0;
+    } else if (position < 2) {
+      if (strcmp(line, options[position++]) != 0) {
+        fail("Batch did not start with the options!");
+      }
+    } else if (atoi(line) != next++ || strlen(line) != ARGUMENT_SIZE) {
+      printf("Expected: argument %d, Got: \"%.10s\"\n", next - 1, line);
+      fail("Arguments not as expected!");
+    }
+  }
+  if (num_batches < 2 || next != num_args) {
+    printf("Got: %d batches with %d arguments\n", num_batches, next);
+    fail("Batches not as expected!");
+  }
+  printf("%d batches as expected!\n", num_batches);
+  free(output);
+  free_arguments(arguments);
+}
+
+/*
+ * checks that batches run side by side get
+ * every argument once between them
+ */
+static void test_in_parallel(int num_args) {
+  Arg_batch batch;
+  char **arguments, *output, *line, *end, *seen;
+  int num_seen = 0, number;
+
+  printf("Testing %d arguments in parallel batches\n", num_args);
+  init_arg_batch(&batch);
+  parse_batch_option("-P", "4", &batch);
+  parse_batch_option("-k", "0", &batch);
+  arguments = make_arguments(echo_script, NULL, 0, num_args);
+  if (run_batches(&batch, echo_script, arguments) != EXIT_SUCCESS) {
+    fail("Batches failed!");
+  }
+
+  seen = calloc(num_args, 1);
+  if (seen == NULL) fail("Out of memory!");
+  output = read_output();
+  for (line = output; *line != '\0'; line = end + 1) {
+    end = strchr(line, '\n');
+    if (end == NULL) fail("Output cut short!");
+    *end = '\0';
+    if (strcmp(line, BATCH_MARKER) == 0) continue;
+    number = atoi(line);
+    if (number < 0 || number >= num_args || seen[number]) {
+      fail("Argument given twice!");
+    }
+    seen[number] = 1;
+    num_seen++;
+  }
+  if (num_seen != num_args) fail("Arguments were lost!");
+  printf("Parallel batches as expected!\n");
+  free(seen);
+  free(output);
+  free_arguments(arguments);
+}
+
+/*
+ * checks that a failed batch is what the
+ * whole command exits with
+ */
+static void test_failed_batch(int num_args) {
+  Arg_batch batch;
+  char **arguments;
+
+  printf("Testing batches that fail\n");
+  init_arg_batch(&batch);
+  batch.jobs = 2;
+  arguments = make_arguments(fail_script, NULL, 0, num_args);
+  if (run_batches(&batch, fail_script, arguments) != EXIT_FAILED_BATCH) {
+    fail("Status of the failed batch was lost!");
+  }
+  printf("Failed batch as expected!\n");
+  free_arguments(arguments);
+}
+
+/*
+ * runs commands with more arguments than ARG_MAX
+ * allows through batches of a script that prints
+ * the arguments it was given
+ */
+int main() {
+  int num_args;
+  char fail_body[PATH_SIZE];
+
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(echo_script, "%s/echo", directory);
+  sprintf(fail_script, "%s/fail", directory);
+  sprintf(output_path, "%s/output", directory);
+  make_script(echo_script,
+    "echo " BATCH_MARKER "\nfor argument; do echo \"$argument\"; done");
+  sprintf(fail_body, "exit %d", EXIT_FAILED_BATCH);
+  make_script(fail_script, fail_body);
+
+  /* two and a half times what fits in one exec() */
+  num_args = (int) (sysconf(_SC_ARG_MAX) / ARGUMENT_SIZE * 5 / 2);
+
+  test_options();
+  test_one_exec();
+  test_in_order(num_args);
+  test_in_parallel(num_args);
+  test_failed_batch(num_args);
+
+  unlink(echo_script);
+  unlink(fail_script);
+  unlink(output_path);
+  rmdir(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions implement the commands
+ * that the shell runs itself instead of handing
+ * off to another program
+ *
+ * a builtin that is the only command in its
+ * pipeline runs inside the shell so it can change
+ * the shell's state, otherwise it runs in the
+ * child process that was forked for it
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "environment.h"
+#include "shell-options.h"
+#include "history.h"
+#include "command-table.h"
+#include "builtins.h"
+
+#define SET_OPTION_ON "-o"
+#define SET_OPTION_OFF "+o"
+
+#define HISTORY_SEARCH_OPTION "-s"
+#define HISTORY_PREFIX_OPTION "-p"
+#define HISTORY_SEARCH_MATCHES 25
+
+typedef int (*Builtin_function)(Command *command);
+
+typedef struct builtin {
+  char *name;
+  Builtin_function function;
+} Builtin;
+
+/*
+ * define prototypes
+ */
+static Builtin_function find_builtin(char *program);
+static int builtin_assign(Command *command);
+static int builtin_export(Command *command);
+static int builtin_unset(Command *command);
+static int builtin_set(Command *command);
+static int parse_count(char *value, long *count);
+static int builtin_history(Command *command);
+static int builtin_complete(Command *command);
+
+/*
+ * the table of builtins terminated
+ * with a NULL name
+ */
+static Builtin builtins[] = {
+  {"export", builtin_export},
+  {"unset", builtin_unset},
+  {"set", builtin_set},
+  {"history", builtin_history},
+  {"complete", builtin_complete},
+  {NULL, NULL}
+};
+
+/*
+ * finds the function implementing a builtin
+ * or NULL if the program is not a builtin
+ */
+static Builtin_function find_builtin(char *program) {
+  Builtin *curr;
+
+  /* a command that is only "NAME=value"
+   * assignments has no program */
+  if (program == NULL) return builtin_assign;
+
+  for (curr = builtins; curr->name != NULL; curr++) {
+    if (strcmp(curr->name, program) == 0) {
+      return curr->function;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * checks if a command is implemented by the shell
+ */
+int is_builtin(Command *command) {
+  if (command == NULL) return NOT_A_BUILTIN;
+
+  return (find_builtin(command->program) != NULL) ?
+    IS_A_BUILTIN : NOT_A_BUILTIN;
+}
+
+/*
+ * runs a builtin command and returns its exit status
+ */
+int run_builtin(Command *command) {
+  Builtin_function function;
+
+  if (command == NULL) return BUILTIN_FAILURE;
+
+  function = find_builtin(command->program);
+  if (function == NULL) return BUILTIN_FAILURE;
+
+  return function(command);
+}
+
+/*
+ * "NAME=value ..." with no program sets each of the
+ * variables in the shell, a new one is not exported
+ */
+static int builtin_assign(Command *command) {
+  int i;
+
+  for (i = 0; i < command->num_assignments; i++) {
+    set_environment_assignment(command->assignments[i]);
+  }
+
+  return BUILTIN_SUCCESS;
+}
+
+/*
+ * "export NAME=value ..." sets each of the variables and
+ * exports it to the programs the shell runs, "export NAME"
+ * exports a variable that is already set
+ */
+static int builtin_export(Command *command) {
+  int i, status = BUILTIN_SUCCESS;
+
+  for (i = 0; i < command->num_args; i++) {
+    if (is_assignment(command->arguments[i])) {
+      set_environment_assignment(command->arguments[i]);
+      export_environment_variable(command->arguments[i]);
+    } else if (is_variable_name(command->arguments[i])) {
+      export_environment_variable(command->arguments[i]);
+    } else if (strchr(command->arguments[i], '=') != NULL) {
+      fprintf(stderr, "non fatal error - \"%s\" is not a valid\
+ assignment\n", command->arguments[i]);
+      status = BUILTIN_FAILURE;
+    }
+  }
+
+  return status;
+}
+
+/*
+ * "unset NAME ..." removes each of the variables
+ */
+static int builtin_unset(Command *command) {
+  int i;
+
+  for (i = 0; i < command->num_args; i++) {
+    unset_environment_variable(command->arguments[i]);
+  }
+
+  return BUILTIN_SUCCESS;
+}
+
+/*
+ * "set -o name", "set -o name=value" and "set +o name"
+ * change the options of the shell and "set -o" on its
+ * own prints all of them
+ */
+static int builtin_set(Command *command) {
+  char *name, *equals, *end;
+  long value;
+  int i, status = BUILTIN_SUCCESS;
+
+  if (command->num_args == 0 || (command->num_args == 1 &&
+    strcmp(command->arguments[0], SET_OPTION_ON) == 0)) {
+    print_shell_options();
+    return BUILTIN_SUCCESS;
+  }
+
+  for (i = 0; i + 1 < command->num_args; i += 2) {
+    name = malloc(sizeof(char) *
+      (strlen(command->arguments[i + 1]) + NUL_TERM_SIZE));
+    MEM_CHECK(name);
+    strcpy(name, command->arguments[i + 1]);
+
+    value = OPTION_ON;
+    equals = strchr(name, '=');
+    if (equals != NULL) {
+      *equals = '\0';
+      value = strtol(equals + 1, &end, 10);
+      if (end == equals + 1 || *end != '\0') {
+        fprintf(stderr, "non fatal error - \"%s\" is not a number\n",
+          equals + 1);
+        free(name);
+        status = BUILTIN_FAILURE;
+        continue;
+      }
+    }
+
+    if (strcmp(command->arguments[i], SET_OPTION_OFF) == 0) {
+      value = OPTION_OFF;
+    } else if (strcmp(command->arguments[i], SET_OPTION_ON) != 0) {
+      fprintf(stderr, "non fatal error - expected \"%s\" or \"%s\"\n",
+        SET_OPTION_ON, SET_OPTION_OFF);
+      free(name);
+      status = BUILTIN_FAILURE;
+      continue;
+    }
+
+    if (set_shell_option(name, value) != OPTION_SET) {
+      fprintf(stderr, "non fatal error - there is no option \"%s\"\n", name);
+      status = BUILTIN_FAILURE;
+    }
+    free(name);
+  }
+
+  if (i < command->num_args) {
+    fprintf(stderr, "non fatal error - \"%s\" needs an option name\n",
+      command->arguments[i]);
+    status = BUILTIN_FAILURE;
+  }
+
+  return status;
+}
+
+/*
+ * reads a count given to a builtin
+ */
+static int parse_count(char *value, long *count) {
+  char *end;
+
+  *count = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || *count < 0) {
+    fprintf(stderr, "non fatal error - \"%s\" is not a count\n", value);
+    return BUILTIN_FAILURE;
+  }
+
+  return BUILTIN_SUCCESS;
+}
+
+/*
+ * "history" prints the history, "history N" prints the
+ * last N lines of it and "history -s TEXT [N]" and
+ * "history -p TEXT [N]" print the newest N lines that
+ * contain or start with TEXT
+ */
+static int builtin_history(Command *command) {
+  long count = HISTORY_ALL;
+  int mode, status;
+
+  if (command->num_args == 0 || (command->num_args == 1 &&
+    command->arguments[0][0] != '-')) {
+    if (command->num_args == 1 &&
+      parse_count(command->arguments[0], &count) != BUILTIN_SUCCESS) {
+      return BUILTIN_FAILURE;
+    }
+    status = print_history(count);
+  } else if ((command->num_args == 2 || command->num_args == 3) &&
+    (strcmp(command->arguments[0], HISTORY_SEARCH_OPTION) == 0 ||
+    strcmp(command->arguments[0], HISTORY_PREFIX_OPTION) == 0)) {
+    mode = (strcmp(command->arguments[0], HISTORY_PREFIX_OPTION) == 0) ?
+      HISTORY_PREFIX : HISTORY_SUBSTRING;
+    count = HISTORY_SEARCH_MATCHES;
+    if (command->num_args == 3 &&
+      parse_count(command->arguments[2], &count) != BUILTIN_SUCCESS) {
+      return BUILTIN_FAILURE;
+    }
+    status = search_history(command->arguments[1], mode, count);
+  } else {
+    fprintf(stderr, "non fatal error - usage: history [N] | history -s TEXT\
+ [N] | history -p TEXT [N]\n");
+    return BUILTIN_FAILURE;
+  }
+
+  return (status == HISTORY_SUCCEEDED) ? BUILTIN_SUCCESS : BUILTIN_FAILURE;
+}
+
+/*
+ * "complete PREFIX" prints the names of the
+ * programs in $PATH that start with PREFIX
+ */
+static int builtin_complete(Command *command) {
+  if (command->num_args > 1) {
+    fprintf(stderr, "non fatal error - usage: complete [PREFIX]\n");
+    return BUILTIN_FAILURE;
+  }
+
+  return (print_command_completions((command->num_args == 1) ?
+    command->arguments[0] : "") == COMMAND_TABLE_SUCCEEDED) ?
+    BUILTIN_SUCCESS : BUILTIN_FAILURE;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "pshell-structs.h"
+
+#define NOT_A_BUILTIN 0
+#define IS_A_BUILTIN 1
+
+#define BUILTIN_SUCCESS 0
+#define BUILTIN_FAILURE 1
+
+/*
+ * define functions for running commands
+ * that are implemented by the shell itself
+ */
+int is_builtin(Command *command);
+int run_builtin(Command *command);
+
+#endif
@@ -0,0 +1,597 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep the output of a pipeline
+ * given the "cache" prefix, like:
+ *
+ *   cache sort big.log | uniq -c | sort -rn
+ *
+ * and write it out again (with the same exit status) in
+ * place of running the pipeline when nothing it uses has
+ * changed since, which is only right for pipelines whose
+ * output depends on nothing but their words and files
+ *
+ * the key of a pipeline is an FNV-1a hash of its expanded
+ * words, the programs they run (found in $PATH like exec()
+ * would), the exported variables, the working directory
+ * and of the inode, size and modification time of every
+ * word that names a file and of a stdin that is a file, so
+ * editing an input (or replacing a program) is a different
+ * key, the files are never read for this
+ *
+ * a word that names a directory brings in everything below
+ * it the same way (a program like "grep -r" reads all of
+ * it), the entries of a directory are hashed one by one
+ * and added up so the order readdir() gives them in does
+ * not matter, and a tree with more than CACHE_MAX_TREE_ENTRIES
+ * entries makes the pipeline one that is not kept
+ *
+ * a stdin that is a pipe, a socket or a terminal is an
+ * input there is no telling the next version of, so a
+ * pipeline with one of those is not kept either
+ *
+ * every entry is a file named by its key in the cache
+ * directory that holds a small header with the exit status
+ * and then the output, it is written out with
+ * copy_file_range() when stdout is a file and sendfile()
+ * otherwise, so the output never passes through the shell
+ *
+ * the last stage of a pipeline that was not in the cache
+ * forks again, the command runs with its stdout on a pipe
+ * and the process it forked from copies that to stdout and
+ * to a new entry, which is renamed into place once the
+ * command exited (one killed by a signal is not kept)
+ */
+
+/* allow us to use 'copy_file_range' and 'st_mtim' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "environment.h"
+#include "expansion.h"
+#include "process-helper.h"
+#include "cache.h"
+
+#define NUL_TERM_SIZE 1
+#define DIR_SEPARATOR_SIZE 1
+
+/*
+ * the 64 bit FNV-1a hash
+ */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325UL
+#define FNV_PRIME 0x100000001b3UL
+
+/*
+ * the first bytes of every entry, which are hashed into
+ * every key too so a new layout never reads an old entry
+ */
+#define CACHE_MAGIC "pshell cache 1"
+#define CACHE_MAGIC_SIZE 16
+
+#define CACHE_KEY_LENGTH 16
+#define CACHE_TEMP_SUFFIX ".XXXXXX"
+#define CACHE_DIR_MODE 0700
+
+#define CACHE_BUFFER_SIZE 65536
+
+/*
+ * how an entry is written out, the first that works
+ * for the shell's stdout is kept
+ */
+#define REPLAY_COPY_FILE_RANGE 0
+#define REPLAY_SENDFILE 1
+#define REPLAY_READ_WRITE 2
+
+#define NUM_IDENTITY_FIELDS 6
+
+#define CACHE_MAX_TREE_ENTRIES 100000
+
+#define PATH_HASHED 0
+#define PATH_TOO_BIG 1
+
+typedef struct cache_header {
+  char magic[CACHE_MAGIC_SIZE];
+  int status;
+} Cache_header;
+
+/*
+ * define prototypes
+ */
+static void hash_bytes(unsigned long *hash, void *data, size_t length);
+static void hash_string(unsigned long *hash, char *string);
+static void hash_identity(unsigned long *hash, struct stat *file_stat);
+static int hash_tree(unsigned long *hash, int dir_fd, long *budget);
+static int hash_path(unsigned long *hash, char *path);
+static void hash_program(unsigned long *hash, char *program);
+static int is_cacheable(Pipeline *pipeline);
+static char *cache_dir(void);
+static int write_all(int fd, char *data, size_t size);
+static void replay_output(int entry_fd, off_t offset, off_t end);
+static int copy_recording(int input_fd, int entry_fd);
+
+/*
+ * adds some bytes to a hash
+ */
+static void hash_bytes(unsigned long *hash, void *data, size_t length) {
+  unsigned char *bytes = data;
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    *hash ^= bytes[i];
+    *hash *= FNV_PRIME;
+  }
+}
+
+/*
+ * adds a string to a hash along with its NUL, so
+ * "ab" "c" and "a" "bc" are different
+ */
+static void hash_string(unsigned long *hash, char *string) {
+  hash_bytes(hash, string, strlen(string) + NUL_TERM_SIZE);
+}
+
+/*
+ * adds what tells one version of a file from
+ * another (without reading it) to a hash
+ */
+static void hash_identity(unsigned long *hash, struct stat *file_stat) {
+  long identity[NUM_IDENTITY_FIELDS];
+
+  identity[0] = (long) file_stat->st_dev;
+  identity[1] = (long) file_stat->st_ino;
+  identity[2] = (long) file_stat->st_mode;
+  identity[3] = (long) file_stat->st_size;
+  identity[4] = (long) file_stat->st_mtim.tv_sec;
+  identity[5] = (long) file_stat->st_mtim.tv_nsec;
+  hash_bytes(hash, identity, sizeof(identity));
+}
+
+/*
+ * adds everything below a directory to a hash, each entry
+ * (its name and identity and what is below it) is hashed
+ * on its own and the sums are added in so the order of the
+ * entries does not matter, budget is how many entries are
+ * left to look at before the tree counts as too big
+ *
+ * symbolic links are not followed, the directory is closed
+ */
+static int hash_tree(unsigned long *hash, int dir_fd, long *budget) {
+  DIR *stream;
+  struct dirent *entry;
+  struct stat entry_stat;
+  unsigned long sum = 0, entry_hash;
+  int child_fd, result = PATH_HASHED;
+
+  stream = fdopendir(dir_fd);
+  if (stream == NULL) {
+    close(dir_fd);
+    return PATH_HASHED;
+  }
+
+  while (result == PATH_HASHED && (entry = readdir(stream)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    if (--(*budget) < 0) {
+      result = PATH_TOO_BIG;
+      break;
+    }
+
+    entry_hash = FNV_OFFSET_BASIS;
+    hash_string(&entry_hash, entry->d_name);
+    if (fstatat(dirfd(stream), entry->d_name, &entry_stat,
+      AT_SYMLINK_NOFOLLOW) == 0) {
+      hash_identity(&entry_hash, &entry_stat);
+      if (S_ISDIR(entry_stat.st_mode)) {
+        child_fd = openat(dirfd(stream), entry->d_name,
+          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_fd >= 0) result = hash_tree(&entry_hash, child_fd, budget);
+      }
+    }
+    sum += entry_hash;
+  }
+  closedir(stream);
+
+  hash_bytes(hash, &sum, sizeof(sum));
+  return result;
+}
+
+/*
+ * adds a word to a hash along with the file it names
+ * if there is one, or the whole tree of a directory,
+ * returns PATH_TOO_BIG if that tree was too big
+ */
+static int hash_path(unsigned long *hash, char *path) {
+  struct stat file_stat;
+  long budget = CACHE_MAX_TREE_ENTRIES;
+  int dir_fd;
+
+  hash_string(hash, path);
+  if (stat(path, &file_stat) != 0) return PATH_HASHED;
+  hash_identity(hash, &file_stat);
+  if (!S_ISDIR(file_stat.st_mode)) return PATH_HASHED;
+
+  dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) return PATH_HASHED;
+
+  return hash_tree(hash, dir_fd, &budget);
+}
+
+/*
+ * adds a program to a hash along with the file that
+ * exec() would run for it, searching $PATH for a
+ * name without a '/' in it
+ */
+static void hash_program(unsigned long *hash, char *program) {
+  struct stat file_stat;
+  char *path, *dir_start, *dir_end, *candidate;
+  size_t dir_length;
+
+  if (strchr(program, '/') != NULL) {
+    hash_string(hash, program);
+    if (stat(program, &file_stat) == 0) hash_identity(hash, &file_stat);
+    return;
+  }
+  hash_string(hash, program);
+
+  path = get_environment_variable("PATH");
+  if (path == NULL) return;
+
+  dir_start = path;
+  while (1) {
+    dir_end = strchr(dir_start, ':');
+    dir_length = (dir_end != NULL) ? (size_t) (dir_end - dir_start) :
+      strlen(dir_start);
+
+    /* an empty directory in $PATH is the working directory */
+    candidate = malloc(sizeof(char) * (dir_length + DIR_SEPARATOR_SIZE +
+      strlen(program) + NUL_TERM_SIZE));
+    MEM_CHECK(candidate);
+    if (dir_length == 0) {
+      strcpy(candidate, program);
+    } else {
+      sprintf(candidate, "%.*s/%s", (int) dir_length, dir_start, program);
+    }
+
+    if (stat(candidate, &file_stat) == 0 && S_ISREG(file_stat.st_mode) &&
+      access(candidate, X_OK) == 0) {
+      hash_string(hash, candidate);
+      hash_identity(hash, &file_stat);
+      free(candidate);
+      return;
+    }
+    free(candidate);
+
+    if (dir_end == NULL) return;
+    dir_start = dir_end + 1;
+  }
+}
+
+/*
+ * checks if the output of a pipeline can be kept, which
+ * needs every stage to be a program (with no process
+ * substitutions) and a stdin that is not a pipe, a socket
+ * or a terminal since there is no telling what would come in
+ */
+static int is_cacheable(Pipeline *pipeline) {
+  struct stat input_stat;
+  int i;
+
+  for (i = 0; i < pipeline->num_commands; i++) {
+    if (pipeline->commands[i]->kind != COMMAND_SIMPLE ||
+      pipeline->commands[i]->program == NULL ||
+      pipeline->commands[i]->num_substitutions > 0) {
+      return 0;
+    }
+  }
+
+  if (fstat(STDIN_FILENO, &input_stat) != 0) return 1;
+  return (!S_ISFIFO(input_stat.st_mode) && !S_ISSOCK(input_stat.st_mode) &&
+    !isatty(STDIN_FILENO));
+}
+
+/*
+ * gets the path of the cache directory (making it
+ * if it is not there yet) or NULL if there is none
+ */
+static char *cache_dir(void) {
+  char *base, *path;
+
+  base = get_environment_variable(CACHE_DIR_VARIABLE);
+  if (base != NULL && base[0] != '\0') {
+    path = malloc(sizeof(char) * (strlen(base) + NUL_TERM_SIZE));
+    MEM_CHECK(path);
+    strcpy(path, base);
+  } else {
+    base = get_environment_variable("HOME");
+    if (base == NULL || base[0] == '\0') return NULL;
+    path = malloc(sizeof(char) * (strlen(base) + DIR_SEPARATOR_SIZE +
+      strlen(CACHE_DEFAULT_NAME) + NUL_TERM_SIZE));
+    MEM_CHECK(path);
+    sprintf(path, "%s/%s", base, CACHE_DEFAULT_NAME);
+  }
+
+  if (mkdir(path, CACHE_DIR_MODE) != 0 && errno != EEXIST) {
+    fprintf(stderr, "non fatal error - could not make the cache directory\
+ \"%s\", running the pipeline without it\n", path);
+    fprintf(stderr, "mkdir() failed with %d\n", errno);
+    free(path);
+    return NULL;
+  }
+
+  return path;
+}
+
+/*
+ * gets the path of the entry a pipeline's output is kept
+ * in (whether it is there yet or not) or NULL if it can
+ * not be kept, this expands the words of the pipeline
+ * and looks at every file they name
+ */
+char *find_cache_entry(Pipeline *pipeline) {
+  unsigned long hash = FNV_OFFSET_BASIS;
+  struct stat input_stat;
+  Command expanded;
+  char **variable;
+  char *cwd, *dir, *entry_path;
+  long offset;
+  int i, j;
+
+  if (!is_cacheable(pipeline)) return NULL;
+
+  hash_string(&hash, CACHE_MAGIC);
+
+  /* a stdin that is a file is an input like any other,
+   * along with how much of it was already read */
+  if (fstat(STDIN_FILENO, &input_stat) == 0 && S_ISREG(input_stat.st_mode)) {
+    hash_identity(&hash, &input_stat);
+    offset = (long) lseek(STDIN_FILENO, 0, SEEK_CUR);
+    hash_bytes(&hash, &offset, sizeof(offset));
+  }
+
+  cwd = getcwd(NULL, 0);
+  if (cwd == NULL) return NULL;
+  hash_string(&hash, cwd);
+  free(cwd);
+
+  for (variable = get_environment_block(); *variable != NULL; variable++) {
+    hash_string(&hash, *variable);
+  }
+
+  for (i = 0; i < pipeline->num_commands; i++) {
+    expand_command(pipeline->commands[i], &expanded);
+    hash_bytes(&hash, &expanded.num_assignments,
+      sizeof(expanded.num_assignments));
+    for (j = 0; j < expanded.num_assignments; j++) {
+      hash_string(&hash, expanded.assignments[j]);
+    }
+    hash_program(&hash, expanded.program);
+    hash_bytes(&hash, &expanded.num_args, sizeof(expanded.num_args));
+    for (j = 0; j < expanded.num_args; j++) {
+      if (hash_path(&hash, expanded.arguments[j]) == PATH_TOO_BIG) break;
+    }
+    cleanup_expanded_command(&expanded);
+    if (j < expanded.num_args) return NULL;
+  }
+
+  dir = cache_dir();
+  if (dir == NULL) return NULL;
+
+  entry_path = malloc(sizeof(char) * (strlen(dir) + DIR_SEPARATOR_SIZE +
+    CACHE_KEY_LENGTH + NUL_TERM_SIZE));
+  MEM_CHECK(entry_path);
+  sprintf(entry_path, "%s/%016lx", dir, hash);
+  free(dir);
+
+  return entry_path;
+}
+
+/*
+ * writes all of the data to a file
+ */
+static int write_all(int fd, char *data, size_t size) {
+  ssize_t written;
+
+  while (size > 0) {
+    written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    data += written;
+    size -= written;
+  }
+
+  return 0;
+}
+
+/*
+ * writes the part of an entry from offset to end out
+ * to stdout without bringing it into the shell, unless
+ * neither copy_file_range() nor sendfile() work there
+ */
+static void replay_output(int entry_fd, off_t offset, off_t end) {
+  struct stat output_stat;
+  char buffer[CACHE_BUFFER_SIZE];
+  ssize_t num_copied;
+  int method;
+
+  method = REPLAY_SENDFILE;
+  if (fstat(STDOUT_FILENO, &output_stat) == 0 &&
+    S_ISREG(output_stat.st_mode)) {
+    method = REPLAY_COPY_FILE_RANGE;
+  }
+
+  while (offset < end) {
+    if (method == REPLAY_COPY_FILE_RANGE) {
+      num_copied = copy_file_range(entry_fd, &offset, STDOUT_FILENO, NULL,
+        end - offset, 0);
+    } else if (method == REPLAY_SENDFILE) {
+      num_copied = sendfile(STDOUT_FILENO, entry_fd, &offset, end - offset);
+    } else {
+      num_copied = pread(entry_fd, buffer, (end - offset < CACHE_BUFFER_SIZE) ?
+        (size_t) (end - offset) : CACHE_BUFFER_SIZE, offset);
+      if (num_copied > 0 && write_all(STDOUT_FILENO, buffer, num_copied) != 0) {
+        return;
+      }
+      if (num_copied > 0) offset += num_copied;
+    }
+
+    if (num_copied < 0 && errno == EINTR) continue;
+
+    /* nothing was written yet when these fail,
+     * so the next method starts at the same offset */
+    if (num_copied < 0 && method != REPLAY_READ_WRITE &&
+      (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+      errno == EOPNOTSUPP || errno == EBADF)) {
+      method++;
+      continue;
+    }
+    if (num_copied <= 0) return;
+  }
+}
+
+/*
+ * writes an entry out to stdout and gets the exit status
+ * kept with it, returns CACHE_MISS if it is not there
+ */
+int replay_cache_entry(char *entry_path, int *status) {
+  Cache_header header;
+  struct stat entry_stat;
+  int entry_fd;
+
+  entry_fd = open(entry_path, O_RDONLY | O_CLOEXEC);
+  if (entry_fd < 0) return CACHE_MISS;
+
+  if (read(entry_fd, &header, sizeof(header)) != sizeof(header) ||
+    memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+    fstat(entry_fd, &entry_stat) != 0) {
+    close(entry_fd);
+    return CACHE_MISS;
+  }
+
+  /* anything the shell printed itself goes first */
+  fflush(stdout);
+  replay_output(entry_fd, sizeof(header), entry_stat.st_size);
+  close(entry_fd);
+
+  *status = header.status;
+  return CACHE_HIT;
+}
+
+/*
+ * copies what comes in on a pipe to stdout and to an
+ * entry until it is closed, returns 1 if all of it
+ * made it into the entry
+ */
+static int copy_recording(int input_fd, int entry_fd) {
+  char buffer[CACHE_BUFFER_SIZE];
+  ssize_t num_read;
+  int kept = 1;
+
+  while (1) {
+    num_read = read(input_fd, buffer, sizeof(buffer));
+    if (num_read < 0 && errno == EINTR) continue;
+    if (num_read <= 0) break;
+
+    write_all(STDOUT_FILENO, buffer, num_read);
+    if (kept && write_all(entry_fd, buffer, num_read) != 0) kept = 0;
+  }
+
+  return (kept && num_read == 0);
+}
+
+/*
+ * keeps the output of the last stage of a pipeline in an
+ * entry, this is meant to be called in the child after
+ * fork() before it runs the command
+ *
+ * it returns in a new child whose stdout is a pipe to the
+ * process it was called in, which copies the output from
+ * that pipe and exits with the command's exit status once
+ * it is done (after renaming the entry into place), if
+ * the entry can not be made it returns right away and the
+ * command runs as if it was not cached
+ */
+void record_cache_entry(char *entry_path) {
+  Cache_header header;
+  char *temp_path;
+  int entry_fd, fds[2], status, kept;
+  pid_t pid;
+
+  temp_path = malloc(sizeof(char) * (strlen(entry_path) +
+    strlen(CACHE_TEMP_SUFFIX) + NUL_TERM_SIZE));
+  MEM_CHECK(temp_path);
+  sprintf(temp_path, "%s%s", entry_path, CACHE_TEMP_SUFFIX);
+
+  /* the header is filled in once the exit status is known */
+  memset(&header, 0, sizeof(header));
+  entry_fd = mkstemp(temp_path);
+  if (entry_fd < 0) {
+    free(temp_path);
+    return;
+  }
+  if (write_all(entry_fd, (char *) &header, sizeof(header)) != 0 ||
+    pipe(fds) != 0) {
+    unlink(temp_path);
+    close(entry_fd);
+    free(temp_path);
+    return;
+  }
+
+  pid = fork();
+  if (pid <= 0) {
+    close(fds[0]);
+    close(entry_fd);
+    if (pid == 0) {
+      dup2(fds[1], STDOUT_FILENO);
+    } else {
+      unlink(temp_path);
+    }
+    close(fds[1]);
+    free(temp_path);
+    return;
+  }
+
+  /* ^C is for the command, this process
+   * cleans up once the command is gone */
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+
+  close(fds[1]);
+  kept = copy_recording(fds[0], entry_fd);
+  close(fds[0]);
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+
+  if (kept && WIFEXITED(status)) {
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.status = WEXITSTATUS(status);
+    kept = (pwrite(entry_fd, &header, sizeof(header), 0) == sizeof(header) &&
+      rename(temp_path, entry_path) == 0);
+  } else {
+    kept = 0;
+  }
+  if (!kept) unlink(temp_path);
+  close(entry_fd);
+  free(temp_path);
+
+  if (WIFSIGNALED(status)) exit(STATUS_SIGNAL_OFFSET + WTERMSIG(status));
+  exit(WEXITSTATUS(status));
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "pshell-structs.h"
+
+#define CACHE_KEYWORD "cache"
+
+/*
+ * where the output of cached pipelines is kept, $PSHELL_CACHE
+ * or a directory with the default name in $HOME
+ */
+#define CACHE_DIR_VARIABLE "PSHELL_CACHE"
+#define CACHE_DEFAULT_NAME ".pshell_cache"
+
+#define CACHE_HIT 0
+#define CACHE_MISS 1
+
+/*
+ * define functions for keeping the output and exit status
+ * of a pipeline and replaying it instead of running the
+ * pipeline again when nothing it uses has changed
+ */
+char *find_cache_entry(Pipeline *pipeline);
+int replay_cache_entry(char *entry_path, int *status);
+void record_cache_entry(char *entry_path);
+
+#endif
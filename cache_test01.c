@@ -0,0 +1,253 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "cache.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "process-helper.h"
+#include "cache.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+#define PATH_SIZE 256
+#define OUTPUT_SIZE 4096
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int run_line(char *line, char *output);
+static void make_file(char *path, char *contents, int mode);
+static int count_runs(void);
+static void expect_run(char *line, int expected_status, char *expected,
+  int expected_runs);
+static void remove_tree(char *path);
+
+/*
+ * the scripts the cached pipelines run append a line
+ * to the log each time they really run
+ */
+static char output_path[PATH_SIZE], log_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * runs a line like the shell would with its output
+ * sent to the output file and gets what it printed
+ * along with its exit status
+ */
+static int run_line(char *line, char *output) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int saved_stdout, fd, status;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  token_list = parse_tokens(line);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  status = execute_sync_sequence(sync_sequence);
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return status;
+}
+
+static void make_file(char *path, char *contents, int mode) {
+  FILE *file;
+
+  file = fopen(path, "w");
+  if (file == NULL) fail("Could not make a file!");
+  fputs(contents, file);
+  fclose(file);
+  chmod(path, mode);
+}
+
+/*
+ * counts how many times the scripts really ran
+ */
+static int count_runs(void) {
+  FILE *log;
+  int c, count = 0;
+
+  log = fopen(log_path, "r");
+  if (log == NULL) return 0;
+  while ((c = fgetc(log)) != EOF) {
+    if (c == '\n') count++;
+  }
+  fclose(log);
+
+  return count;
+}
+
+/*
+ * checks what a line printed and its exit status, and
+ * how many times the scripts ran so far, which does not
+ * go up when the output came from the cache
+ */
+static void expect_run(char *line, int expected_status, char *expected,
+  int expected_runs) {
+  char output[OUTPUT_SIZE];
+  int status;
+
+  printf("Testing \"%s\"\n", line);
+  status = run_line(line, output);
+  if (status != expected_status) {
+    printf("Expected: status %d, Got: %d\n", expected_status, status);
+    fail("Exit status not as expected!");
+  }
+  if (strcmp(output, expected) != 0) {
+    printf("Expected: \"%s\", Got: \"%s\"\n", expected, output);
+    fail("Output not as expected!");
+  }
+  if (count_runs() != expected_runs) {
+    printf("Expected: %d runs, Got: %d\n", expected_runs, count_runs());
+    fail((count_runs() > expected_runs) ? "Cache was missed!" :
+      "Cache was hit!");
+  }
+  printf("Runs as expected!\n");
+}
+
+/*
+ * removes a directory and everything below it
+ */
+static void remove_tree(char *path) {
+  char child[PATH_SIZE * 2];
+  struct dirent *entry;
+  struct stat child_stat;
+  DIR *dir;
+
+  dir = opendir(path);
+  if (dir == NULL) return;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    sprintf(child, "%s/%s", path, entry->d_name);
+    if (lstat(child, &child_stat) == 0 && S_ISDIR(child_stat.st_mode)) {
+      remove_tree(child);
+    } else {
+      unlink(child);
+    }
+  }
+  closedir(dir);
+  rmdir(path);
+}
+
+/*
+ * runs cached pipelines over files that are changed
+ * between the runs and checks which runs were replayed
+ */
+int main() {
+  char directory[] = "/tmp/pshell-cache-XXXXXX";
+  char cache_dir[PATH_SIZE], input[PATH_SIZE], script[PATH_SIZE];
+  char failing[PATH_SIZE], lister[PATH_SIZE], tree[PATH_SIZE];
+  char path[PATH_SIZE * 2], body[OUTPUT_SIZE], line[OUTPUT_SIZE];
+  int fd;
+
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(output_path, "%s/output", directory);
+  sprintf(log_path, "%s/log", directory);
+  sprintf(cache_dir, "%s/cache", directory);
+  sprintf(input, "%s/input", directory);
+  sprintf(script, "%s/show", directory);
+  sprintf(failing, "%s/fail", directory);
+  sprintf(lister, "%s/list", directory);
+  sprintf(tree, "%s/tree", directory);
+  set_environment_variable(CACHE_DIR_VARIABLE, cache_dir);
+
+  /* a stdin that is a pipe or a terminal is never cached */
+  fd = open("/dev/null", O_RDONLY);
+  if (fd < 0) fail("Could not open /dev/null!");
+  dup2(fd, STDIN_FILENO);
+  close(fd);
+
+  sprintf(body, "#!/bin/sh\necho run >> %s\ncat \"$@\"\n", log_path);
+  make_file(script, body, 0700);
+  sprintf(body, "#!/bin/sh\necho run >> %s\necho failed\nexit 4\n",
+    log_path);
+  make_file(failing, body, 0700);
+  sprintf(body, "#!/bin/sh\necho run >> %s\ncd \"$1\" && find . -type f | "
+    "sort\n", log_path);
+  make_file(lister, body, 0700);
+  make_file(input, "first\n", 0600);
+
+  sprintf(line, "cache %s %s | tr a-z A-Z", script, input);
+  expect_run(line, 0, "FIRST\n", 1);
+  expect_run(line, 0, "FIRST\n", 1);
+
+  /* a different size is a different key even
+   * within the same tick of the clock */
+  make_file(input, "second one\n", 0600);
+  expect_run(line, 0, "SECOND ONE\n", 2);
+  expect_run(line, 0, "SECOND ONE\n", 2);
+
+  /* other words are another pipeline */
+  sprintf(line, "cache %s %s %s", script, input, input);
+  expect_run(line, 0, "second one\nsecond one\n", 3);
+
+  /* the exit status is replayed along with the output */
+  sprintf(line, "cache %s %s", failing, input);
+  expect_run(line, 4, "failed\n", 4);
+  expect_run(line, 4, "failed\n", 4);
+
+  /* a file added deep inside of a directory
+   * that is named changes the key too */
+  sprintf(path, "%s/sub", tree);
+  mkdir(tree, 0700);
+  mkdir(path, 0700);
+  sprintf(path, "%s/sub/a", tree);
+  make_file(path, "", 0600);
+  sprintf(line, "cache %s %s", lister, tree);
+  expect_run(line, 0, "./sub/a\n", 5);
+  expect_run(line, 0, "./sub/a\n", 5);
+  sprintf(path, "%s/sub/b", tree);
+  make_file(path, "", 0600);
+  expect_run(line, 0, "./sub/a\n./sub/b\n", 6);
+
+  remove_tree(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
@@ -0,0 +1,438 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep a trie of the names of the
+ * programs in every directory of $PATH along with the
+ * first directory each one is found in
+ *
+ * the trie is built once, the first time it is needed, and
+ * then kept current with inotify on the directories instead
+ * of scanning them again, so completing a name ("complete")
+ * and finding the program to exec are both just a walk down
+ * the trie
+ *
+ * the inotify events are read before each pipeline is forked
+ * so the children inherit an up to date copy of the trie and
+ * can exec the program directly without searching $PATH
+ */
+
+/* allow us to use 'faccessat', 'fstatat' and 'inotify_init1' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "pshell.h"
+#include "tokenizer.h"
+#include "environment.h"
+#include "command-table.h"
+
+#define NO_DIR -1
+
+#define TABLE_NOT_BUILT 0
+#define TABLE_BUILT 1
+
+#define PATH_SEPARATOR ':'
+#define DIR_SEPARATOR_SIZE 1
+
+#define MAX_COMMAND_NAME_SIZE 256
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |\
+ IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define EVENT_BUFFER_SIZE 4096
+
+/*
+ * a node of the trie for one character of a name, the
+ * children of a node are kept sorted by their character
+ *
+ * dir is the index of the first directory of $PATH that
+ * has a program with the name ending at this node or
+ * NO_DIR if there is no such program
+ */
+typedef struct trie_node {
+  char letter;
+  int dir;
+  struct trie_node *child;
+  struct trie_node *sibling;
+} Trie_node;
+
+/*
+ * a directory of $PATH in the order they are searched
+ */
+typedef struct path_dir {
+  char *path;
+  int fd;
+  int watch;
+} Path_dir;
+
+static int table_state = TABLE_NOT_BUILT;
+static char *table_path = NULL;
+static Trie_node root = {'\0', NO_DIR, NULL, NULL};
+static Path_dir *dirs = NULL;
+static int num_dirs = 0;
+static int first_relative_dir = INT_MAX;
+static int inotify_fd = -1;
+
+/*
+ * define prototypes
+ */
+static Trie_node *find_node(char *name, int create);
+static void free_nodes(Trie_node *node);
+static int is_executable(int dir, char *name);
+static void update_name(int dir, char *name);
+static void scan_dir(int dir);
+static void add_path_dir(char *path, size_t length);
+static void build_command_table(char *path);
+static void read_events(void);
+static void print_names(Trie_node *node, char *name, size_t length);
+
+/*
+ * finds the node where a name ends, adding the
+ * nodes for it if create is set
+ */
+static Trie_node *find_node(char *name, int create) {
+  Trie_node *node, **link;
+
+  node = &root;
+  for (; *name != '\0'; name++) {
+    link = &node->child;
+    while (*link != NULL && (*link)->letter < *name) {
+      link = &(*link)->sibling;
+    }
+    if (*link == NULL || (*link)->letter != *name) {
+      if (!create) return NULL;
+      node = malloc(sizeof(Trie_node));
+      MEM_CHECK(node);
+      node->letter = *name;
+      node->dir = NO_DIR;
+      node->child = NULL;
+      node->sibling = *link;
+      *link = node;
+    }
+    node = *link;
+  }
+
+  return node;
+}
+
+/*
+ * frees the nodes below and after a node
+ */
+static void free_nodes(Trie_node *node) {
+  Trie_node *next;
+
+  while (node != NULL) {
+    free_nodes(node->child);
+    next = node->sibling;
+    free(node);
+    node = next;
+  }
+}
+
+/*
+ * checks if a name in a directory of $PATH
+ * is a file that can be executed
+ */
+static int is_executable(int dir, char *name) {
+  struct stat file_stat;
+
+  if (dirs[dir].fd < 0) return 0;
+  if (fstatat(dirs[dir].fd, name, &file_stat, 0) != 0) return 0;
+  if (!S_ISREG(file_stat.st_mode)) return 0;
+
+  return (faccessat(dirs[dir].fd, name, X_OK, 0) == 0);
+}
+
+/*
+ * updates the trie after a name in a directory of
+ * $PATH was added, removed or had its mode changed
+ */
+static void update_name(int dir, char *name) {
+  Trie_node *node;
+  int next;
+
+  if (is_executable(dir, name)) {
+    node = find_node(name, 1);
+    if (node->dir == NO_DIR || dir < node->dir) node->dir = dir;
+    return;
+  }
+
+  /* if it was the program that gets run the next
+   * directory that has it takes its place */
+  node = find_node(name, 0);
+  if (node == NULL || node->dir != dir) return;
+  node->dir = NO_DIR;
+  for (next = dir + 1; next < num_dirs; next++) {
+    if (is_executable(next, name)) {
+      node->dir = next;
+      break;
+    }
+  }
+}
+
+/*
+ * adds every program in a directory of $PATH to the trie
+ */
+static void scan_dir(int dir) {
+  DIR *stream;
+  struct dirent *entry;
+  Trie_node *node;
+  int fd;
+
+  if (dirs[dir].fd < 0) return;
+
+  /* the directory stream gets its own descriptor
+   * so that closedir() leaves dirs[dir].fd open */
+  fd = dup(dirs[dir].fd);
+  if (fd < 0) return;
+  stream = fdopendir(fd);
+  if (stream == NULL) {
+    close(fd);
+    return;
+  }
+
+  while ((entry = readdir(stream)) != NULL) {
+    if (entry->d_name[0] == '.' || entry->d_type == DT_DIR) continue;
+    if (entry->d_type == DT_REG) {
+      /* a regular file only needs its permissions checked */
+      if (faccessat(dirs[dir].fd, entry->d_name, X_OK, 0) != 0) continue;
+    } else if (!is_executable(dir, entry->d_name)) {
+      continue;
+    }
+
+    node = find_node(entry->d_name, 1);
+    if (node->dir == NO_DIR) node->dir = dir;
+  }
+
+  closedir(stream);
+}
+
+/*
+ * adds a directory of $PATH and starts watching it
+ */
+static void add_path_dir(char *path, size_t length) {
+  Path_dir *dir;
+
+  dirs = realloc(dirs, sizeof(Path_dir) * (num_dirs + 1));
+  MEM_CHECK(dirs);
+  dir = &dirs[num_dirs];
+
+  /* an empty entry in $PATH means the current directory */
+  if (length == 0) {
+    path = ".";
+    length = strlen(path);
+  }
+  dir->path = malloc(sizeof(char) * (length + NUL_TERM_SIZE));
+  MEM_CHECK(dir->path);
+  strncpy(dir->path, path, length);
+  dir->path[length] = '\0';
+
+  /* a relative directory changes with the current directory
+   * so nothing found after it can be trusted at exec time */
+  if (dir->path[0] != '/' && first_relative_dir > num_dirs) {
+    first_relative_dir = num_dirs;
+  }
+
+  dir->fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  dir->watch = (dir->fd < 0) ? -1 :
+    inotify_add_watch(inotify_fd, dir->path, WATCH_MASK);
+  num_dirs++;
+}
+
+/*
+ * builds the trie from scratch for a $PATH
+ */
+static void build_command_table(char *path) {
+  char *curr, *end;
+  int i;
+
+  cleanup_command_table();
+
+  table_path = malloc(sizeof(char) * (strlen(path) + NUL_TERM_SIZE));
+  MEM_CHECK(table_path);
+  strcpy(table_path, path);
+
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  first_relative_dir = INT_MAX;
+
+  curr = path;
+  while (1) {
+    end = strchr(curr, PATH_SEPARATOR);
+    if (end == NULL) end = curr + strlen(curr);
+    add_path_dir(curr, end - curr);
+    if (*end == '\0') break;
+    curr = end + 1;
+  }
+
+  for (i = 0; i < num_dirs; i++) {
+    scan_dir(i);
+  }
+
+  table_state = TABLE_BUILT;
+}
+
+/*
+ * applies the changes inotify has seen since the last time,
+ * anything that cannot be applied one name at a time (a
+ * directory that went away or too many events) throws the
+ * trie away so it is built again
+ */
+static void read_events(void) {
+  char buffer[EVENT_BUFFER_SIZE];
+  struct inotify_event *event;
+  ssize_t size;
+  char *curr;
+  int i;
+
+  if (inotify_fd < 0) return;
+
+  while ((size = read(inotify_fd, buffer, EVENT_BUFFER_SIZE)) > 0) {
+    for (curr = buffer; curr < buffer + size;
+      curr += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *) curr;
+
+      if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        table_state = TABLE_NOT_BUILT;
+        continue;
+      }
+      if (event->len == 0) continue;
+
+      for (i = 0; i < num_dirs; i++) {
+        if (dirs[i].watch == event->wd) update_name(i, event->name);
+      }
+    }
+  }
+}
+
+/*
+ * builds the trie the first time it is needed (or after
+ * $PATH changed) and applies any changes to the directories
+ * of $PATH since the last time it was refreshed
+ */
+void refresh_command_table(void) {
+  char *path;
+
+  path = get_environment_variable("PATH");
+  if (path == NULL) path = "";
+
+  if (table_state == TABLE_BUILT && strcmp(path, table_path) == 0) {
+    read_events();
+  }
+  if (table_state != TABLE_BUILT || strcmp(path, table_path) != 0) {
+    build_command_table(path);
+  }
+}
+
+/*
+ * gets the full path of the program that a name runs
+ * or NULL if it is not known, this makes no system calls
+ * so the trie must already be refreshed
+ */
+char *find_command_path(char *name) {
+  Trie_node *node;
+  char *path;
+
+  if (table_state != TABLE_BUILT || name == NULL || name[0] == '\0' ||
+    strchr(name, '/') != NULL) {
+    return NULL;
+  }
+
+  node = find_node(name, 0);
+  if (node == NULL || node->dir == NO_DIR || node->dir >= first_relative_dir) {
+    return NULL;
+  }
+
+  path = malloc(sizeof(char) * (strlen(dirs[node->dir].path) +
+    DIR_SEPARATOR_SIZE + strlen(name) + NUL_TERM_SIZE));
+  MEM_CHECK(path);
+  sprintf(path, "%s/%s", dirs[node->dir].path, name);
+
+  return path;
+}
+
+/*
+ * prints the names below a node in sorted order
+ */
+static void print_names(Trie_node *node, char *name, size_t length) {
+  for (; node != NULL; node = node->sibling) {
+    if (length + NUL_TERM_SIZE >= MAX_COMMAND_NAME_SIZE) return;
+    name[length] = node->letter;
+    if (node->dir != NO_DIR) {
+      printf("%.*s\n", (int) (length + 1), name);
+    }
+    print_names(node->child, name, length + 1);
+  }
+}
+
+/*
+ * prints the names of the programs starting with a prefix
+ */
+int print_command_completions(char *prefix) {
+  char name[MAX_COMMAND_NAME_SIZE];
+  Trie_node *node;
+  size_t length;
+
+  if (prefix == NULL) return COMMAND_TABLE_FAILED;
+  length = strlen(prefix);
+  if (length + NUL_TERM_SIZE >= MAX_COMMAND_NAME_SIZE) {
+    return COMMAND_TABLE_SUCCEEDED;
+  }
+
+  refresh_command_table();
+
+  node = find_node(prefix, 0);
+  if (node == NULL) return COMMAND_TABLE_SUCCEEDED;
+
+  strcpy(name, prefix);
+  if (length > 0 && node->dir != NO_DIR) printf("%s\n", name);
+  print_names(node->child, name, length);
+
+  return COMMAND_TABLE_SUCCEEDED;
+}
+
+/*
+ * stops applying the changes to the directories of $PATH,
+ * the trie is kept as it is and the events are left for
+ * the process this one was forked from (which shares the
+ * inotify instance)
+ */
+void stop_watching_command_table(void) {
+  if (inotify_fd >= 0) close(inotify_fd);
+  inotify_fd = -1;
+}
+
+/*
+ * frees the trie and stops watching the directories
+ */
+void cleanup_command_table(void) {
+  int i;
+
+  for (i = 0; i < num_dirs; i++) {
+    if (dirs[i].fd >= 0) close(dirs[i].fd);
+    free(dirs[i].path);
+  }
+  free(dirs);
+  dirs = NULL;
+  num_dirs = 0;
+
+  if (inotify_fd >= 0) close(inotify_fd);
+  inotify_fd = -1;
+
+  free_nodes(root.child);
+  root.child = NULL;
+  root.dir = NO_DIR;
+
+  free(table_path);
+  table_path = NULL;
+
+  table_state = TABLE_NOT_BUILT;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#define COMMAND_TABLE_SUCCEEDED 0
+#define COMMAND_TABLE_FAILED 1
+
+/*
+ * define functions for finding and completing
+ * the names of the programs in $PATH
+ */
+void refresh_command_table(void);
+char *find_command_path(char *name);
+int print_command_completions(char *prefix);
+void stop_watching_command_table(void);
+void cleanup_command_table(void);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions run the compound commands
+ * ("for", "while", "function" and fan-outs) and calls
+ * to the functions that have been defined
+ *
+ * the bodies of all of these were parsed into blocks
+ * when the line was read so running them again and
+ * again only redoes the variable expansion
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "expansion.h"
+#include "builtins.h"
+#include "process-helper.h"
+#include "fan-out.h"
+#include "control-flow.h"
+
+/*
+ * a linked list of the functions that have been defined
+ */
+typedef struct function {
+  char *name;
+  Block *body;
+  struct function *next;
+} Function;
+
+static Function *functions = NULL;
+
+/*
+ * the arguments of the function that is running
+ *
+ * position 0 is the name of the function
+ */
+static char **positional_parameters = NULL;
+static int num_positional_parameters = 0;
+
+/*
+ * define prototypes
+ */
+static Function *find_function(char *name);
+static int define_function(Command *command);
+static int call_function(Function *function, Command *expanded);
+static int run_for_loop(Command *command);
+static int run_while_loop(Command *command);
+
+/*
+ * finds a function by name or returns NULL
+ */
+static Function *find_function(char *name) {
+  Function *curr;
+
+  if (name == NULL) return NULL;
+
+  for (curr = functions; curr != NULL; curr = curr->next) {
+    if (strcmp(curr->name, name) == 0) {
+      return curr;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * defines (or redefines) a function
+ *
+ * the function shares the body that was parsed for
+ * the definition instead of parsing it again
+ */
+static int define_function(Command *command) {
+  Function *function;
+
+  function = find_function(command->program);
+  if (function == NULL) {
+    function = malloc(sizeof(Function));
+    MEM_CHECK(function);
+    function->name = malloc(sizeof(char) *
+      (strlen(command->program) + NUL_TERM_SIZE));
+    MEM_CHECK(function->name);
+    strcpy(function->name, command->program);
+    function->body = NULL;
+    function->next = functions;
+    functions = function;
+  }
+
+  retain_block(command->body);
+  release_block(function->body);
+  function->body = command->body;
+
+  return EXIT_SUCCESS;
+}
+
+/*
+ * runs the body of a function with the arguments
+ * of the command that called it as $1, $2, ...
+ */
+static int call_function(Function *function, Command *expanded) {
+  char **saved_parameters;
+  int saved_num_parameters;
+  Block *body;
+  int status;
+
+  saved_parameters = positional_parameters;
+  saved_num_parameters = num_positional_parameters;
+
+  /* the arguments directly follow the program in
+   * an expanded command so $0 can be the program */
+  positional_parameters = malloc(sizeof(char *) * (expanded->num_args + 1));
+  MEM_CHECK(positional_parameters);
+  positional_parameters[0] = expanded->program;
+  memcpy(positional_parameters + 1, expanded->arguments,
+    sizeof(char *) * expanded->num_args);
+  num_positional_parameters = expanded->num_args;
+
+  /* hold on to the body in case the function
+   * redefines itself while it is running */
+  body = function->body;
+  retain_block(body);
+  status = execute_sync_sequence(body->sync_sequence);
+  release_block(body);
+
+  free(positional_parameters);
+  positional_parameters = saved_parameters;
+  num_positional_parameters = saved_num_parameters;
+
+  return status;
+}
+
+/*
+ * runs the body of a "for" loop once for each word
+ * with the loop variable set to that word, the words
+ * (and the paths of their patterns) are worked out
+ * once when the loop starts
+ */
+static int run_for_loop(Command *command) {
+  char **words;
+  int i, num_words, status = EXIT_SUCCESS;
+
+  words = expand_arguments(command, &num_words);
+  for (i = 0; i < num_words; i++) {
+    set_environment_variable(command->program, words[i]);
+    status = execute_sync_sequence(command->body->sync_sequence);
+  }
+
+  for (i = 0; i < num_words; i++) free(words[i]);
+  free(words);
+
+  return status;
+}
+
+/*
+ * runs the body of a "while" loop for as
+ * long as the condition exits successfully
+ */
+static int run_while_loop(Command *command) {
+  int status = EXIT_SUCCESS;
+
+  while (execute_sync_sequence(command->condition->sync_sequence) ==
+    EXIT_SUCCESS) {
+    status = execute_sync_sequence(command->body->sync_sequence);
+  }
+
+  return status;
+}
+
+/*
+ * checks if a command is run by the shell itself
+ */
+int is_shell_command(Command *command) {
+  if (command == NULL) return NOT_A_SHELL_COMMAND;
+
+  if (command->kind != COMMAND_SIMPLE || is_builtin(command) ||
+    find_function(command->program) != NULL) {
+    return IS_A_SHELL_COMMAND;
+  }
+
+  return NOT_A_SHELL_COMMAND;
+}
+
+/*
+ * runs a command that the shell implements
+ * itself and returns its exit status
+ */
+int run_shell_command(Command *command) {
+  Command expanded;
+  Function *function;
+  int status;
+
+  if (command->kind == COMMAND_FOR) return run_for_loop(command);
+  if (command->kind == COMMAND_WHILE) return run_while_loop(command);
+  if (command->kind == COMMAND_FUNCTION) return define_function(command);
+  if (command->kind == COMMAND_FAN_OUT) return run_fan_out(command);
+  if (command->kind == COMMAND_INVALID) return SYNTAX_ERROR_STATUS;
+
+  expand_command(command, &expanded);
+  function = find_function(expanded.program);
+  if (function != NULL) {
+    status = call_function(function, &expanded);
+  } else {
+    status = run_builtin(&expanded);
+  }
+  cleanup_expanded_command(&expanded);
+
+  return status;
+}
+
+/*
+ * gets one of the arguments of the current
+ * function or NULL if there is no such argument
+ */
+char *get_positional_parameter(int position) {
+  if (position < 0 || position > num_positional_parameters ||
+    positional_parameters == NULL) {
+    return NULL;
+  }
+
+  return positional_parameters[position];
+}
+
+/*
+ * gets the number of arguments of the current function
+ */
+int get_num_positional_parameters(void) {
+  return num_positional_parameters;
+}
+
+/*
+ * sets the arguments of the shell itself, parameters[0]
+ * is $0 and is followed by num_parameters arguments
+ *
+ * the array is not copied so it must outlive the shell
+ */
+void set_positional_parameters(char **parameters, int num_parameters) {
+  positional_parameters = parameters;
+  num_positional_parameters = num_parameters;
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef CONTROL_FLOW_H
+#define CONTROL_FLOW_H
+
+#include "pshell-structs.h"
+
+#define NOT_A_SHELL_COMMAND 0
+#define IS_A_SHELL_COMMAND 1
+
+/*
+ * the exit status of a command that
+ * could not run because it did not parse
+ */
+#define SYNTAX_ERROR_STATUS 2
+
+/*
+ * define functions for running loops, functions
+ * and builtins (all the commands that are run
+ * by the shell instead of by another program)
+ */
+int is_shell_command(Command *command);
+int run_shell_command(Command *command);
+
+/*
+ * define functions for getting the arguments of the
+ * current function (or of the shell itself outside
+ * of any function)
+ */
+char *get_positional_parameter(int position);
+int get_num_positional_parameters(void);
+void set_positional_parameters(char **parameters, int num_parameters);
+
+#endif
@@ -0,0 +1,602 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep track of the
+ * variables of the shell and of which of them
+ * it exports to the programs it runs, a variable
+ * is only exported if it came with the shell's
+ * environment or was given to "export"
+ *
+ * rather than building a new envp array for
+ * every process that is launched the shell keeps
+ * one prebuilt envp array that points into one
+ * contiguous block of "NAME=value" strings, an
+ * exported variable that changes gets its new
+ * entry added at the end of the block and its
+ * pointer moved to it, and the block is only
+ * packed again once it runs out of room
+ *
+ * a variable that is not exported (a loop
+ * variable most of all) does not touch the
+ * block at all
+ *
+ * until the first exported variable changes the
+ * shell just hands out the environment it was
+ * started with so no work is done at startup
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "pshell.h"
+#include "tokenizer.h"
+#include "environment.h"
+
+#define VARIABLE_NOT_FOUND -1
+
+#define INITIAL_VARS_CAPACITY 64
+
+#define VARIABLE_LOCAL 0
+#define VARIABLE_EXPORTED 1
+
+#define NO_BLOCK_SLOT -1
+
+/*
+ * how much bigger than the entries the block is made
+ * when it is packed, the rest is room for changes
+ */
+#define BLOCK_SLACK_FACTOR 2
+
+/*
+ * the environment the shell was started with
+ *
+ * this is not owned by the shell and is only
+ * used until the first variable is changed
+ */
+static char **initial_vars = NULL;
+
+/*
+ * the shell's own copy of the variables, each
+ * one is a separately allocated "NAME=value",
+ * with whether it is exported and which entry
+ * of the block it has (NO_BLOCK_SLOT if none)
+ */
+static char **vars = NULL;
+static char *var_exports = NULL;
+static int *var_slots = NULL;
+static int num_vars = 0;
+static int vars_capacity = 0;
+
+/*
+ * bumped every time an exported variable changes
+ */
+static unsigned long generation = 0;
+
+/*
+ * the prebuilt envp array, the variable behind each
+ * of its entries and the contiguous string block that
+ * every entry points into, block_strings_used is where
+ * the entry of the next change goes
+ */
+static char **block_envp = NULL;
+static int *block_vars = NULL;
+static int num_block_entries = 0;
+static int block_envp_capacity = 0;
+static char *block_strings = NULL;
+static size_t block_strings_used = 0;
+static size_t block_strings_capacity = 0;
+static int block_is_stale = 1;
+
+/*
+ * define prototypes
+ */
+static size_t name_length(char *entry);
+static int find_variable(char *name, size_t length);
+static void take_ownership_of_vars(void);
+static void grow_vars(void);
+static void store_assignment(char *assignment);
+static void patch_block_entry(int index);
+static void drop_block_entry(int index);
+static void rebuild_environment_block(void);
+static int count_envp(char **envp);
+static int is_overridden(char *entry, char **assignments, int num_assignments);
+
+/*
+ * records the environment the shell was started
+ * with, nothing is copied until it is changed
+ */
+void init_environment(char **initial_environment) {
+  initial_vars = initial_environment;
+}
+
+/*
+ * gets the length of the name part of a
+ * "NAME=value" entry
+ */
+static size_t name_length(char *entry) {
+  char *equals;
+
+  equals = strchr(entry, '=');
+  if (equals == NULL) return strlen(entry);
+
+  return equals - entry;
+}
+
+/*
+ * finds the index of the variable with the
+ * given name in the shell's copy of the variables
+ */
+static int find_variable(char *name, size_t length) {
+  int i;
+
+  for (i = 0; i < num_vars; i++) {
+    if (name_length(vars[i]) == length &&
+      strncmp(vars[i], name, length) == 0) {
+      return i;
+    }
+  }
+
+  return VARIABLE_NOT_FOUND;
+}
+
+/*
+ * copies the initial environment into memory owned
+ * by the shell the first time a variable is changed
+ */
+static void take_ownership_of_vars(void) {
+  int i, count;
+
+  if (vars != NULL) return;
+
+  count = count_envp(initial_vars);
+  vars_capacity = INITIAL_VARS_CAPACITY;
+  while (vars_capacity < count + 1) {
+    vars_capacity *= 2;
+  }
+  vars = malloc(sizeof(char *) * vars_capacity);
+  MEM_CHECK(vars);
+  var_exports = malloc(sizeof(char) * vars_capacity);
+  MEM_CHECK(var_exports);
+  var_slots = malloc(sizeof(int) * vars_capacity);
+  MEM_CHECK(var_slots);
+
+  /* everything the shell was started with is exported */
+  for (i = 0; i < count; i++) {
+    vars[i] = malloc(sizeof(char) *
+      (strlen(initial_vars[i]) + NUL_TERM_SIZE));
+    MEM_CHECK(vars[i]);
+    strcpy(vars[i], initial_vars[i]);
+    var_exports[i] = VARIABLE_EXPORTED;
+    var_slots[i] = NO_BLOCK_SLOT;
+  }
+  num_vars = count;
+}
+
+/*
+ * makes room for one more variable
+ */
+static void grow_vars(void) {
+  if (num_vars + 1 < vars_capacity) return;
+
+  vars_capacity *= 2;
+  vars = realloc(vars, sizeof(char *) * vars_capacity);
+  MEM_CHECK(vars);
+  var_exports = realloc(var_exports, sizeof(char) * vars_capacity);
+  MEM_CHECK(var_exports);
+  var_slots = realloc(var_slots, sizeof(int) * vars_capacity);
+  MEM_CHECK(var_slots);
+}
+
+/*
+ * stores a copy of a "NAME=value" entry replacing
+ * any variable that already has the same name, a
+ * new variable is not exported
+ */
+static void store_assignment(char *assignment) {
+  char *copy;
+  int index;
+
+  take_ownership_of_vars();
+
+  copy = malloc(sizeof(char) * (strlen(assignment) + NUL_TERM_SIZE));
+  MEM_CHECK(copy);
+  strcpy(copy, assignment);
+
+  index = find_variable(copy, name_length(copy));
+  if (index != VARIABLE_NOT_FOUND) {
+    free(vars[index]);
+    vars[index] = copy;
+  } else {
+    grow_vars();
+    index = num_vars++;
+    vars[index] = copy;
+    var_exports[index] = VARIABLE_LOCAL;
+    var_slots[index] = NO_BLOCK_SLOT;
+  }
+
+  if (var_exports[index] == VARIABLE_EXPORTED) {
+    patch_block_entry(index);
+    generation++;
+  }
+}
+
+/*
+ * puts the new entry of an exported variable at the end
+ * of the block and points its envp entry at it, if there
+ * is no room left the block is packed again when it is
+ * next asked for
+ */
+static void patch_block_entry(int index) {
+  size_t length;
+  int slot;
+
+  if (block_envp == NULL || block_is_stale) return;
+
+  length = strlen(vars[index]) + NUL_TERM_SIZE;
+  slot = var_slots[index];
+  if (block_strings_used + length > block_strings_capacity ||
+    (slot == NO_BLOCK_SLOT && num_block_entries + 1 >= block_envp_capacity)) {
+    block_is_stale = 1;
+    return;
+  }
+
+  if (slot == NO_BLOCK_SLOT) {
+    slot = num_block_entries++;
+    block_envp[num_block_entries] = NULL;
+    block_vars[slot] = index;
+    var_slots[index] = slot;
+  }
+  memcpy(block_strings + block_strings_used, vars[index], length);
+  block_envp[slot] = block_strings + block_strings_used;
+  block_strings_used += length;
+}
+
+/*
+ * takes the entry of a variable out of the envp
+ * array, the last entry is moved into its place
+ */
+static void drop_block_entry(int index) {
+  int slot, last;
+
+  slot = var_slots[index];
+  var_slots[index] = NO_BLOCK_SLOT;
+  if (block_envp == NULL || block_is_stale || slot == NO_BLOCK_SLOT) return;
+
+  last = --num_block_entries;
+  if (slot != last) {
+    block_envp[slot] = block_envp[last];
+    block_vars[slot] = block_vars[last];
+    var_slots[block_vars[slot]] = slot;
+  }
+  block_envp[last] = NULL;
+}
+
+/*
+ * gets the value of a variable or NULL
+ * if the variable is not set
+ */
+char *get_environment_variable(char *name) {
+  char **curr;
+  size_t length;
+  int index;
+
+  if (name == NULL) return NULL;
+
+  length = strlen(name);
+  if (vars == NULL) {
+    if (initial_vars == NULL) return NULL;
+    for (curr = initial_vars; *curr != NULL; curr++) {
+      if (name_length(*curr) == length &&
+        strncmp(*curr, name, length) == 0) {
+        return *curr + length + EQUALS_SIGN_SIZE;
+      }
+    }
+    return NULL;
+  }
+
+  index = find_variable(name, length);
+  if (index == VARIABLE_NOT_FOUND) return NULL;
+
+  return vars[index] + length + EQUALS_SIGN_SIZE;
+}
+
+/*
+ * sets (or replaces) a variable, which
+ * stays exported if it already was
+ */
+void set_environment_variable(char *name, char *value) {
+  char *assignment;
+
+  if (name == NULL || value == NULL) return;
+
+  assignment = malloc(sizeof(char) * (strlen(name) + EQUALS_SIGN_SIZE +
+    strlen(value) + NUL_TERM_SIZE));
+  MEM_CHECK(assignment);
+  sprintf(assignment, "%s=%s", name, value);
+  store_assignment(assignment);
+  free(assignment);
+}
+
+/*
+ * sets a variable from a word of the
+ * form "NAME=value"
+ */
+void set_environment_assignment(char *assignment) {
+  if (assignment == NULL || !is_assignment(assignment)) return;
+
+  store_assignment(assignment);
+}
+
+/*
+ * removes a variable if it is set, the
+ * last variable is moved into its place
+ */
+void unset_environment_variable(char *name) {
+  int index, last;
+
+  if (name == NULL || get_environment_variable(name) == NULL) return;
+
+  take_ownership_of_vars();
+  index = find_variable(name, strlen(name));
+  if (var_exports[index] == VARIABLE_EXPORTED) {
+    drop_block_entry(index);
+    generation++;
+  }
+  free(vars[index]);
+
+  last = --num_vars;
+  if (index != last) {
+    vars[index] = vars[last];
+    var_exports[index] = var_exports[last];
+    var_slots[index] = var_slots[last];
+    if (var_slots[index] != NO_BLOCK_SLOT) block_vars[var_slots[index]] = index;
+  }
+}
+
+/*
+ * exports a variable that is set, name may also be
+ * the start of a "NAME=value" word
+ */
+void export_environment_variable(char *name) {
+  int index;
+
+  if (name == NULL || vars == NULL) return;
+
+  index = find_variable(name, name_length(name));
+  if (index == VARIABLE_NOT_FOUND ||
+    var_exports[index] == VARIABLE_EXPORTED) {
+    return;
+  }
+
+  var_exports[index] = VARIABLE_EXPORTED;
+  patch_block_entry(index);
+  generation++;
+}
+
+/*
+ * gets the length of the valid variable name at
+ * the start of a word (0 if it does not start
+ * with a valid variable name)
+ */
+size_t variable_name_length(char *word) {
+  char *curr;
+
+  if (word == NULL) return 0;
+  if (!isalpha((unsigned char) word[0]) && word[0] != '_') return 0;
+
+  for (curr = word + 1; isalnum((unsigned char) *curr) || *curr == '_';
+    curr++);
+
+  return curr - word;
+}
+
+/*
+ * checks if a word is a valid variable name
+ */
+int is_variable_name(char *word) {
+  size_t length;
+
+  length = variable_name_length(word);
+
+  return (length > 0 && word[length] == '\0');
+}
+
+/*
+ * checks if a word is of the form "NAME=value"
+ * where NAME is a valid variable name
+ */
+int is_assignment(char *word) {
+  size_t length;
+
+  length = variable_name_length(word);
+  if (length == 0) return IS_NOT_ASSIGNMENT;
+
+  return (word[length] == '=') ? IS_ASSIGNMENT : IS_NOT_ASSIGNMENT;
+}
+
+/*
+ * gets the generation of the exported variables
+ *
+ * this changes every time an exported variable
+ * changes so callers can tell if an envp they
+ * got earlier is still current
+ */
+unsigned long get_environment_generation(void) {
+  return generation;
+}
+
+/*
+ * packs the exported variables into the contiguous
+ * string block and points the envp array into it
+ *
+ * both buffers are reused between rebuilds and are
+ * only grown, with room to spare for the changes
+ * that are patched in after it, so a rebuild does
+ * not allocate unless the environment got bigger
+ */
+static void rebuild_environment_block(void) {
+  size_t total_size, length;
+  int i, count;
+
+  total_size = 0;
+  count = 0;
+  for (i = 0; i < num_vars; i++) {
+    if (var_exports[i] != VARIABLE_EXPORTED) continue;
+    total_size += strlen(vars[i]) + NUL_TERM_SIZE;
+    count++;
+  }
+
+  if (total_size > block_strings_capacity / BLOCK_SLACK_FACTOR) {
+    free(block_strings);
+    block_strings_capacity = total_size * BLOCK_SLACK_FACTOR;
+    block_strings = malloc(sizeof(char) * block_strings_capacity);
+    MEM_CHECK(block_strings);
+  }
+  if (count + 1 > block_envp_capacity / BLOCK_SLACK_FACTOR) {
+    free(block_envp);
+    free(block_vars);
+    block_envp_capacity = (count + 1) * BLOCK_SLACK_FACTOR;
+    block_envp = malloc(sizeof(char *) * block_envp_capacity);
+    MEM_CHECK(block_envp);
+    block_vars = malloc(sizeof(int) * block_envp_capacity);
+    MEM_CHECK(block_vars);
+  }
+
+  num_block_entries = 0;
+  block_strings_used = 0;
+  for (i = 0; i < num_vars; i++) {
+    var_slots[i] = NO_BLOCK_SLOT;
+    if (var_exports[i] != VARIABLE_EXPORTED) continue;
+
+    length = strlen(vars[i]) + NUL_TERM_SIZE;
+    memcpy(block_strings + block_strings_used, vars[i], length);
+    block_envp[num_block_entries] = block_strings + block_strings_used;
+    block_vars[num_block_entries] = i;
+    var_slots[i] = num_block_entries++;
+    block_strings_used += length;
+  }
+  block_envp[num_block_entries] = NULL;
+
+  block_is_stale = 0;
+}
+
+/*
+ * gets the envp array to hand to execvpe()
+ *
+ * the array is owned by the environment and stays
+ * valid until the next exported variable changes
+ */
+char **get_environment_block(void) {
+  /* only variables that are not exported changed */
+  if (vars == NULL || generation == 0) return initial_vars;
+
+  if (block_envp == NULL || block_is_stale) rebuild_environment_block();
+
+  return block_envp;
+}
+
+/*
+ * counts the entries in an envp array
+ */
+static int count_envp(char **envp) {
+  int count;
+
+  if (envp == NULL) return 0;
+
+  for (count = 0; envp[count] != NULL; count++);
+
+  return count;
+}
+
+/*
+ * checks if an entry is replaced by one of the
+ * "NAME=value" assignments in a list
+ */
+static int is_overridden(char *entry, char **assignments, int num_assignments) {
+  size_t length;
+  int i;
+
+  length = name_length(entry);
+  for (i = 0; i < num_assignments; i++) {
+    if (name_length(assignments[i]) == length &&
+      strncmp(assignments[i], entry, length) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * layers per command "NAME=value" assignments on top
+ * of the prebuilt block for a "NAME=value prog" command
+ *
+ * only a new pointer array is allocated, all of the
+ * strings are shared with the block and the assignments
+ * so this is meant to be called in the child right
+ * before exec
+ */
+char **build_override_environment(char **assignments, int num_assignments) {
+  char **base, **envp;
+  int i, count, num_base;
+
+  base = get_environment_block();
+  if (num_assignments <= 0) return base;
+
+  num_base = count_envp(base);
+  envp = malloc(sizeof(char *) * (num_base + num_assignments + 1));
+  MEM_CHECK(envp);
+
+  count = 0;
+  for (i = 0; i < num_base; i++) {
+    if (!is_overridden(base[i], assignments, num_assignments)) {
+      envp[count++] = base[i];
+    }
+  }
+
+  /* a later assignment to the same name wins */
+  for (i = 0; i < num_assignments; i++) {
+    if (!is_overridden(assignments[i], assignments + i + 1,
+      num_assignments - i - 1)) {
+      envp[count++] = assignments[i];
+    }
+  }
+  envp[count] = NULL;
+
+  return envp;
+}
+
+/*
+ * free all the space used by the environment
+ */
+void cleanup_environment(void) {
+  int i;
+
+  for (i = 0; i < num_vars; i++) {
+    free(vars[i]);
+  }
+  free(vars);
+  free(var_exports);
+  free(var_slots);
+  free(block_envp);
+  free(block_vars);
+  free(block_strings);
+
+  vars = NULL;
+  var_exports = NULL;
+  var_slots = NULL;
+  num_vars = 0;
+  vars_capacity = 0;
+  block_envp = NULL;
+  block_vars = NULL;
+  num_block_entries = 0;
+  block_envp_capacity = 0;
+  block_strings = NULL;
+  block_strings_used = 0;
+  block_strings_capacity = 0;
+  block_is_stale = 1;
+}
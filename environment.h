@@ -0,0 +1,43 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <stddef.h>
+
+/*
+ * the size of the '=' that separates the
+ * name and value of an environment entry
+ */
+#define EQUALS_SIGN_SIZE 1
+
+#define IS_NOT_ASSIGNMENT 0
+#define IS_ASSIGNMENT 1
+
+/*
+ * define functions for reading and changing the
+ * variables of the shell and exporting them to
+ * child processes
+ */
+void init_environment(char **initial_environment);
+char *get_environment_variable(char *name);
+void set_environment_variable(char *name, char *value);
+void set_environment_assignment(char *assignment);
+void unset_environment_variable(char *name);
+void export_environment_variable(char *name);
+size_t variable_name_length(char *word);
+int is_variable_name(char *word);
+int is_assignment(char *word);
+
+/*
+ * define functions for getting the envp
+ * block that is handed to execvpe()
+ */
+unsigned long get_environment_generation(void);
+char **get_environment_block(void);
+char **build_override_environment(char **assignments, int num_assignments);
+void cleanup_environment(void);
+
+#endif
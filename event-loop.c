@@ -0,0 +1,351 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions drive an io_uring for the shell's
+ * own waiting when it is turned on with "set -o uring"
+ *
+ * the shell queues everything it is waiting on at once
+ * (reading its input, the child it waits for, reaping the
+ * background children that finished and the timers and
+ * stages of the timed pipelines, see jobs.c), submits them
+ * all with one io_uring_enter() and then handles every
+ * completion that is ready in one pass, so a shell with
+ * thousands of background jobs reaps a batch of them per
+ * system call instead of making one waitpid() for each
+ *
+ * the rings are set up with raw system calls the first
+ * time they are needed, and if io_uring (or its waitid,
+ * linux 6.7 and up) is not there the shell keeps using
+ * poll() and waitpid() like it does when this is off
+ *
+ * a child forked by the shell drops the rings (they are a
+ * shared mapping) and sets up its own if it needs them
+ */
+
+/* allow us to use 'syscall' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "pshell.h"
+#include "event-loop.h"
+#include "shell-options.h"
+
+#define EVENT_RING_ENTRIES 64
+
+/*
+ * IORING_OP_WAITID came with linux 6.7 which
+ * is newer than some of the headers around
+ */
+#define EVENT_OP_WAITID 50
+#define NUM_PROBE_OPS 256
+
+#define LOOP_NOT_STARTED 0
+#define LOOP_STARTED 1
+#define LOOP_FAILED 2
+
+/*
+ * the parts of the submission and completion rings
+ * that are shared with the kernel
+ */
+typedef struct event_ring {
+  int fd;
+  unsigned int *sq_head;
+  unsigned int *sq_tail;
+  unsigned int *sq_mask;
+  unsigned int *sq_array;
+  unsigned int sq_entries;
+  unsigned int local_tail;
+  struct io_uring_sqe *sqes;
+  unsigned int *cq_head;
+  unsigned int *cq_tail;
+  unsigned int *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  size_t sqes_size;
+} Event_ring;
+
+static Event_ring ring;
+static int loop_state = LOOP_NOT_STARTED;
+static int fork_handler_installed = 0;
+
+/*
+ * define prototypes
+ */
+static int supports_waitid(int ring_fd);
+static int setup_ring(void);
+static void drop_ring(void);
+static struct io_uring_sqe *get_sqe(void);
+
+/*
+ * checks if the kernel can do waitid through io_uring
+ */
+static int supports_waitid(int ring_fd) {
+  struct io_uring_probe *probe;
+  size_t probe_size;
+  int supported;
+
+  /* the kernel wants the probe zeroed */
+  probe_size = sizeof(struct io_uring_probe) +
+    NUM_PROBE_OPS * sizeof(struct io_uring_probe_op);
+  probe = malloc(probe_size);
+  MEM_CHECK(probe);
+  memset(probe, 0, probe_size);
+
+  supported = (syscall(SYS_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+    probe, NUM_PROBE_OPS) == 0 && probe->last_op >= EVENT_OP_WAITID &&
+    (probe->ops[EVENT_OP_WAITID].flags & IO_URING_OP_SUPPORTED));
+  free(probe);
+
+  return supported;
+}
+
+/*
+ * sets up the rings and maps them into the shell
+ */
+static int setup_ring(void) {
+  struct io_uring_params params;
+  char *sq_ring, *cq_ring;
+
+  memset(&params, 0, sizeof(params));
+  ring.fd = syscall(SYS_io_uring_setup, EVENT_RING_ENTRIES, &params);
+  if (ring.fd < 0) return EVENT_LOOP_UNAVAILABLE;
+  if (!supports_waitid(ring.fd)) {
+    close(ring.fd);
+    errno = EOPNOTSUPP;
+    return EVENT_LOOP_UNAVAILABLE;
+  }
+
+  ring.sq_map_size = params.sq_off.array +
+    params.sq_entries * sizeof(unsigned int);
+  ring.cq_map_size = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+
+  /* newer kernels share one mapping between the two rings */
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring.cq_map_size > ring.sq_map_size) {
+      ring.sq_map_size = ring.cq_map_size;
+    }
+    ring.cq_map_size = ring.sq_map_size;
+  }
+
+  ring.sq_map = mmap(NULL, ring.sq_map_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  if (ring.sq_map == MAP_FAILED) {
+    close(ring.fd);
+    return EVENT_LOOP_UNAVAILABLE;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring.cq_map = ring.sq_map;
+  } else {
+    ring.cq_map = mmap(NULL, ring.cq_map_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cq_map == MAP_FAILED) {
+      munmap(ring.sq_map, ring.sq_map_size);
+      close(ring.fd);
+      return EVENT_LOOP_UNAVAILABLE;
+    }
+  }
+
+  ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED) {
+    if (ring.cq_map != ring.sq_map) munmap(ring.cq_map, ring.cq_map_size);
+    munmap(ring.sq_map, ring.sq_map_size);
+    close(ring.fd);
+    return EVENT_LOOP_UNAVAILABLE;
+  }
+
+  sq_ring = ring.sq_map;
+  ring.sq_head = (unsigned int *) (sq_ring + params.sq_off.head);
+  ring.sq_tail = (unsigned int *) (sq_ring + params.sq_off.tail);
+  ring.sq_mask = (unsigned int *) (sq_ring + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned int *) (sq_ring + params.sq_off.array);
+  ring.sq_entries = params.sq_entries;
+  ring.local_tail = *ring.sq_tail;
+
+  cq_ring = ring.cq_map;
+  ring.cq_head = (unsigned int *) (cq_ring + params.cq_off.head);
+  ring.cq_tail = (unsigned int *) (cq_ring + params.cq_off.tail);
+  ring.cq_mask = (unsigned int *) (cq_ring + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *) (cq_ring + params.cq_off.cqes);
+
+  return EVENT_LOOP_READY;
+}
+
+/*
+ * unmaps the rings, the forked children call this
+ * so they never touch the shell's rings
+ */
+static void drop_ring(void) {
+  if (loop_state != LOOP_STARTED) return;
+
+  munmap(ring.sqes, ring.sqes_size);
+  if (ring.cq_map != ring.sq_map) munmap(ring.cq_map, ring.cq_map_size);
+  munmap(ring.sq_map, ring.sq_map_size);
+  close(ring.fd);
+  loop_state = LOOP_NOT_STARTED;
+}
+
+/*
+ * checks if the shell should wait with io_uring and
+ * sets it up the first time it is needed
+ */
+int start_event_loop(void) {
+  if (!get_shell_option(OPTION_URING)) return EVENT_LOOP_UNAVAILABLE;
+  if (loop_state == LOOP_STARTED) return EVENT_LOOP_READY;
+  if (loop_state == LOOP_FAILED) return EVENT_LOOP_UNAVAILABLE;
+
+  if (!fork_handler_installed) {
+    pthread_atfork(NULL, NULL, drop_ring);
+    fork_handler_installed = 1;
+  }
+
+  if (setup_ring() != EVENT_LOOP_READY) {
+    fprintf(stderr, "non fatal error - could not set up io_uring,\
+ waiting with poll() instead\n");
+    fprintf(stderr, "strerror() says the problem is \"%s\"\n",
+      strerror(errno));
+    loop_state = LOOP_FAILED;
+    return EVENT_LOOP_UNAVAILABLE;
+  }
+  loop_state = LOOP_STARTED;
+
+  return EVENT_LOOP_READY;
+}
+
+/*
+ * gets the next free submission entry, submitting
+ * what is queued first if the ring is full
+ */
+static struct io_uring_sqe *get_sqe(void) {
+  struct io_uring_sqe *sqe;
+  unsigned int index;
+
+  if (ring.local_tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >=
+    ring.sq_entries) {
+    submit_events(0);
+  }
+
+  index = ring.local_tail & *ring.sq_mask;
+  sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring.sq_array[index] = index;
+  ring.local_tail++;
+
+  return sqe;
+}
+
+/*
+ * queues a wait for fd to become readable
+ */
+void queue_event_poll(int fd, void *tag) {
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = (unsigned long) tag;
+}
+
+/*
+ * queues a read of up to size bytes from fd
+ */
+void queue_event_read(int fd, char *buffer, size_t size, void *tag) {
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long) buffer;
+  sqe->len = size;
+  /* -1 reads from the current position like read() */
+  sqe->off = (unsigned long) -1;
+  sqe->user_data = (unsigned long) tag;
+}
+
+/*
+ * queues a waitid(), info is a siginfo_t that
+ * is filled in for the child that was reaped
+ */
+void queue_event_waitid(int idtype, pid_t pid, int options, void *info,
+  void *tag) {
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode = EVENT_OP_WAITID;
+  sqe->len = idtype;
+  sqe->fd = pid;
+  sqe->file_index = options;
+  sqe->addr2 = (unsigned long) info;
+  sqe->user_data = (unsigned long) tag;
+}
+
+/*
+ * queues the cancelling of every request still in
+ * flight, each of them still completes (with
+ * -ECANCELED) along with the cancel itself
+ */
+void queue_event_cancel_all(void *tag) {
+  struct io_uring_sqe *sqe = get_sqe();
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY;
+  sqe->user_data = (unsigned long) tag;
+}
+
+/*
+ * submits everything queued and waits until at least
+ * min_complete requests have completed
+ */
+int submit_events(int min_complete) {
+  unsigned int to_submit;
+  int result;
+
+  __atomic_store_n(ring.sq_tail, ring.local_tail, __ATOMIC_RELEASE);
+
+  do {
+    /* the kernel moves the head past what it took, so an
+     * interrupted wait does not submit anything twice */
+    to_submit = ring.local_tail -
+      __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    result = syscall(SYS_io_uring_enter, ring.fd, to_submit, min_complete,
+      (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while (result < 0 && errno == EINTR);
+
+  return result;
+}
+
+/*
+ * takes the next completion, returns EVENT_NONE
+ * if none are ready
+ */
+int next_event(void **tag, int *result) {
+  struct io_uring_cqe *cqe;
+  unsigned int head;
+
+  head = *ring.cq_head;
+  if (head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+    return EVENT_NONE;
+  }
+
+  cqe = &ring.cqes[head & *ring.cq_mask];
+  *tag = (void *) (unsigned long) cqe->user_data;
+  *result = cqe->res;
+  __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return EVENT_FOUND;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define EVENT_LOOP_READY 0
+#define EVENT_LOOP_UNAVAILABLE 1
+
+#define EVENT_FOUND 0
+#define EVENT_NONE 1
+
+/*
+ * define functions for batching the shell's waits and
+ * reads into io_uring submissions, every request carries
+ * a tag that comes back with its result
+ */
+int start_event_loop(void);
+void queue_event_poll(int fd, void *tag);
+void queue_event_read(int fd, char *buffer, size_t size, void *tag);
+void queue_event_waitid(int idtype, pid_t pid, int options, void *info,
+  void *tag);
+void queue_event_cancel_all(void *tag);
+int submit_events(int min_complete);
+int next_event(void **tag, int *result);
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions substitute the values of
+ * variables into the words of a command and replace
+ * its patterns with the paths they match
+ *
+ * commands keep the words exactly as they were typed
+ * and are expanded every time they are run which lets
+ * the body of a loop be parsed once and still see the
+ * new value of the loop variable (and the files that
+ * are there now) on every iteration
+ *
+ * the following are understood:
+ *   $NAME or ${NAME} -> the value of the variable NAME
+ *   $1 ... $9 -> the arguments of the current function
+ *   $# -> the number of arguments of the current function
+ *   $? -> the exit status of the last command
+ *
+ * an argument that was not quoted and has a pattern in
+ * it is replaced by the paths it matches (see
+ * glob-expand.c) unless it has a variable in it or is a
+ * "NAME=value" word
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "environment.h"
+#include "control-flow.h"
+#include "process-helper.h"
+#include "glob-expand.h"
+#include "expansion.h"
+
+/*
+ * big enough to hold any int printed in decimal
+ */
+#define MAX_NUMBER_SIZE 32
+
+typedef struct expansion_buffer {
+  char *data;
+  size_t length;
+  size_t capacity;
+} Expansion_buffer;
+
+/*
+ * define prototypes
+ */
+static void append_text(Expansion_buffer *buffer, char *text, size_t length);
+static char *expand_variable(char *start, Expansion_buffer *buffer);
+static char **expand_words(char **words, int num_words);
+
+/*
+ * appends some text to the buffer growing it if needed
+ */
+static void append_text(Expansion_buffer *buffer, char *text, size_t length) {
+  while (buffer->length + length + NUL_TERM_SIZE > buffer->capacity) {
+    buffer->capacity *= 2;
+    buffer->data = realloc(buffer->data, sizeof(char) * buffer->capacity);
+    MEM_CHECK(buffer->data);
+  }
+
+  memcpy(buffer->data + buffer->length, text, length);
+  buffer->length += length;
+  buffer->data[buffer->length] = '\0';
+}
+
+/*
+ * appends the value of the variable that starts just
+ * after a '$' and returns where the variable ended
+ *
+ * a '$' that does not start a variable is kept as is
+ */
+static char *expand_variable(char *start, Expansion_buffer *buffer) {
+  char number[MAX_NUMBER_SIZE];
+  char *name, *value, *end;
+  char saved;
+  size_t length;
+
+  if (*start == LAST_STATUS_VARIABLE) {
+    sprintf(number, "%d", get_last_status());
+    append_text(buffer, number, strlen(number));
+    return start + 1;
+  }
+  if (*start == NUM_POSITIONAL_VARIABLE) {
+    sprintf(number, "%d", get_num_positional_parameters());
+    append_text(buffer, number, strlen(number));
+    return start + 1;
+  }
+  if (isdigit((unsigned char) *start)) {
+    value = get_positional_parameter(*start - '0');
+    if (value != NULL) append_text(buffer, value, strlen(value));
+    return start + 1;
+  }
+
+  if (*start == '{') {
+    length = variable_name_length(start + 1);
+    if (length == 0 || start[length + 1] != '}') {
+      append_text(buffer, start - 1, 1);
+      return start;
+    }
+    name = start + 1;
+    end = start + length + 2;
+  } else {
+    length = variable_name_length(start);
+    if (length == 0) {
+      append_text(buffer, start - 1, 1);
+      return start;
+    }
+    name = start;
+    end = start + length;
+  }
+
+  /* look the name up in place by temporarily
+   * ending the word right after it */
+  saved = name[length];
+  name[length] = '\0';
+  value = get_environment_variable(name);
+  name[length] = saved;
+  if (value != NULL) append_text(buffer, value, strlen(value));
+
+  return end;
+}
+
+/*
+ * gets a newly allocated copy of a word with
+ * the values of all variables substituted in
+ */
+char *expand_word(char *word) {
+  Expansion_buffer buffer;
+  char *curr, *next_sign;
+
+  if (word == NULL) return NULL;
+
+  buffer.length = 0;
+  buffer.capacity = strlen(word) + NUL_TERM_SIZE;
+  buffer.data = malloc(sizeof(char) * buffer.capacity);
+  MEM_CHECK(buffer.data);
+  buffer.data[0] = '\0';
+
+  curr = word;
+  while ((next_sign = strchr(curr, VARIABLE_SIGN)) != NULL) {
+    append_text(&buffer, curr, next_sign - curr);
+    curr = expand_variable(next_sign + 1, &buffer);
+  }
+  append_text(&buffer, curr, strlen(curr));
+
+  return buffer.data;
+}
+
+/*
+ * expands every word in an array of words
+ */
+static char **expand_words(char **words, int num_words) {
+  char **expanded;
+  int i;
+
+  expanded = malloc(sizeof(char *) * (num_words + 1));
+  MEM_CHECK(expanded);
+  for (i = 0; i < num_words; i++) {
+    expanded[i] = expand_word(words[i]);
+  }
+  expanded[num_words] = NULL;
+
+  return expanded;
+}
+
+/*
+ * checks if argument i of a command is a pattern
+ * to replace with the paths it matches
+ */
+int is_pattern_argument(Command *command, int i) {
+  return ((command->was_quoted == NULL || !command->was_quoted[i]) &&
+    has_glob_characters(command->arguments[i]) &&
+    strchr(command->arguments[i], VARIABLE_SIGN) == NULL &&
+    !is_assignment(command->arguments[i]));
+}
+
+/*
+ * checks if any argument of a command is a pattern
+ */
+int has_patterns(Command *command) {
+  int i;
+
+  for (i = 0; i < command->num_args; i++) {
+    if (is_pattern_argument(command, i)) return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * gets a newly allocated NULL terminated array of the
+ * arguments of a command with their variables substituted
+ * in and each pattern replaced by the paths it matches
+ * now (one that matches nothing is kept as it is)
+ */
+char **expand_arguments(Command *command, int *num_args) {
+  Glob_matches matches;
+  char **expanded;
+  int i, j, count, capacity;
+
+  capacity = command->num_args + 1;
+  expanded = malloc(sizeof(char *) * capacity);
+  MEM_CHECK(expanded);
+
+  count = 0;
+  for (i = 0; i < command->num_args; i++) {
+    if (!is_pattern_argument(command, i) ||
+      expand_glob(command->arguments[i], &matches) != GLOB_MATCHED) {
+      expanded[count++] = expand_word(command->arguments[i]);
+      continue;
+    }
+
+    if (count + matches.num_paths + command->num_args - i > capacity) {
+      capacity = count + matches.num_paths + command->num_args - i;
+      expanded = realloc(expanded, sizeof(char *) * capacity);
+      MEM_CHECK(expanded);
+    }
+    for (j = 0; j < matches.num_paths; j++) {
+      expanded[count] = malloc(sizeof(char) *
+        (strlen(matches.paths[j]) + NUL_TERM_SIZE));
+      MEM_CHECK(expanded[count]);
+      strcpy(expanded[count++], matches.paths[j]);
+    }
+    cleanup_glob_matches(&matches);
+  }
+  expanded[count] = NULL;
+  *num_args = count;
+
+  return expanded;
+}
+
+/*
+ * fills in expanded with a copy of a simple command
+ * that has all of its variables substituted in and
+ * its patterns replaced by the paths they match
+ *
+ * the copy must be cleaned up with
+ * cleanup_expanded_command
+ */
+void expand_command(Command *command, Command *expanded) {
+  *expanded = *command;
+  expanded->assignments = expand_words(command->assignments,
+    command->num_assignments);
+  expanded->program = expand_word(command->program);
+  expanded->arguments = expand_arguments(command, &expanded->num_args);
+  expanded->was_quoted = NULL;
+}
+
+/*
+ * free all the space used by an expanded command
+ *
+ * the blocks are shared with the original
+ * command so they are left alone
+ */
+void cleanup_expanded_command(Command *expanded) {
+  int i;
+
+  for (i = 0; i < expanded->num_assignments; i++) {
+    free(expanded->assignments[i]);
+  }
+  for (i = 0; i < expanded->num_args; i++) {
+    free(expanded->arguments[i]);
+  }
+  free(expanded->assignments);
+  free(expanded->program);
+  free(expanded->arguments);
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef EXPANSION_H
+#define EXPANSION_H
+
+#include "pshell-structs.h"
+
+/*
+ * the character that starts a variable
+ * and the characters of the special variables
+ */
+#define VARIABLE_SIGN '$'
+#define LAST_STATUS_VARIABLE '?'
+#define NUM_POSITIONAL_VARIABLE '#'
+
+/*
+ * define functions for substituting the values
+ * of variables into the words of a command and
+ * expanding its patterns
+ */
+char *expand_word(char *word);
+int is_pattern_argument(Command *command, int i);
+int has_patterns(Command *command);
+char **expand_arguments(Command *command, int *num_args);
+void expand_command(Command *command, Command *expanded);
+void cleanup_expanded_command(Command *expanded);
+
+#endif
@@ -0,0 +1,353 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions run a fan-out, the last stage
+ * of a pipeline like "producer |+ ( a | b ) ( c )" which
+ * hands everything the stages before it write to each of
+ * the branches in parentheses
+ *
+ * the fan-out runs in the child that was forked for that
+ * stage: it forks a child for each branch (which runs the
+ * branch like a line of its own) with a pipe for its stdin
+ * and then moves its input into those pipes with splice()
+ * and tee(), which only pass around references to the
+ * pages in the pipes so the bytes are never copied and
+ * never pass through this process
+ *
+ * each round splices what is in the input (up to 64K) into
+ * a pipe of the fan-out's own, tees that into the pipe of
+ * every branch and then drops it; a branch whose pipe is
+ * too full to take the whole round gets the rest kept for
+ * it in a pipe of its own, which it has to catch up on
+ * before the next round starts, so the pipes of the
+ * branches are grown (to 1M) to let a slow branch fall
+ * that far behind before it holds back the others, and a
+ * branch that exits is dropped without disturbing the rest
+ *
+ * the fan-out exits with the status of its last branch
+ * once every branch is done, the branches and their pipes
+ * are admitted like the stages of a pipeline (see
+ * admission.c) and a branch that can not be started is
+ * left out while the ones before it still get the input
+ */
+
+/* allow us to use 'splice', 'tee' and 'F_SETPIPE_SZ' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "process-helper.h"
+#include "admission.h"
+#include "fan-out.h"
+
+#define BRANCH_GONE -1
+#define NO_PIPE -1
+
+/*
+ * a branch of a fan-out, output is the write end of its
+ * pipe (BRANCH_GONE once it stopped reading) and the
+ * num_kept bytes of the last round it did not take yet
+ * wait for it in the kept pipe
+ */
+typedef struct fan_out_branch {
+  pid_t pid;
+  int output;
+  int kept[2];
+  long num_kept;
+} Fan_out_branch;
+
+/*
+ * define prototypes
+ */
+static pid_t start_branch(Block *branch, int input, Fan_out_branch *branches,
+  int num_started);
+static void drop_branch(Fan_out_branch *branch);
+static int drop_bytes(int pipe_read_end, long num_bytes, int discard);
+static void give_round(Fan_out_branch *branch, int round, long num_bytes,
+  int discard);
+static int catch_up_branches(Fan_out_branch *branches, int num_branches,
+  struct pollfd *pollfds);
+static void pump_fan_out(int input, Fan_out_branch *branches,
+  int num_branches);
+static int wait_for_branch(pid_t pid);
+
+/*
+ * forks a child to run one branch of a fan-out with its
+ * stdin reading from input, the child closes the pipes
+ * of the branches that were started before it, returns
+ * a negative pid if it could not be forked
+ */
+static pid_t start_branch(Block *branch, int input, Fan_out_branch *branches,
+  int num_started) {
+  pid_t pid;
+  int i;
+
+  pid = admit_fork();
+  if (pid == 0) {
+    for (i = 0; i < num_started; i++) close(branches[i].output);
+    dup2(input, STDIN_FILENO);
+    close(input);
+    close(branches[num_started].output);
+
+    exit(execute_last_sync_sequence(branch->sync_sequence));
+  } else if (pid < 0) {
+    fprintf(stderr, "non fatal error - could not create child process\
+ for a branch of the fan-out\n");
+    fprintf(stderr, "fork() failed with %d\n", errno);
+  }
+
+  return pid;
+}
+
+/*
+ * stops passing the input on to a branch
+ * that is no longer reading it
+ */
+static void drop_branch(Fan_out_branch *branch) {
+  if (branch->output == BRANCH_GONE) return;
+
+  close(branch->output);
+  branch->output = BRANCH_GONE;
+  if (branch->kept[0] != NO_PIPE) {
+    close(branch->kept[0]);
+    close(branch->kept[1]);
+    branch->kept[0] = branch->kept[1] = NO_PIPE;
+  }
+  branch->num_kept = 0;
+}
+
+/*
+ * throws away the first num_bytes bytes of a pipe by
+ * splicing them into /dev/null (discard), which only
+ * lets go of the pages
+ */
+static int drop_bytes(int pipe_read_end, long num_bytes, int discard) {
+  long num_dropped;
+
+  while (num_bytes > 0) {
+    num_dropped = splice(pipe_read_end, NULL, discard, NULL, num_bytes, 0);
+    if (num_dropped < 0 && errno == EINTR) continue;
+    if (num_dropped <= 0) return -1;
+    num_bytes -= num_dropped;
+  }
+
+  return 0;
+}
+
+/*
+ * tees the num_bytes bytes in the round pipe into the pipe
+ * of a branch, keeping whatever does not fit in its pipe
+ * for it in the kept pipe
+ *
+ * the kept pipe is empty and as big as the round pipe
+ * here so the whole round always fits into it
+ */
+static void give_round(Fan_out_branch *branch, int round, long num_bytes,
+  int discard) {
+  long num_taken;
+
+  num_taken = tee(round, branch->output, num_bytes, SPLICE_F_NONBLOCK);
+  if (num_taken < 0 && (errno == EAGAIN || errno == EINTR)) num_taken = 0;
+  if (num_taken < 0) {
+    drop_branch(branch);
+    return;
+  }
+  if (num_taken == num_bytes) return;
+
+  if (branch->kept[0] == NO_PIPE) {
+    if (admit_pipe(branch->kept) != ADMITTED) {
+      fprintf(stderr, "non fatal error - could not keep up a branch of\
+ the fan-out, dropping it\n");
+      fprintf(stderr, "pipe() failed with %d\n", errno);
+      branch->kept[0] = branch->kept[1] = NO_PIPE;
+      drop_branch(branch);
+      return;
+    }
+    fcntl(branch->kept[1], F_SETPIPE_SZ, FAN_OUT_ROUND_SIZE);
+  }
+  if (tee(round, branch->kept[1], num_bytes, 0) != num_bytes ||
+    drop_bytes(branch->kept[0], num_taken, discard) < 0) {
+    drop_branch(branch);
+    return;
+  }
+  branch->num_kept = num_bytes - num_taken;
+}
+
+/*
+ * splices what was kept for each branch that fell behind
+ * into its pipe, waiting for room in those pipes until
+ * every branch has caught up, returns how many branches
+ * are still reading
+ */
+static int catch_up_branches(Fan_out_branch *branches, int num_branches,
+  struct pollfd *pollfds) {
+  long num_moved;
+  int i, num_behind, num_live;
+
+  while (1) {
+    num_behind = 0;
+    num_live = 0;
+    for (i = 0; i < num_branches; i++) {
+      if (branches[i].output == BRANCH_GONE) continue;
+      num_live++;
+      if (branches[i].num_kept == 0) continue;
+
+      num_moved = splice(branches[i].kept[0], NULL, branches[i].output, NULL,
+        branches[i].num_kept, SPLICE_F_NONBLOCK);
+      if (num_moved > 0) {
+        branches[i].num_kept -= num_moved;
+      } else if (num_moved < 0 && errno != EAGAIN && errno != EINTR) {
+        drop_branch(&branches[i]);
+        num_live--;
+        continue;
+      }
+
+      if (branches[i].num_kept > 0) {
+        pollfds[num_behind].fd = branches[i].output;
+        pollfds[num_behind++].events = POLLOUT;
+      }
+    }
+    if (num_behind == 0) return num_live;
+
+    /* a branch that exits wakes this up with POLLERR
+     * and is dropped by the splice() that follows */
+    poll(pollfds, num_behind, -1);
+  }
+}
+
+/*
+ * passes everything read from input on to every branch
+ * until the input ends or no branch is reading anymore
+ */
+static void pump_fan_out(int input, Fan_out_branch *branches,
+  int num_branches) {
+  struct pollfd *pollfds;
+  int round[2], discard, i;
+  long num_bytes;
+
+  discard = open("/dev/null", O_WRONLY);
+  if (discard < 0 || admit_pipe(round) != ADMITTED) {
+    fprintf(stderr, "non fatal error - could not start the fan-out\n");
+    fprintf(stderr, "open() or pipe() failed with %d\n", errno);
+    if (discard >= 0) close(discard);
+    return;
+  }
+  fcntl(round[1], F_SETPIPE_SZ, FAN_OUT_ROUND_SIZE);
+
+  pollfds = malloc(sizeof(struct pollfd) * num_branches);
+  MEM_CHECK(pollfds);
+
+  /* every branch has caught up on the last round by the
+   * time the input ends since that is checked first */
+  while (catch_up_branches(branches, num_branches, pollfds) > 0) {
+    num_bytes = splice(input, NULL, round[1], NULL, FAN_OUT_ROUND_SIZE, 0);
+    if (num_bytes < 0 && errno == EINTR) continue;
+    if (num_bytes < 0) {
+      fprintf(stderr, "non fatal error - could not read the input of\
+ the fan-out\n");
+      fprintf(stderr, "splice() failed with %d\n", errno);
+    }
+    if (num_bytes <= 0) break;
+
+    for (i = 0; i < num_branches; i++) {
+      if (branches[i].output != BRANCH_GONE) {
+        give_round(&branches[i], round[0], num_bytes, discard);
+      }
+    }
+    if (drop_bytes(round[0], num_bytes, discard) < 0) break;
+  }
+
+  free(pollfds);
+  close(round[0]);
+  close(round[1]);
+  close(discard);
+}
+
+/*
+ * waits for a branch to finish and gets its exit status
+ */
+static int wait_for_branch(pid_t pid) {
+  int wait_status;
+
+  while (waitpid(pid, &wait_status, 0) < 0) {
+    if (errno != EINTR) return EXIT_SUCCESS;
+  }
+
+  if (WIFEXITED(wait_status)) return WEXITSTATUS(wait_status);
+  if (WIFSIGNALED(wait_status)) {
+    return STATUS_SIGNAL_OFFSET + WTERMSIG(wait_status);
+  }
+
+  return wait_status;
+}
+
+/*
+ * runs the branches of a fan-out with its stdin passed on
+ * to each of them, this is meant to be called in the child
+ * forked for the stage and returns the exit status of
+ * the last branch
+ */
+int run_fan_out(Command *command) {
+  Fan_out_branch *branches;
+  int branch_pipe[2];
+  int i, num_started, branch_status, status = EXIT_SUCCESS;
+
+  branches = malloc(sizeof(Fan_out_branch) * command->num_branches);
+  MEM_CHECK(branches);
+
+  for (num_started = 0; num_started < command->num_branches; num_started++) {
+    i = num_started;
+    if (admit_pipe(branch_pipe) != ADMITTED) {
+      fprintf(stderr, "non fatal error - could not create pipe for a\
+ branch of the fan-out\n");
+      fprintf(stderr, "pipe() failed with %d\n", errno);
+      status = EXIT_COULD_NOT_CREATE_PIPE;
+      break;
+    }
+    branches[i].output = branch_pipe[1];
+    branches[i].kept[0] = branches[i].kept[1] = NO_PIPE;
+    branches[i].num_kept = 0;
+    branches[i].pid = start_branch(command->branches[i], branch_pipe[0],
+      branches, i);
+    close(branch_pipe[0]);
+    if (branches[i].pid < 0) {
+      close(branch_pipe[1]);
+      status = EXIT_COULD_NOT_FORK;
+      break;
+    }
+
+    /* a branch that reads slowly can fall this far
+     * behind before it holds back the others */
+    fcntl(branches[i].output, F_SETPIPE_SZ, FAN_OUT_BRANCH_PIPE_SIZE);
+  }
+
+  /* a branch that exits is noticed by EPIPE */
+  signal(SIGPIPE, SIG_IGN);
+  if (num_started > 0) pump_fan_out(STDIN_FILENO, branches, num_started);
+
+  for (i = 0; i < num_started; i++) {
+    drop_branch(&branches[i]);
+  }
+  /* the status is that of the last branch, or the
+   * error if not every branch could be started */
+  for (i = 0; i < num_started; i++) {
+    branch_status = wait_for_branch(branches[i].pid);
+    if (num_started == command->num_branches) status = branch_status;
+  }
+  free(branches);
+
+  return status;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef FAN_OUT_H
+#define FAN_OUT_H
+
+#include "pshell-structs.h"
+
+/*
+ * the most a round moves out of the input (the size of
+ * the pipe it goes through) and the size the pipe of each
+ * branch is grown to, which is how far a branch can fall
+ * behind before it holds back the others
+ */
+#define FAN_OUT_ROUND_SIZE 65536
+#define FAN_OUT_BRANCH_PIPE_SIZE 1048576
+
+/*
+ * define function for running the
+ * branches of a fan-out
+ */
+int run_fan_out(Command *command);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "fan-out.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "process-helper.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * a fan-out that never finishes is
+ * killed by SIGALRM after this long
+ */
+#define TEST_TIMEOUT_SECONDS 30
+
+#define PATH_SIZE 256
+#define OUTPUT_SIZE 4096
+#define MAX_LINES 16
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int run_line(char *line, char *output);
+static int compare_lines(const void *a, const void *b);
+static void expect_lines(char *line, int expected_status, char *expected[]);
+
+static char output_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * runs a line like the shell would with its output
+ * sent to the output file and gets what it printed
+ * along with its exit status
+ */
+static int run_line(char *line, char *output) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int saved_stdout, fd, status;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  token_list = parse_tokens(line);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  status = execute_sync_sequence(sync_sequence);
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return status;
+}
+
+static int compare_lines(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * checks the exit status of a line and the lines it
+ * printed, which are sorted first since the branches
+ * of a fan-out write to stdout in no set order
+ */
+static void expect_lines(char *line, int expected_status, char *expected[]) {
+  char output[OUTPUT_SIZE], *lines[MAX_LINES], *end;
+  int status, num_lines = 0, i;
+
+  printf("Testing \"%s\"\n", line);
+  status = run_line(line, output);
+  if (status != expected_status) {
+    printf("Expected: status %d, Got: %d\n", expected_status, status);
+    fail("Exit status not as expected!");
+  }
+
+  for (lines[0] = output; *lines[num_lines] != '\0' &&
+    num_lines < MAX_LINES - 1; num_lines++) {
+    end = strchr(lines[num_lines], '\n');
+    if (end == NULL) fail("Output cut short!");
+    *end = '\0';
+    lines[num_lines + 1] = end + 1;
+  }
+  qsort(lines, num_lines, sizeof(char *), compare_lines);
+
+  for (i = 0; expected[i] != NULL; i++) {
+    if (i >= num_lines || strcmp(lines[i], expected[i]) != 0) {
+      printf("Expected: \"%s\", Got: \"%s\"\n", expected[i],
+        (i < num_lines) ? lines[i] : "");
+      fail("Output not as expected!");
+    }
+  }
+  if (i != num_lines) fail("Had too many lines!");
+  printf("Output as expected!\n");
+}
+
+/*
+ * runs fan-outs that copy small and large inputs to
+ * their branches, some of which stop reading early,
+ * and checks what every branch printed
+ */
+int main() {
+  char directory[] = "/tmp/pshell-fan-out-XXXXXX";
+  char *small[] = {"1", "2", "3", "a", "b", "c", NULL};
+  char *counted[] = {"100000", "100000", NULL};
+  char *ends[] = {"1", "100000", NULL};
+  char *nested[] = {"1", "2", "3", "6", NULL};
+  char *first_only[] = {"1", NULL};
+
+  alarm(TEST_TIMEOUT_SECONDS);
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(output_path, "%s/output", directory);
+
+  expect_lines("seq 1 3 |+ ( cat ) ( tr 1-3 a-c )", 0, small);
+
+  /* far more than one round of splice() and tee() */
+  expect_lines("seq 1 100000 |+ ( tail -n 1 ) ( wc -l )", 0, counted);
+
+  /* a branch that exits early does not hold back the other */
+  expect_lines("seq 1 100000 |+ ( head -n 1 ) ( tail -n 1 )", 0, ends);
+
+  /* a branch can be a pipeline of its own */
+  expect_lines("seq 1 3 |+ ( cat ) ( tr 1-3 4-6 | tail -n 1 )", 0, nested);
+
+  /* the fan-out exits with the status of its last branch */
+  expect_lines("seq 1 3 |+ ( sh -c \"cat > /dev/null ; exit 3\" ) "
+    "( head -n 1 )", 0, first_only);
+  expect_lines("seq 1 3 |+ ( head -n 1 ) "
+    "( sh -c \"cat > /dev/null ; exit 3\" )", 3, first_only);
+
+  unlink(output_path);
+  rmdir(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
@@ -0,0 +1,481 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions expand patterns like "*.c" or
+ * "test?.[ch]" into the paths that they match
+ *
+ * directories are read with getdents64() into one large
+ * buffer so that even a directory with hundreds of
+ * thousands of files takes only a few system calls, and
+ * the names are kept in a small cache keyed by the device,
+ * inode and modification time of the directory so that
+ * globbing the same directory again (in a loop or on the
+ * next line of a script) does not read it again
+ *
+ * a directory that was changed within the last second is
+ * not cached since a change in the same tick of the clock
+ * would leave its modification time the same
+ *
+ * the matches are sorted with a multikey quicksort which
+ * never compares the common prefix of two paths twice
+ */
+
+/* allow us to use 'syscall', 'st_mtim' and 'O_CLOEXEC' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "pshell.h"
+#include "tokenizer.h"
+#include "glob-expand.h"
+
+#define GETDENTS_BUFFER_SIZE (1 << 20)
+#define GLOB_CACHE_SIZE 8
+#define RACY_SECONDS 1
+
+/*
+ * where the fields are in a struct linux_dirent64,
+ * which is read by hand since C90 cannot declare it
+ */
+#define DIRENT_RECLEN_OFFSET 16
+#define DIRENT_TYPE_OFFSET 18
+#define DIRENT_NAME_OFFSET 19
+
+#define INITIAL_CAPACITY 64
+#define INSERTION_SORT_SIZE 8
+
+#define PATH_SEPARATOR '/'
+#define PATH_SEPARATOR_SIZE 1
+
+#define LISTING_NOT_CACHED 0
+#define LISTING_CACHED 1
+
+/*
+ * a growing list of strings kept in one block of text
+ */
+typedef struct path_list {
+  char *text;
+  size_t text_size, text_capacity;
+  size_t *offsets;
+  unsigned char *types;
+  int num_paths, capacity;
+} Path_list;
+
+/*
+ * the names in a directory along with what identifies
+ * the version of the directory that they came from
+ */
+typedef struct dir_listing {
+  int state;
+  dev_t device;
+  ino_t inode;
+  struct timespec modified;
+  unsigned long last_used;
+  Path_list names;
+} Dir_listing;
+
+static Dir_listing glob_cache[GLOB_CACHE_SIZE];
+static unsigned long glob_cache_clock = 0;
+static char *dents_buffer = NULL;
+
+/*
+ * define prototypes
+ */
+static void init_path_list(Path_list *list);
+static void add_path(Path_list *list, char *start, size_t length,
+  char *name, unsigned char type);
+static void cleanup_path_list(Path_list *list);
+static int read_dir(char *path, Path_list *names);
+static Dir_listing *get_listing(char *path);
+static int is_dir(char *path, unsigned char type);
+static void expand_component(Path_list *paths, char *component,
+  int is_last, int must_be_dir, Path_list *next);
+static int char_at(char *string, size_t depth);
+static void swap_strings(char **strings, int i, int j);
+static void string_sort(char **strings, int num_strings, size_t depth);
+
+/*
+ * checks if a word has any of the characters
+ * that make it a pattern
+ */
+int has_glob_characters(char *word) {
+  if (word == NULL) return 0;
+
+  return (strpbrk(word, "*?[") != NULL);
+}
+
+/*
+ * initializes an empty list of paths
+ */
+static void init_path_list(Path_list *list) {
+  list->text = NULL;
+  list->text_size = list->text_capacity = 0;
+  list->offsets = NULL;
+  list->types = NULL;
+  list->num_paths = list->capacity = 0;
+}
+
+/*
+ * adds "start/name" (or just "start" if name is NULL) to
+ * a list of paths, start is not joined if it is empty
+ */
+static void add_path(Path_list *list, char *start, size_t length,
+  char *name, unsigned char type) {
+  size_t name_length, size;
+
+  name_length = (name == NULL) ? 0 : strlen(name);
+  size = length + PATH_SEPARATOR_SIZE + name_length + NUL_TERM_SIZE;
+
+  if (list->num_paths == list->capacity) {
+    list->capacity = (list->capacity == 0) ? INITIAL_CAPACITY :
+      list->capacity * 2;
+    list->offsets = realloc(list->offsets, sizeof(size_t) * list->capacity);
+    MEM_CHECK(list->offsets);
+    list->types = realloc(list->types, list->capacity);
+    MEM_CHECK(list->types);
+  }
+  while (list->text_size + size > list->text_capacity) {
+    list->text_capacity = (list->text_capacity == 0) ?
+      INITIAL_CAPACITY * INITIAL_CAPACITY : list->text_capacity * 2;
+    list->text = realloc(list->text, list->text_capacity);
+    MEM_CHECK(list->text);
+  }
+
+  list->offsets[list->num_paths] = list->text_size;
+  list->types[list->num_paths] = type;
+  list->num_paths++;
+
+  memcpy(list->text + list->text_size, start, length);
+  list->text_size += length;
+  if (name != NULL) {
+    if (length > 0 && start[length - 1] != PATH_SEPARATOR) {
+      list->text[list->text_size++] = PATH_SEPARATOR;
+    }
+    memcpy(list->text + list->text_size, name, name_length);
+    list->text_size += name_length;
+  }
+  list->text[list->text_size++] = '\0';
+}
+
+/*
+ * frees a list of paths
+ */
+static void cleanup_path_list(Path_list *list) {
+  free(list->text);
+  free(list->offsets);
+  free(list->types);
+  init_path_list(list);
+}
+
+/*
+ * reads the names in a directory with getdents64()
+ */
+static int read_dir(char *path, Path_list *names) {
+  unsigned short record_length;
+  long num_read, position;
+  char *entry;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return GLOB_NO_MATCH;
+
+  if (dents_buffer == NULL) {
+    dents_buffer = malloc(GETDENTS_BUFFER_SIZE);
+    MEM_CHECK(dents_buffer);
+  }
+
+  while ((num_read = syscall(SYS_getdents64, fd, dents_buffer,
+    GETDENTS_BUFFER_SIZE)) > 0) {
+    for (position = 0; position < num_read; position += record_length) {
+      entry = dents_buffer + position;
+      memcpy(&record_length, entry + DIRENT_RECLEN_OFFSET,
+        sizeof(record_length));
+      add_path(names, "", 0, entry + DIRENT_NAME_OFFSET,
+        (unsigned char) entry[DIRENT_TYPE_OFFSET]);
+    }
+  }
+  close(fd);
+
+  return (num_read < 0) ? GLOB_NO_MATCH : GLOB_MATCHED;
+}
+
+/*
+ * gets the names in a directory from the cache or by
+ * reading it, the listing is only good until the next call
+ */
+static Dir_listing *get_listing(char *path) {
+  Dir_listing *listing, *oldest;
+  struct stat dir_stat;
+  int i;
+
+  if (stat(path, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) return NULL;
+
+  glob_cache_clock++;
+  oldest = &glob_cache[0];
+  for (i = 0; i < GLOB_CACHE_SIZE; i++) {
+    listing = &glob_cache[i];
+    if (listing->state == LISTING_CACHED &&
+      listing->device == dir_stat.st_dev &&
+      listing->inode == dir_stat.st_ino &&
+      listing->modified.tv_sec == dir_stat.st_mtim.tv_sec &&
+      listing->modified.tv_nsec == dir_stat.st_mtim.tv_nsec) {
+      listing->last_used = glob_cache_clock;
+      return listing;
+    }
+    if (listing->last_used < oldest->last_used) oldest = listing;
+  }
+
+  /* reuse the least recently used listing */
+  listing = oldest;
+  cleanup_path_list(&listing->names);
+  listing->state = LISTING_NOT_CACHED;
+  listing->last_used = glob_cache_clock;
+  if (read_dir(path, &listing->names) != GLOB_MATCHED) return NULL;
+
+  if (time(NULL) - dir_stat.st_mtim.tv_sec > RACY_SECONDS) {
+    listing->state = LISTING_CACHED;
+    listing->device = dir_stat.st_dev;
+    listing->inode = dir_stat.st_ino;
+    listing->modified = dir_stat.st_mtim;
+  }
+
+  return listing;
+}
+
+/*
+ * checks if a path is a directory, only calling
+ * stat() when the type from the directory is unknown
+ */
+static int is_dir(char *path, unsigned char type) {
+  struct stat path_stat;
+
+  if (type == DT_DIR) return 1;
+  if (type != DT_LNK && type != DT_UNKNOWN) return 0;
+
+  return (stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode));
+}
+
+/*
+ * matches one component of a pattern against
+ * every path so far, adding the results to next
+ */
+static void expand_component(Path_list *paths, char *component,
+  int is_last, int must_be_dir, Path_list *next) {
+  Dir_listing *listing;
+  struct stat path_stat;
+  char *path, *name;
+  size_t length;
+  int i, j, start;
+
+  for (i = 0; i < paths->num_paths; i++) {
+    path = paths->text + paths->offsets[i];
+    length = strlen(path);
+
+    /* a component without a pattern is just added on */
+    if (!has_glob_characters(component)) {
+      start = next->num_paths;
+      add_path(next, path, length, component, DT_UNKNOWN);
+      if (is_last && lstat(next->text + next->offsets[start],
+        &path_stat) != 0) {
+        next->num_paths--;
+        next->text_size = next->offsets[start];
+      }
+      continue;
+    }
+
+    listing = get_listing((length == 0) ? "." : path);
+    if (listing == NULL) continue;
+
+    for (j = 0; j < listing->names.num_paths; j++) {
+      name = listing->names.text + listing->names.offsets[j];
+
+      /* hidden files only match a pattern
+       * that starts with a '.' itself */
+      if (name[0] == '.' && component[0] != '.') continue;
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+      if (fnmatch(component, name, 0) != 0) continue;
+
+      start = next->num_paths;
+      add_path(next, path, length, name, listing->names.types[j]);
+      if ((!is_last || must_be_dir) && !is_dir(next->text +
+        next->offsets[start], listing->names.types[j])) {
+        next->num_paths--;
+        next->text_size = next->offsets[start];
+      }
+    }
+  }
+}
+
+/*
+ * gets the character of a string at a depth
+ * (strings are never read past their NUL)
+ */
+static int char_at(char *string, size_t depth) {
+  return (unsigned char) string[depth];
+}
+
+/*
+ * swaps two strings of an array
+ */
+static void swap_strings(char **strings, int i, int j) {
+  char *temp;
+
+  temp = strings[i];
+  strings[i] = strings[j];
+  strings[j] = temp;
+}
+
+/*
+ * sorts strings that all share their first depth characters
+ * by splitting them three ways on the character at depth
+ */
+static void string_sort(char **strings, int num_strings, size_t depth) {
+  int less, greater, i, j, pivot, curr;
+
+  while (num_strings > 1) {
+    if (num_strings <= INSERTION_SORT_SIZE) {
+      for (i = 1; i < num_strings; i++) {
+        for (j = i; j > 0 && strcmp(strings[j - 1] + depth,
+          strings[j] + depth) > 0; j--) {
+          swap_strings(strings, j - 1, j);
+        }
+      }
+      return;
+    }
+
+    pivot = char_at(strings[num_strings / 2], depth);
+    less = 0;
+    i = 0;
+    greater = num_strings - 1;
+    while (i <= greater) {
+      curr = char_at(strings[i], depth);
+      if (curr < pivot) {
+        swap_strings(strings, less++, i++);
+      } else if (curr > pivot) {
+        swap_strings(strings, i, greater--);
+      } else {
+        i++;
+      }
+    }
+
+    string_sort(strings, less, depth);
+    if (pivot != '\0') {
+      string_sort(strings + less, greater - less + 1, depth + 1);
+    }
+
+    /* loop on the last part instead of recursing */
+    strings += greater + 1;
+    num_strings -= greater + 1;
+  }
+}
+
+/*
+ * expands a pattern into the sorted list of paths that
+ * it matches, returning GLOB_NO_MATCH if there are none
+ */
+int expand_glob(char *pattern, Glob_matches *matches) {
+  Path_list paths, next;
+  char *copy, *component, *end;
+  int i, is_last, must_be_dir;
+
+  matches->num_paths = 0;
+  matches->paths = NULL;
+  matches->text = NULL;
+  if (pattern == NULL || !has_glob_characters(pattern)) return GLOB_NO_MATCH;
+
+  copy = malloc(sizeof(char) * (strlen(pattern) + NUL_TERM_SIZE));
+  MEM_CHECK(copy);
+  strcpy(copy, pattern);
+
+  init_path_list(&paths);
+  add_path(&paths, (copy[0] == PATH_SEPARATOR) ? "/" : "",
+    (copy[0] == PATH_SEPARATOR) ? 1 : 0, NULL, DT_DIR);
+
+  /* match one component of the pattern at a time */
+  component = copy;
+  while (*component != '\0' && paths.num_paths > 0) {
+    while (*component == PATH_SEPARATOR) component++;
+    if (*component == '\0') break;
+
+    end = strchr(component, PATH_SEPARATOR);
+    if (end != NULL) *end = '\0';
+    is_last = (end == NULL || end[1 + strspn(end + 1, "/")] == '\0');
+    must_be_dir = (is_last && end != NULL);
+
+    init_path_list(&next);
+    expand_component(&paths, component, is_last, must_be_dir, &next);
+    cleanup_path_list(&paths);
+    paths = next;
+
+    component = (end == NULL) ? component + strlen(component) : end + 1;
+  }
+
+  /* a pattern ending in '/' keeps it on every match */
+  if (copy[0] != '\0' && pattern[strlen(pattern) - 1] == PATH_SEPARATOR) {
+    init_path_list(&next);
+    for (i = 0; i < paths.num_paths; i++) {
+      add_path(&next, paths.text + paths.offsets[i],
+        strlen(paths.text + paths.offsets[i]), "", DT_DIR);
+    }
+    cleanup_path_list(&paths);
+    paths = next;
+  }
+  free(copy);
+
+  if (paths.num_paths == 0) {
+    cleanup_path_list(&paths);
+    return GLOB_NO_MATCH;
+  }
+
+  matches->num_paths = paths.num_paths;
+  matches->text = paths.text;
+  matches->paths = malloc(sizeof(char *) * paths.num_paths);
+  MEM_CHECK(matches->paths);
+  for (i = 0; i < paths.num_paths; i++) {
+    matches->paths[i] = paths.text + paths.offsets[i];
+  }
+  free(paths.offsets);
+  free(paths.types);
+
+  string_sort(matches->paths, matches->num_paths, 0);
+
+  return GLOB_MATCHED;
+}
+
+/*
+ * frees the paths a pattern matched
+ */
+void cleanup_glob_matches(Glob_matches *matches) {
+  if (matches == NULL) return;
+
+  free(matches->paths);
+  free(matches->text);
+  matches->paths = NULL;
+  matches->text = NULL;
+  matches->num_paths = 0;
+}
+
+/*
+ * frees the cached directory listings
+ */
+void cleanup_glob_cache(void) {
+  int i;
+
+  for (i = 0; i < GLOB_CACHE_SIZE; i++) {
+    cleanup_path_list(&glob_cache[i].names);
+    glob_cache[i].state = LISTING_NOT_CACHED;
+  }
+  free(dents_buffer);
+  dents_buffer = NULL;
+}
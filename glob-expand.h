@@ -0,0 +1,30 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef GLOB_EXPAND_H
+#define GLOB_EXPAND_H
+
+#define GLOB_MATCHED 0
+#define GLOB_NO_MATCH 1
+
+/*
+ * a list of the paths a pattern matched, the
+ * paths all point into the one block of text
+ */
+typedef struct glob_matches {
+  int num_paths;
+  char **paths;
+  char *text;
+} Glob_matches;
+
+/*
+ * define functions for expanding
+ * patterns like "*.c" into paths
+ */
+int has_glob_characters(char *word);
+int expand_glob(char *pattern, Glob_matches *matches);
+void cleanup_glob_matches(Glob_matches *matches);
+void cleanup_glob_cache(void);
+
+#endif
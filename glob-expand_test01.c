@@ -0,0 +1,218 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "glob-expand.h" and the patterns
+ * in the arguments of "expansion.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "expansion.h"
+#include "glob-expand.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+#define PATH_SIZE 256
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static void make_file(char *path);
+static void expect_glob(char *pattern, char *expected[]);
+static void expect_arguments(Command *command, char *expected[]);
+static void test_patterns(char *directory);
+static void test_arguments(void);
+
+/*
+ * the files made in the directory the
+ * test runs in, in the order they are made
+ */
+static char *test_files[] = {"a.c", "b.c", "ab.h", ".hidden.c", "sub/x.c",
+  "sub/y.txt", "c.c", "d.c", NULL};
+static char *test_dirs[] = {"sub", "dir2", NULL};
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+static void make_file(char *path) {
+  int fd;
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) fail("Could not make a file!");
+  close(fd);
+}
+
+/*
+ * checks that a pattern matches the NULL terminated
+ * list of paths in order, an empty list means no match
+ */
+static void expect_glob(char *pattern, char *expected[]) {
+  Glob_matches matches;
+  int i, status;
+
+  printf("Testing the pattern \"%s\"\n", pattern);
+  status = expand_glob(pattern, &matches);
+  if (expected[0] == NULL) {
+    if (status != GLOB_NO_MATCH) fail("Pattern matched something!");
+    printf("No match as expected!\n");
+    return;
+  }
+  if (status != GLOB_MATCHED) fail("Pattern matched nothing!");
+
+  for (i = 0; expected[i] != NULL; i++) {
+    if (i >= matches.num_paths ||
+      strcmp(matches.paths[i], expected[i]) != 0) {
+      printf("Expected: \"%s\", Got: \"%s\"\n", expected[i],
+        (i < matches.num_paths) ? matches.paths[i] : "");
+      fail("Paths not as expected!");
+    }
+  }
+  if (i != matches.num_paths) fail("Had too many paths!");
+  printf("Paths as expected!\n");
+  cleanup_glob_matches(&matches);
+}
+
+/*
+ * checks the arguments of a command after expanding
+ * them against a NULL terminated list
+ */
+static void expect_arguments(Command *command, char *expected[]) {
+  char **arguments;
+  int i, num_args;
+
+  arguments = expand_arguments(command, &num_args);
+  for (i = 0; expected[i] != NULL; i++) {
+    if (i >= num_args || strcmp(arguments[i], expected[i]) != 0) {
+      printf("Expected: \"%s\", Got: \"%s\"\n", expected[i],
+        (i < num_args) ? arguments[i] : "");
+      fail("Arguments not as expected!");
+    }
+  }
+  if (i != num_args || arguments[num_args] != NULL) {
+    fail("Had too many arguments!");
+  }
+  printf("Arguments as expected!\n");
+
+  for (i = 0; i < num_args; i++) free(arguments[i]);
+  free(arguments);
+}
+
+/*
+ * matches patterns with every kind of wildcard
+ * and component against the files of the directory
+ */
+static void test_patterns(char *directory) {
+  char *c_files[] = {"a.c", "b.c", NULL};
+  char *a_files[] = {"a.c", "ab.h", NULL};
+  char *nested[] = {"sub/x.c", NULL};
+  char *dirs[] = {"dir2/", "sub/", NULL};
+  char *hidden[] = {".hidden.c", NULL};
+  char *more_c_files[] = {"a.c", "b.c", "c.c", NULL};
+  char *none[] = {NULL};
+  char absolute[PATH_SIZE], absolute_match[PATH_SIZE];
+  char *absolute_matches[] = {absolute_match, NULL};
+
+  expect_glob("*.c", c_files);
+  expect_glob("?.c", c_files);
+  expect_glob("[a]*", a_files);
+  expect_glob("*/*.c", nested);
+  expect_glob("*/", dirs);
+  expect_glob(".*.c", hidden);
+  expect_glob("*.zzz", none);
+  expect_glob("missing/*.c", none);
+
+  sprintf(absolute, "%s/sub/*.txt", directory);
+  sprintf(absolute_match, "%s/sub/y.txt", directory);
+  expect_glob(absolute, absolute_matches);
+
+  /* a file made after the directory was read is found */
+  make_file("c.c");
+  expect_glob("*.c", more_c_files);
+}
+
+/*
+ * checks that the patterns in the arguments of a parsed
+ * command are matched when it is expanded, each time it
+ * is expanded, and that quoted words and assignments
+ * are left alone
+ */
+static void test_arguments(void) {
+  char *input = "echo *.c \"*.c\" X=*.c *.zzz";
+  char *first[] = {"a.c", "b.c", "c.c", "*.c", "X=*.c", "*.zzz", NULL};
+  char *second[] = {"a.c", "b.c", "c.c", "d.c", "*.c", "X=*.c", "*.zzz",
+    NULL};
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Command *command;
+
+  printf("Testing the arguments of \"%s\"\n", input);
+  token_list = parse_tokens(input);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  command = sync_sequence[0]->pipelines[0]->commands[0];
+  if (!is_pattern_argument(command, 0) || is_pattern_argument(command, 1) ||
+    is_pattern_argument(command, 2) || !has_patterns(command)) {
+    fail("Pattern arguments not as expected!");
+  }
+  expect_arguments(command, first);
+
+  make_file("d.c");
+  expect_arguments(command, second);
+
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+}
+
+/*
+ * makes a directory of files and runs patterns
+ * and commands with patterns against it
+ */
+int main() {
+  char directory[] = "/tmp/pshell-glob-XXXXXX";
+  int i;
+
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+    fail("Could not make a directory!");
+  }
+  for (i = 0; test_dirs[i] != NULL; i++) mkdir(test_dirs[i], 0700);
+  for (i = 0; strcmp(test_files[i], "c.c") != 0; i++) {
+    make_file(test_files[i]);
+  }
+
+  test_patterns(directory);
+  test_arguments();
+
+  for (i = 0; test_files[i] != NULL; i++) unlink(test_files[i]);
+  for (i = 0; test_dirs[i] != NULL; i++) rmdir(test_dirs[i]);
+  if (chdir("/") == 0) rmdir(directory);
+  cleanup_glob_cache();
+  cleanup_environment();
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
@@ -0,0 +1,695 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep the history of the
+ * lines given to the shell in two append only files:
+ *
+ *   ~/.pshell_history -> the lines themselves, one per line
+ *   ~/.pshell_history.idx -> a fixed size entry per line
+ *   ~/.pshell_history.blk -> a summary per block of entries
+ *
+ * an entry holds where its line starts in the history file,
+ * the first few bytes of the line and a 64 bit signature
+ * with one bit set for every pair of adjacent characters
+ * in the line, so a search can skip almost every line by
+ * looking only at the entry and never touches the text of
+ * a line that cannot match
+ *
+ * every full block of BLOCK_ENTRIES entries also gets a
+ * bitmap with one bit set for every three characters in
+ * a row in any of its lines, so a search for text that is
+ * rare (or not there at all) skips whole blocks after
+ * checking a few bits and only scans the entries of the
+ * blocks that might hold a match
+ *
+ * nothing is read when the shell starts, both files are
+ * only opened the first time a line is added or the history
+ * is searched and are then read through mmap() so only the
+ * pages a search actually looks at are ever loaded; searches
+ * go from the newest line to the oldest and stop as soon as
+ * they have found enough matches
+ *
+ * lines are added with one write() to each file under a
+ * flock() so that several shells can share the history,
+ * there is no fsync() so adding a line never waits on the
+ * disk (a line that was written without its entry because
+ * of a crash is indexed the next time the files are opened)
+ */
+
+/* allow us to use 'flock', 'memmem' and 'O_CLOEXEC' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pshell.h"
+#include "tokenizer.h"
+#include "environment.h"
+#include "shell-options.h"
+#include "history.h"
+
+#define HISTORY_NOT_OPENED 0
+#define HISTORY_OPENED 1
+#define HISTORY_UNAVAILABLE 2
+
+#define HISTORY_FILE_MODE 0600
+
+/*
+ * the index file starts with this header so
+ * that a file in another format is rebuilt
+ */
+#define HISTORY_MAGIC "pshidx1\n"
+#define HISTORY_MAGIC_SIZE 8
+
+#define PREFIX_SIZE 4
+#define BITS_PER_BYTE 8
+#define SIGNATURE_BITS 64
+#define SIGNATURE_MULTIPLIER 31
+
+#define NEWLINE_SIZE 1
+#define ENTRY_BATCH_SIZE 256
+
+#define BLOCK_ENTRIES 4096
+#define BLOCK_BITS 65536
+#define BLOCK_SUMMARY_SIZE (BLOCK_BITS / BITS_PER_BYTE)
+#define TRIGRAM_SIZE 3
+#define TRIGRAM_MULTIPLIER 2654435761UL
+#define TRIGRAM_SHIFT 16
+
+/*
+ * one entry of the index for each line in the
+ * history file, the length leaves out the newline
+ */
+typedef struct history_entry {
+  unsigned long offset;
+  unsigned long signature;
+  unsigned int length;
+  unsigned int prefix;
+} History_entry;
+
+/*
+ * a read only mapping of one of the two files
+ */
+typedef struct history_map {
+  char *data;
+  size_t size;
+} History_map;
+
+/*
+ * the text being searched for with everything
+ * that is checked against the entries and blocks
+ */
+typedef struct history_query {
+  char *text;
+  size_t length;
+  int mode;
+  unsigned long signature;
+  unsigned int prefix;
+  unsigned int prefix_mask;
+  unsigned long *trigram_bits;
+  size_t num_trigrams;
+} History_query;
+
+static int history_state = HISTORY_NOT_OPENED;
+static int text_fd = -1;
+static int index_fd = -1;
+static int block_fd = -1;
+static History_map text_map = {NULL, 0};
+static History_map index_map = {NULL, 0};
+static History_map block_map = {NULL, 0};
+
+/*
+ * define prototypes
+ */
+static unsigned long compute_signature(char *text, size_t length);
+static unsigned int compute_prefix(char *text, size_t length);
+static void fill_entry(History_entry *entry, char *text, size_t length,
+  unsigned long offset);
+static char *history_path(char *suffix);
+static int update_map(History_map *map, int fd);
+static unsigned long num_entries(void);
+static History_entry *get_entry(unsigned long i);
+static int write_all(int fd, char *data, size_t size);
+static unsigned long trigram_bit(char *text);
+static void write_block_summary(unsigned long block);
+static void index_missing_lines(void);
+static void index_missing_blocks(void);
+static int update_maps(void);
+static int open_history(void);
+static void print_entry(unsigned long i);
+static int entry_matches(unsigned long i, History_query *query);
+static int block_may_match(unsigned long block, History_query *query);
+static long search_entries(unsigned long first, unsigned long end,
+  History_query *query, long matches, long max_matches);
+
+/*
+ * sets one bit for every pair of adjacent characters
+ */
+static unsigned long compute_signature(char *text, size_t length) {
+  unsigned long signature = 0;
+  size_t i;
+
+  for (i = 0; i + 1 < length; i++) {
+    signature |= 1UL << (((unsigned char) text[i] * SIGNATURE_MULTIPLIER +
+      (unsigned char) text[i + 1]) % SIGNATURE_BITS);
+  }
+
+  return signature;
+}
+
+/*
+ * packs the first PREFIX_SIZE characters into an int
+ * with the first character in the highest byte
+ */
+static unsigned int compute_prefix(char *text, size_t length) {
+  unsigned int prefix = 0;
+  size_t i;
+
+  for (i = 0; i < PREFIX_SIZE; i++) {
+    prefix <<= BITS_PER_BYTE;
+    if (i < length) prefix |= (unsigned char) text[i];
+  }
+
+  return prefix;
+}
+
+/*
+ * fills in the index entry of a line
+ */
+static void fill_entry(History_entry *entry, char *text, size_t length,
+  unsigned long offset) {
+  memset(entry, 0, sizeof(History_entry));
+  entry->offset = offset;
+  entry->signature = compute_signature(text, length);
+  entry->length = length;
+  entry->prefix = compute_prefix(text, length);
+}
+
+/*
+ * gets the path of the history file with the suffix added
+ * or NULL if there is no $PSHELL_HISTORY or $HOME
+ */
+static char *history_path(char *suffix) {
+  char *base, *path;
+  size_t size;
+
+  base = get_environment_variable(HISTORY_FILE_VARIABLE);
+  if (base != NULL && base[0] != '\0') {
+    size = strlen(base) + strlen(suffix) + NUL_TERM_SIZE;
+    path = malloc(sizeof(char) * size);
+    MEM_CHECK(path);
+    sprintf(path, "%s%s", base, suffix);
+    return path;
+  }
+
+  base = get_environment_variable("HOME");
+  if (base == NULL || base[0] == '\0') return NULL;
+
+  size = strlen(base) + strlen("/") + strlen(HISTORY_DEFAULT_NAME) +
+    strlen(suffix) + NUL_TERM_SIZE;
+  path = malloc(sizeof(char) * size);
+  MEM_CHECK(path);
+  sprintf(path, "%s/%s%s", base, HISTORY_DEFAULT_NAME, suffix);
+
+  return path;
+}
+
+/*
+ * maps a file again if it has grown since it was last mapped
+ */
+static int update_map(History_map *map, int fd) {
+  struct stat file_stat;
+  char *data;
+
+  if (fstat(fd, &file_stat) != 0) return HISTORY_FAILED;
+  if ((size_t) file_stat.st_size == map->size) return HISTORY_SUCCEEDED;
+
+  if (map->data != NULL) munmap(map->data, map->size);
+  map->data = NULL;
+  map->size = 0;
+  if (file_stat.st_size == 0) return HISTORY_SUCCEEDED;
+
+  data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) return HISTORY_FAILED;
+  map->data = data;
+  map->size = file_stat.st_size;
+
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * gets the number of whole entries in the mapped index
+ */
+static unsigned long num_entries(void) {
+  if (index_map.size < HISTORY_MAGIC_SIZE) return 0;
+
+  return (index_map.size - HISTORY_MAGIC_SIZE) / sizeof(History_entry);
+}
+
+/*
+ * gets an entry of the mapped index, entries that point
+ * past the end of the mapped history file are NULL
+ */
+static History_entry *get_entry(unsigned long i) {
+  History_entry *entry;
+
+  entry = (History_entry *) (index_map.data + HISTORY_MAGIC_SIZE) + i;
+  if (entry->offset + entry->length > text_map.size) return NULL;
+
+  return entry;
+}
+
+/*
+ * writes all of the data to a file
+ */
+static int write_all(int fd, char *data, size_t size) {
+  ssize_t written;
+
+  while (size > 0) {
+    written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return HISTORY_FAILED;
+    }
+    data += written;
+    size -= written;
+  }
+
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * gets the bit of a block summary for the
+ * three characters at the start of the text
+ */
+static unsigned long trigram_bit(char *text) {
+  unsigned long trigram;
+
+  trigram = ((unsigned long) (unsigned char) text[0] << (2 * BITS_PER_BYTE)) |
+    ((unsigned long) (unsigned char) text[1] << BITS_PER_BYTE) |
+    (unsigned char) text[2];
+
+  return ((trigram * TRIGRAM_MULTIPLIER) >> TRIGRAM_SHIFT) % BLOCK_BITS;
+}
+
+/*
+ * writes the summary of a full block of entries
+ *
+ * the index and history file must be mapped
+ */
+static void write_block_summary(unsigned long block) {
+  unsigned char summary[BLOCK_SUMMARY_SIZE];
+  History_entry *entry;
+  unsigned long i, bit;
+  size_t j;
+
+  memset(summary, 0, BLOCK_SUMMARY_SIZE);
+  for (i = block * BLOCK_ENTRIES; i < (block + 1) * BLOCK_ENTRIES; i++) {
+    entry = get_entry(i);
+    if (entry == NULL) continue;
+
+    for (j = 0; j + TRIGRAM_SIZE <= entry->length; j++) {
+      bit = trigram_bit(text_map.data + entry->offset + j);
+      summary[bit / BITS_PER_BYTE] |= 1 << (bit % BITS_PER_BYTE);
+    }
+  }
+
+  write_all(block_fd, (char *) summary, BLOCK_SUMMARY_SIZE);
+}
+
+/*
+ * adds entries for any lines of the history file that
+ * are not in the index yet, rebuilding the index if it
+ * is in another format or the history file was cut short
+ *
+ * must be called with the index locked
+ */
+static void index_missing_lines(void) {
+  History_entry batch[ENTRY_BATCH_SIZE];
+  History_entry *last;
+  unsigned long indexed_end = 0;
+  char *curr, *end, *newline;
+  int count = 0;
+
+  if (update_map(&index_map, index_fd) != HISTORY_SUCCEEDED ||
+    update_map(&text_map, text_fd) != HISTORY_SUCCEEDED) {
+    return;
+  }
+
+  if (index_map.size < HISTORY_MAGIC_SIZE ||
+    memcmp(index_map.data, HISTORY_MAGIC, HISTORY_MAGIC_SIZE) != 0) {
+    if (ftruncate(index_fd, 0) != 0 || ftruncate(block_fd, 0) != 0) return;
+    write_all(index_fd, HISTORY_MAGIC, HISTORY_MAGIC_SIZE);
+    update_map(&index_map, index_fd);
+  } else if ((index_map.size - HISTORY_MAGIC_SIZE) % sizeof(History_entry)) {
+    /* drop an entry that was only partly written */
+    if (ftruncate(index_fd, HISTORY_MAGIC_SIZE +
+      num_entries() * sizeof(History_entry)) != 0) {
+      return;
+    }
+    update_map(&index_map, index_fd);
+  }
+
+  if (num_entries() > 0) {
+    last = (History_entry *) (index_map.data + HISTORY_MAGIC_SIZE) +
+      (num_entries() - 1);
+    indexed_end = last->offset + last->length + NEWLINE_SIZE;
+    if (indexed_end > text_map.size) {
+      if (ftruncate(index_fd, HISTORY_MAGIC_SIZE) != 0 ||
+        ftruncate(block_fd, 0) != 0) {
+        return;
+      }
+      update_map(&index_map, index_fd);
+      indexed_end = 0;
+    }
+  }
+
+  if (indexed_end >= text_map.size) return;
+
+  curr = text_map.data + indexed_end;
+  end = text_map.data + text_map.size;
+  while (curr < end) {
+    newline = memchr(curr, '\n', end - curr);
+    if (newline == NULL) break;
+
+    fill_entry(&batch[count++], curr, newline - curr, curr - text_map.data);
+    if (count == ENTRY_BATCH_SIZE) {
+      write_all(index_fd, (char *) batch, sizeof(History_entry) * count);
+      count = 0;
+    }
+    curr = newline + NEWLINE_SIZE;
+  }
+  if (count > 0) {
+    write_all(index_fd, (char *) batch, sizeof(History_entry) * count);
+  }
+}
+
+/*
+ * writes the summaries of any full blocks of
+ * entries that do not have one yet
+ *
+ * must be called with the index locked
+ */
+static void index_missing_blocks(void) {
+  unsigned long block, have, want;
+
+  if (update_maps() != HISTORY_SUCCEEDED) return;
+
+  have = block_map.size / BLOCK_SUMMARY_SIZE;
+  want = num_entries() / BLOCK_ENTRIES;
+  if (have > want) {
+    if (ftruncate(block_fd, 0) != 0) return;
+    have = 0;
+  } else if (block_map.size % BLOCK_SUMMARY_SIZE != 0) {
+    /* drop a summary that was only partly written */
+    if (ftruncate(block_fd, have * BLOCK_SUMMARY_SIZE) != 0) return;
+  }
+
+  for (block = have; block < want; block++) {
+    write_block_summary(block);
+  }
+}
+
+/*
+ * maps the files again if they have grown
+ */
+static int update_maps(void) {
+  if (update_map(&text_map, text_fd) != HISTORY_SUCCEEDED ||
+    update_map(&index_map, index_fd) != HISTORY_SUCCEEDED ||
+    update_map(&block_map, block_fd) != HISTORY_SUCCEEDED) {
+    return HISTORY_FAILED;
+  }
+
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * opens the history files the first time they are needed
+ */
+static int open_history(void) {
+  char *text_path, *index_path, *block_path;
+  int flags = O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC;
+
+  if (history_state == HISTORY_OPENED) return HISTORY_SUCCEEDED;
+  if (history_state == HISTORY_UNAVAILABLE) return HISTORY_FAILED;
+  history_state = HISTORY_UNAVAILABLE;
+
+  text_path = history_path("");
+  if (text_path == NULL) return HISTORY_FAILED;
+  index_path = history_path(HISTORY_INDEX_SUFFIX);
+  block_path = history_path(HISTORY_BLOCK_SUFFIX);
+
+  text_fd = open(text_path, flags, HISTORY_FILE_MODE);
+  index_fd = open(index_path, flags, HISTORY_FILE_MODE);
+  block_fd = open(block_path, flags, HISTORY_FILE_MODE);
+  if (text_fd < 0 || index_fd < 0 || block_fd < 0) {
+    fprintf(stderr, "non fatal error - could not open the history %s\n",
+      text_path);
+    fprintf(stderr, "open() failed with %d\n", errno);
+    cleanup_history();
+    history_state = HISTORY_UNAVAILABLE;
+    text_fd = -1;
+  }
+  free(text_path);
+  free(index_path);
+  free(block_path);
+  if (text_fd < 0) return HISTORY_FAILED;
+
+  flock(index_fd, LOCK_EX);
+  index_missing_lines();
+  index_missing_blocks();
+  flock(index_fd, LOCK_UN);
+
+  history_state = HISTORY_OPENED;
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * records a line given to the shell if
+ * the history option is on
+ */
+void add_history_line(char *line) {
+  History_entry entry;
+  char *text;
+  size_t length, i;
+  off_t offset, index_size;
+
+  if (line == NULL || !get_shell_option(OPTION_HISTORY)) return;
+
+  length = strlen(line);
+  if (length > 0 && line[length - 1] == '\n') length--;
+  i = 0;
+  while (i < length && isspace((unsigned char) line[i])) i++;
+  if (i == length) return;
+
+  if (open_history() != HISTORY_SUCCEEDED) return;
+
+  /* the newline is written in the same write()
+   * so that lines of other shells never mix in */
+  text = malloc(sizeof(char) * (length + NEWLINE_SIZE));
+  MEM_CHECK(text);
+  memcpy(text, line, length);
+  text[length] = '\n';
+
+  flock(index_fd, LOCK_EX);
+  offset = lseek(text_fd, 0, SEEK_END);
+  if (offset >= 0) {
+    fill_entry(&entry, text, length, offset);
+    if (write_all(text_fd, text, length + NEWLINE_SIZE) ==
+      HISTORY_SUCCEEDED &&
+      write_all(index_fd, (char *) &entry, sizeof(History_entry)) ==
+      HISTORY_SUCCEEDED) {
+      /* summarize the block this entry filled up */
+      index_size = lseek(index_fd, 0, SEEK_END);
+      if (index_size >= HISTORY_MAGIC_SIZE && ((index_size -
+        HISTORY_MAGIC_SIZE) / sizeof(History_entry)) % BLOCK_ENTRIES == 0) {
+        index_missing_blocks();
+      }
+    }
+  }
+  flock(index_fd, LOCK_UN);
+
+  free(text);
+}
+
+/*
+ * prints an entry with its number
+ */
+static void print_entry(unsigned long i) {
+  History_entry *entry;
+
+  entry = get_entry(i);
+  if (entry == NULL) return;
+
+  printf("%5lu  %.*s\n", i + 1, (int) entry->length,
+    text_map.data + entry->offset);
+}
+
+/*
+ * prints the last count lines of the history
+ * or all of it if count is HISTORY_ALL
+ */
+int print_history(long count) {
+  unsigned long i, total;
+
+  if (open_history() != HISTORY_SUCCEEDED ||
+    update_maps() != HISTORY_SUCCEEDED) {
+    return HISTORY_FAILED;
+  }
+
+  total = num_entries();
+  i = (count == HISTORY_ALL || (unsigned long) count >= total) ?
+    0 : total - count;
+  for (; i < total; i++) {
+    print_entry(i);
+  }
+
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * checks if the line of an entry matches the query, looking
+ * only at the entry for most lines that cannot match
+ */
+static int entry_matches(unsigned long i, History_query *query) {
+  History_entry *entry;
+
+  entry = (History_entry *) (index_map.data + HISTORY_MAGIC_SIZE) + i;
+  if (entry->length < query->length) return 0;
+  if ((entry->signature & query->signature) != query->signature) return 0;
+  if (query->mode == HISTORY_PREFIX &&
+    (entry->prefix & query->prefix_mask) != query->prefix) {
+    return 0;
+  }
+
+  entry = get_entry(i);
+  if (entry == NULL) return 0;
+  if (query->mode == HISTORY_PREFIX) {
+    return (memcmp(text_map.data + entry->offset, query->text,
+      query->length) == 0);
+  }
+
+  return (memmem(text_map.data + entry->offset, entry->length,
+    query->text, query->length) != NULL);
+}
+
+/*
+ * checks if a full block might hold a line containing
+ * the query, which needs every three characters in a
+ * row of the query to be set in the summary of the block
+ */
+static int block_may_match(unsigned long block, History_query *query) {
+  unsigned char *summary;
+  unsigned long bit;
+  size_t i;
+
+  summary = (unsigned char *) block_map.data + block * BLOCK_SUMMARY_SIZE;
+  for (i = 0; i < query->num_trigrams; i++) {
+    bit = query->trigram_bits[i];
+    if (!(summary[bit / BITS_PER_BYTE] & (1 << (bit % BITS_PER_BYTE)))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/*
+ * prints the entries from end - 1 down to first that
+ * match the query until there are max_matches matches
+ *
+ * returns the number of matches so far
+ */
+static long search_entries(unsigned long first, unsigned long end,
+  History_query *query, long matches, long max_matches) {
+  unsigned long i;
+
+  for (i = end; i > first && matches != max_matches; i--) {
+    if (entry_matches(i - 1, query)) {
+      print_entry(i - 1);
+      matches++;
+    }
+  }
+
+  return matches;
+}
+
+/*
+ * prints up to max_matches lines of the history that contain
+ * (or start with) the text from the newest to the oldest
+ */
+int search_history(char *text, int mode, long max_matches) {
+  History_query query;
+  unsigned long block, full_blocks;
+  long matches;
+  size_t i;
+
+  if (text == NULL || open_history() != HISTORY_SUCCEEDED ||
+    update_maps() != HISTORY_SUCCEEDED) {
+    return HISTORY_FAILED;
+  }
+
+  query.text = text;
+  query.length = strlen(text);
+  query.mode = mode;
+  query.signature = compute_signature(text, query.length);
+  query.prefix = compute_prefix(text, query.length);
+  query.prefix_mask = (query.length >= PREFIX_SIZE) ? ~0U :
+    ~(~0U >> (BITS_PER_BYTE * query.length));
+  if (query.length == 0) query.prefix_mask = 0;
+
+  query.num_trigrams = (query.length >= TRIGRAM_SIZE) ?
+    query.length - TRIGRAM_SIZE + 1 : 0;
+  query.trigram_bits = malloc(sizeof(unsigned long) *
+    (query.num_trigrams + 1));
+  MEM_CHECK(query.trigram_bits);
+  for (i = 0; i < query.num_trigrams; i++) {
+    query.trigram_bits[i] = trigram_bit(text + i);
+  }
+
+  /* the entries after the last full block have no summary */
+  full_blocks = num_entries() / BLOCK_ENTRIES;
+  if (full_blocks > block_map.size / BLOCK_SUMMARY_SIZE) {
+    full_blocks = block_map.size / BLOCK_SUMMARY_SIZE;
+  }
+  matches = search_entries(full_blocks * BLOCK_ENTRIES, num_entries(),
+    &query, 0, max_matches);
+
+  for (block = full_blocks; block > 0 && matches != max_matches; block--) {
+    if (block_may_match(block - 1, &query)) {
+      matches = search_entries((block - 1) * BLOCK_ENTRIES,
+        block * BLOCK_ENTRIES, &query, matches, max_matches);
+    }
+  }
+
+  free(query.trigram_bits);
+  return HISTORY_SUCCEEDED;
+}
+
+/*
+ * unmaps and closes the history files
+ */
+void cleanup_history(void) {
+  if (text_map.data != NULL) munmap(text_map.data, text_map.size);
+  if (index_map.data != NULL) munmap(index_map.data, index_map.size);
+  if (block_map.data != NULL) munmap(block_map.data, block_map.size);
+  text_map.data = index_map.data = block_map.data = NULL;
+  text_map.size = index_map.size = block_map.size = 0;
+
+  if (text_fd >= 0) close(text_fd);
+  if (index_fd >= 0) close(index_fd);
+  if (block_fd >= 0) close(block_fd);
+  text_fd = index_fd = block_fd = -1;
+
+  history_state = HISTORY_NOT_OPENED;
+}
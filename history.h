@@ -0,0 +1,33 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#define HISTORY_FILE_VARIABLE "PSHELL_HISTORY"
+#define HISTORY_DEFAULT_NAME ".pshell_history"
+#define HISTORY_INDEX_SUFFIX ".idx"
+#define HISTORY_BLOCK_SUFFIX ".blk"
+
+/*
+ * how a search matches the text of an entry
+ */
+#define HISTORY_SUBSTRING 0
+#define HISTORY_PREFIX 1
+
+#define HISTORY_ALL -1
+
+#define HISTORY_SUCCEEDED 0
+#define HISTORY_FAILED 1
+
+/*
+ * define functions for recording and
+ * searching the history of the shell
+ */
+void add_history_line(char *line);
+int print_history(long count);
+int search_history(char *text, int mode, long max_matches);
+void cleanup_history(void);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "history.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "environment.h"
+#include "shell-options.h"
+#include "history.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * enough lines that the oldest ones are in blocks
+ * that are looked at through their summaries
+ */
+#define NUM_LINES 9000
+#define LINE_SIZE 64
+#define OUTPUT_SIZE 4096
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static void fill_history(void);
+static char *run_search(char *text, int mode, long max_matches);
+static int count_lines(char *output);
+static void expect_search(char *text, int mode, long max_matches,
+  char *expected[], int num_expected);
+
+/*
+ * where the history files are made, the output
+ * of a search is read back through output_path
+ */
+static char directory[] = "/tmp/pshell-history-XXXXXX";
+static char history_file[LINE_SIZE], output_path[LINE_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * records the lines the searches look for among
+ * lines that none of them should find
+ */
+static void fill_history(void) {
+  char line[LINE_SIZE];
+  int i;
+
+  for (i = 0; i < NUM_LINES; i++) {
+    if (i == 10) {
+      add_history_line("grep needle old.txt");
+    } else if (i == 5000) {
+      add_history_line("make needle");
+    } else if (i == 8500) {
+      add_history_line("git commit -m needle\n");
+    } else if (i == 8600) {
+      add_history_line("echo git");
+    } else if (i == 8700) {
+      add_history_line("   ");
+    } else {
+      sprintf(line, "echo line %d", i);
+      add_history_line(line);
+    }
+  }
+}
+
+/*
+ * runs a search with its output sent to a file
+ * and gets what it printed
+ */
+static char *run_search(char *text, int mode, long max_matches) {
+  static char output[OUTPUT_SIZE];
+  int saved_stdout, fd;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  if (search_history(text, mode, max_matches) != HISTORY_SUCCEEDED) {
+    dup2(saved_stdout, STDOUT_FILENO);
+    fail("Search failed!");
+  }
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return output;
+}
+
+static int count_lines(char *output) {
+  int count = 0;
+
+  for (; *output != '\0'; output++) {
+    if (*output == '\n') count++;
+  }
+
+  return count;
+}
+
+/*
+ * checks that a search prints the expected lines
+ * from the newest to the oldest
+ */
+static void expect_search(char *text, int mode, long max_matches,
+  char *expected[], int num_expected) {
+  char *output, *line;
+  int i;
+
+  printf("Testing a %s search for \"%s\"\n",
+    (mode == HISTORY_PREFIX) ? "prefix" : "substring", text);
+  output = run_search(text, mode, max_matches);
+  if (count_lines(output) != num_expected) {
+    printf("Got:\n%s", output);
+    fail("Number of matches not as expected!");
+  }
+  line = output;
+  for (i = 0; i < num_expected; i++) {
+    if (strstr(line, expected[i]) == NULL ||
+      strchr(line, '\n') < strstr(line, expected[i])) {
+      printf("Expected: \"%s\", Got:\n%s", expected[i], output);
+      fail("Match not as expected!");
+    }
+    line = strchr(line, '\n') + 1;
+  }
+  printf("Matches as expected!\n");
+}
+
+/*
+ * records lines that fill a few blocks and searches
+ * them, both with the index as it was written and
+ * with the index rebuilt from the lines
+ */
+int main() {
+  char *needles[] = {"8501  git commit -m needle", "5001  make needle",
+    "11  grep needle old.txt"};
+  char *gits[] = {"8501  git commit -m needle"};
+  char *echo_gits[] = {"8601  echo git", "8501  git commit -m needle"};
+  char index_file[LINE_SIZE], block_file[LINE_SIZE];
+  int pass;
+
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(history_file, "%s/history", directory);
+  sprintf(output_path, "%s/output", directory);
+  sprintf(index_file, "%s%s", history_file, HISTORY_INDEX_SUFFIX);
+  sprintf(block_file, "%s%s", history_file, HISTORY_BLOCK_SUFFIX);
+  set_environment_variable(HISTORY_FILE_VARIABLE, history_file);
+  set_shell_option("history", OPTION_ON);
+
+  fill_history();
+  for (pass = 0; pass < 2; pass++) {
+    expect_search("needle", HISTORY_SUBSTRING, HISTORY_ALL, needles, 3);
+    expect_search("needle", HISTORY_SUBSTRING, 2, needles, 2);
+    expect_search("git", HISTORY_PREFIX, HISTORY_ALL, gits, 1);
+    expect_search("git", HISTORY_SUBSTRING, HISTORY_ALL, echo_gits, 2);
+    expect_search("gr", HISTORY_PREFIX, HISTORY_ALL, needles + 2, 1);
+    expect_search("not in the history", HISTORY_SUBSTRING, HISTORY_ALL,
+      NULL, 0);
+
+    /* make the index again from the lines alone */
+    cleanup_history();
+    unlink(index_file);
+    unlink(block_file);
+    if (pass == 0) printf("Rebuilding the index\n");
+  }
+
+  unlink(history_file);
+  unlink(output_path);
+  rmdir(directory);
+  cleanup_environment();
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
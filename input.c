@@ -0,0 +1,144 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions read the lines given to the
+ * shell in the same way as fgets() but on top of a plain
+ * file descriptor
+ *
+ * this lets the shell know for certain when it is about
+ * to block for more input, which it does with poll() (or
+ * io_uring, see jobs.c) so that it can keep enforcing the
+ * timeouts of pipelines that are still running in the
+ * background
+ *
+ * it also lets the shell look ahead without blocking to
+ * see if the line it just read is the last one
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "jobs.h"
+#include "input.h"
+
+/*
+ * define prototypes
+ */
+static int fill_buffer(Input_reader *reader);
+static int is_blank(char *start, size_t length);
+
+/*
+ * initializes a reader of the lines from fd
+ */
+void init_input_reader(Input_reader *reader, int fd) {
+  if (reader == NULL) return;
+
+  reader->fd = fd;
+  reader->start = 0;
+  reader->end = 0;
+}
+
+/*
+ * reads more input into the (empty) buffer
+ *
+ * returns the number of bytes read, 0 at the
+ * end of the input
+ */
+static int fill_buffer(Input_reader *reader) {
+  long num_read;
+
+  num_read = read_input(reader->fd, reader->buffer, INPUT_BUFFER_SIZE);
+
+  reader->start = 0;
+  reader->end = (num_read > 0) ? num_read : 0;
+
+  return reader->end;
+}
+
+/*
+ * reads the next line into line just like fgets()
+ *
+ * at most size - 1 characters are read, the newline is kept
+ * and NULL is returned if there is no more input
+ */
+char *read_input_line(Input_reader *reader, char *line, int size) {
+  char *newline;
+  size_t length, num_copied = 0;
+
+  if (reader == NULL || line == NULL || size <= 0) return NULL;
+
+  while (num_copied < (size_t) (size - 1)) {
+    if (reader->start == reader->end && fill_buffer(reader) == 0) break;
+
+    length = reader->end - reader->start;
+    if (length > (size_t) (size - 1) - num_copied) {
+      length = (size_t) (size - 1) - num_copied;
+    }
+    newline = memchr(reader->buffer + reader->start, '\n', length);
+    if (newline != NULL) {
+      length = newline - (reader->buffer + reader->start) + 1;
+    }
+
+    memcpy(line + num_copied, reader->buffer + reader->start, length);
+    reader->start += length;
+    num_copied += length;
+    if (newline != NULL) break;
+  }
+
+  if (num_copied == 0) return NULL;
+
+  line[num_copied] = '\0';
+
+  return line;
+}
+
+/*
+ * checks if text is only whitespace
+ */
+static int is_blank(char *start, size_t length) {
+  size_t i;
+
+  for (i = 0; i < length; i++) {
+    if (!isspace((unsigned char) start[i])) return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * checks if the line that was just read is the last one
+ * (only blank lines are left before the end of the input)
+ *
+ * this never blocks, if more input might still come the
+ * line is not the last one
+ */
+int is_last_input_line(Input_reader *reader) {
+  struct pollfd poll_fd;
+  ssize_t num_read;
+
+  if (reader == NULL) return 0;
+
+  while (1) {
+    if (!is_blank(reader->buffer + reader->start,
+      reader->end - reader->start)) {
+      return 0;
+    }
+    reader->start = reader->end = 0;
+
+    poll_fd.fd = reader->fd;
+    poll_fd.events = POLLIN;
+    if (poll(&poll_fd, 1, 0) <= 0) return 0;
+
+    do {
+      num_read = read(reader->fd, reader->buffer, INPUT_BUFFER_SIZE);
+    } while (num_read < 0 && errno == EINTR);
+    if (num_read < 0) return 0;
+    if (num_read == 0) return 1;
+    reader->end = num_read;
+  }
+}
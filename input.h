@@ -0,0 +1,29 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+
+#define INPUT_BUFFER_SIZE 4096
+
+/*
+ * a buffered reader of lines from a file descriptor
+ */
+typedef struct input_reader {
+  int fd;
+  char buffer[INPUT_BUFFER_SIZE];
+  size_t start, end;
+} Input_reader;
+
+/*
+ * define functions for reading the lines
+ * of input given to the shell
+ */
+void init_input_reader(Input_reader *reader, int fd);
+char *read_input_line(Input_reader *reader, char *line, int size);
+int is_last_input_line(Input_reader *reader);
+
+#endif
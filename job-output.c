@@ -0,0 +1,495 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep the output of background
+ * jobs from interleaving when it is turned on with
+ * "set -o bgbuffer" (or "set -o bgtag", which also puts
+ * "[N] " in front of every line of the Nth such job)
+ *
+ * each background job gets a pipe for its stdout and one
+ * for its stderr, the shell reads them with large read()s
+ * whenever it waits for something (see jobs.c) and holds
+ * on to whatever is not a whole line yet, then writes the
+ * whole lines of every job at once with one writev() for
+ * stdout and one for stderr, so lines of different jobs
+ * never end up mixed together and a round of output costs
+ * the same two system calls however many jobs made it
+ *
+ * a job's output is done once both of its pipes are
+ * closed, which happens when every stage of it exited
+ * (and whatever it left in the background did too), and
+ * the shell (or a forked child running a loop that
+ * started jobs of its own) waits for that when it exits
+ */
+
+/* allow us to use 'memrchr' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "pshell.h"
+#include "job-output.h"
+#include "shell-options.h"
+#include "admission.h"
+#include "event-loop.h"
+#include "jobs.h"
+
+static Job_output *job_outputs = NULL;
+static int num_jobs_buffered = 0;
+static int handlers_installed = 0;
+
+/*
+ * the pieces of output of one round, written
+ * with a single writev() per destination
+ */
+static struct iovec iovecs[JOB_OUTPUT_MAX_IOVECS];
+static int num_iovecs = 0;
+
+static char line_end[] = "\n";
+
+/*
+ * define prototypes
+ */
+static void drop_job_outputs(void);
+static void read_stream(Job_output *output, int stream);
+static size_t ready_length(Job_output *output, int stream);
+static void write_iovecs(int fd);
+static void add_iovec(int fd, char *base, size_t length);
+static void emit_stream(Job_output *output, int stream, int fd);
+static void flush_job_outputs(void);
+
+/*
+ * checks if background jobs should get their output buffered
+ */
+int buffers_job_output(void) {
+  return (get_shell_option(OPTION_BACKGROUND_BUFFER) ||
+    get_shell_option(OPTION_BACKGROUND_TAG));
+}
+
+/*
+ * closes the shell's ends of the pipes of every job and
+ * forgets them, the forked children call this so that
+ * only the shell ever reads a job's output
+ */
+static void drop_job_outputs(void) {
+  Job_output *next;
+  int i;
+
+  while (job_outputs != NULL) {
+    next = job_outputs->next;
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      if (job_outputs->fds[i] != NO_OUTPUT_FD) close(job_outputs->fds[i]);
+      free(job_outputs->buffers[i]);
+    }
+    free(job_outputs);
+    job_outputs = next;
+  }
+}
+
+/*
+ * makes the pipes for the output of a background job that
+ * is about to be started, returns NULL if it cannot in
+ * which case the job writes to the shell's own output
+ */
+Job_output *open_job_output(void) {
+  Job_output *output;
+  int pipe_fds[2];
+  int i;
+
+  if (!handlers_installed) {
+    pthread_atfork(NULL, NULL, drop_job_outputs);
+    atexit(wait_for_job_outputs);
+    handlers_installed = 1;
+  }
+
+  output = malloc(sizeof(Job_output));
+  MEM_CHECK(output);
+  for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    output->fds[i] = output->write_fds[i] = NO_OUTPUT_FD;
+    output->buffers[i] = NULL;
+    output->lengths[i] = 0;
+  }
+  output->next = NULL;
+
+  for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    if (admit_pipe(pipe_fds) != ADMITTED) {
+      fprintf(stderr, "non fatal error - could not buffer the output of a\
+ background job\n");
+      fprintf(stderr, "pipe() failed with %d\n", errno);
+      close_job_output(output);
+      return NULL;
+    }
+    output->fds[i] = pipe_fds[0];
+    output->write_fds[i] = pipe_fds[1];
+
+    /* the shell never blocks on a job that has not
+     * written anything, and no program it runs keeps
+     * an end it was not given as its stdout or stderr */
+    fcntl(pipe_fds[0], F_SETFL, fcntl(pipe_fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC);
+  }
+
+  num_jobs_buffered++;
+  output->tag[0] = '\0';
+  if (get_shell_option(OPTION_BACKGROUND_TAG)) {
+    sprintf(output->tag, "[%d] ", num_jobs_buffered);
+  }
+
+  return output;
+}
+
+/*
+ * gives a stage of the job the write ends of its pipes,
+ * only the last stage's stdout is the job's stdout, this
+ * is meant to be called in the child after fork()
+ */
+void use_job_output(Job_output *output, int is_last_stage) {
+  int i;
+
+  if (is_last_stage) {
+    dup2(output->write_fds[OUTPUT_STDOUT], STDOUT_FILENO);
+  }
+  dup2(output->write_fds[OUTPUT_STDERR], STDERR_FILENO);
+
+  for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    close(output->fds[i]);
+    close(output->write_fds[i]);
+  }
+}
+
+/*
+ * starts reading the output of a job whose stages
+ * were all forked, the shell's write ends are closed
+ * so the pipes end when the job does
+ */
+void start_job_output(Job_output *output) {
+  int i;
+
+  for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    close(output->write_fds[i]);
+    output->write_fds[i] = NO_OUTPUT_FD;
+  }
+
+  output->next = job_outputs;
+  job_outputs = output;
+}
+
+/*
+ * gets rid of the pipes of a job that was never
+ * started (or never will be read)
+ */
+void close_job_output(Job_output *output) {
+  int i;
+
+  for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+    if (output->fds[i] != NO_OUTPUT_FD) close(output->fds[i]);
+    if (output->write_fds[i] != NO_OUTPUT_FD) close(output->write_fds[i]);
+    free(output->buffers[i]);
+  }
+  free(output);
+}
+
+/*
+ * checks if any job still has output to read
+ */
+int has_job_outputs(void) {
+  return (job_outputs != NULL);
+}
+
+/*
+ * gets how many pollfds poll_job_outputs() fills in
+ */
+int num_job_output_fds(void) {
+  Job_output *curr;
+  int num_fds = 0;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    num_fds += NUM_OUTPUT_STREAMS;
+  }
+
+  return num_fds;
+}
+
+/*
+ * fills in a pollfd for each pipe of each job,
+ * the ones that ended are left negative so
+ * poll() ignores them
+ */
+void poll_job_outputs(struct pollfd *pollfds) {
+  Job_output *curr;
+  int i;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      pollfds->fd = curr->fds[i];
+      pollfds->events = POLLIN;
+      pollfds++;
+    }
+  }
+}
+
+/*
+ * reads what one pipe of a job has into its buffer,
+ * which always has room since it was flushed after
+ * the last read, and notices when the pipe ends
+ */
+static void read_stream(Job_output *output, int stream) {
+  long num_read;
+
+  if (output->fds[stream] == NO_OUTPUT_FD) return;
+  if (output->buffers[stream] == NULL) {
+    output->buffers[stream] = malloc(JOB_OUTPUT_BUFFER_SIZE);
+    MEM_CHECK(output->buffers[stream]);
+  }
+
+  num_read = read(output->fds[stream],
+    output->buffers[stream] + output->lengths[stream],
+    JOB_OUTPUT_BUFFER_SIZE - output->lengths[stream]);
+  if (num_read > 0) {
+    output->lengths[stream] += num_read;
+  } else if (num_read == 0 || (errno != EAGAIN && errno != EINTR)) {
+    close(output->fds[stream]);
+    output->fds[stream] = NO_OUTPUT_FD;
+  }
+}
+
+/*
+ * gets how much of a job's buffer can be written out:
+ * the whole lines, or everything once the pipe ended
+ * or the buffer is full without a line end in it
+ */
+static size_t ready_length(Job_output *output, int stream) {
+  char *last_line_end;
+
+  if (output->lengths[stream] == 0) return 0;
+  if (output->fds[stream] == NO_OUTPUT_FD) return output->lengths[stream];
+
+  last_line_end = memrchr(output->buffers[stream], '\n',
+    output->lengths[stream]);
+  if (last_line_end != NULL) {
+    return last_line_end - output->buffers[stream] + 1;
+  }
+  if (output->lengths[stream] == JOB_OUTPUT_BUFFER_SIZE) {
+    return output->lengths[stream];
+  }
+
+  return 0;
+}
+
+/*
+ * writes out the pieces gathered so far, picking up
+ * after a short write, the output goes nowhere if the
+ * destination is gone
+ */
+static void write_iovecs(int fd) {
+  struct iovec *curr;
+  int num_left;
+  long num_written;
+
+  curr = iovecs;
+  num_left = num_iovecs;
+  while (num_left > 0) {
+    num_written = writev(fd, curr, num_left);
+    if (num_written < 0 && errno == EINTR) continue;
+    if (num_written < 0) break;
+    while (num_left > 0 && (size_t) num_written >= curr->iov_len) {
+      num_written -= curr->iov_len;
+      curr++;
+      num_left--;
+    }
+    if (num_left > 0) {
+      curr->iov_base = (char *) curr->iov_base + num_written;
+      curr->iov_len -= num_written;
+    }
+  }
+
+  num_iovecs = 0;
+}
+
+/*
+ * adds a piece of output, writing out the ones before
+ * it first if there is no room left for it
+ */
+static void add_iovec(int fd, char *base, size_t length) {
+  if (num_iovecs == JOB_OUTPUT_MAX_IOVECS) write_iovecs(fd);
+  iovecs[num_iovecs].iov_base = base;
+  iovecs[num_iovecs].iov_len = length;
+  num_iovecs++;
+}
+
+/*
+ * adds whatever a job has ready on one stream, with its
+ * tag in front of every line when it has one
+ */
+static void emit_stream(Job_output *output, int stream, int fd) {
+  char *line, *end, *next_line_end;
+  size_t length;
+
+  length = ready_length(output, stream);
+  if (length == 0) return;
+
+  if (output->tag[0] == '\0') {
+    add_iovec(fd, output->buffers[stream], length);
+    return;
+  }
+
+  line = output->buffers[stream];
+  end = line + length;
+  while (line < end) {
+    next_line_end = memchr(line, '\n', end - line);
+    add_iovec(fd, output->tag, strlen(output->tag));
+    if (next_line_end == NULL) {
+      add_iovec(fd, line, end - line);
+      add_iovec(fd, line_end, strlen(line_end));
+      break;
+    }
+    add_iovec(fd, line, next_line_end - line + 1);
+    line = next_line_end + 1;
+  }
+}
+
+/*
+ * writes out what every job has ready, all the stdout
+ * in one writev() and then all the stderr in another,
+ * and keeps the rest of each buffer for later
+ */
+static void flush_job_outputs(void) {
+  Job_output *curr;
+  int stream, fd;
+  size_t length;
+
+  for (stream = 0; stream < NUM_OUTPUT_STREAMS; stream++) {
+    fd = (stream == OUTPUT_STDOUT) ? STDOUT_FILENO : STDERR_FILENO;
+
+    /* anything the shell printed itself comes first */
+    if (stream == OUTPUT_STDOUT) fflush(stdout);
+
+    for (curr = job_outputs; curr != NULL; curr = curr->next) {
+      emit_stream(curr, stream, fd);
+    }
+    write_iovecs(fd);
+
+    for (curr = job_outputs; curr != NULL; curr = curr->next) {
+      length = ready_length(curr, stream);
+      if (length == 0) continue;
+      memmove(curr->buffers[stream], curr->buffers[stream] + length,
+        curr->lengths[stream] - length);
+      curr->lengths[stream] -= length;
+    }
+  }
+}
+
+/*
+ * reads every pipe poll() found ready (in the layout of
+ * poll_job_outputs()) and writes out the whole lines
+ */
+void drain_job_outputs(struct pollfd *pollfds) {
+  Job_output *curr;
+  int i;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      if (pollfds->revents != 0) read_stream(curr, i);
+      pollfds++;
+    }
+  }
+  flush_job_outputs();
+}
+
+/*
+ * queues a wait on every pipe of every job with io_uring,
+ * the address of the fd is the tag, returns how many
+ * waits were queued
+ */
+int queue_job_outputs(void) {
+  Job_output *curr;
+  int num_queued = 0, i;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      if (curr->fds[i] != NO_OUTPUT_FD) {
+        queue_event_poll(curr->fds[i], &curr->fds[i]);
+        num_queued++;
+      }
+    }
+  }
+
+  return num_queued;
+}
+
+/*
+ * checks if a completed wait is one of queue_job_outputs()
+ */
+int is_job_output_tag(void *tag) {
+  Job_output *curr;
+  int i;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      if (tag == &curr->fds[i]) return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * handles a completed wait on the pipe of a job, the pipe
+ * is waited on again if rearm is set and it has not ended,
+ * returns how many waits were queued
+ */
+int handle_job_output_event(void *tag, int result, int rearm) {
+  Job_output *curr;
+  int i;
+
+  for (curr = job_outputs; curr != NULL; curr = curr->next) {
+    for (i = 0; i < NUM_OUTPUT_STREAMS; i++) {
+      if (tag != &curr->fds[i]) continue;
+      if (result > 0) {
+        read_stream(curr, i);
+        flush_job_outputs();
+      }
+      if (rearm && curr->fds[i] != NO_OUTPUT_FD) {
+        queue_event_poll(curr->fds[i], &curr->fds[i]);
+        return 1;
+      }
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * frees every job whose pipes both ended and
+ * whose output was all written out
+ */
+void remove_finished_job_outputs(void) {
+  Job_output **curr, *finished;
+  int i;
+
+  curr = &job_outputs;
+  while (*curr != NULL) {
+    if ((*curr)->fds[OUTPUT_STDOUT] == NO_OUTPUT_FD &&
+      (*curr)->fds[OUTPUT_STDERR] == NO_OUTPUT_FD &&
+      (*curr)->lengths[OUTPUT_STDOUT] == 0 &&
+      (*curr)->lengths[OUTPUT_STDERR] == 0) {
+      finished = *curr;
+      *curr = finished->next;
+      for (i = 0; i < NUM_OUTPUT_STREAMS; i++) free(finished->buffers[i]);
+      free(finished);
+    } else {
+      curr = &(*curr)->next;
+    }
+  }
+}
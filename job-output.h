@@ -0,0 +1,62 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef JOB_OUTPUT_H
+#define JOB_OUTPUT_H
+
+#include <poll.h>
+
+/*
+ * how much of a job's stdout or stderr the shell holds
+ * at once, a line longer than this is written out in
+ * pieces
+ */
+#define JOB_OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * the most pieces of output put in one writev()
+ */
+#define JOB_OUTPUT_MAX_IOVECS 1024
+
+#define JOB_TAG_SIZE 24
+
+#define NO_OUTPUT_FD -1
+
+#define OUTPUT_STDOUT 0
+#define OUTPUT_STDERR 1
+#define NUM_OUTPUT_STREAMS 2
+
+/*
+ * the stdout and stderr of one background job, which go to
+ * pipes the shell reads instead of the shell's own, fds are
+ * the read ends and write_fds the ends the job's stages get
+ */
+typedef struct job_output {
+  char tag[JOB_TAG_SIZE];
+  int fds[NUM_OUTPUT_STREAMS];
+  int write_fds[NUM_OUTPUT_STREAMS];
+  char *buffers[NUM_OUTPUT_STREAMS];
+  size_t lengths[NUM_OUTPUT_STREAMS];
+  struct job_output *next;
+} Job_output;
+
+/*
+ * define functions for buffering the output of background
+ * jobs and writing it out a whole line at a time
+ */
+int buffers_job_output(void);
+Job_output *open_job_output(void);
+void use_job_output(Job_output *output, int is_last_stage);
+void start_job_output(Job_output *output);
+void close_job_output(Job_output *output);
+int has_job_outputs(void);
+int num_job_output_fds(void);
+void poll_job_outputs(struct pollfd *pollfds);
+void drain_job_outputs(struct pollfd *pollfds);
+int queue_job_outputs(void);
+int is_job_output_tag(void *tag);
+int handle_job_output_event(void *tag, int result, int rearm);
+void remove_finished_job_outputs(void);
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions handle the priority that a
+ * pipeline runs at, either given with the "sched" prefix:
+ *
+ *   sched -n 10 -i idle -p batch cmd | cmd2 &
+ *
+ * or given to every background pipeline (the ones
+ * before a "&") by the shell's options:
+ *
+ *   set -o bgnice=N -> nice background jobs by N
+ *   set -o bgbatch -> run background jobs as SCHED_BATCH
+ *   set -o bgidle -> run background jobs as SCHED_IDLE
+ *                    and in the idle io class
+ *
+ * so that large batch jobs started with "&" leave
+ * the cpu and the disks to the foreground work
+ *
+ * the priority is applied in each child after fork()
+ */
+
+/* allow us to use 'SCHED_BATCH', 'SCHED_IDLE' and 'syscall' */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "shell-options.h"
+#include "job-priority.h"
+
+/*
+ * the values from linux/ioprio.h which cannot be included
+ * directly because its enums do not compile as C90
+ */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_VALUE(class, level) (((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+/*
+ * the kernel gives a process that has no io priority
+ * the best effort level (nice + 20) / 5, background
+ * jobs get the same level set explicitly
+ */
+#define NICE_TO_IO_OFFSET 20
+#define NICE_PER_IO_LEVEL 5
+
+/*
+ * define prototypes
+ */
+static int parse_bounded_number(char *value, int max, int *number);
+static int nice_to_io_priority(int nice_increment);
+
+/*
+ * initializes the priority of a pipeline to not set
+ */
+void init_job_priority(Job_priority *priority) {
+  if (priority == NULL) return;
+
+  priority->nice = PRIORITY_NOT_SET;
+  priority->io_priority = PRIORITY_NOT_SET;
+  priority->policy = PRIORITY_NOT_SET;
+}
+
+/*
+ * checks if any part of the priority of a pipeline is set
+ */
+int has_job_priority(Job_priority *priority) {
+  if (priority == NULL) return 0;
+
+  return (priority->nice != PRIORITY_NOT_SET ||
+    priority->io_priority != PRIORITY_NOT_SET ||
+    priority->policy != PRIORITY_NOT_SET);
+}
+
+/*
+ * reads a number from 0 to max
+ */
+static int parse_bounded_number(char *value, int max, int *number) {
+  char *end;
+  long parsed;
+
+  errno = 0;
+  parsed = strtol(value, &end, 10);
+  if (errno != 0 || end == value || *end != '\0' || parsed < 0 ||
+    parsed > max) {
+    return PRIORITY_NOT_PARSED;
+  }
+  *number = parsed;
+
+  return PRIORITY_PARSED;
+}
+
+/*
+ * parses one "-x value" option of "sched"
+ * into the priority of a pipeline
+ */
+int parse_sched_option(char *option, char *value, Job_priority *priority) {
+  if (option == NULL || value == NULL || priority == NULL) {
+    return PRIORITY_NOT_PARSED;
+  }
+
+  if (strcmp(option, SCHED_NICE_OPTION) == 0) {
+    return parse_bounded_number(value, MAX_NICE_INCREMENT, &priority->nice);
+  } else if (strcmp(option, SCHED_IO_OPTION) == 0) {
+    if (strcmp(value, SCHED_IDLE_NAME) == 0) {
+      priority->io_priority = IO_PRIORITY_IDLE;
+      return PRIORITY_PARSED;
+    }
+    return parse_bounded_number(value, MAX_IO_PRIORITY_LEVEL,
+      &priority->io_priority);
+  } else if (strcmp(option, SCHED_POLICY_OPTION) == 0) {
+    if (strcmp(value, SCHED_BATCH_NAME) == 0) {
+      priority->policy = SCHED_BATCH;
+    } else if (strcmp(value, SCHED_IDLE_NAME) == 0) {
+      priority->policy = SCHED_IDLE;
+    } else {
+      return PRIORITY_NOT_PARSED;
+    }
+    return PRIORITY_PARSED;
+  }
+
+  return PRIORITY_NOT_PARSED;
+}
+
+/*
+ * gets the io priority level that the
+ * kernel would derive from a nice value
+ */
+static int nice_to_io_priority(int nice_increment) {
+  int level;
+
+  level = (nice_increment + NICE_TO_IO_OFFSET) / NICE_PER_IO_LEVEL;
+
+  return (level > MAX_IO_PRIORITY_LEVEL) ? MAX_IO_PRIORITY_LEVEL : level;
+}
+
+/*
+ * fills in whatever the "sched" prefix of a background
+ * pipeline left unset from the options of the shell
+ */
+void add_background_priority(Job_priority *priority) {
+  int background_nice;
+
+  if (priority == NULL) return;
+
+  background_nice = get_shell_option(OPTION_BACKGROUND_NICE);
+  if (priority->nice == PRIORITY_NOT_SET && background_nice > 0) {
+    priority->nice = (background_nice > MAX_NICE_INCREMENT) ?
+      MAX_NICE_INCREMENT : background_nice;
+  }
+
+  if (priority->policy == PRIORITY_NOT_SET) {
+    if (get_shell_option(OPTION_BACKGROUND_IDLE)) {
+      priority->policy = SCHED_IDLE;
+    } else if (get_shell_option(OPTION_BACKGROUND_BATCH)) {
+      priority->policy = SCHED_BATCH;
+    }
+  }
+
+  if (priority->io_priority == PRIORITY_NOT_SET) {
+    if (get_shell_option(OPTION_BACKGROUND_IDLE)) {
+      priority->io_priority = IO_PRIORITY_IDLE;
+    } else if (priority->nice != PRIORITY_NOT_SET) {
+      priority->io_priority = nice_to_io_priority(priority->nice);
+    }
+  }
+}
+
+/*
+ * applies the priority of a pipeline to the current process
+ *
+ * this is meant to be called in the child
+ * after fork() and before exec()
+ */
+void apply_job_priority(Job_priority *priority) {
+  struct sched_param param;
+  int io_value;
+
+  if (priority == NULL) return;
+
+  if (priority->nice != PRIORITY_NOT_SET) {
+    /* nice() can return -1 on success so check errno */
+    errno = 0;
+    if (nice(priority->nice) == -1 && errno != 0) {
+      fprintf(stderr, "non fatal error - could not nice by %d\n",
+        priority->nice);
+      fprintf(stderr, "nice() failed with %d\n", errno);
+    }
+  }
+
+  if (priority->policy != PRIORITY_NOT_SET) {
+    param.sched_priority = 0;
+    if (sched_setscheduler(0, priority->policy, &param) != 0) {
+      fprintf(stderr, "non fatal error - could not change the scheduling\
+ policy\n");
+      fprintf(stderr, "sched_setscheduler() failed with %d\n", errno);
+    }
+  }
+
+  if (priority->io_priority != PRIORITY_NOT_SET) {
+    io_value = (priority->io_priority == IO_PRIORITY_IDLE) ?
+      IOPRIO_VALUE(IOPRIO_CLASS_IDLE, 0) :
+      IOPRIO_VALUE(IOPRIO_CLASS_BE, priority->io_priority);
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, io_value) != 0) {
+      fprintf(stderr, "non fatal error - could not change the io priority\n");
+      fprintf(stderr, "ioprio_set() failed with %d\n", errno);
+    }
+  }
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef JOB_PRIORITY_H
+#define JOB_PRIORITY_H
+
+#include "pshell-structs.h"
+
+#define SCHED_KEYWORD "sched"
+
+/*
+ * the options understood by "sched"
+ *
+ * -n -> nice increment of each stage (0 to 19)
+ * -i -> io priority, a best effort level (0 to 7) or "idle"
+ * -p -> scheduling policy, "batch" or "idle"
+ */
+#define SCHED_NICE_OPTION "-n"
+#define SCHED_IO_OPTION "-i"
+#define SCHED_POLICY_OPTION "-p"
+
+#define SCHED_IDLE_NAME "idle"
+#define SCHED_BATCH_NAME "batch"
+
+#define MAX_NICE_INCREMENT 19
+#define MAX_IO_PRIORITY_LEVEL 7
+#define IO_PRIORITY_IDLE (MAX_IO_PRIORITY_LEVEL + 1)
+
+#define PRIORITY_PARSED 0
+#define PRIORITY_NOT_PARSED 1
+
+/*
+ * define functions for parsing and applying
+ * the priority of a pipeline
+ */
+void init_job_priority(Job_priority *priority);
+int has_job_priority(Job_priority *priority);
+int parse_sched_option(char *option, char *value, Job_priority *priority);
+void add_background_priority(Job_priority *priority);
+void apply_job_priority(Job_priority *priority);
+
+#endif
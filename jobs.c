@@ -0,0 +1,705 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep track of the pipelines
+ * that were started with a timeout ("limit -t")
+ *
+ * each timed pipeline gets a timerfd for its deadline
+ * and a pidfd for each of its stages so that the shell
+ * can wait for a child, or for input, with a single
+ * poll() that also notices when a deadline passes
+ *
+ * when a deadline passes every stage that is still
+ * running gets SIGTERM and, if it is still around
+ * after a grace period, SIGKILL
+ *
+ * the pipes of the background jobs whose output is
+ * buffered (see job-output.c) are in the same poll() so
+ * their output is written out while the shell waits
+ *
+ * when nothing has a timeout and no output is buffered
+ * the shell just uses a plain blocking waitpid()
+ *
+ * the stages of background jobs are never waited for,
+ * their pids are kept so they can be reaped once they
+ * are done without reaping any child someone else
+ * still waits for (a ">( ... )" child or the stage of a
+ * profiled pipeline)
+ *
+ * with "set -o uring" all of this is done with io_uring
+ * instead (see event-loop.c): the child (or the read of
+ * the input) the shell waits for, the timers and stages of
+ * the timed pipelines and a batch of waits that reap the
+ * background children that already finished are submitted
+ * together and handled as they complete
+ */
+
+/* allow us to use 'syscall' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "pshell.h"
+#include "jobs.h"
+#include "event-loop.h"
+#include "job-output.h"
+
+#define MILLISECONDS_PER_SECOND 1000L
+#define NANOSECONDS_PER_MILLISECOND 1000000L
+
+#define NO_SIGNAL_SENT 0
+#define SIGTERM_SENT 1
+#define SIGKILL_SENT 2
+
+#define FD_NOT_READY 0
+#define FD_READY 1
+
+/*
+ * how many of the background jobs' stages are looked
+ * at by each wait done with io_uring, each wait starts
+ * where the one before it stopped
+ */
+#define REAP_BATCH 16
+
+#define NO_CHILD 0
+#define NO_INPUT_FD -1
+
+#define REARM_EVENTS 1
+#define DRAIN_EVENTS 0
+
+#define FIRST_BACKGROUND_CAPACITY 16
+
+/*
+ * a stopped child does not make its pidfd readable
+ * so a wait that returns on a stop checks this often
+ */
+#define STOP_POLL_MS 50
+
+/*
+ * a linked list of the pipelines that have a timeout
+ */
+typedef struct timed_pipeline {
+  int num_pids;
+  int *pidfds;
+  int num_running;
+  int timerfd;
+  int signals_sent;
+  struct timed_pipeline *next;
+} Timed_pipeline;
+
+static Timed_pipeline *timed_pipelines = NULL;
+
+/*
+ * the stages of background jobs that were not reaped yet
+ */
+static pid_t *background_pids = NULL;
+static int num_background_pids = 0;
+static int background_capacity = 0;
+static int reap_cursor = 0;
+
+/*
+ * what a wait done with io_uring is for, either the
+ * child pid or a read of size bytes of the input fd,
+ * result is what waitpid() or read() would return
+ */
+typedef struct wait_request {
+  pid_t pid;
+  int options;
+  int fd;
+  char *buffer;
+  size_t size;
+  siginfo_t info;
+  int status;
+  long result;
+  int done;
+} Wait_request;
+
+/*
+ * the children reaped in the background, the address
+ * of each one is the tag of the wait that fills it in
+ * and reaped_children[i] is for the background pid i
+ * places after reap_cursor
+ */
+static siginfo_t reaped_children[REAP_BATCH];
+static int num_reap_waits = 0;
+static int cancel_tag;
+
+/*
+ * define prototypes
+ */
+static int open_pidfd(pid_t pid);
+static int arm_timer(int timerfd, long timeout_ms);
+static void signal_timed_pipeline(Timed_pipeline *timed_pipeline, int signal);
+static void handle_deadline(Timed_pipeline *timed_pipeline);
+static void remove_finished_pipelines(void);
+static int has_watched_fds(void);
+static int wait_on_fd(int fd, int timeout_ms);
+static int encode_wait_status(siginfo_t *info);
+static int queue_timed_pipelines(void);
+static int handle_timed_event(void *tag, int result, int rearm);
+static void handle_wait_event(Wait_request *request, void *tag, int result);
+static void forget_background_pid(pid_t pid);
+static void forget_reaped_jobs(void);
+static void wait_with_uring(Wait_request *request);
+static void wait_for_input(int fd);
+
+/*
+ * gets a pidfd for a child or NO_PIDFD if the
+ * kernel does not support them
+ */
+static int open_pidfd(pid_t pid) {
+  int pidfd;
+
+  pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (pidfd < 0) return NO_PIDFD;
+
+  return pidfd;
+}
+
+/*
+ * arms a timerfd to go off once after timeout_ms
+ */
+static int arm_timer(int timerfd, long timeout_ms) {
+  struct itimerspec deadline;
+
+  deadline.it_interval.tv_sec = 0;
+  deadline.it_interval.tv_nsec = 0;
+  deadline.it_value.tv_sec = timeout_ms / MILLISECONDS_PER_SECOND;
+  deadline.it_value.tv_nsec = (timeout_ms % MILLISECONDS_PER_SECOND) *
+    NANOSECONDS_PER_MILLISECOND;
+
+  /* a zero it_value would disarm the timer */
+  if (timeout_ms <= 0) deadline.it_value.tv_nsec = 1;
+
+  return timerfd_settime(timerfd, 0, &deadline, NULL);
+}
+
+/*
+ * starts enforcing a timeout on the stages of a pipeline
+ * that was just started
+ */
+void add_timed_pipeline(pid_t *pids, int num_pids, long timeout_ms) {
+  Timed_pipeline *timed_pipeline;
+  int i;
+
+  timed_pipeline = malloc(sizeof(Timed_pipeline));
+  MEM_CHECK(timed_pipeline);
+  timed_pipeline->pidfds = malloc(sizeof(int) * num_pids);
+  MEM_CHECK(timed_pipeline->pidfds);
+  timed_pipeline->num_pids = num_pids;
+  timed_pipeline->num_running = 0;
+  timed_pipeline->signals_sent = NO_SIGNAL_SENT;
+
+  for (i = 0; i < num_pids; i++) {
+    timed_pipeline->pidfds[i] = open_pidfd(pids[i]);
+    if (timed_pipeline->pidfds[i] != NO_PIDFD) {
+      timed_pipeline->num_running++;
+    }
+  }
+
+  timed_pipeline->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if (timed_pipeline->timerfd < 0 || timed_pipeline->num_running < num_pids ||
+    arm_timer(timed_pipeline->timerfd, timeout_ms) != 0) {
+    fprintf(stderr, "non fatal error - could not enforce the timeout\n");
+    fprintf(stderr, "pidfd_open() or timerfd_create() failed with %d\n", errno);
+    timed_pipeline->num_running = 0;
+  }
+
+  timed_pipeline->next = timed_pipelines;
+  timed_pipelines = timed_pipeline;
+
+  /* drops the pipeline right away if it could not be timed */
+  remove_finished_pipelines();
+}
+
+/*
+ * keeps the pids of the stages of a background job that
+ * was just started so they can be reaped later, a pid of
+ * 0 (a stage that ran inside the shell) is skipped
+ */
+void add_background_job(pid_t *pids, int num_pids) {
+  int i;
+
+  for (i = 0; i < num_pids; i++) {
+    if (pids[i] <= 0) continue;
+
+    /* make room from the jobs that are done first */
+    if (num_background_pids >= background_capacity) {
+      reap_background_jobs();
+    }
+    if (num_background_pids >= background_capacity) {
+      background_capacity = (background_capacity == 0) ?
+        FIRST_BACKGROUND_CAPACITY : background_capacity * 2;
+      background_pids = realloc(background_pids,
+        sizeof(pid_t) * background_capacity);
+      MEM_CHECK(background_pids);
+    }
+    background_pids[num_background_pids++] = pids[i];
+  }
+}
+
+/*
+ * reaps the stages of background jobs that are done
+ * without waiting for the ones that are still running
+ */
+void reap_background_jobs(void) {
+  int i, status;
+
+  for (i = 0; i < num_background_pids; i++) {
+    if (waitpid(background_pids[i], &status, WNOHANG) == 0) continue;
+
+    /* reaped (or somehow no longer a child) */
+    background_pids[i--] = background_pids[--num_background_pids];
+  }
+}
+
+/*
+ * checks if any pipeline still has a timeout to enforce
+ */
+int has_timed_pipelines(void) {
+  return (timed_pipelines != NULL);
+}
+
+/*
+ * sends a signal to every stage of a
+ * timed pipeline that is still running
+ */
+static void signal_timed_pipeline(Timed_pipeline *timed_pipeline, int signal) {
+  int i;
+
+  for (i = 0; i < timed_pipeline->num_pids; i++) {
+    if (timed_pipeline->pidfds[i] != NO_PIDFD) {
+      syscall(SYS_pidfd_send_signal, timed_pipeline->pidfds[i], signal,
+        NULL, 0);
+    }
+  }
+}
+
+/*
+ * escalates a pipeline whose deadline passed
+ * from SIGTERM to SIGKILL
+ */
+static void handle_deadline(Timed_pipeline *timed_pipeline) {
+  uint64_t expirations;
+
+  if (read(timed_pipeline->timerfd, &expirations, sizeof(expirations)) !=
+    sizeof(expirations)) {
+    return;
+  }
+
+  if (timed_pipeline->signals_sent == NO_SIGNAL_SENT) {
+    fprintf(stderr, "non fatal error - pipeline timed out, sending SIGTERM\n");
+    signal_timed_pipeline(timed_pipeline, SIGTERM);
+    timed_pipeline->signals_sent = SIGTERM_SENT;
+    arm_timer(timed_pipeline->timerfd, TIMEOUT_KILL_GRACE_MS);
+  } else if (timed_pipeline->signals_sent == SIGTERM_SENT) {
+    fprintf(stderr, "non fatal error - pipeline ignored SIGTERM,\
+ sending SIGKILL\n");
+    signal_timed_pipeline(timed_pipeline, SIGKILL);
+    timed_pipeline->signals_sent = SIGKILL_SENT;
+  }
+}
+
+/*
+ * frees every timed pipeline that has no stages left running
+ */
+static void remove_finished_pipelines(void) {
+  Timed_pipeline **curr, *finished;
+
+  curr = &timed_pipelines;
+  while (*curr != NULL) {
+    if ((*curr)->num_running == 0) {
+      finished = *curr;
+      *curr = finished->next;
+      if (finished->timerfd >= 0) close(finished->timerfd);
+      free(finished->pidfds);
+      free(finished);
+    } else {
+      curr = &(*curr)->next;
+    }
+  }
+}
+
+/*
+ * checks if the shell has anything to watch while it
+ * waits besides what it is waiting for
+ */
+static int has_watched_fds(void) {
+  return (has_timed_pipelines() || has_job_outputs());
+}
+
+/*
+ * polls fd together with the timers and stages of every
+ * timed pipeline and the pipes of every buffered job and
+ * handles whatever happened to them, waiting for up to
+ * timeout_ms (-1 for as long as it takes)
+ *
+ * returns FD_READY once fd is readable
+ */
+static int wait_on_fd(int fd, int timeout_ms) {
+  struct pollfd *pollfds;
+  Timed_pipeline *curr;
+  int num_pollfds, i, j, ready;
+
+  num_pollfds = 1 + num_job_output_fds();
+  for (curr = timed_pipelines; curr != NULL; curr = curr->next) {
+    num_pollfds += 1 + curr->num_pids;
+  }
+  pollfds = malloc(sizeof(struct pollfd) * num_pollfds);
+  MEM_CHECK(pollfds);
+
+  /* the layout is fd, then for each pipeline its
+   * timerfd followed by the pidfd of each stage, then
+   * the pipes of the buffered jobs
+   *
+   * negative fds (finished stages) are ignored by poll() */
+  pollfds[0].fd = fd;
+  pollfds[0].events = POLLIN;
+  i = 1;
+  for (curr = timed_pipelines; curr != NULL; curr = curr->next) {
+    pollfds[i].fd = curr->timerfd;
+    pollfds[i++].events = POLLIN;
+    for (j = 0; j < curr->num_pids; j++) {
+      pollfds[i].fd = curr->pidfds[j];
+      pollfds[i++].events = POLLIN;
+    }
+  }
+  poll_job_outputs(pollfds + i);
+
+  if (poll(pollfds, num_pollfds, timeout_ms) < 0) {
+    free(pollfds);
+    return FD_NOT_READY;
+  }
+
+  i = 1;
+  for (curr = timed_pipelines; curr != NULL; curr = curr->next) {
+    if (pollfds[i++].revents & POLLIN) {
+      handle_deadline(curr);
+    }
+    for (j = 0; j < curr->num_pids; j++) {
+      if (pollfds[i++].revents & (POLLIN | POLLHUP)) {
+        close(curr->pidfds[j]);
+        curr->pidfds[j] = NO_PIDFD;
+        curr->num_running--;
+      }
+    }
+  }
+  remove_finished_pipelines();
+  drain_job_outputs(pollfds + i);
+  remove_finished_job_outputs();
+
+  ready = (pollfds[0].revents != 0) ? FD_READY : FD_NOT_READY;
+  free(pollfds);
+
+  return ready;
+}
+
+/*
+ * turns what waitid() says about a child into
+ * the status waitpid() would have given
+ */
+static int encode_wait_status(siginfo_t *info) {
+  if (info->si_code == CLD_EXITED) return (info->si_status & 0xff) << 8;
+  if (info->si_code == CLD_DUMPED) return info->si_status | WCOREFLAG;
+  if (info->si_code == CLD_STOPPED) return (info->si_status << 8) | 0x7f;
+
+  return info->si_status;
+}
+
+/*
+ * queues a wait on the timer and on every running stage
+ * of each timed pipeline, the address of the fd is
+ * the tag, returns how many waits were queued
+ */
+static int queue_timed_pipelines(void) {
+  Timed_pipeline *curr;
+  int num_queued = 0, j;
+
+  for (curr = timed_pipelines; curr != NULL; curr = curr->next) {
+    if (curr->timerfd >= 0 && curr->signals_sent != SIGKILL_SENT) {
+      queue_event_poll(curr->timerfd, &curr->timerfd);
+      num_queued++;
+    }
+    for (j = 0; j < curr->num_pids; j++) {
+      if (curr->pidfds[j] != NO_PIDFD) {
+        queue_event_poll(curr->pidfds[j], &curr->pidfds[j]);
+        num_queued++;
+      }
+    }
+  }
+
+  return num_queued;
+}
+
+/*
+ * handles a completed wait on a timer or a stage of a timed
+ * pipeline, a timer is waited on again if rearm is set,
+ * returns how many waits were queued
+ */
+static int handle_timed_event(void *tag, int result, int rearm) {
+  Timed_pipeline *curr;
+  int j;
+
+  for (curr = timed_pipelines; curr != NULL; curr = curr->next) {
+    if (tag == &curr->timerfd) {
+      if (result > 0) handle_deadline(curr);
+      if (rearm && curr->signals_sent != SIGKILL_SENT) {
+        queue_event_poll(curr->timerfd, &curr->timerfd);
+        return 1;
+      }
+      return 0;
+    }
+    for (j = 0; j < curr->num_pids; j++) {
+      if (tag == &curr->pidfds[j]) {
+        if (result > 0) {
+          close(curr->pidfds[j]);
+          curr->pidfds[j] = NO_PIDFD;
+          curr->num_running--;
+        }
+        return 0;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * handles the completion of the request itself, a wait
+ * that reaped a background child only fills in its
+ * entry of reaped_children
+ */
+static void handle_wait_event(Wait_request *request, void *tag, int result) {
+  if (tag != request || request->done) return;
+
+  request->done = 1;
+  request->result = result;
+  if (result < 0) {
+    errno = -result;
+    request->result = -1;
+  } else if (request->pid != NO_CHILD) {
+    request->status = encode_wait_status(&request->info);
+    request->result = request->pid;
+  }
+}
+
+/*
+ * drops a stage of a background job that was reaped
+ */
+static void forget_background_pid(pid_t pid) {
+  int i;
+
+  for (i = 0; i < num_background_pids; i++) {
+    if (background_pids[i] == pid) {
+      background_pids[i] = background_pids[--num_background_pids];
+      return;
+    }
+  }
+}
+
+/*
+ * drops the background pids that the waits done with
+ * io_uring reaped and moves the cursor past the ones
+ * that were looked at
+ */
+static void forget_reaped_jobs(void) {
+  int i;
+
+  for (i = 0; i < num_reap_waits; i++) {
+    if (reaped_children[i].si_pid == 0) continue;
+    forget_background_pid(reaped_children[i].si_pid);
+  }
+  reap_cursor += num_reap_waits;
+  num_reap_waits = 0;
+}
+
+/*
+ * waits with io_uring for a request to finish while
+ * reaping the background children that finished and
+ * enforcing the timeouts of the timed pipelines, every
+ * wait still in flight afterwards is cancelled
+ */
+static void wait_with_uring(Wait_request *request) {
+  int in_flight = 0, result, i;
+  void *tag;
+
+  /* the waits with WNOHANG complete as soon as they are
+   * submitted, before the wait for the request itself,
+   * and only look at the stages of background jobs so no
+   * child someone else waits for is reaped */
+  if (reap_cursor >= num_background_pids) reap_cursor = 0;
+  num_reap_waits = (num_background_pids < REAP_BATCH) ?
+    num_background_pids : REAP_BATCH;
+  for (i = 0; i < num_reap_waits; i++) {
+    reaped_children[i].si_pid = 0;
+    queue_event_waitid(P_PID,
+      background_pids[(reap_cursor + i) % num_background_pids],
+      WEXITED | WNOHANG, &reaped_children[i], &reaped_children[i]);
+  }
+  in_flight += num_reap_waits;
+
+  request->done = 0;
+  if (request->pid != NO_CHILD) {
+    queue_event_waitid(P_PID, request->pid, request->options, &request->info,
+      request);
+  } else {
+    queue_event_read(request->fd, request->buffer, request->size, request);
+  }
+  in_flight++;
+  in_flight += queue_timed_pipelines();
+  in_flight += queue_job_outputs();
+
+  while (!request->done) {
+    if (submit_events(1) < 0) {
+      request->result = -1;
+      break;
+    }
+    while (next_event(&tag, &result) == EVENT_FOUND) {
+      in_flight--;
+      if (tag == request || (tag >= (void *) reaped_children &&
+        tag < (void *) (reaped_children + REAP_BATCH))) {
+        handle_wait_event(request, tag, result);
+      } else if (is_job_output_tag(tag)) {
+        in_flight += handle_job_output_event(tag, result, REARM_EVENTS);
+      } else {
+        in_flight += handle_timed_event(tag, result, REARM_EVENTS);
+      }
+    }
+  }
+
+  /* a stage that exits while its wait is being
+   * cancelled is still counted as finished */
+  if (in_flight > 0) {
+    queue_event_cancel_all(&cancel_tag);
+    in_flight++;
+  }
+  while (in_flight > 0 && submit_events(in_flight) >= 0) {
+    while (next_event(&tag, &result) == EVENT_FOUND) {
+      in_flight--;
+      if (tag == request || (tag >= (void *) reaped_children &&
+        tag < (void *) (reaped_children + REAP_BATCH))) {
+        handle_wait_event(request, tag, result);
+      } else if (is_job_output_tag(tag)) {
+        handle_job_output_event(tag, result, DRAIN_EVENTS);
+      } else if (tag != &cancel_tag) {
+        handle_timed_event(tag, result, DRAIN_EVENTS);
+      }
+    }
+  }
+  forget_reaped_jobs();
+  remove_finished_pipelines();
+  remove_finished_job_outputs();
+}
+
+/*
+ * waits for a child like waitpid() while still
+ * enforcing the timeouts of any timed pipelines
+ * and writing out the output of buffered jobs,
+ * until is WAIT_FOR_EXIT_OR_STOP to also return
+ * when the child is stopped (like WUNTRACED)
+ */
+pid_t wait_for_process(pid_t pid, int *status, int until) {
+  Wait_request request;
+  int pidfd, timeout_ms;
+  pid_t result;
+
+  if (start_event_loop() == EVENT_LOOP_READY) {
+    request.pid = pid;
+    request.options = WEXITED;
+    if (until == WAIT_FOR_EXIT_OR_STOP) request.options |= WSTOPPED;
+    request.fd = NO_INPUT_FD;
+    wait_with_uring(&request);
+    if (request.result == pid) *status = request.status;
+    return request.result;
+  }
+
+  if (has_watched_fds()) {
+    pidfd = open_pidfd(pid);
+    if (pidfd != NO_PIDFD) {
+      timeout_ms = (until == WAIT_FOR_EXIT_OR_STOP) ? STOP_POLL_MS : -1;
+      while (has_watched_fds()) {
+        if (until == WAIT_FOR_EXIT_OR_STOP) {
+          result = waitpid(pid, status, WUNTRACED | WNOHANG);
+          if (result != 0) {
+            close(pidfd);
+            return result;
+          }
+        }
+        if (wait_on_fd(pidfd, timeout_ms) == FD_READY) break;
+      }
+      close(pidfd);
+    }
+  }
+
+  result = waitpid(pid, status, (until == WAIT_FOR_EXIT_OR_STOP) ?
+    WUNTRACED : 0);
+
+  /* the io_uring wait reaps the background jobs as it
+   * goes, without it they are reaped after each wait */
+  if (result >= 0) reap_background_jobs();
+
+  return result;
+}
+
+/*
+ * handles the deadlines of the timed pipelines that
+ * have passed (and the output buffered jobs have
+ * ready) without waiting for anything, for the
+ * shell's own loops that wait in some other way
+ */
+void enforce_timeouts(void) {
+  if (has_watched_fds()) wait_on_fd(NO_INPUT_FD, 0);
+}
+
+/*
+ * waits until every buffered job's output was written
+ * out, which is when the shell is about to exit
+ */
+void wait_for_job_outputs(void) {
+  while (has_job_outputs()) wait_on_fd(NO_INPUT_FD, -1);
+}
+
+/*
+ * waits until there is input to read on fd while
+ * still enforcing the timeouts of any timed pipelines
+ */
+static void wait_for_input(int fd) {
+  while (has_watched_fds() && wait_on_fd(fd, -1) != FD_READY);
+}
+
+/*
+ * reads the shell's input like read() while still
+ * enforcing the timeouts of any timed pipelines
+ */
+long read_input(int fd, char *buffer, size_t size) {
+  Wait_request request;
+  long num_read;
+
+  if (start_event_loop() == EVENT_LOOP_READY) {
+    request.pid = NO_CHILD;
+    request.fd = fd;
+    request.buffer = buffer;
+    request.size = size;
+    wait_with_uring(&request);
+    return request.result;
+  }
+
+  wait_for_input(fd);
+  do {
+    num_read = read(fd, buffer, size);
+  } while (num_read < 0 && errno == EINTR);
+
+  return num_read;
+}
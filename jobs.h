@@ -0,0 +1,41 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * how long a timed out pipeline gets to exit after
+ * SIGTERM before it is sent SIGKILL
+ */
+#define TIMEOUT_KILL_GRACE_MS 2000
+
+#define NO_PIDFD -1
+#define NO_TIMERFD -1
+
+/*
+ * whether a wait for a child also ends when the child
+ * is stopped (by ^Z at the terminal it was handed)
+ */
+#define WAIT_FOR_EXIT 0
+#define WAIT_FOR_EXIT_OR_STOP 1
+
+/*
+ * define functions for keeping track of pipelines
+ * with a timeout and of background jobs and for
+ * waiting in a way that still enforces those timeouts
+ */
+void add_timed_pipeline(pid_t *pids, int num_pids, long timeout_ms);
+int has_timed_pipelines(void);
+void add_background_job(pid_t *pids, int num_pids);
+void reap_background_jobs(void);
+pid_t wait_for_process(pid_t pid, int *status, int until);
+void enforce_timeouts(void);
+void wait_for_job_outputs(void);
+long read_input(int fd, char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions count what the shell does
+ * (lines parsed, pipelines and forks, exec() failures)
+ * and keep histograms of how long parsing, fork() and the
+ * children the shell waits for take, and serve them as
+ * Prometheus text on the unix domain socket named by
+ * $PSHELL_METRICS, for example:
+ *
+ *   PSHELL_METRICS=/run/worker.sock pshell.x < jobs.txt
+ *   curl --unix-socket /run/worker.sock http://x/metrics
+ *
+ * the counters live in a shared anonymous mapping so the
+ * children can count their own exec() failures, and they
+ * are only ever changed with relaxed atomic adds so the
+ * shell never takes a lock or makes a system call to
+ * record anything (when $PSHELL_METRICS is not set every
+ * function here returns right away)
+ *
+ * a thread of its own answers the socket, reading the
+ * counters as they are and counting the live and zombie
+ * children of the shell from /proc when it is asked
+ *
+ * the histograms have log-linear buckets in microseconds
+ * (each bucket is about a quarter bigger than the last)
+ * like an HDR histogram with two significant bits
+ */
+
+/* allow us to use 'MAP_ANONYMOUS', 'accept4' and 'vsnprintf' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "pshell.h"
+#include "metrics.h"
+
+#define NUM_BUCKETS 96
+#define BUCKET_GROWTH_SHIFT 2
+
+#define MICROSECONDS_PER_SECOND 1000000.0
+#define NANOSECONDS_PER_MICROSECOND 1000
+
+#define LISTEN_BACKLOG 16
+#define REQUEST_TIMEOUT_MS 100
+#define REQUEST_BUFFER_SIZE 1024
+#define RESPONSE_BUFFER_SIZE 65536
+#define PROC_BUFFER_SIZE 65536
+#define PROC_PATH_SIZE 64
+#define STAT_BUFFER_SIZE 512
+
+#define HTTP_REQUEST "GET "
+#define HTTP_HEADER "HTTP/1.0 200 OK\r\n\
+Content-Type: text/plain; version=0.0.4\r\n\r\n"
+
+#define ZOMBIE_STATE 'Z'
+
+/*
+ * counts of the observations that fell into each
+ * bucket (the last one is for anything too big
+ * for the rest) along with their sum
+ */
+typedef struct histogram {
+  unsigned long buckets[NUM_BUCKETS + 1];
+  unsigned long sum;
+} Histogram;
+
+typedef struct shell_metrics {
+  unsigned long counters[NUM_COUNTERS];
+  Histogram histograms[NUM_HISTOGRAMS];
+} Shell_metrics;
+
+/*
+ * the name and help text of each counter and
+ * histogram in the order of their index
+ */
+typedef struct metric_name {
+  char *name;
+  char *help;
+} Metric_name;
+
+static Metric_name counter_names[NUM_COUNTERS] = {
+  {"pshell_lines_total", "Lines of input parsed."},
+  {"pshell_pipelines_total", "Pipelines started."},
+  {"pshell_forks_total", "Child processes forked."},
+  {"pshell_exec_failures_total", "Children that could not exec()."},
+  {"pshell_waits_total", "Children waited for."}
+};
+
+static Metric_name histogram_names[NUM_HISTOGRAMS] = {
+  {"pshell_parse_seconds", "Time to tokenize and parse a line."},
+  {"pshell_fork_seconds", "Time the shell spends in fork()."},
+  {"pshell_child_seconds",
+    "Time from starting a synchronous step to its last child exiting."}
+};
+
+static Shell_metrics *metrics = NULL;
+static unsigned long bucket_bounds[NUM_BUCKETS];
+static char *metrics_path = NULL;
+static int listen_fd = -1;
+static int server_running = 0;
+static pthread_t server_thread;
+
+/*
+ * only used by the server thread
+ */
+static char response[RESPONSE_BUFFER_SIZE];
+static size_t response_size;
+static char proc_buffer[PROC_BUFFER_SIZE];
+
+/*
+ * define prototypes
+ */
+static void init_bucket_bounds(void);
+static int find_bucket(unsigned long value);
+static unsigned long load(unsigned long *value);
+static void append(char *format, ...);
+static void count_children(unsigned long *live, unsigned long *zombies);
+static void format_metrics(void);
+static void write_all(int fd, char *data, size_t size);
+static void serve_request(int fd);
+static void *serve_metrics(void *argument);
+
+/*
+ * fills in the upper bound (in microseconds) of each bucket
+ */
+static void init_bucket_bounds(void) {
+  unsigned long step;
+  int i;
+
+  bucket_bounds[0] = 1;
+  for (i = 1; i < NUM_BUCKETS; i++) {
+    step = bucket_bounds[i - 1] >> BUCKET_GROWTH_SHIFT;
+    bucket_bounds[i] = bucket_bounds[i - 1] + ((step == 0) ? 1 : step);
+  }
+}
+
+/*
+ * finds the first bucket a value fits in with a
+ * binary search, NUM_BUCKETS if it fits in none
+ */
+static int find_bucket(unsigned long value) {
+  int low = 0, high = NUM_BUCKETS, middle;
+
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (value <= bucket_bounds[middle]) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  return low;
+}
+
+/*
+ * starts recording metrics and serving them on a socket
+ */
+int init_metrics(char *socket_path) {
+  struct sockaddr_un address;
+  sigset_t all_signals, old_signals;
+
+  if (socket_path == NULL || metrics != NULL) return METRICS_FAILED;
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "non fatal error - metrics socket path is too long\n");
+    return METRICS_FAILED;
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) return METRICS_FAILED;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+
+  /* a socket left behind by an earlier shell is replaced */
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+    listen(listen_fd, LISTEN_BACKLOG) != 0) {
+    fprintf(stderr, "non fatal error - could not serve metrics on %s\n",
+      socket_path);
+    fprintf(stderr, "strerror() says the problem is \"%s\"\n",
+      strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return METRICS_FAILED;
+  }
+
+  metrics = mmap(NULL, sizeof(Shell_metrics), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (metrics == MAP_FAILED) {
+    metrics = NULL;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+    return METRICS_FAILED;
+  }
+  init_bucket_bounds();
+
+  metrics_path = malloc(sizeof(char) * (strlen(socket_path) + 1));
+  MEM_CHECK(metrics_path);
+  strcpy(metrics_path, socket_path);
+
+  /* the thread blocks every signal so they
+   * keep going to the shell itself */
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  server_running = (pthread_create(&server_thread, NULL, serve_metrics,
+    NULL) == 0);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+  if (!server_running) {
+    cleanup_metrics();
+    return METRICS_FAILED;
+  }
+
+  return METRICS_SUCCEEDED;
+}
+
+/*
+ * reads the monotonic clock in microseconds, this is
+ * METRICS_OFF when nothing is being recorded so the
+ * callers pay for nothing but the call
+ */
+unsigned long metrics_clock(void) {
+  struct timespec now;
+  unsigned long microseconds;
+
+  if (metrics == NULL) return METRICS_OFF;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  microseconds = now.tv_sec * (unsigned long) MICROSECONDS_PER_SECOND +
+    now.tv_nsec / NANOSECONDS_PER_MICROSECOND;
+
+  /* never hand back the value that means off */
+  return (microseconds == METRICS_OFF) ? 1 : microseconds;
+}
+
+/*
+ * adds one to a counter
+ */
+void count_metric(int counter) {
+  if (metrics == NULL || counter < 0 || counter >= NUM_COUNTERS) return;
+
+  __atomic_fetch_add(&metrics->counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * adds the time since start (from metrics_clock())
+ * to a histogram
+ */
+void observe_metric(int histogram, unsigned long start) {
+  Histogram *curr;
+  unsigned long elapsed;
+
+  if (metrics == NULL || start == METRICS_OFF || histogram < 0 ||
+    histogram >= NUM_HISTOGRAMS) {
+    return;
+  }
+
+  elapsed = metrics_clock() - start;
+  curr = &metrics->histograms[histogram];
+  __atomic_fetch_add(&curr->buckets[find_bucket(elapsed)], 1,
+    __ATOMIC_RELAXED);
+  __atomic_fetch_add(&curr->sum, elapsed, __ATOMIC_RELAXED);
+}
+
+/*
+ * reads a value that the shell may be adding to
+ */
+static unsigned long load(unsigned long *value) {
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+/*
+ * adds formatted text to the end of the response
+ */
+static void append(char *format, ...) {
+  va_list arguments;
+  int size;
+
+  if (response_size >= RESPONSE_BUFFER_SIZE) return;
+
+  va_start(arguments, format);
+  size = vsnprintf(response + response_size,
+    RESPONSE_BUFFER_SIZE - response_size, format, arguments);
+  va_end(arguments);
+
+  if (size > 0) response_size += size;
+  if (response_size > RESPONSE_BUFFER_SIZE) {
+    response_size = RESPONSE_BUFFER_SIZE;
+  }
+}
+
+/*
+ * counts the children of the shell that are still
+ * running and the ones that exited but were never
+ * waited for (background jobs) from /proc
+ */
+static void count_children(unsigned long *live, unsigned long *zombies) {
+  char path[PROC_PATH_SIZE], stat[STAT_BUFFER_SIZE];
+  char *curr, *end, *state;
+  ssize_t size;
+  long pid;
+  int fd;
+
+  *live = *zombies = 0;
+
+  /* children are listed under the thread that forked them */
+  sprintf(path, "/proc/%ld/task/%ld/children", (long) getpid(),
+    (long) getpid());
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return;
+  size = read(fd, proc_buffer, PROC_BUFFER_SIZE - 1);
+  close(fd);
+  if (size <= 0) return;
+  proc_buffer[size] = '\0';
+
+  for (curr = proc_buffer; *curr != '\0'; curr = end) {
+    pid = strtol(curr, &end, 10);
+    if (end == curr) break;
+
+    sprintf(path, "/proc/%ld/stat", pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    size = read(fd, stat, STAT_BUFFER_SIZE - 1);
+    close(fd);
+    if (size <= 0) continue;
+    stat[size] = '\0';
+
+    /* the state comes after the name, which
+     * is in parentheses and may have spaces */
+    state = strrchr(stat, ')');
+    if (state == NULL || state[1] == '\0') continue;
+    if (state[2] == ZOMBIE_STATE) {
+      (*zombies)++;
+    } else {
+      (*live)++;
+    }
+  }
+}
+
+/*
+ * formats every metric into the response
+ */
+static void format_metrics(void) {
+  Histogram *curr;
+  unsigned long live, zombies, cumulative;
+  int i, j;
+
+  response_size = 0;
+
+  for (i = 0; i < NUM_COUNTERS; i++) {
+    append("# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+      counter_names[i].name, counter_names[i].help, counter_names[i].name,
+      counter_names[i].name, load(&metrics->counters[i]));
+  }
+
+  count_children(&live, &zombies);
+  append("# HELP pshell_live_jobs Children of the shell still running.\n"
+    "# TYPE pshell_live_jobs gauge\npshell_live_jobs %lu\n", live);
+  append("# HELP pshell_zombies Children that exited but were not waited for.\n"
+    "# TYPE pshell_zombies gauge\npshell_zombies %lu\n", zombies);
+
+  for (i = 0; i < NUM_HISTOGRAMS; i++) {
+    curr = &metrics->histograms[i];
+    append("# HELP %s %s\n# TYPE %s histogram\n", histogram_names[i].name,
+      histogram_names[i].help, histogram_names[i].name);
+
+    cumulative = 0;
+    for (j = 0; j < NUM_BUCKETS; j++) {
+      cumulative += load(&curr->buckets[j]);
+      append("%s_bucket{le=\"%.6f\"} %lu\n", histogram_names[i].name,
+        bucket_bounds[j] / MICROSECONDS_PER_SECOND, cumulative);
+    }
+
+    /* the count is taken from the buckets so the
+     * numbers agree even while the shell adds to them */
+    cumulative += load(&curr->buckets[NUM_BUCKETS]);
+    append("%s_bucket{le=\"+Inf\"} %lu\n%s_sum %.6f\n%s_count %lu\n",
+      histogram_names[i].name, cumulative, histogram_names[i].name,
+      load(&curr->sum) / MICROSECONDS_PER_SECOND, histogram_names[i].name,
+      cumulative);
+  }
+}
+
+/*
+ * writes all of a buffer to a socket
+ */
+static void write_all(int fd, char *data, size_t size) {
+  ssize_t written;
+
+  while (size > 0) {
+    written = write(fd, data, size);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return;
+    data += written;
+    size -= written;
+  }
+}
+
+/*
+ * answers one connection, a client that sends an http
+ * GET gets an http response and anything else (even
+ * nothing at all) gets just the metrics
+ */
+static void serve_request(int fd) {
+  char request[REQUEST_BUFFER_SIZE];
+  struct pollfd request_poll;
+  ssize_t size = 0;
+
+  request_poll.fd = fd;
+  request_poll.events = POLLIN;
+  if (poll(&request_poll, 1, REQUEST_TIMEOUT_MS) > 0) {
+    size = read(fd, request, REQUEST_BUFFER_SIZE);
+  }
+
+  format_metrics();
+  if (size >= (ssize_t) strlen(HTTP_REQUEST) &&
+    strncmp(request, HTTP_REQUEST, strlen(HTTP_REQUEST)) == 0) {
+    write_all(fd, HTTP_HEADER, strlen(HTTP_HEADER));
+  }
+  write_all(fd, response, response_size);
+}
+
+/*
+ * the server thread, which answers connections
+ * until the socket is shut down
+ */
+static void *serve_metrics(void *argument) {
+  int fd;
+
+  (void) argument;
+  while (1) {
+    fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    serve_request(fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+/*
+ * stops serving metrics and removes the socket
+ */
+void cleanup_metrics(void) {
+  if (listen_fd >= 0) {
+    /* this makes accept() fail so the thread returns */
+    shutdown(listen_fd, SHUT_RDWR);
+    if (server_running) pthread_join(server_thread, NULL);
+    server_running = 0;
+    close(listen_fd);
+    listen_fd = -1;
+  }
+  if (metrics_path != NULL) {
+    unlink(metrics_path);
+    free(metrics_path);
+    metrics_path = NULL;
+  }
+  if (metrics != NULL) {
+    munmap(metrics, sizeof(Shell_metrics));
+    metrics = NULL;
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#define METRICS_SOCKET_VARIABLE "PSHELL_METRICS"
+
+/*
+ * the counters, each one is an index
+ * into the table of counters
+ */
+#define COUNTER_LINES 0
+#define COUNTER_PIPELINES 1
+#define COUNTER_FORKS 2
+#define COUNTER_EXEC_FAILURES 3
+#define COUNTER_WAITS 4
+#define NUM_COUNTERS 5
+
+/*
+ * the latency histograms, each one is an
+ * index into the table of histograms
+ */
+#define HISTOGRAM_PARSE 0
+#define HISTOGRAM_FORK 1
+#define HISTOGRAM_CHILD 2
+#define NUM_HISTOGRAMS 3
+
+#define METRICS_OFF 0
+
+#define METRICS_SUCCEEDED 0
+#define METRICS_FAILED 1
+
+/*
+ * define functions for recording what the shell
+ * does and serving it on a unix domain socket
+ */
+int init_metrics(char *socket_path);
+unsigned long metrics_clock(void);
+void count_metric(int counter);
+void observe_metric(int histogram, unsigned long start);
+void cleanup_metrics(void);
+
+#endif
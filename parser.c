@@ -0,0 +1,912 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions turn the tokens of an
+ * input line into the synchronous sequence of async
+ * sequences of pipelines of commands that the
+ * shell will have to execute
+ *
+ * the bodies of loops and functions are parsed
+ * into blocks right here, once, so running them
+ * again only has to redo the variable expansion
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "splitter.h"
+#include "environment.h"
+#include "resource-limits.h"
+#include "job-priority.h"
+#include "affinity.h"
+#include "arg-batch.h"
+#include "profile.h"
+#include "cache.h"
+#include "parser.h"
+
+#define PARSE_SUCCEEDED 0
+#define PARSE_FAILED 1
+
+/*
+ * define prototypes
+ */
+static char *copy_token_data(Token token);
+static int is_keyword(Token_list *token_list, char *keyword);
+static int is_unquoted(Token token, char *text);
+static int is_substitution_start(Token token);
+static int nesting_change(Token token, int depth);
+static void init_command(Command *command);
+static void syntax_error(Command *command, char *keyword, char *message);
+static Block *parse_block(Token_list *token_list);
+static int parse_block_and_end(Token_list *token_list, Block **block);
+static int parse_substitution(Token_list *token_list, Command *command,
+  int count_args);
+static void parse_simple_command(Token_list *token_list, Command *command,
+  int count_args);
+static void parse_for_loop(Token_list *token_list, Command *command,
+  int count_args);
+static void parse_while_loop(Token_list *token_list, Command *command);
+static void parse_function(Token_list *token_list, Command *command);
+static int parse_command_prefix(Token_list *token_list, Command *command,
+  char **keyword);
+static Command *parse_command(Token_list *token_list);
+static int take_fan_out_tokens(Token_list *token_list,
+  Token_list *branch_tokens);
+static Command *parse_fan_out(Token_list *token_list);
+static void parse_pipeline_commands(Token_list *token_list,
+  Pipeline *pipeline);
+static int parse_pipeline_prefix(Token_list *token_list, Pipeline *pipeline);
+static void cleanup_command(Command *command);
+
+/*
+ * makes a copy of the text of a token that
+ * outlives the token itself
+ */
+static char *copy_token_data(Token token) {
+  char *data;
+
+  data = malloc(sizeof(char) * (strlen(token.data) + NUL_TERM_SIZE));
+  MEM_CHECK(data);
+  strcpy(data, token.data);
+
+  return data;
+}
+
+/*
+ * checks if the first token in a token
+ * list is the given (unquoted) keyword
+ */
+static int is_keyword(Token_list *token_list, char *keyword) {
+  if (token_list->head == NULL || token_list->head->was_quoted) return 0;
+
+  return (strcmp(token_list->head->data, keyword) == 0);
+}
+
+/*
+ * checks if a token is the given unquoted text
+ */
+static int is_unquoted(Token token, char *text) {
+  if (token.data == NULL || token.was_quoted) return 0;
+
+  return (strcmp(token.data, text) == 0);
+}
+
+/*
+ * checks if a token is the "<(" or ">(" that
+ * starts a process substitution
+ */
+static int is_substitution_start(Token token) {
+  return (is_unquoted(token, INPUT_SUBSTITUTION) ||
+    is_unquoted(token, OUTPUT_SUBSTITUTION));
+}
+
+/*
+ * checks if a token opens or closes a "{ ... }" block
+ * or a process substitution, the words inside of which
+ * are left for when it is parsed itself
+ */
+static int nesting_change(Token token, int depth) {
+  if (is_unquoted(token, OPEN_BLOCK) || is_substitution_start(token)) {
+    return 1;
+  }
+  if (is_unquoted(token, CLOSE_BLOCK) ||
+    (depth > 0 && is_unquoted(token, CLOSE_GROUP))) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * initializes a command to an empty simple command
+ */
+static void init_command(Command *command) {
+  command->kind = COMMAND_SIMPLE;
+  command->affinity = NULL;
+  init_arg_batch(&command->batch);
+  command->num_assignments = 0;
+  command->assignments = NULL;
+  command->program = NULL;
+  command->num_args = 0;
+  command->arguments = NULL;
+  command->was_quoted = NULL;
+  command->condition = NULL;
+  command->body = NULL;
+  command->num_branches = 0;
+  command->branches = NULL;
+  command->num_substitutions = 0;
+  command->substitutions = NULL;
+}
+
+/*
+ * reports a syntax error in a compound command
+ * and marks the command so it will not run
+ */
+static void syntax_error(Command *command, char *keyword, char *message) {
+  fprintf(stderr, "non fatal error - syntax error in \"%s\"\n", keyword);
+  fprintf(stderr, "%s\n", message);
+  command->kind = COMMAND_INVALID;
+}
+
+/*
+ * parses a list of tokens into a block
+ * that nobody has a reference to yet
+ */
+static Block *parse_block(Token_list *token_list) {
+  Block *block;
+
+  block = malloc(sizeof(Block));
+  MEM_CHECK(block);
+  block->references = 0;
+  block->sync_sequence = parse_synchronous_command_sequence(*token_list);
+
+  return block;
+}
+
+/*
+ * parses the rest of a "{ ... }" block after the
+ * "{" has been read and makes sure that the block
+ * is the last thing in the command
+ */
+static int parse_block_and_end(Token_list *token_list, Block **block) {
+  Token_list block_tokens;
+  Token curr_token;
+  int depth = 1;
+
+  init_token_list(&block_tokens);
+  while (has_token(*token_list)) {
+    curr_token = next_token(token_list);
+    if (is_unquoted(curr_token, OPEN_BLOCK)) {
+      depth++;
+    } else if (is_unquoted(curr_token, CLOSE_BLOCK)) {
+      depth--;
+    }
+    if (depth == 0) {
+      cleanup_token(&curr_token);
+      break;
+    }
+    add_token(&block_tokens, curr_token.data, curr_token.was_quoted);
+    cleanup_token(&curr_token);
+  }
+
+  if (depth != 0 || has_token(*token_list)) {
+    cleanup_token_list(&block_tokens);
+    return PARSE_FAILED;
+  }
+
+  *block = parse_block(&block_tokens);
+  retain_block(*block);
+  cleanup_token_list(&block_tokens);
+
+  return PARSE_SUCCEEDED;
+}
+
+/*
+ * parses the rest of a process substitution after the
+ * "<(" or ">(" that starts it (the last argument so far)
+ * into a block that is run for that argument
+ */
+static int parse_substitution(Token_list *token_list, Command *command,
+  int count_args) {
+  Token_list body_tokens;
+  Token curr_token;
+  Substitution *substitution;
+  int depth = 1;
+
+  init_token_list(&body_tokens);
+  while (has_token(*token_list)) {
+    curr_token = next_token(token_list);
+    if (is_substitution_start(curr_token) ||
+      is_unquoted(curr_token, OPEN_GROUP)) {
+      depth++;
+    } else if (is_unquoted(curr_token, CLOSE_GROUP)) {
+      depth--;
+    }
+    if (depth == 0) {
+      cleanup_token(&curr_token);
+      break;
+    }
+    add_token(&body_tokens, curr_token.data, curr_token.was_quoted);
+    cleanup_token(&curr_token);
+  }
+
+  if (depth != 0 || body_tokens.head == NULL) {
+    cleanup_token_list(&body_tokens);
+    return PARSE_FAILED;
+  }
+
+  /* there are fewer substitutions than tokens */
+  if (command->substitutions == NULL) {
+    command->substitutions = malloc(sizeof(Substitution) * count_args);
+    MEM_CHECK(command->substitutions);
+  }
+  substitution = &command->substitutions[command->num_substitutions++];
+  substitution->argument = command->num_args - 1;
+  substitution->direction = (strcmp(command->arguments[command->num_args - 1],
+    INPUT_SUBSTITUTION) == 0) ? READ_SUBSTITUTION : WRITE_SUBSTITUTION;
+  substitution->body = parse_block(&body_tokens);
+  retain_block(substitution->body);
+  cleanup_token_list(&body_tokens);
+
+  return PARSE_SUCCEEDED;
+}
+
+/*
+ * parses "NAME=value ... program args ..."
+ *
+ * a process substitution in the arguments is kept as
+ * its "<(" or ">(" until the command runs, when it is
+ * replaced with the path of its pipe
+ */
+static void parse_simple_command(Token_list *token_list, Command *command,
+  int count_args) {
+  Token curr_token;
+
+  /* any unquoted "NAME=value" words in front of the
+   * program are assignments for just this command */
+  command->assignments = malloc(sizeof(char *) * count_args);
+  MEM_CHECK(command->assignments);
+  command->arguments = malloc(sizeof(char *) * count_args);
+  MEM_CHECK(command->arguments);
+  command->was_quoted = malloc(sizeof(char) * count_args);
+  MEM_CHECK(command->was_quoted);
+  while (has_token(*token_list)) {
+    curr_token = next_token(token_list);
+    if (command->program == NULL && !curr_token.was_quoted &&
+      is_assignment(curr_token.data)) {
+      command->assignments[command->num_assignments++] =
+        copy_token_data(curr_token);
+    } else if (command->program == NULL && is_substitution_start(curr_token)) {
+      syntax_error(command, curr_token.data, "expected a program in front\
+ of it");
+      cleanup_token(&curr_token);
+      return;
+    } else if (command->program == NULL) {
+      command->program = copy_token_data(curr_token);
+    } else {
+      command->was_quoted[command->num_args] = (char) curr_token.was_quoted;
+      command->arguments[command->num_args++] =
+        copy_token_data(curr_token);
+      if (is_substitution_start(curr_token) &&
+        parse_substitution(token_list, command, count_args) !=
+        PARSE_SUCCEEDED) {
+        syntax_error(command, curr_token.data, "expected a command and\
+ \")\" to end it");
+        cleanup_token(&curr_token);
+        return;
+      }
+    }
+    cleanup_token(&curr_token);
+  }
+}
+
+/*
+ * parses "for NAME in words ... { body }"
+ */
+static void parse_for_loop(Token_list *token_list, Command *command,
+  int count_args) {
+  Token curr_token;
+
+  command->kind = COMMAND_FOR;
+  command->arguments = malloc(sizeof(char *) * count_args);
+  MEM_CHECK(command->arguments);
+  command->was_quoted = malloc(sizeof(char) * count_args);
+  MEM_CHECK(command->was_quoted);
+
+  /* skip the "for" */
+  curr_token = next_token(token_list);
+  cleanup_token(&curr_token);
+
+  curr_token = next_token(token_list);
+  if (curr_token.data == NULL || !is_variable_name(curr_token.data)) {
+    cleanup_token(&curr_token);
+    syntax_error(command, FOR_KEYWORD, "expected a variable name");
+    return;
+  }
+  command->program = copy_token_data(curr_token);
+  cleanup_token(&curr_token);
+
+  curr_token = next_token(token_list);
+  if (!is_unquoted(curr_token, IN_KEYWORD)) {
+    cleanup_token(&curr_token);
+    syntax_error(command, FOR_KEYWORD, "expected \"in\"");
+    return;
+  }
+  cleanup_token(&curr_token);
+
+  /* everything up to the "{" is a word to loop over */
+  while (1) {
+    curr_token = next_token(token_list);
+    if (curr_token.data == NULL || is_unquoted(curr_token, OPEN_BLOCK)) {
+      break;
+    }
+    command->was_quoted[command->num_args] = (char) curr_token.was_quoted;
+    command->arguments[command->num_args++] = copy_token_data(curr_token);
+    cleanup_token(&curr_token);
+  }
+  if (curr_token.data == NULL) {
+    syntax_error(command, FOR_KEYWORD, "expected \"{\"");
+    return;
+  }
+  cleanup_token(&curr_token);
+
+  if (parse_block_and_end(token_list, &command->body) != PARSE_SUCCEEDED) {
+    syntax_error(command, FOR_KEYWORD, "expected \"}\" at the end");
+  }
+}
+
+/*
+ * parses "while condition ... { body }"
+ *
+ * the condition is a single command since
+ * a "|" would end the while loop's pipeline
+ */
+static void parse_while_loop(Token_list *token_list, Command *command) {
+  Token_list condition_tokens;
+  Token curr_token;
+
+  command->kind = COMMAND_WHILE;
+
+  /* skip the "while" */
+  curr_token = next_token(token_list);
+  cleanup_token(&curr_token);
+
+  init_token_list(&condition_tokens);
+  while (1) {
+    curr_token = next_token(token_list);
+    if (curr_token.data == NULL || is_unquoted(curr_token, OPEN_BLOCK)) {
+      break;
+    }
+    add_token(&condition_tokens, curr_token.data, curr_token.was_quoted);
+    cleanup_token(&curr_token);
+  }
+  if (curr_token.data == NULL || condition_tokens.head == NULL) {
+    cleanup_token(&curr_token);
+    cleanup_token_list(&condition_tokens);
+    syntax_error(command, WHILE_KEYWORD, "expected a condition and \"{\"");
+    return;
+  }
+  cleanup_token(&curr_token);
+
+  command->condition = parse_block(&condition_tokens);
+  retain_block(command->condition);
+  cleanup_token_list(&condition_tokens);
+
+  if (parse_block_and_end(token_list, &command->body) != PARSE_SUCCEEDED) {
+    syntax_error(command, WHILE_KEYWORD, "expected \"}\" at the end");
+  }
+}
+
+/*
+ * parses "function NAME { body }"
+ */
+static void parse_function(Token_list *token_list, Command *command) {
+  Token curr_token;
+
+  command->kind = COMMAND_FUNCTION;
+
+  /* skip the "function" */
+  curr_token = next_token(token_list);
+  cleanup_token(&curr_token);
+
+  curr_token = next_token(token_list);
+  if (curr_token.data == NULL || curr_token.was_quoted) {
+    cleanup_token(&curr_token);
+    syntax_error(command, FUNCTION_KEYWORD, "expected a function name");
+    return;
+  }
+  command->program = copy_token_data(curr_token);
+  cleanup_token(&curr_token);
+
+  curr_token = next_token(token_list);
+  if (!is_unquoted(curr_token, OPEN_BLOCK)) {
+    cleanup_token(&curr_token);
+    syntax_error(command, FUNCTION_KEYWORD, "expected \"{\"");
+    return;
+  }
+  cleanup_token(&curr_token);
+
+  if (parse_block_and_end(token_list, &command->body) != PARSE_SUCCEEDED) {
+    syntax_error(command, FUNCTION_KEYWORD, "expected \"}\" at the end");
+  }
+}
+
+/*
+ * parses (and removes) the "pin CPUS" and "batch -x value ..."
+ * prefixes from the front of the tokens of a command, in
+ * either order, setting keyword to the one that had an error
+ */
+static int parse_command_prefix(Token_list *token_list, Command *command,
+  char **keyword) {
+  Token *option, *value;
+
+  while (1) {
+    if (is_keyword(token_list, PIN_KEYWORD)) {
+      *keyword = PIN_KEYWORD;
+      remove_first_token(token_list);
+
+      value = token_list->head;
+      if (value == NULL || !is_valid_cpu_list(value->data)) {
+        return PARSE_FAILED;
+      }
+      free(command->affinity);
+      command->affinity = copy_token_data(*value);
+      remove_first_token(token_list);
+    } else if (is_keyword(token_list, BATCH_KEYWORD)) {
+      *keyword = BATCH_KEYWORD;
+      remove_first_token(token_list);
+      command->batch.jobs = 1;
+
+      while (token_list->head != NULL && !token_list->head->was_quoted &&
+        token_list->head->data[0] == '-') {
+        option = token_list->head;
+        value = option->next;
+        if (value == NULL || parse_batch_option(option->data, value->data,
+          &command->batch) != BATCH_PARSED) {
+          return PARSE_FAILED;
+        }
+        remove_first_token(token_list);
+        remove_first_token(token_list);
+      }
+    } else {
+      return PARSE_SUCCEEDED;
+    }
+  }
+}
+
+/*
+ * parses the tokens between two pipes into a command
+ */
+static Command *parse_command(Token_list *token_list) {
+  Command *command;
+  int count_args, prefix_status;
+  char *keyword;
+
+  command = malloc(sizeof(Command));
+  MEM_CHECK(command);
+  init_command(command);
+
+  prefix_status = parse_command_prefix(token_list, command, &keyword);
+
+  /* counting the tokens also resets the iterator */
+  count_args = count_token_list_size(token_list);
+
+  if (is_keyword(token_list, FOR_KEYWORD)) {
+    parse_for_loop(token_list, command, count_args);
+  } else if (is_keyword(token_list, WHILE_KEYWORD)) {
+    parse_while_loop(token_list, command);
+  } else if (is_keyword(token_list, FUNCTION_KEYWORD)) {
+    parse_function(token_list, command);
+  } else {
+    parse_simple_command(token_list, command, count_args);
+  }
+
+  if (prefix_status != PARSE_SUCCEEDED &&
+    strcmp(keyword, PIN_KEYWORD) == 0) {
+    syntax_error(command, PIN_KEYWORD, "expected a list of cpus like 0-3,6");
+  } else if (prefix_status != PARSE_SUCCEEDED) {
+    syntax_error(command, BATCH_KEYWORD,
+      "expected \"-P jobs\" (1 to 1024) or \"-k count\"");
+  }
+
+  return command;
+}
+
+/*
+ * moves the tokens after a "|+" (the branches of a fan-out)
+ * from the end of the tokens of a command to branch_tokens,
+ * returns 1 if the command was followed by a fan-out
+ */
+static int take_fan_out_tokens(Token_list *token_list,
+  Token_list *branch_tokens) {
+  Token_list command_tokens;
+  Token curr_token, *token;
+  int depth = 0, in_fan_out = 0;
+
+  /* most commands are not followed by a fan-out */
+  for (token = token_list->head; token != NULL; token = token->next) {
+    if (!token->was_quoted && strcmp(token->data, FAN_OUT_DELIMITER) == 0) {
+      break;
+    }
+  }
+  if (token == NULL) return 0;
+
+  init_token_list(&command_tokens);
+  begin_iter(token_list);
+  while (has_token(*token_list)) {
+    curr_token = next_token(token_list);
+    if (in_fan_out) {
+      add_token(branch_tokens, curr_token.data, curr_token.was_quoted);
+    } else if (depth == 0 && is_unquoted(curr_token, FAN_OUT_DELIMITER)) {
+      in_fan_out = 1;
+    } else {
+      depth += nesting_change(curr_token, depth);
+      add_token(&command_tokens, curr_token.data, curr_token.was_quoted);
+    }
+    cleanup_token(&curr_token);
+  }
+
+  /* the "|+" was inside of a block or a substitution */
+  if (!in_fan_out) {
+    cleanup_token_list(&command_tokens);
+    return 0;
+  }
+  cleanup_token_list(token_list);
+  *token_list = command_tokens;
+
+  return 1;
+}
+
+/*
+ * parses the branches of a fan-out, "( ... ) ( ... ) ...",
+ * each of which is parsed into a block of its own
+ */
+static Command *parse_fan_out(Token_list *token_list) {
+  Command *command;
+  Token_list branch_tokens;
+  Token curr_token;
+  int depth;
+
+  command = malloc(sizeof(Command));
+  MEM_CHECK(command);
+  init_command(command);
+  command->kind = COMMAND_FAN_OUT;
+
+  /* there are fewer branches than tokens */
+  command->branches = malloc(sizeof(Block *) *
+    (count_token_list_size(token_list) + 1));
+  MEM_CHECK(command->branches);
+
+  while (has_token(*token_list)) {
+    curr_token = next_token(token_list);
+    if (!is_unquoted(curr_token, OPEN_GROUP)) {
+      cleanup_token(&curr_token);
+      syntax_error(command, FAN_OUT_DELIMITER, "expected \"(\" to start\
+ a branch");
+      return command;
+    }
+    cleanup_token(&curr_token);
+
+    init_token_list(&branch_tokens);
+    depth = 1;
+    while (has_token(*token_list)) {
+      curr_token = next_token(token_list);
+      if (is_unquoted(curr_token, OPEN_GROUP)) {
+        depth++;
+      } else if (is_unquoted(curr_token, CLOSE_GROUP)) {
+        depth--;
+      }
+      if (depth == 0) {
+        cleanup_token(&curr_token);
+        break;
+      }
+      add_token(&branch_tokens, curr_token.data, curr_token.was_quoted);
+      cleanup_token(&curr_token);
+    }
+    if (depth != 0 || branch_tokens.head == NULL) {
+      cleanup_token_list(&branch_tokens);
+      syntax_error(command, FAN_OUT_DELIMITER, "expected a command and\
+ \")\" to end a branch");
+      return command;
+    }
+
+    command->branches[command->num_branches] = parse_block(&branch_tokens);
+    retain_block(command->branches[command->num_branches++]);
+    cleanup_token_list(&branch_tokens);
+  }
+
+  if (command->num_branches == 0) {
+    syntax_error(command, FAN_OUT_DELIMITER, "expected \"( ... )\" branches");
+  }
+
+  return command;
+}
+
+/*
+ * parses the tokens of a pipeline between the pipes into its
+ * commands, a fan-out after the last one is one more command
+ */
+static void parse_pipeline_commands(Token_list *token_list,
+  Pipeline *pipeline) {
+  Token_list_list split_by_pipe_delim;
+  Token_list *token_list_command, branch_tokens;
+  Command *fan_out;
+  int count_pipe_sections, k, has_command;
+
+  split_by_pipe_delim = split(*token_list, PIPE_DELIMITER);
+  count_pipe_sections = count_token_list_list_size(&split_by_pipe_delim);
+  pipeline->num_commands = 0;
+  pipeline->commands = malloc(sizeof(Command *) * (count_pipe_sections + 1));
+  MEM_CHECK(pipeline->commands);
+  for (k = 0; k < count_pipe_sections; k++) {
+    token_list_command = next_token_list(&split_by_pipe_delim);
+    init_token_list(&branch_tokens);
+    if (!take_fan_out_tokens(token_list_command, &branch_tokens)) {
+      pipeline->commands[pipeline->num_commands++] =
+        parse_command(token_list_command);
+      continue;
+    }
+
+    has_command = (token_list_command->head != NULL);
+    pipeline->commands[pipeline->num_commands++] =
+      parse_command(token_list_command);
+    fan_out = parse_fan_out(&branch_tokens);
+    cleanup_token_list(&branch_tokens);
+    if (fan_out->kind != COMMAND_INVALID &&
+      (!has_command || k != count_pipe_sections - 1)) {
+      syntax_error(fan_out, FAN_OUT_DELIMITER, "expected a command in front\
+ of it and nothing but branches after it");
+    }
+
+    /* a fan-out that is not at the end of the
+     * pipeline still ends it (and does not run) */
+    pipeline->commands[pipeline->num_commands++] = fan_out;
+    break;
+  }
+  cleanup_token_list_list(&split_by_pipe_delim);
+}
+
+/*
+ * parses (and removes) the "limit -x value ...",
+ * "sched -x value ...", "profile" and "cache" prefixes
+ * from the front of the tokens of a pipeline, in any order,
+ * there has to be a command after the last of them
+ */
+static int parse_pipeline_prefix(Token_list *token_list, Pipeline *pipeline) {
+  Token *option, *value;
+  char *keyword = NULL;
+  int parsed;
+
+  init_resource_limits(&pipeline->limits);
+  init_job_priority(&pipeline->priority);
+  pipeline->profile = PIPELINE_NOT_PROFILED;
+  pipeline->cache = PIPELINE_NOT_CACHED;
+
+  while (1) {
+    if (is_keyword(token_list, PROFILE_KEYWORD)) {
+      keyword = PROFILE_KEYWORD;
+      remove_first_token(token_list);
+      pipeline->profile = PIPELINE_PROFILED;
+      continue;
+    } else if (is_keyword(token_list, CACHE_KEYWORD)) {
+      keyword = CACHE_KEYWORD;
+      remove_first_token(token_list);
+      pipeline->cache = PIPELINE_CACHED;
+      continue;
+    } else if (is_keyword(token_list, LIMIT_KEYWORD)) {
+      keyword = LIMIT_KEYWORD;
+    } else if (is_keyword(token_list, SCHED_KEYWORD)) {
+      keyword = SCHED_KEYWORD;
+    } else {
+      break;
+    }
+    remove_first_token(token_list);
+
+    while (token_list->head != NULL && !token_list->head->was_quoted &&
+      token_list->head->data[0] == '-') {
+      option = token_list->head;
+      value = option->next;
+      if (value == NULL) {
+        parsed = 0;
+      } else if (strcmp(keyword, LIMIT_KEYWORD) == 0) {
+        parsed = (parse_limit_option(option->data, value->data,
+          &pipeline->limits) == LIMIT_PARSED);
+      } else {
+        parsed = (parse_sched_option(option->data, value->data,
+          &pipeline->priority) == PRIORITY_PARSED);
+      }
+      if (!parsed) {
+        fprintf(stderr, "non fatal error - syntax error in \"%s\"\n",
+          keyword);
+        fprintf(stderr, "could not understand \"%s\"\n", option->data);
+        return PARSE_FAILED;
+      }
+      remove_first_token(token_list);
+      remove_first_token(token_list);
+    }
+  }
+
+  if (keyword != NULL && token_list->head == NULL) {
+    fprintf(stderr, "non fatal error - syntax error in \"%s\"\n", keyword);
+    fprintf(stderr, "expected a command after it\n");
+    return PARSE_FAILED;
+  }
+
+  return PARSE_SUCCEEDED;
+}
+
+/*
+ * takes in a token list and then parses the list into a synchronous sequence
+ * of async sequences of pipelines of commands that the shell will have to
+ * execute
+ *
+ * the function return type "Async_sequence **" means an array of
+ * Async_sequence terminated with a NULL pointer which is the same
+ * as a sequence of synchronous commands
+ *
+ * the grammar parsing for this shell DEFINITELY should be done in a more
+ * robust way -> but that wasn't really the goal of this project so this
+ * fairly rigid and in-extensible system is all we've got
+ */
+Async_sequence **parse_synchronous_command_sequence(Token_list token_list) {
+  Async_sequence **sync_sequence;
+  Token_list_list split_by_sync_delim, split_by_async_delim;
+  int count_sync_sections, count_async_sections;
+  int i, j, prefix_status;
+  Async_sequence *async_sequence;
+  Pipeline *pipeline;
+  Command *command;
+  Token_list *token_list_sync, *token_list_async;
+
+  /* TODO This function needs to be able to handle cases where people
+   * do this wrong in their input without blowing up */
+
+  split_by_sync_delim = split(token_list, SYNC_DELIMITER);
+  count_sync_sections = count_token_list_list_size(&split_by_sync_delim);
+  sync_sequence = malloc(sizeof(Async_sequence *) *
+    (count_sync_sections + 1));
+  MEM_CHECK(sync_sequence);
+
+  /* pad the end of the sync sections array
+   * with a NULL pointer to show where it ends */
+  sync_sequence[count_sync_sections] = NULL;
+  for (i = 0; i < count_sync_sections; i++) {
+    token_list_sync = next_token_list(&split_by_sync_delim);
+    async_sequence = malloc(sizeof(Async_sequence));
+    MEM_CHECK(async_sequence);
+    sync_sequence[i] = async_sequence;
+
+    split_by_async_delim = split(*token_list_sync, ASYNC_DELIMITER);
+    count_async_sections = count_token_list_list_size(&split_by_async_delim);
+    async_sequence->num_pipelines = count_async_sections;
+    async_sequence->pipelines = malloc(sizeof(Pipeline *) * count_async_sections);
+    MEM_CHECK(async_sequence->pipelines);
+    for (j = 0; j < count_async_sections; j++) {
+      token_list_async = next_token_list(&split_by_async_delim);
+      pipeline = malloc(sizeof(Pipeline));
+      MEM_CHECK(pipeline);
+      async_sequence->pipelines[j] = pipeline;
+
+      prefix_status = parse_pipeline_prefix(token_list_async, pipeline);
+      parse_pipeline_commands(token_list_async, pipeline);
+
+      /* a prefix with nothing after it still
+       * needs a command to mark as invalid */
+      if (prefix_status != PARSE_SUCCEEDED && pipeline->num_commands == 0) {
+        command = malloc(sizeof(Command));
+        MEM_CHECK(command);
+        init_command(command);
+        pipeline->commands[pipeline->num_commands++] = command;
+      }
+      if (prefix_status != PARSE_SUCCEEDED) {
+        pipeline->commands[0]->kind = COMMAND_INVALID;
+
+        /* so the error is given by the shell itself
+         * without profiling or caching anything */
+        init_resource_limits(&pipeline->limits);
+        init_job_priority(&pipeline->priority);
+        pipeline->profile = PIPELINE_NOT_PROFILED;
+        pipeline->cache = PIPELINE_NOT_CACHED;
+      }
+    }
+    cleanup_token_list_list(&split_by_async_delim);
+  }
+  cleanup_token_list_list(&split_by_sync_delim);
+
+  return sync_sequence;
+}
+
+/*
+ * takes a reference to a block
+ */
+void retain_block(Block *block) {
+  if (block == NULL) return;
+
+  block->references++;
+}
+
+/*
+ * drops a reference to a block and frees the
+ * block once nothing refers to it anymore
+ */
+void release_block(Block *block) {
+  if (block == NULL) return;
+
+  block->references--;
+  if (block->references <= 0) {
+    cleanup_sync_sequence(block->sync_sequence);
+    free(block);
+  }
+}
+
+/*
+ * cleans up all the dynamically allocated data for a command
+ */
+static void cleanup_command(Command *command) {
+  int i;
+
+  for (i = 0; i < command->num_assignments; i++) {
+    free(command->assignments[i]);
+  }
+  for (i = 0; i < command->num_args; i++) {
+    free(command->arguments[i]);
+  }
+  free(command->affinity);
+  free(command->assignments);
+  free(command->program);
+  free(command->arguments);
+  free(command->was_quoted);
+  release_block(command->condition);
+  release_block(command->body);
+  for (i = 0; i < command->num_branches; i++) {
+    release_block(command->branches[i]);
+  }
+  free(command->branches);
+  for (i = 0; i < command->num_substitutions; i++) {
+    release_block(command->substitutions[i].body);
+  }
+  free(command->substitutions);
+  free(command);
+}
+
+/*
+ * cleans up all the dynamically allocated data for
+ * a synchronous command sequence
+ */
+void cleanup_sync_sequence(Async_sequence **sync_sequence) {
+  Async_sequence **curr_async_sequence, **tmp_async_sequence;
+  Pipeline **curr_pipeline, **tmp_pipeline;
+  int i, j;
+
+  /* loop through all async sequences */
+  curr_async_sequence = sync_sequence;
+  while (*curr_async_sequence != NULL) {
+    /* loop through all pipelines */
+    curr_pipeline = (*curr_async_sequence)->pipelines;
+    for (i = 0; i < (*curr_async_sequence)->num_pipelines; i++) {
+      /* loop through all commands */
+      for (j = 0; j < (*curr_pipeline)->num_commands; j++) {
+        cleanup_command((*curr_pipeline)->commands[j]);
+      }
+
+      /* free the pipeline itself */
+      tmp_pipeline = curr_pipeline + 1;
+      free((*curr_pipeline)->commands);
+      free(*curr_pipeline);
+      curr_pipeline = tmp_pipeline;
+    }
+
+    /* free the async sequence itself */
+    tmp_async_sequence = curr_async_sequence + 1;
+    free((*curr_async_sequence)->pipelines);
+    free(*curr_async_sequence);
+    curr_async_sequence = tmp_async_sequence;
+  }
+  free(sync_sequence);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+
+#define SYNC_DELIMITER ";"
+#define ASYNC_DELIMITER "&"
+#define PIPE_DELIMITER "|"
+
+/*
+ * the words that start a compound command
+ */
+#define FOR_KEYWORD "for"
+#define IN_KEYWORD "in"
+#define WHILE_KEYWORD "while"
+#define FUNCTION_KEYWORD "function"
+
+/*
+ * define functions for turning a list of tokens
+ * into a synchronous sequence of commands
+ */
+Async_sequence **parse_synchronous_command_sequence(Token_list token_list);
+void cleanup_sync_sequence(Async_sequence **sync_sequence);
+
+/*
+ * define functions for sharing blocks
+ * between commands and functions
+ */
+void retain_block(Block *block);
+void release_block(Block *block);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "parser.h" and "splitter.h"
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "splitter.h"
+#include "parser.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int count_sync_sequence(Async_sequence **sync_sequence);
+static Command *first_command(Async_sequence **sync_sequence);
+static void test_split(void);
+static void test_for_loop(void);
+static void test_while_loop(void);
+static void test_function(void);
+static void test_invalid(void);
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * counts the sections of a NULL terminated sync sequence
+ */
+static int count_sync_sequence(Async_sequence **sync_sequence) {
+  int count = 0;
+
+  while (sync_sequence[count] != NULL) count++;
+
+  return count;
+}
+
+/*
+ * gets the first command of the first pipeline
+ */
+static Command *first_command(Async_sequence **sync_sequence) {
+  if (sync_sequence[0] == NULL || sync_sequence[0]->num_pipelines < 1 ||
+    sync_sequence[0]->pipelines[0]->num_commands < 1) {
+    fail("Parsed sequence has no command!");
+  }
+
+  return sync_sequence[0]->pipelines[0]->commands[0];
+}
+
+/*
+ * checks that the delimiters inside of a block
+ * are left for the block to split on
+ */
+static void test_split(void) {
+  char *input = "echo a ; for i in 1 2 { echo $i ; echo b } ; echo c";
+  int expected_sizes[] = {2, 12, 2};
+  Token_list token_list;
+  Token_list_list sections;
+  Token_list *section;
+  int i;
+
+  printf("Testing the splitter on \"%s\"\n", input);
+  token_list = parse_tokens(input);
+  sections = split(token_list, SYNC_DELIMITER);
+  if (count_token_list_list_size(&sections) != 3) {
+    fail("Split into the wrong number of sections!");
+  }
+  for (i = 0; i < 3; i++) {
+    section = next_token_list(&sections);
+    if (count_token_list_size(section) != expected_sizes[i]) {
+      printf("Expected: %d tokens, Got: %d\n", expected_sizes[i],
+        count_token_list_size(section));
+      fail("Section not as expected!");
+    }
+  }
+  printf("Sections as expected!\n");
+  cleanup_token_list_list(&sections);
+  cleanup_token_list(&token_list);
+}
+
+/*
+ * checks the name, the words and the body of a for loop
+ */
+static void test_for_loop(void) {
+  char *input = "for i in a \"b c\" d { echo $i ; echo done }";
+  char *expected_words[] = {"a", "b c", "d"};
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Command *command;
+  int i;
+
+  printf("Testing the parser on \"%s\"\n", input);
+  token_list = parse_tokens(input);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  command = first_command(sync_sequence);
+  if (command->kind != COMMAND_FOR || strcmp(command->program, "i") != 0) {
+    fail("For loop not as expected!");
+  }
+  if (command->num_args != 3) fail("For loop words not as expected!");
+  for (i = 0; i < 3; i++) {
+    if (strcmp(command->arguments[i], expected_words[i]) != 0) {
+      printf("Expected: \"%s\", Got: \"%s\"\n", expected_words[i],
+        command->arguments[i]);
+      fail("For loop word not as expected!");
+    }
+  }
+  if (command->was_quoted[0] || !command->was_quoted[1]) {
+    fail("For loop word quote state not as expected!");
+  }
+  if (command->body == NULL ||
+    count_sync_sequence(command->body->sync_sequence) != 2 ||
+    strcmp(first_command(command->body->sync_sequence)->program,
+      "echo") != 0) {
+    fail("For loop body not as expected!");
+  }
+  printf("For loop as expected!\n");
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+}
+
+/*
+ * checks the condition and the body of a while loop,
+ * with a for loop nested in its body
+ */
+static void test_while_loop(void) {
+  char *input = "while test -f x { for j in 1 { echo $j } ; echo x }";
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Command *command, *condition, *inner;
+
+  printf("Testing the parser on \"%s\"\n", input);
+  token_list = parse_tokens(input);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  command = first_command(sync_sequence);
+  if (command->kind != COMMAND_WHILE || command->condition == NULL ||
+    command->body == NULL) {
+    fail("While loop not as expected!");
+  }
+  condition = first_command(command->condition->sync_sequence);
+  if (condition->kind != COMMAND_SIMPLE ||
+    strcmp(condition->program, "test") != 0 || condition->num_args != 2) {
+    fail("While loop condition not as expected!");
+  }
+  if (count_sync_sequence(command->body->sync_sequence) != 2) {
+    fail("While loop body not as expected!");
+  }
+  inner = first_command(command->body->sync_sequence);
+  if (inner->kind != COMMAND_FOR || inner->body == NULL ||
+    count_sync_sequence(inner->body->sync_sequence) != 1) {
+    fail("Nested for loop not as expected!");
+  }
+  printf("While loop as expected!\n");
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+}
+
+/*
+ * checks that a function and the call after it
+ * are two sections with the body kept whole
+ */
+static void test_function(void) {
+  char *input = "function greet { echo hi ; echo there } ; greet";
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Command *command;
+
+  printf("Testing the parser on \"%s\"\n", input);
+  token_list = parse_tokens(input);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  if (count_sync_sequence(sync_sequence) != 2) {
+    fail("Function and call not split as expected!");
+  }
+  command = first_command(sync_sequence);
+  if (command->kind != COMMAND_FUNCTION ||
+    strcmp(command->program, "greet") != 0 || command->body == NULL ||
+    count_sync_sequence(command->body->sync_sequence) != 2) {
+    fail("Function not as expected!");
+  }
+  command = first_command(sync_sequence + 1);
+  if (command->kind != COMMAND_SIMPLE ||
+    strcmp(command->program, "greet") != 0) {
+    fail("Function call not as expected!");
+  }
+  printf("Function as expected!\n");
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+}
+
+/*
+ * checks that broken compound commands and prefixes
+ * with no command after them are marked invalid
+ * instead of being run
+ */
+static void test_invalid(void) {
+  char *inputs[] = {"for 1x in a { echo }",
+    "for i a { echo }",
+    "for i in a { echo",
+    "while { echo }",
+    "function { echo }",
+    "function f echo",
+    "limit -t 1",
+    "sched -n 5 profile",
+    "cache",
+    "limit -t 1 ; echo alive"};
+  int num_inputs = 10;
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int i;
+
+  for (i = 0; i < num_inputs; i++) {
+    printf("Testing the parser on \"%s\"\n", inputs[i]);
+    token_list = parse_tokens(inputs[i]);
+    sync_sequence = parse_synchronous_command_sequence(token_list);
+    if (first_command(sync_sequence)->kind != COMMAND_INVALID) {
+      fail("Syntax error not found!");
+    }
+    printf("Syntax error as expected!\n");
+    cleanup_sync_sequence(sync_sequence);
+    cleanup_token_list(&token_list);
+  }
+}
+
+/*
+ * runs the splitter and the parser over blocks,
+ * loops and functions and confirms what they build
+ */
+int main() {
+  test_split();
+  test_for_loop();
+  test_while_loop();
+  test_function();
+  test_invalid();
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
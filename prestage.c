@@ -0,0 +1,244 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions get the next step of a synchronous
+ * sequence ready while the shell waits on the current one,
+ * so that when the wait returns there is little more than
+ * fork() and exec() between the two steps
+ *
+ * the pipes between the stages of its first pipeline are
+ * made ahead of time (not those of the pipelines after it,
+ * they would be open in every stage the first one forks and
+ * a loop that runs in a child never exec()s to close them)
+ * and the arguments for exec() are put together for every
+ * program whose words have no variables in them, which are
+ * the same words that would come out of expanding them, so
+ * the child does not have to copy them
+ *
+ * nothing the current step can change is looked at here,
+ * the values of variables ($? most of all) and the program
+ * that a name runs are still worked out after the wait
+ *
+ * this only pays off when the shell has a cpu to itself
+ * while the step runs, on a single cpu it just takes turns
+ * with the step and the next step starts no sooner
+ */
+
+/* allow us to use 'sched_getaffinity' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "expansion.h"
+#include "control-flow.h"
+#include "process-helper.h"
+#include "shell-options.h"
+#include "prestage.h"
+
+#define NO_PIPE_FD -1
+
+#define CPUS_NOT_COUNTED -1
+
+/*
+ * how many cpus the shell may run on, counted once
+ */
+static int num_cpus = CPUS_NOT_COUNTED;
+
+/*
+ * define prototypes
+ */
+static int count_cpus(void);
+static int has_variables(char **words, int num_words);
+static char **build_argv(Command *command);
+static void prestage_pipeline(Pipeline *pipeline,
+  Prestaged_pipeline *prestaged, int makes_pipes);
+
+/*
+ * counts the cpus the shell is allowed to run on
+ */
+static int count_cpus(void) {
+  cpu_set_t allowed;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return 1;
+
+  return CPU_COUNT(&allowed);
+}
+
+/*
+ * checks if the next step should be made ready during the
+ * wait, which takes "set -o prestage" (the default) and
+ * more than one cpu
+ */
+int should_prestage(void) {
+  if (!get_shell_option(OPTION_PRESTAGE)) return 0;
+
+  if (num_cpus == CPUS_NOT_COUNTED) num_cpus = count_cpus();
+  return (num_cpus > 1);
+}
+
+/*
+ * checks if any of the words has a variable in it
+ */
+static int has_variables(char **words, int num_words) {
+  int i;
+
+  for (i = 0; i < num_words; i++) {
+    if (strchr(words[i], VARIABLE_SIGN) != NULL) return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * puts together the arguments for exec() of a program
+ * that has no variables in it (the words are shared with
+ * the command) or gets NULL if it has to be expanded
+ *
+ * a command with process substitutions gets none since
+ * the child replaces those words with "/dev/fd/N" itself,
+ * and neither does one with patterns, whose paths are
+ * only looked for when it runs
+ */
+static char **build_argv(Command *command) {
+  char **argv;
+  int j;
+
+  if (command->kind != COMMAND_SIMPLE || command->program == NULL ||
+    is_shell_command(command) || command->num_substitutions > 0 ||
+    has_patterns(command) ||
+    strchr(command->program, VARIABLE_SIGN) != NULL ||
+    has_variables(command->arguments, command->num_args) ||
+    has_variables(command->assignments, command->num_assignments)) {
+    return NULL;
+  }
+
+  argv = malloc(sizeof(char *) * (command->num_args + EXECV_EXTRA_SIZE));
+  MEM_CHECK(argv);
+  argv[0] = command->program;
+  for (j = 0; j < command->num_args; j++) {
+    argv[j + 1] = command->arguments[j];
+  }
+  argv[command->num_args + 1] = NULL;
+
+  return argv;
+}
+
+/*
+ * makes the arguments (and the pipes if makes_pipes is set)
+ * of one pipeline, a pipe that is not made now is made when
+ * the pipeline is started
+ */
+static void prestage_pipeline(Pipeline *pipeline,
+  Prestaged_pipeline *prestaged, int makes_pipes) {
+  int i;
+
+  prestaged->num_commands = pipeline->num_commands;
+  prestaged->fds = malloc(sizeof(int [2]) * pipeline->num_commands);
+  MEM_CHECK(prestaged->fds);
+  prestaged->argvs = malloc(sizeof(char **) * pipeline->num_commands);
+  MEM_CHECK(prestaged->argvs);
+
+  for (i = 0; i < pipeline->num_commands; i++) {
+    prestaged->argvs[i] = build_argv(pipeline->commands[i]);
+    prestaged->fds[i][0] = prestaged->fds[i][1] = NO_PIPE_FD;
+    if (makes_pipes && i < pipeline->num_commands - 1 &&
+      pipe(prestaged->fds[i]) != 0) {
+      prestaged->fds[i][0] = prestaged->fds[i][1] = NO_PIPE_FD;
+    }
+  }
+}
+
+/*
+ * gets the pipelines of an async sequence ready to be
+ * started, this is meant to be called right after the
+ * step before it was started
+ */
+Prestaged_sequence *prestage_async_sequence(Async_sequence *async_sequence) {
+  Prestaged_sequence *prestaged;
+  int i;
+
+  prestaged = malloc(sizeof(Prestaged_sequence));
+  MEM_CHECK(prestaged);
+  prestaged->num_pipelines = async_sequence->num_pipelines;
+  prestaged->pipelines = malloc(sizeof(Prestaged_pipeline) *
+    async_sequence->num_pipelines);
+  MEM_CHECK(prestaged->pipelines);
+
+  for (i = 0; i < async_sequence->num_pipelines; i++) {
+    prestage_pipeline(async_sequence->pipelines[i],
+      &prestaged->pipelines[i], i == 0);
+  }
+
+  return prestaged;
+}
+
+/*
+ * hands over the pipe after stage i of a pipeline if it was
+ * made ahead of time, returns PIPE_NOT_PRESTAGED if not
+ */
+int take_prestaged_pipe(Prestaged_pipeline *prestaged, int i, int fds[2]) {
+  if (prestaged == NULL || prestaged->fds[i][0] == NO_PIPE_FD) {
+    return PIPE_NOT_PRESTAGED;
+  }
+
+  fds[0] = prestaged->fds[i][0];
+  fds[1] = prestaged->fds[i][1];
+  prestaged->fds[i][0] = prestaged->fds[i][1] = NO_PIPE_FD;
+
+  return PIPE_PRESTAGED;
+}
+
+/*
+ * closes the pipes of a pipeline that were not taken, which
+ * are the boundaries that became rings between two thread
+ * stages, before any of its stages is forked with them
+ */
+void close_untaken_prestaged_pipes(Prestaged_pipeline *prestaged) {
+  int i;
+
+  if (prestaged == NULL) return;
+
+  for (i = 0; i < prestaged->num_commands; i++) {
+    if (prestaged->fds[i][0] != NO_PIPE_FD) close(prestaged->fds[i][0]);
+    if (prestaged->fds[i][1] != NO_PIPE_FD) close(prestaged->fds[i][1]);
+    prestaged->fds[i][0] = prestaged->fds[i][1] = NO_PIPE_FD;
+  }
+}
+
+/*
+ * gets the arguments for exec() of stage i of a pipeline
+ * or NULL if they have to be worked out in the child
+ */
+char **get_prestaged_argv(Prestaged_pipeline *prestaged, int i) {
+  if (prestaged == NULL) return NULL;
+
+  return prestaged->argvs[i];
+}
+
+/*
+ * closes the pipes that were never taken (those of a
+ * pipeline that was not started) and frees the rest
+ */
+void cleanup_prestaged_sequence(Prestaged_sequence *prestaged) {
+  Prestaged_pipeline *pipeline;
+  int i, j;
+
+  if (prestaged == NULL) return;
+
+  for (i = 0; i < prestaged->num_pipelines; i++) {
+    pipeline = &prestaged->pipelines[i];
+    close_untaken_prestaged_pipes(pipeline);
+    for (j = 0; j < pipeline->num_commands; j++) free(pipeline->argvs[j]);
+    free(pipeline->fds);
+    free(pipeline->argvs);
+  }
+  free(prestaged->pipelines);
+  free(prestaged);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef PRESTAGE_H
+#define PRESTAGE_H
+
+#include "pshell-structs.h"
+
+#define PIPE_PRESTAGED 0
+#define PIPE_NOT_PRESTAGED 1
+
+/*
+ * what was made ready for a pipeline of the next step while
+ * the shell waited on the current one, fds are the pipes
+ * between its stages ({-1, -1} for one that was not made or
+ * was already taken) and argvs the arguments for exec() of
+ * each stage or NULL for one that has to be expanded first
+ */
+typedef struct prestaged_pipeline {
+  int num_commands;
+  int (*fds)[2];
+  char ***argvs;
+} Prestaged_pipeline;
+
+typedef struct prestaged_sequence {
+  int num_pipelines;
+  Prestaged_pipeline *pipelines;
+} Prestaged_sequence;
+
+/*
+ * define functions for getting the next step of a
+ * synchronous sequence ready to start
+ */
+int should_prestage(void);
+Prestaged_sequence *prestage_async_sequence(Async_sequence *async_sequence);
+int take_prestaged_pipe(Prestaged_pipeline *prestaged, int i, int fds[2]);
+void close_untaken_prestaged_pipes(Prestaged_pipeline *prestaged);
+char **get_prestaged_argv(Prestaged_pipeline *prestaged, int i);
+void cleanup_prestaged_sequence(Prestaged_sequence *prestaged);
+
+#endif
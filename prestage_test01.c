@@ -0,0 +1,268 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "prestage.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "process-helper.h"
+#include "shell-options.h"
+#include "prestage.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+#define PATH_SIZE 256
+#define OUTPUT_SIZE 4096
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int run_line(char *line, char *output);
+static int count_open_fds(void);
+static Prestaged_sequence *prestage_line(char *line, Token_list *token_list,
+  Async_sequence ***sync_sequence);
+static void cleanup_line(Token_list *token_list,
+  Async_sequence **sync_sequence);
+static void expect_argv(char *line, char *expected[]);
+static void test_pipes(void);
+static void expect_same_output(char *line);
+
+static char output_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * runs a line like the shell would with its output
+ * sent to the output file and gets what it printed
+ * along with its exit status
+ */
+static int run_line(char *line, char *output) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int saved_stdout, fd, status;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  token_list = parse_tokens(line);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  status = execute_sync_sequence(sync_sequence);
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return status;
+}
+
+/*
+ * counts the fds the test has open
+ */
+static int count_open_fds(void) {
+  DIR *fds;
+  int count = 0;
+
+  fds = opendir("/proc/self/fd");
+  if (fds == NULL) fail("Could not list the open fds!");
+  while (readdir(fds) != NULL) count++;
+  closedir(fds);
+
+  return count;
+}
+
+/*
+ * parses a line and gets its first step ready
+ */
+static Prestaged_sequence *prestage_line(char *line, Token_list *token_list,
+  Async_sequence ***sync_sequence) {
+  *token_list = parse_tokens(line);
+  *sync_sequence = parse_synchronous_command_sequence(*token_list);
+
+  return prestage_async_sequence((*sync_sequence)[0]);
+}
+
+static void cleanup_line(Token_list *token_list,
+  Async_sequence **sync_sequence) {
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(token_list);
+}
+
+/*
+ * checks the arguments for exec() that were put together
+ * for the first stage of a line, an empty list means
+ * they are left to be worked out in the child
+ */
+static void expect_argv(char *line, char *expected[]) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Prestaged_sequence *prestaged;
+  char **argv;
+  int i;
+
+  printf("Testing the arguments prestaged for \"%s\"\n", line);
+  prestaged = prestage_line(line, &token_list, &sync_sequence);
+  argv = get_prestaged_argv(&prestaged->pipelines[0], 0);
+  if (expected[0] == NULL) {
+    if (argv != NULL) fail("Arguments were prestaged!");
+  } else {
+    if (argv == NULL) fail("Arguments were not prestaged!");
+    for (i = 0; expected[i] != NULL; i++) {
+      if (argv[i] == NULL || strcmp(argv[i], expected[i]) != 0) {
+        printf("Expected: \"%s\", Got: \"%s\"\n", expected[i],
+          (argv[i] != NULL) ? argv[i] : "");
+        fail("Arguments not as expected!");
+      }
+    }
+    if (argv[i] != NULL) fail("Had too many arguments!");
+  }
+  printf("Arguments as expected!\n");
+  cleanup_prestaged_sequence(prestaged);
+  cleanup_line(&token_list, sync_sequence);
+}
+
+/*
+ * checks that only the pipes of the first pipeline are
+ * made ahead of time and that every one of them that is
+ * not taken is closed again
+ */
+static void test_pipes(void) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  Prestaged_sequence *prestaged;
+  int num_fds, fds[2];
+
+  printf("Testing the pipes prestaged for a sequence\n");
+  num_fds = count_open_fds();
+  prestaged = prestage_line("seq 1 3 | tr 1-3 a-c | cat & seq 1 3 | cat",
+    &token_list, &sync_sequence);
+  if (count_open_fds() != num_fds + 4) fail("Pipes not made as expected!");
+  if (take_prestaged_pipe(&prestaged->pipelines[0], 0, fds) !=
+    PIPE_PRESTAGED) {
+    fail("Pipe was not prestaged!");
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if (take_prestaged_pipe(&prestaged->pipelines[0], 0, fds) !=
+    PIPE_NOT_PRESTAGED ||
+    take_prestaged_pipe(&prestaged->pipelines[0], 2, fds) !=
+    PIPE_NOT_PRESTAGED ||
+    take_prestaged_pipe(&prestaged->pipelines[1], 0, fds) !=
+    PIPE_NOT_PRESTAGED) {
+    fail("Pipe was prestaged twice!");
+  }
+  cleanup_prestaged_sequence(prestaged);
+  cleanup_line(&token_list, sync_sequence);
+  if (count_open_fds() != num_fds) fail("Pipes left open!");
+
+  /* the pipes the stages did not take are closed
+   * before the pipeline forks any of them */
+  prestaged = prestage_line("seq 1 3 | tr 1-3 a-c | cat", &token_list,
+    &sync_sequence);
+  close_untaken_prestaged_pipes(&prestaged->pipelines[0]);
+  if (count_open_fds() != num_fds) fail("Untaken pipes left open!");
+  if (take_prestaged_pipe(&prestaged->pipelines[0], 1, fds) !=
+    PIPE_NOT_PRESTAGED) {
+    fail("Closed pipe was handed out!");
+  }
+  cleanup_prestaged_sequence(prestaged);
+  cleanup_line(&token_list, sync_sequence);
+  printf("Pipes as expected!\n");
+}
+
+/*
+ * checks that a line prints the same and leaves the
+ * same fds open with and without prestaging, which is
+ * only used where the shell has more than one cpu
+ */
+static void expect_same_output(char *line) {
+  char unstaged[OUTPUT_SIZE], staged[OUTPUT_SIZE];
+  int unstaged_status, staged_status, num_fds;
+
+  printf("Testing \"%s\" with and without prestaging\n", line);
+  num_fds = count_open_fds();
+  set_shell_option("prestage", OPTION_OFF);
+  unstaged_status = run_line(line, unstaged);
+  set_shell_option("prestage", OPTION_ON);
+  staged_status = run_line(line, staged);
+  if (unstaged[0] == '\0') fail("No output!");
+  if (staged_status != unstaged_status || strcmp(staged, unstaged) != 0) {
+    printf("Expected: \"%s\", Got: \"%s\"\n", unstaged, staged);
+    fail("Prestaged output not as expected!");
+  }
+  if (count_open_fds() != num_fds) fail("Pipes left open!");
+  printf("Output as expected!\n");
+}
+
+/*
+ * gets steps of sequences ready ahead of time and runs
+ * sequences with and without getting them ready
+ */
+int main() {
+  char directory[] = "/tmp/pshell-prestage-XXXXXX";
+  char *simple[] = {"seq", "1", "3", NULL};
+  char *quoted[] = {"echo", "a b", "c", NULL};
+  char *none[] = {NULL};
+
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(output_path, "%s/output", directory);
+
+  expect_argv("seq 1 3 | cat ; echo done", simple);
+  expect_argv("echo \"a b\" c", quoted);
+  expect_argv("echo $HOME", none);
+  expect_argv("X=$HOME env", none);
+  expect_argv("export X=1", none);
+  expect_argv("cat <( echo a )", none);
+  expect_argv("echo *", none);
+  test_pipes();
+
+  expect_same_output("seq 1 3 | tr 1-3 a-c ; echo x ; seq 1 5 | tail -n 1");
+  expect_same_output("X=1 ; echo $X | cat ; X=2 ; echo $X | cat");
+  expect_same_output("seq 1 3 | cat ; cat <( echo sub ) | tr a-z A-Z ; "
+    "echo done");
+  expect_same_output("for i in 1 2 { echo $i | cat ; echo $i } ; echo end");
+  expect_same_output("false ; echo $? | cat ; true ; echo $?");
+
+  unlink(output_path);
+  rmdir(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
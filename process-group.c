@@ -0,0 +1,204 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions give every pipeline its own
+ * process group (the first stage that is forked starts
+ * it and the others join it) so the whole pipeline can
+ * be signalled at once
+ *
+ * the shell only waits for the last stage of a pipeline
+ * and the stages before it used to run on until they
+ * happened to write into the pipe it left behind (in
+ * "huge_producer | head -1" that can be a long time),
+ * so once the last stage is done the rest of its group
+ * is sent SIGPIPE, which is what the stages would die
+ * of anyway, and only the ones still around after a
+ * short grace period (those that ignore it or are busy
+ * cleaning up) are sent SIGTERM
+ *
+ * when the shell is the foreground of a terminal it
+ * hands the terminal to the group of the pipeline it
+ * waits for, so that pipeline gets ^C and ^Z and can read
+ * the terminal, and takes it back once the wait is over,
+ * a pipeline in the background that reads the terminal
+ * is stopped (SIGTTIN) like it is in other shells
+ *
+ * only the shell itself makes groups, the pipelines run by
+ * a stage it forked (a loop in a pipeline or a branch of a
+ * fan-out) stay in the group of that stage so the signals
+ * sent to it reach them too
+ */
+
+/* allow us to use 'setpgid', 'pthread_sigmask' and 'nanosleep' */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "process-group.h"
+
+#define TERMINAL_NOT_CHECKED -1
+#define TERMINAL_NOT_OWNED 0
+#define TERMINAL_OWNED 1
+
+/*
+ * how often and how many times the shell looks for what
+ * is left of a group after SIGPIPE before sending SIGTERM
+ */
+#define END_GRACE_STEP_NS 1000000L
+#define END_GRACE_STEPS 50
+
+static int terminal_state = TERMINAL_NOT_CHECKED;
+static int terminal_given = 0;
+static int makes_groups = 1;
+
+/*
+ * define prototypes
+ */
+static void give_terminal(pid_t group);
+static int has_live_processes(pid_t group);
+
+/*
+ * checks if the shell is the foreground of the terminal
+ * on its stdin, which is only checked the first time
+ */
+int shell_owns_terminal(void) {
+  if (terminal_state == TERMINAL_NOT_CHECKED) {
+    terminal_state = (isatty(STDIN_FILENO) &&
+      tcgetpgrp(STDIN_FILENO) == getpgrp()) ? TERMINAL_OWNED :
+      TERMINAL_NOT_OWNED;
+  }
+
+  return (terminal_state == TERMINAL_OWNED);
+}
+
+/*
+ * makes a process group the foreground of the terminal,
+ * SIGTTOU is blocked since the caller may already be in
+ * the background (the shell taking the terminal back)
+ */
+static void give_terminal(pid_t group) {
+  sigset_t blocked, old_mask;
+
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGTTOU);
+  pthread_sigmask(SIG_BLOCK, &blocked, &old_mask);
+  tcsetpgrp(STDIN_FILENO, group);
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+/*
+ * puts a stage that was just forked in the group of its
+ * pipeline, this is meant to be called in the child
+ * after fork() and is repeated by the shell (see
+ * add_to_pipeline_group()) so neither has to wait
+ * for the other
+ */
+void join_pipeline_group(pid_t group, int gets_terminal) {
+  if (makes_groups) {
+    setpgid(0, group);
+    if (gets_terminal == GETS_TERMINAL) give_terminal(getpgrp());
+  }
+
+  /* a shell command run by this stage runs
+   * its pipelines in the stage's group */
+  makes_groups = 0;
+  terminal_state = TERMINAL_NOT_OWNED;
+
+  reset_pipe_signal();
+}
+
+/*
+ * gives SIGPIPE back its default action and unblocks it,
+ * the shell may have been started with it ignored or
+ * blocked, which exec() would pass on to a stage and keep
+ * it from dying when its reader goes away
+ */
+void reset_pipe_signal(void) {
+  sigset_t pipe_signal;
+
+  signal(SIGPIPE, SIG_DFL);
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_UNBLOCK, &pipe_signal, NULL);
+}
+
+/*
+ * puts a child in the group of its pipeline from the
+ * shell's side, the first stage's group is its own,
+ * returns the group or NEW_PROCESS_GROUP if the
+ * child stays in the group of its parent
+ */
+pid_t add_to_pipeline_group(pid_t pid, pid_t group, int gets_terminal) {
+  if (!makes_groups) return NEW_PROCESS_GROUP;
+  if (group == NEW_PROCESS_GROUP) group = pid;
+
+  /* this fails once the child has called exec(),
+   * by which time it has joined the group itself */
+  setpgid(pid, group);
+  if (gets_terminal == GETS_TERMINAL && group == pid) {
+    give_terminal(group);
+    terminal_given = 1;
+  }
+
+  return group;
+}
+
+/*
+ * reaps the children in a group that have exited without
+ * waiting for any and checks if anything is left in it
+ */
+static int has_live_processes(pid_t group) {
+  int status;
+
+  while (waitpid(-group, &status, WNOHANG) > 0);
+
+  return (kill(-group, 0) == 0);
+}
+
+/*
+ * ends whatever is left of a pipeline after its last stage
+ * is done and reaps the stages that exit, a stage that was
+ * stopped is continued so the signals reach it
+ *
+ * this must not be called while a child in the group is
+ * still to be waited for, it could be reaped here
+ */
+void end_pipeline_group(pid_t group) {
+  struct timespec step;
+  int i;
+
+  if (group <= NEW_PROCESS_GROUP) return;
+
+  kill(-group, SIGPIPE);
+  kill(-group, SIGCONT);
+
+  step.tv_sec = 0;
+  step.tv_nsec = END_GRACE_STEP_NS;
+  for (i = 0; has_live_processes(group); i++) {
+    if (i == END_GRACE_STEPS) {
+      kill(-group, SIGTERM);
+      kill(-group, SIGCONT);
+      return;
+    }
+    while (nanosleep(&step, NULL) != 0 && errno == EINTR);
+  }
+}
+
+/*
+ * takes the terminal back from the pipeline it was
+ * handed to, if it was handed to one
+ */
+void reclaim_terminal(void) {
+  if (!terminal_given) return;
+
+  give_terminal(getpgrp());
+  terminal_given = 0;
+}
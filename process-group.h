@@ -0,0 +1,32 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef PROCESS_GROUP_H
+#define PROCESS_GROUP_H
+
+#include <sys/types.h>
+
+/*
+ * the group a pipeline's first forked
+ * stage joins, which makes a new one
+ */
+#define NEW_PROCESS_GROUP 0
+
+#define KEEPS_TERMINAL 0
+#define GETS_TERMINAL 1
+
+/*
+ * define functions for running each pipeline in its
+ * own process group, handing the terminal to the one
+ * the shell waits for and ending what is left of a
+ * pipeline once its last stage is done
+ */
+int shell_owns_terminal(void);
+void join_pipeline_group(pid_t group, int gets_terminal);
+void reset_pipe_signal(void);
+pid_t add_to_pipeline_group(pid_t pid, pid_t group, int gets_terminal);
+void end_pipeline_group(pid_t group);
+void reclaim_terminal(void);
+
+#endif
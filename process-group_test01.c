@@ -0,0 +1,232 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "process-group.h"
+ */
+
+/* allow us to use 'mkdtemp' and 'clock_gettime' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "process-helper.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * a group that is never ended is
+ * killed by SIGALRM after this long
+ */
+#define TEST_TIMEOUT_SECONDS 60
+
+/*
+ * how long ending a group may take, the stages
+ * that are left get well under a second
+ */
+#define MAX_END_SECONDS 5
+
+#define PATH_SIZE 256
+#define OUTPUT_SIZE 4096
+#define READ_SIZE 4096
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int run_line(char *line, char *output);
+static double now(void);
+static int count_open_fds(void);
+static void expect_ended(char *line, char *expected);
+static void test_exec_in_place(void);
+
+static char output_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * runs a line like the shell would with its output
+ * sent to the output file and gets what it printed
+ * along with its exit status
+ */
+static int run_line(char *line, char *output) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int saved_stdout, fd, status;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  token_list = parse_tokens(line);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  status = execute_sync_sequence(sync_sequence);
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return status;
+}
+
+/*
+ * gets the time in seconds for measuring how long a line took
+ */
+static double now(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+/*
+ * counts the fds the test has open
+ */
+static int count_open_fds(void) {
+  DIR *fds;
+  int count = 0;
+
+  fds = opendir("/proc/self/fd");
+  if (fds == NULL) fail("Could not list the open fds!");
+  while (readdir(fds) != NULL) count++;
+  closedir(fds);
+
+  return count;
+}
+
+/*
+ * checks that a line whose first stage would run for
+ * much longer is ended along with its last stage
+ * and prints what that last stage printed
+ */
+static void expect_ended(char *line, char *expected) {
+  char output[OUTPUT_SIZE];
+  double start;
+  int status;
+
+  printf("Testing \"%s\"\n", line);
+  start = now();
+  status = run_line(line, output);
+  if (now() - start > MAX_END_SECONDS) fail("Group was not ended!");
+  if (status != 0) {
+    printf("Expected: status 0, Got: %d\n", status);
+    fail("Exit status not as expected!");
+  }
+  if (strcmp(output, expected) != 0) {
+    printf("Expected: \"%s\", Got: \"%s\"\n", expected, output);
+    fail("Output not as expected!");
+  }
+  printf("Group ended as expected!\n");
+}
+
+/*
+ * checks that a command exec()d in place of a shell that
+ * ignores SIGPIPE is still ended by SIGPIPE, so "yes" run
+ * last by "pshell -c" stops once its reader is gone
+ */
+static void test_exec_in_place(void) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  char buffer[READ_SIZE];
+  int fds[2], status;
+  pid_t pid;
+
+  printf("Testing \"yes\" run in place of a shell ignoring SIGPIPE\n");
+  if (pipe(fds) != 0) fail("Could not make a pipe!");
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    signal(SIGPIPE, SIG_IGN);
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+    token_list = parse_tokens("yes");
+    sync_sequence = parse_synchronous_command_sequence(token_list);
+    _exit(execute_last_sync_sequence(sync_sequence));
+  } else if (pid < 0) {
+    fail("Could not fork!");
+  }
+
+  close(fds[1]);
+  if (read(fds[0], buffer, READ_SIZE) <= 0) fail("Nothing was written!");
+  close(fds[0]);
+  if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status) ||
+    WTERMSIG(status) != SIGPIPE) {
+    fail("Command was not ended by SIGPIPE!");
+  }
+  printf("SIGPIPE as expected!\n");
+}
+
+/*
+ * runs pipelines whose first stages outlive their last
+ * stage and checks that every group is ended, even one
+ * with a stage that ignores SIGPIPE
+ */
+int main() {
+  char directory[] = "/tmp/pshell-process-group-XXXXXX";
+  int num_fds;
+
+  alarm(TEST_TIMEOUT_SECONDS);
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(output_path, "%s/output", directory);
+  num_fds = count_open_fds();
+
+  expect_ended("yes | head -n 1", "y\n");
+  expect_ended("seq 1 3 | head -n 1", "1\n");
+
+  /* a stage that never writes has no SIGPIPE coming */
+  expect_ended("sleep 30 | echo done", "done\n");
+
+  /* nor does one that ignores it */
+  expect_ended("sh -c \"trap '' PIPE ; while : ; do echo y 2> /dev/null ; "
+    "done\" | head -n 1", "y\n");
+  expect_ended("yes | sh -c \"trap '' PIPE ; cat 2> /dev/null\" | "
+    "head -n 1", "y\n");
+
+  printf("Testing that no pipe was left open\n");
+  if (count_open_fds() != num_fds) fail("Pipes left open in the shell!");
+  printf("No pipe left open as expected!\n");
+
+  test_exec_in_place();
+
+  unlink(output_path);
+  rmdir(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
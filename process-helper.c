@@ -16,11 +16,33 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 
 #include "tokenizer.h"
 #include "pshell.h"
 #include "pshell-structs.h"
 #include "process-helper.h"
+#include "environment.h"
+#include "expansion.h"
+#include "control-flow.h"
+#include "resource-limits.h"
+#include "job-priority.h"
+#include "jobs.h"
+#include "affinity.h"
+#include "shell-options.h"
+#include "command-table.h"
+#include "arg-batch.h"
+#include "metrics.h"
+#include "admission.h"
+#include "ring-buffer.h"
+#include "stream-builtins.h"
+#include "process-group.h"
+#include "substitution.h"
+#include "profile.h"
+#include "job-output.h"
+#include "cache.h"
+#include "prestage.h"
 
 /*
  * pull in the current environment
@@ -29,6 +51,283 @@
  */
 extern char **environ;
 
+/*
+ * the exit status of the last synchronous step
+ * (or of the last command run inside the shell)
+ */
+static int last_status = EXIT_SUCCESS;
+
+/*
+ * the process group of the pipeline the shell waits for,
+ * ended once its last stage is, NEW_PROCESS_GROUP if that
+ * pipeline forked no more than the last stage
+ */
+static pid_t foreground_group = NEW_PROCESS_GROUP;
+
+/*
+ * define prototypes
+ */
+static int runs_in_shell(Pipeline *pipeline);
+static int overrides_path(Command *expanded);
+static void exec_command(Command *command, char **environment_block,
+  char **prestaged_argv);
+static void abandon_pipeline(pid_t *pids, int (*fds)[2], Stream_stage *stages,
+  Ring_buffer **rings, int num_commands);
+static Stream_stage *prepare_thread_stages(Pipeline *pipeline,
+  int in_foreground, int gets_terminal);
+static int is_thread_stage(Stream_stage *stages, int i);
+static int run_thread_stages(Stream_stage *stages, Ring_buffer **rings,
+  int (*fds)[2], int num_commands);
+static pid_t start_pipeline(Pipeline pipeline, int in_foreground,
+  Prestaged_pipeline *prestaged);
+static int can_exec_in_place(Pipeline *pipeline);
+static void exec_in_place(Pipeline pipeline, Prestaged_pipeline *prestaged);
+static pid_t run_async_sequence(Async_sequence async_sequence,
+  int exec_last, Prestaged_sequence *prestaged);
+static int run_sync_sequence(Async_sequence **sync_sequence,
+  int exec_last);
+static int decode_wait_status(int status);
+
+/*
+ * checks if a pipeline is a builtin, loop or function
+ * call on its own that runs inside the shell so that
+ * it can change the shell's state (a profiled one is
+ * forked so it has a process to look at and a cached
+ * one so its output can be kept)
+ */
+static int runs_in_shell(Pipeline *pipeline) {
+  return (pipeline->num_commands == 1 &&
+    is_shell_command(pipeline->commands[0]) &&
+    pipeline->commands[0]->num_substitutions == 0 &&
+    pipeline->profile == PIPELINE_NOT_PROFILED &&
+    pipeline->cache == PIPELINE_NOT_CACHED &&
+    !has_resource_limits(&pipeline->limits) &&
+    !has_job_priority(&pipeline->priority) &&
+    pipeline->commands[0]->affinity == NULL);
+}
+
+/*
+ * replaces the current process with a command, this is
+ * meant to be called in the child after fork() (or by the
+ * shell itself for its last command) and never returns
+ *
+ * prestaged_argv is the arguments for exec() if they were
+ * put together while the step before was running (see
+ * prestage.c), which means the command has no variables
+ */
+static void exec_command(Command *command, char **environment_block,
+  char **prestaged_argv) {
+  char **execv_arguments;
+  char **envp;
+  char *program_path;
+  Command expanded;
+  int j;
+
+  if (prestaged_argv != NULL) {
+    expanded = *command;
+    execv_arguments = prestaged_argv;
+  } else {
+    /* substitute the current values of the variables
+     * into the command, only the child pays for this */
+    expand_command(command, &expanded);
+
+    /* set up the arguments for the command in a way
+     * that execv will understand 
+     *
+     * this requires 2 extra strings because the
+     * start of the array must be the command itself
+     * and the end of the array must be a NULL pointer */
+    execv_arguments = malloc(sizeof(char *) *
+      (expanded.num_args + EXECV_EXTRA_SIZE));
+    MEM_CHECK(execv_arguments);
+    execv_arguments[0] = expanded.program;
+    for (j = 0; j < expanded.num_args; j++) {
+      execv_arguments[j+1] = expanded.arguments[j];
+    }
+    execv_arguments[expanded.num_args+1] = NULL;
+  }
+
+  /* "NAME=value prog" assignments are layered on top
+   * of the shared block without copying any strings
+   *
+   * environ is pointed at the result so that the PATH
+   * search done by execvpe() uses the exported PATH */
+  envp = build_override_environment(expanded.assignments,
+    expanded.num_assignments);
+  if (envp == NULL) {
+    envp = environment_block;
+  }
+  environ = envp;
+
+  /* replace the currently running program with the current
+   * command (this preserves the file descriptors so the pipes
+   * will properly connect everything) */
+  program_path = NULL;
+  if (get_shell_option(OPTION_HASH_ALL) && !overrides_path(&expanded)) {
+    program_path = find_command_path(expanded.program);
+  }
+
+  /* "batch" splits the arguments up if they are too big
+   * for one exec(), otherwise it returns and we go on */
+  if (is_batched(&expanded.batch)) {
+    exec_batches(&expanded.batch, (program_path != NULL) ? program_path :
+      expanded.program, execv_arguments, envp);
+  }
+
+  if (program_path != NULL) {
+    execve(program_path, execv_arguments, envp);
+  }
+  execvpe(expanded.program, execv_arguments, envp);
+
+  /* if we get here exec failed
+   *
+   * we use stderr here because it will still
+   * be the same as the parent (the shell)
+   *
+   * this lets the error appear to the user easily */
+  count_metric(COUNTER_EXEC_FAILURES);
+  fprintf(stderr, "non fatal error - could not run command\n");
+  fprintf(stderr, "\"\" failed with error %d\n", errno);
+  fprintf(stderr, "error code meanings can be found with \"man -P\
+ 'less -p ^ERRORS' execve\"\n");
+  fprintf(stderr, "strerror() says the problem is \"%s\"\n", strerror(errno));
+
+  /* even though execv didn't work we still need the child
+   * process to die 
+   *
+   * NOTE: this exit() is not killing the shell, just the
+   * child process that the shell spawned to do its bidding
+   * (unless the shell is exec()ing its last command) */
+  exit(EXIT_COULD_NOT_EXEC);
+}
+
+/*
+ * tears down a pipeline that could not be started in full,
+ * closing the pipes the shell still has open and killing
+ * (and reaping) the stages that were already started, which
+ * would otherwise be left waiting on a pipe with nobody at
+ * the other end, then frees what was allocated for it
+ *
+ * the pipe ends that were closed are -1, the stages that
+ * were not started have a pid of 0 and the thread stages
+ * have not been started yet
+ */
+static void abandon_pipeline(pid_t *pids, int (*fds)[2], Stream_stage *stages,
+  Ring_buffer **rings, int num_commands) {
+  int i, status;
+
+  for (i = 0; i < num_commands - 1; i++) {
+    if (fds[i][0] >= 0) close(fds[i][0]);
+    if (fds[i][1] >= 0) close(fds[i][1]);
+  }
+  for (i = 0; i < num_commands; i++) {
+    if (pids[i] > 0) kill(pids[i], SIGKILL);
+  }
+  for (i = 0; i < num_commands; i++) {
+    if (pids[i] > 0) {
+      while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR);
+    }
+  }
+
+  if (stages != NULL) {
+    for (i = 0; i < num_commands; i++) {
+      cleanup_stream_builtin(&stages[i]);
+      if (i < num_commands - 1 && rings[i] != NULL) destroy_ring(rings[i]);
+    }
+    free(stages);
+    free(rings);
+  }
+  free(fds);
+  free(pids);
+}
+
+/*
+ * picks the stages of a pipeline that run as threads of the
+ * shell (see stream-builtins.c), which is only done for a
+ * pipeline the shell waits for anyway and that has no limits
+ * or priority (those are set on a process) and is not
+ * profiled or cached, returns NULL if every stage is forked
+ * as usual
+ *
+ * a pipeline that is handed the terminal is forked in full
+ * so that ^Z stops all of it and not the shell
+ */
+static Stream_stage *prepare_thread_stages(Pipeline *pipeline,
+  int in_foreground, int gets_terminal) {
+  Stream_stage *stages;
+  int i, num_threads = 0;
+
+  if (in_foreground != PIPELINE_IN_FOREGROUND ||
+    gets_terminal == GETS_TERMINAL || pipeline->num_commands < 2 ||
+    pipeline->profile == PIPELINE_PROFILED ||
+    pipeline->cache == PIPELINE_CACHED ||
+    !get_shell_option(OPTION_IN_SHELL_STAGES) ||
+    has_resource_limits(&pipeline->limits) ||
+    has_job_priority(&pipeline->priority)) {
+    return NULL;
+  }
+
+  stages = malloc(sizeof(Stream_stage) * pipeline->num_commands);
+  MEM_CHECK(stages);
+  for (i = 0; i < pipeline->num_commands; i++) {
+    num_threads += prepare_stream_builtin(pipeline->commands[i], &stages[i]);
+  }
+  if (num_threads == 0) {
+    free(stages);
+    return NULL;
+  }
+
+  return stages;
+}
+
+/*
+ * checks if stage i of a pipeline runs as a thread
+ */
+static int is_thread_stage(Stream_stage *stages, int i) {
+  return (stages != NULL && stages[i].builtin != NOT_A_STREAM_BUILTIN);
+}
+
+/*
+ * connects the thread stages of a pipeline to the rings and
+ * pipe ends around them, runs them and waits for them all
+ * (the forked stages are already running by now) and then
+ * frees them, returns the exit status of the last stage
+ * if it is a thread
+ */
+static int run_thread_stages(Stream_stage *stages, Ring_buffer **rings,
+  int (*fds)[2], int num_commands) {
+  int i, status = EXIT_SUCCESS;
+
+  for (i = 0; i < num_commands; i++) {
+    if (!is_thread_stage(stages, i)) continue;
+
+    /* the first stage reads the shell's stdin and the last
+     * writes its stdout, which are left open afterwards */
+    if (i > 0 && rings[i - 1] != NULL) {
+      set_stage_ring(&stages[i].input, rings[i - 1]);
+    } else if (i > 0) {
+      set_stage_fd(&stages[i].input, fds[i - 1][0], 1);
+    }
+    if (i < num_commands - 1 && rings[i] != NULL) {
+      set_stage_ring(&stages[i].output, rings[i]);
+    } else if (i < num_commands - 1) {
+      set_stage_fd(&stages[i].output, fds[i][1], 1);
+    }
+    start_stream_builtin(&stages[i]);
+  }
+
+  for (i = 0; i < num_commands; i++) {
+    if (is_thread_stage(stages, i)) status = finish_stream_builtin(&stages[i]);
+  }
+  for (i = 0; i < num_commands - 1; i++) {
+    if (rings[i] != NULL) destroy_ring(rings[i]);
+  }
+  free(stages);
+  free(rings);
+
+  return status;
+}
+
 /*
  * takes in a pipeline and executes all of the commands in
  * the pipeline while properly setting up pipes between
@@ -37,10 +336,84 @@ extern char **environ;
  * returns the PID of the last command in the pipeline
  */
 pid_t execute_pipeline(Pipeline pipeline) {
+  return start_pipeline(pipeline, PIPELINE_IN_FOREGROUND, NULL);
+}
+
+/*
+ * executes a pipeline (see execute_pipeline()), when it is
+ * in the foreground its cat, head and tr stages run as
+ * threads of the shell that are done by the time this
+ * returns, two of them next to each other are joined by a
+ * ring instead of a pipe and only the forked stages get
+ * file descriptors
+ *
+ * the forked stages are put in a process group of their
+ * own (see process-group.c) which gets the terminal when
+ * the pipeline is in the foreground, along with the
+ * process substitutions of their commands
+ *
+ * returns PID_RAN_IN_SHELL if the last stage was a thread,
+ * the pipeline was profiled (see profile.c) or its output
+ * was written out from the cache (see cache.c), in which
+ * case it is already done
+ */
+static pid_t start_pipeline(Pipeline pipeline, int in_foreground,
+  Prestaged_pipeline *prestaged) {
   int (*fds)[2];
-  int i, j;
-  pid_t new_process_id;
-  char **execv_arguments;
+  int i, j, gets_terminal, num_forked;
+  pid_t new_process_id, group;
+  pid_t *pids;
+  int *stage_cpus, *substitution_pipes;
+  char **environment_block;
+  unsigned long fork_start;
+  Stream_stage *stages;
+  Ring_buffer **rings;
+  Job_output *output;
+  char *entry_path;
+
+  /* the parser never makes a pipeline without a
+   * command but nothing below could start one */
+  if (pipeline.num_commands < 1) {
+    last_status = SYNTAX_ERROR_STATUS;
+    return PID_RAN_IN_SHELL;
+  }
+
+  if (runs_in_shell(&pipeline)) {
+    last_status = run_shell_command(pipeline.commands[0]);
+    return PID_RAN_IN_SHELL;
+  }
+  count_metric(COUNTER_PIPELINES);
+
+  /* a cached pipeline whose output was already kept
+   * is not run, the output is written out instead */
+  entry_path = NULL;
+  if (pipeline.cache == PIPELINE_CACHED) {
+    entry_path = find_cache_entry(&pipeline);
+    if (entry_path != NULL &&
+      replay_cache_entry(entry_path, &last_status) == CACHE_HIT) {
+      free(entry_path);
+      return PID_RAN_IN_SHELL;
+    }
+  }
+
+  gets_terminal = (in_foreground == PIPELINE_IN_FOREGROUND &&
+    shell_owns_terminal()) ? GETS_TERMINAL : KEEPS_TERMINAL;
+  if (in_foreground == PIPELINE_IN_FOREGROUND) {
+    foreground_group = NEW_PROCESS_GROUP;
+  }
+
+  /* get the prebuilt environment block once for the
+   * whole pipeline, it is only rebuilt if an exported
+   * variable changed since the last pipeline ran */
+  environment_block = get_environment_block();
+
+  /* bring the table of programs in $PATH up to date so
+   * the children can exec without searching $PATH */
+  if (get_shell_option(OPTION_HASH_ALL)) refresh_command_table();
+
+  /* anything the shell printed itself has to be written
+   * out before forking or the children would repeat it */
+  fflush(stdout);
 
   /* init array to hold the file descriptor
    * arrays returned by pipe() */
@@ -48,6 +421,33 @@ pid_t execute_pipeline(Pipeline pipeline) {
     (pipeline.num_commands - 1));
   MEM_CHECK(fds);
 
+  /* keep the PID of every stage so that the
+   * timeout can be enforced on all of them */
+  pids = malloc(sizeof(pid_t) * pipeline.num_commands);
+  MEM_CHECK(pids);
+  for (i = 0; i < pipeline.num_commands; i++) {
+    pids[i] = 0;
+    if (i < pipeline.num_commands - 1) fds[i][0] = fds[i][1] = -1;
+  }
+
+  stages = prepare_thread_stages(&pipeline, in_foreground, gets_terminal);
+  rings = NULL;
+  if (stages != NULL) {
+    rings = malloc(sizeof(Ring_buffer *) * (pipeline.num_commands - 1));
+    MEM_CHECK(rings);
+    for (i = 0; i < pipeline.num_commands - 1; i++) rings[i] = NULL;
+  }
+
+  /* with autopin on adjacent stages are put on cores that
+   * share a last level cache, a command on its own is left
+   * alone since pinning it would only take cpus away */
+  stage_cpus = NULL;
+  if (get_shell_option(OPTION_AUTOPIN) && pipeline.num_commands > 1) {
+    stage_cpus = malloc(sizeof(int) * pipeline.num_commands);
+    MEM_CHECK(stage_cpus);
+    choose_pipeline_cpus(stage_cpus, pipeline.num_commands);
+  }
+
   /* make pipeline.num_commands - 1 pipes
    * and store the file descriptors for each pipe
    * in fds
@@ -56,29 +456,93 @@ pid_t execute_pipeline(Pipeline pipeline) {
    */
   /*printf("begin building %d pipes\n", pipeline.num_commands - 1);*/
   for (i = 0; i < pipeline.num_commands - 1; i++) {
-    if (pipe(fds[i]) != STATUS_PIPE_CREATED) {
-      fprintf(stderr, "fatal error - could not create pipe\n");
+    /* two thread stages in a row share a ring */
+    if (is_thread_stage(stages, i) && is_thread_stage(stages, i + 1)) {
+      rings[i] = create_ring();
+      continue;
+    }
+
+    if (take_prestaged_pipe(prestaged, i, fds[i]) == PIPE_PRESTAGED) continue;
+    if (admit_pipe(fds[i]) != ADMITTED) {
+      fprintf(stderr, "non fatal error - could not create pipe\n");
       fprintf(stderr, "pipe() failed with %d\n", errno);
-      exit(EXIT_COULD_NOT_CREATE_PIPE);
+      last_status = EXIT_COULD_NOT_CREATE_PIPE;
+      fds[i][0] = fds[i][1] = -1;
+      abandon_pipeline(pids, fds, stages, rings, pipeline.num_commands);
+      free(stage_cpus);
+      free(entry_path);
+      return PID_CANNOT_EXEC_PIPELINE;
     }
     /*printf("pipe read end %d write end %d\n", fds[i][0], fds[i][1]);
     fflush(stdout);*/
   }
   /*printf("end building pipes\n");*/
+
+  /* a prestaged pipe for a boundary that became a ring
+   * would otherwise be inherited by every forked stage */
+  close_untaken_prestaged_pipes(prestaged);
+
+  /* a background job can write to pipes the shell reads
+   * instead of its stdout and stderr (see job-output.c) */
+  output = NULL;
+  if (in_foreground == PIPELINE_IN_BACKGROUND && buffers_job_output()) {
+    output = open_job_output();
+  }
  
   /* fork pipeline.num_commands processes,
    * one child process for each command that
    * needs to be run */
+  new_process_id = PID_RAN_IN_SHELL;
+  group = NEW_PROCESS_GROUP;
+  num_forked = 0;
   for (i = 0; i < pipeline.num_commands; i++) {
+    if (is_thread_stage(stages, i)) {
+      new_process_id = PID_RAN_IN_SHELL;
+      continue;
+    }
+
+    /* the pipes of the process substitutions of a command
+     * are only made right before its stage is forked */
+    substitution_pipes = NULL;
+    if (pipeline.commands[i]->num_substitutions > 0) {
+      substitution_pipes = open_substitution_pipes(pipeline.commands[i]);
+      if (substitution_pipes == NULL) {
+        last_status = EXIT_COULD_NOT_CREATE_PIPE;
+        if (output != NULL) close_job_output(output);
+        abandon_pipeline(pids, fds, stages, rings, pipeline.num_commands);
+        free(stage_cpus);
+        free(entry_path);
+        return PID_CANNOT_EXEC_PIPELINE;
+      }
+    }
+
     /*printf("creating a new process #%d\n", i);*/
     /* create a new process to run the command */
-    new_process_id = fork();
+    fork_start = metrics_clock();
+    new_process_id = admit_fork();
  
     if (new_process_id == 0) {
+      join_pipeline_group(group, gets_terminal);
+      if (output != NULL) {
+        use_job_output(output, i == pipeline.num_commands - 1);
+      }
+
+      /* the limits are inherited across exec() */
+      apply_resource_limits(&pipeline.limits);
+      apply_job_priority(&pipeline.priority);
+
+      /* so is the cpu affinity, "pin" beats autopin */
+      if (pipeline.commands[i]->affinity != NULL) {
+        apply_cpu_list(pipeline.commands[i]->affinity);
+      } else if (stage_cpus != NULL) {
+        apply_cpu(stage_cpus[i]);
+      }
+
       /* loop through all the pipes and close all inputs
-       * that are not the incoming pipe to this process */
+       * that are not the incoming pipe to this process
+       * (the boundaries that are rings have no fds) */
       for (j = 0; j < pipeline.num_commands - 1; j++) {
-        if (j != i - 1) {
+        if (j != i - 1 && fds[j][0] >= 0) {
           /*printf("am child process #%d and am closing read end of pipe #%d\n", i, j);*/
           close(fds[j][0]);
         }
@@ -87,7 +551,7 @@ pid_t execute_pipeline(Pipeline pipeline) {
       /* loop through all the pipes and close all outputs
        * that are not the output pipe for this process */
       for (j = 0; j < pipeline.num_commands - 1; j++) {
-        if (j != i) {
+        if (j != i && fds[j][1] >= 0) {
           /*printf("am child process #%d and am closing write end of pipe #%d\n", i, j);*/
           close(fds[j][1]);
         }
@@ -109,73 +573,77 @@ pid_t execute_pipeline(Pipeline pipeline) {
         dup2(fds[i][1], STDOUT_FILENO);
         close(fds[i][1]);
       }
+      if (substitution_pipes != NULL) {
+        use_substitution_pipes(pipeline.commands[i], substitution_pipes);
+      }
 
-      /* set up the arguments for the command in a way
-       * that execv will understand 
-       *
-       * this requires 2 extra strings because the
-       * start of the array must be the command itself
-       * and the end of the array must be a NULL pointer */
-        execv_arguments = malloc(sizeof(char *) *
-          (pipeline.commands[i]->num_args + EXECV_EXTRA_SIZE));
-      MEM_CHECK(execv_arguments);      
-      execv_arguments[0] = malloc(sizeof(char) *
-        (strlen(pipeline.commands[i]->program) + NUL_TERM_SIZE));
-      strcpy(execv_arguments[0], pipeline.commands[i]->program);
-      /*printf("am child process #%d and pos 0 of the execv_argument list is now\
- %s\n", i, execv_arguments[0]);*/
-      execv_arguments[pipeline.commands[i]->num_args+1] = NULL;
-      for (j = 0; j < pipeline.commands[i]->num_args; j++) {
-        execv_arguments[j+1] = malloc(sizeof(char) *
-          (strlen(pipeline.commands[i]->arguments[j]) + NUL_TERM_SIZE));
-        MEM_CHECK(execv_arguments[j+1]);
-        strcpy(execv_arguments[j+1], pipeline.commands[i]->arguments[j]);
-        /*printf("am child process #%d and pos %d of the execv_argument list is now\
- %s\n", i, j + 1, execv_arguments[j+1]);*/
-      }
-
-      /*printf("am child process #%d and am about to run\
- program %s\n", i, pipeline.commands[i]->program);*/
-      /* replace the currently running program with the current
-       * command (this preserves the file descriptors so the pipes
-       * will properly connect everything) */
-      execvpe(pipeline.commands[i]->program, execv_arguments, environ);
-
-      /* if we get here exec failed
-       *
-       * we use stderr here because it will still
-       * be the same as the parent (the shell)
-       *
-       * this lets the error appear to the user easily */
-      fprintf(stderr, "non fatal error - could not run command\n");
-      fprintf(stderr, "\"\" failed with error %d\n", errno);
-      fprintf(stderr, "error code meanings can be found with \"man -P\
- 'less -p ^ERRORS' execve\"\n");
-      fprintf(stderr, "strerror() says the problem is \"%s\"\n", strerror(errno));
+      /* the output of the last stage of a cached
+       * pipeline is kept on its way out */
+      if (entry_path != NULL && i == pipeline.num_commands - 1) {
+        record_cache_entry(entry_path);
+      }
 
-      /* even though execv didn't work we still need the child
-       * process to die 
-       *
-       * NOTE: this exit() is not killing the shell, just the
-       * child process that the shell spawned to do its bidding */
-      exit(EXIT_COULD_NOT_EXEC);
+      /* builtins, loops and function calls that are part
+       * of a bigger pipeline run in the child like any
+       * other command */
+      if (is_shell_command(pipeline.commands[i])) {
+        exit(run_shell_command(pipeline.commands[i]));
+      }
+
+      exec_command(pipeline.commands[i], environment_block,
+        get_prestaged_argv(prestaged, i));
 
     } else if (new_process_id > 0) {
+      observe_metric(HISTOGRAM_FORK, fork_start);
+      count_metric(COUNTER_FORKS);
+      pids[i] = new_process_id;
+      group = add_to_pipeline_group(new_process_id, group, gets_terminal);
+      num_forked++;
+      if (substitution_pipes != NULL) {
+        num_forked += start_substitutions(pipeline.commands[i],
+          substitution_pipes, fds, pipeline.num_commands - 1, group,
+          in_foreground);
+      }
+
+      /* close the parent's file descriptors for the ends of
+       * the pipes this child uses because they aren't going
+       * to be used directly by the shell (the ends a thread
+       * stage uses stay open for it) */
       if (i - 1 >= 0) {
-        /* close the parent's file descriptors for each of the
-         * pipes because they aren't going to be used directly by
-         * the shell */
-        /*printf("am parent process and am closing read and write end of pipe #%d\n", i);*/
+        /*printf("am parent process and am closing read end of pipe #%d\n", i - 1);*/
         close(fds[i - 1][0]); /* close read end of pipe */
-        close(fds[i - 1][1]); /* close write end of pipe */    
+        fds[i - 1][0] = -1;
+      }
+      if (i < pipeline.num_commands - 1) {
+        close(fds[i][1]); /* close write end of pipe */
+        fds[i][1] = -1;
       }
     } else{
-      fprintf(stderr, "fatal error - could not create child process\n");
+      /* the shell goes on without this pipeline */
+      fprintf(stderr, "non fatal error - could not create child process\n");
       fprintf(stderr, "fork() failed with %d\n", errno);
-      exit(EXIT_COULD_NOT_FORK);
+      last_status = EXIT_COULD_NOT_FORK;
+      if (substitution_pipes != NULL) {
+        close_substitution_pipes(pipeline.commands[i], substitution_pipes);
+      }
+      if (output != NULL) close_job_output(output);
+      abandon_pipeline(pids, fds, stages, rings, pipeline.num_commands);
+      free(stage_cpus);
+      free(entry_path);
+      return PID_CANNOT_EXEC_PIPELINE;
     }
   }
 
+  if (output != NULL) start_job_output(output);
+  free(entry_path);
+
+  /* the thread stages run now that every child
+   * has been forked and are waited for here */
+  if (stages != NULL) {
+    j = run_thread_stages(stages, rings, fds, pipeline.num_commands);
+    if (new_process_id == PID_RAN_IN_SHELL) last_status = j;
+  }
+
   /* make sure to cleanup the memory used by
    * the file descriptor array in the parent
    *
@@ -184,27 +652,266 @@ pid_t execute_pipeline(Pipeline pipeline) {
    */
   free(fds);
 
+  /* the shell enforces the timeout while it waits */
+  if (pipeline.limits.timeout_ms != LIMIT_NOT_SET) {
+    add_timed_pipeline(pids, pipeline.num_commands,
+      pipeline.limits.timeout_ms);
+  }
+
+  /* a profiled pipeline is watched (and reaped) right
+   * here until every stage is done, one that was stopped
+   * is left stopped instead of being ended */
+  if (pipeline.profile == PIPELINE_PROFILED) {
+    if (profile_pipeline(&pipeline, pids, &last_status) == PROFILE_STOPPED) {
+      group = NEW_PROCESS_GROUP;
+    }
+    new_process_id = PID_RAN_IN_SHELL;
+  }
+
+  /* the forked stages before the last one are ended once
+   * the last stage is, which has already happened when
+   * the last stage was a thread, and nothing waits for
+   * the stages of a background job so they are reaped
+   * once they are done */
+  if (new_process_id == PID_RAN_IN_SHELL) {
+    wait_for_output_substitutions();
+    end_pipeline_group(group);
+  } else if (in_foreground == PIPELINE_IN_FOREGROUND) {
+    if (num_forked > 1) foreground_group = group;
+  } else {
+    add_background_job(pids, pipeline.num_commands);
+  }
+  free(pids);
+  free(stage_cpus);
+
   return new_process_id;
 }
 
 /*
- * takes in an async sequence and executes all of the piplines
- * in the sequence asynchronously
+ * checks if the last pipeline of the shell can replace the
+ * shell with exec() instead of being forked and waited for,
+ * which needs a single external command and nothing left
+ * for the shell to do (no timeouts to enforce and no
+ * output of background jobs to write out)
  *
- * returns the PID of the last command in the last pipeline
+ * a command with limits, a priority or cpus of its own is
+ * forked instead since they would have to be applied to
+ * the shell before exec() and would stay on it if exec()
+ * failed
  */
-pid_t execute_async_sequence(Async_sequence async_sequence) {
+static int can_exec_in_place(Pipeline *pipeline) {
+  return (pipeline->num_commands == 1 &&
+    pipeline->commands[0]->kind == COMMAND_SIMPLE &&
+    pipeline->commands[0]->program != NULL &&
+    !is_shell_command(pipeline->commands[0]) &&
+    pipeline->commands[0]->num_substitutions == 0 &&
+    pipeline->profile == PIPELINE_NOT_PROFILED &&
+    pipeline->cache == PIPELINE_NOT_CACHED &&
+    !has_resource_limits(&pipeline->limits) &&
+    !has_job_priority(&pipeline->priority) &&
+    pipeline->commands[0]->affinity == NULL &&
+    !has_timed_pipelines() && !has_job_outputs());
+}
+
+/*
+ * replaces the shell with the last pipeline, this
+ * sets up what the child after fork() would have
+ */
+static void exec_in_place(Pipeline pipeline, Prestaged_pipeline *prestaged) {
+  if (get_shell_option(OPTION_HASH_ALL)) refresh_command_table();
+
+  /* the stdio buffers do not survive exec() and
+   * neither does the thread serving the metrics */
+  fflush(stdout);
+  cleanup_metrics();
+
+  /* the command takes the shell's place without
+   * joining a group, which is what resets it */
+  reset_pipe_signal();
+
+  exec_command(pipeline.commands[0], get_environment_block(),
+    get_prestaged_argv(prestaged, 0));
+}
+
+/*
+ * runs the pipelines of an async sequence, exec()ing
+ * the last one in place of the shell if exec_last is
+ * EXEC_LAST_PIPELINE and it is able to
+ *
+ * prestaged is what was made ready for it while the step
+ * before was running (see prestage.c) or NULL
+ */
+static pid_t run_async_sequence(Async_sequence async_sequence,
+  int exec_last, Prestaged_sequence *prestaged) {
   Pipeline **curr_pipeline;
+  Pipeline pipeline;
+  Prestaged_pipeline *prestaged_pipeline;
   int i;
   pid_t last_command_pid = PID_CANNOT_EXEC_ASYNC_SEQUENCE;
 
   curr_pipeline = async_sequence.pipelines;
   for (i = 0; i < async_sequence.num_pipelines; i++) {
+    /* every pipeline but the last is a background job (nothing
+     * waits on it) so it gets the background priority from the
+     * shell's options, unless it runs inside the shell */
+    pipeline = **curr_pipeline;
+    if (i < async_sequence.num_pipelines - 1 && !runs_in_shell(&pipeline)) {
+      add_background_priority(&pipeline.priority);
+    }
+    prestaged_pipeline = (prestaged != NULL) ? &prestaged->pipelines[i] : NULL;
+
+    if (i == async_sequence.num_pipelines - 1 &&
+      exec_last == EXEC_LAST_PIPELINE && can_exec_in_place(&pipeline)) {
+      exec_in_place(pipeline, prestaged_pipeline);
+    }
+
     /*printf("begin exec pipeline #%d\n", i);*/
-    last_command_pid = execute_pipeline(**curr_pipeline);
+    last_command_pid = start_pipeline(pipeline,
+      (i == async_sequence.num_pipelines - 1) ? PIPELINE_IN_FOREGROUND :
+      PIPELINE_IN_BACKGROUND, prestaged_pipeline);
     curr_pipeline++;
     /*printf("end exec pipeline #%d, it had PID of %d\n", i, last_command_pid);*/
   }
 
   return last_command_pid;
 }
+
+/*
+ * takes in an async sequence and executes all of the piplines
+ * in the sequence asynchronously
+ *
+ * returns the PID of the last command in the last pipeline
+ */
+pid_t execute_async_sequence(Async_sequence async_sequence) {
+  return run_async_sequence(async_sequence, RUN_LAST_PIPELINE, NULL);
+}
+
+/*
+ * checks if a command is given its own $PATH with
+ * "PATH=... prog" in which case the table of
+ * programs in the shell's $PATH does not apply
+ */
+static int overrides_path(Command *expanded) {
+  int i;
+
+  for (i = 0; i < expanded->num_assignments; i++) {
+    if (strncmp(expanded->assignments[i], "PATH=", strlen("PATH=")) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * turns a status returned by waitpid() into
+ * the exit status of the command
+ */
+static int decode_wait_status(int status) {
+  if (WIFEXITED(status)) return WEXITSTATUS(status);
+  if (WIFSIGNALED(status)) return STATUS_SIGNAL_OFFSET + WTERMSIG(status);
+  if (WIFSTOPPED(status)) return STATUS_SIGNAL_OFFSET + WSTOPSIG(status);
+
+  return status;
+}
+
+/*
+ * takes in a synchronous sequence and executes each of the async
+ * sequences in it one after another by waiting for the last command
+ * of each async sequence before starting the next one
+ *
+ * if exec_last is EXEC_LAST_PIPELINE the very last pipeline
+ * may replace the shell with exec() and never return
+ *
+ * returns the exit status of the last async sequence
+ */
+static int run_sync_sequence(Async_sequence **sync_sequence,
+  int exec_last) {
+  Async_sequence **curr_async_sequence;
+  Prestaged_sequence *prestaged;
+  unsigned long step_start;
+  pid_t async_pid;
+  int status;
+
+  prestaged = NULL;
+  curr_async_sequence = sync_sequence;
+  while (*curr_async_sequence != NULL) {
+    /* execute all the commands in the async sequence simultaneously
+     * and wait for the last command in the async sequence to
+     * complete before moving on to the next async sequence in
+     * this synchronous sequence
+     *
+     * async_pid is the PID of the last process started in
+     * the async_sequence which will be the procecss that we
+     * must wait for completion
+     *
+     * if the last pipeline ran inside the shell there is nothing
+     * to wait for and last_status is already set */
+    step_start = metrics_clock();
+    async_pid = run_async_sequence(**curr_async_sequence,
+      (*(curr_async_sequence + 1) == NULL) ? exec_last : RUN_LAST_PIPELINE,
+      prestaged);
+    cleanup_prestaged_sequence(prestaged);
+    prestaged = NULL;
+    if (async_pid > 0) {
+      /* the next step is made ready while this one runs, a
+       * step that ran inside the shell leaves no time for it */
+      if (*(curr_async_sequence + 1) != NULL && should_prestage()) {
+        prestaged = prestage_async_sequence(*(curr_async_sequence + 1));
+      }
+      wait_for_process(async_pid, &status, shell_owns_terminal() ?
+        WAIT_FOR_EXIT_OR_STOP : WAIT_FOR_EXIT);
+      last_status = decode_wait_status(status);
+      count_metric(COUNTER_WAITS);
+      observe_metric(HISTOGRAM_CHILD, step_start);
+
+      /* a pipeline stopped with ^Z is left stopped and
+       * the shell goes on, otherwise what is left of it
+       * is ended now that its last stage is done */
+      if (WIFSTOPPED(status)) {
+        fprintf(stderr, "non fatal error - pipeline stopped, send SIGCONT to process group %d to continue it\n", (int) getpgid(async_pid));
+        forget_output_substitutions();
+      } else {
+        wait_for_output_substitutions();
+        end_pipeline_group(foreground_group);
+      }
+    }
+    reclaim_terminal();
+
+    curr_async_sequence++;
+  }
+
+  return last_status;
+}
+
+/*
+ * executes a synchronous sequence (see run_sync_sequence())
+ */
+int execute_sync_sequence(Async_sequence **sync_sequence) {
+  return run_sync_sequence(sync_sequence, RUN_LAST_PIPELINE);
+}
+
+/*
+ * executes the last synchronous sequence the shell will
+ * ever run, when it ends in a single external command the
+ * shell exec()s it in place of itself which saves a fork()
+ * and a wait() (the exit status is then the command's own)
+ */
+int execute_last_sync_sequence(Async_sequence **sync_sequence) {
+  return run_sync_sequence(sync_sequence, EXEC_LAST_PIPELINE);
+}
+
+/*
+ * gets the exit status of the last command
+ */
+int get_last_status(void) {
+  return last_status;
+}
+
+/*
+ * sets the exit status of the last command, for lines
+ * the shell runs in some other way (see watch.c)
+ */
+void set_last_status(int status) {
+  last_status = status;
+}
@@ -11,16 +11,41 @@
 
 #define PID_CANNOT_EXEC_PIPELINE -1
 #define PID_CANNOT_EXEC_ASYNC_SEQUENCE -1
+#define PID_RAN_IN_SHELL 0
 
 #define STATUS_PIPE_CREATED 0
 
 #define EXECV_EXTRA_SIZE 2
 
+/*
+ * whether the last pipeline of a sequence may
+ * replace the shell with exec()
+ */
+#define RUN_LAST_PIPELINE 0
+#define EXEC_LAST_PIPELINE 1
+
+/*
+ * whether the shell waits for a pipeline, only then
+ * can its cat, head and tr stages run as threads
+ */
+#define PIPELINE_IN_BACKGROUND 0
+#define PIPELINE_IN_FOREGROUND 1
+
+/*
+ * a command killed by a signal exits with
+ * this plus the number of the signal
+ */
+#define STATUS_SIGNAL_OFFSET 128
+
 /*
  * define functions for executing
  * pipelines and async sequences
  */
 pid_t execute_pipeline(Pipeline pipeline);
 pid_t execute_async_sequence(Async_sequence async_sequence);
+int execute_sync_sequence(Async_sequence **sync_sequence);
+int execute_last_sync_sequence(Async_sequence **sync_sequence);
+int get_last_status(void);
+void set_last_status(int status);
 
 #endif
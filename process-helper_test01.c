@@ -12,10 +12,21 @@
 
 #include "pshell-structs.h"
 #include "process-helper.h"
+#include "environment.h"
+#include "resource-limits.h"
+#include "job-priority.h"
+#include "arg-batch.h"
 
 #define TEST_SUCCEEDED 0
 #define TEST_FAILED 1
 
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
 /*
  * runs through a variety of pipelines
  * and confirms the proper creation of
@@ -23,25 +34,54 @@
  */
 int main() {
   Pipeline pipeline;
+  init_environment(environ);
   pipeline.num_commands = 2;
+  init_resource_limits(&pipeline.limits);
+  init_job_priority(&pipeline.priority);
+  pipeline.profile = PIPELINE_NOT_PROFILED;
+  pipeline.cache = PIPELINE_NOT_CACHED;
   pipeline.commands = malloc(sizeof(Command *) * 2);
   pipeline.commands[0] = malloc(sizeof(Command));
+  pipeline.commands[0]->kind = COMMAND_SIMPLE;
+  pipeline.commands[0]->affinity = NULL;
+  init_arg_batch(&pipeline.commands[0]->batch);
+  pipeline.commands[0]->condition = NULL;
+  pipeline.commands[0]->body = NULL;
+  pipeline.commands[0]->num_branches = 0;
+  pipeline.commands[0]->branches = NULL;
+  pipeline.commands[0]->num_substitutions = 0;
+  pipeline.commands[0]->substitutions = NULL;
   pipeline.commands[0]->program = malloc(sizeof(char) * 3);
   strcpy(pipeline.commands[0]->program, "ls");
+  pipeline.commands[0]->num_assignments = 0;
+  pipeline.commands[0]->assignments = NULL;
   pipeline.commands[0]->num_args = 1;
   pipeline.commands[0]->arguments = malloc(sizeof(char *) * 2);
   pipeline.commands[0]->arguments[0] = malloc(sizeof(char) * 3);
   strcpy(pipeline.commands[0]->arguments[0], "-l");
   pipeline.commands[0]->arguments[1] = NULL;
+  pipeline.commands[0]->was_quoted = NULL;
   
   pipeline.commands[1] = malloc(sizeof(Command));
+  pipeline.commands[1]->kind = COMMAND_SIMPLE;
+  pipeline.commands[1]->affinity = NULL;
+  init_arg_batch(&pipeline.commands[1]->batch);
+  pipeline.commands[1]->condition = NULL;
+  pipeline.commands[1]->body = NULL;
+  pipeline.commands[1]->num_branches = 0;
+  pipeline.commands[1]->branches = NULL;
+  pipeline.commands[1]->num_substitutions = 0;
+  pipeline.commands[1]->substitutions = NULL;
   pipeline.commands[1]->program = malloc(sizeof(char) * 5);
   strcpy(pipeline.commands[1]->program, "grep");
+  pipeline.commands[1]->num_assignments = 0;
+  pipeline.commands[1]->assignments = NULL;
   pipeline.commands[1]->num_args = 1;
   pipeline.commands[1]->arguments = malloc(sizeof(char *) * 2);
   pipeline.commands[1]->arguments[0] = malloc(sizeof(char) * 4);
   strcpy(pipeline.commands[1]->arguments[0], "dco");
   pipeline.commands[1]->arguments[1] = NULL;
+  pipeline.commands[1]->was_quoted = NULL;
 
   execute_pipeline(pipeline);
 }
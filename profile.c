@@ -0,0 +1,427 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions watch a pipeline given the
+ * "profile" prefix while it runs and report on each of its
+ * stages once it is done, so the slow stage of a long
+ * pipeline can be found in one run
+ *
+ * every stage is forked (none run inside the shell) and the
+ * shell stays here until all of them are done, every few
+ * milliseconds it looks at how full each pipe is (FIONREAD
+ * on the pipe, opened again through /proc/<pid>/fd) and at
+ * the state of each stage (/proc/<pid>/stat), a stage that
+ * is asleep with an empty pipe in front of it is counted as
+ * blocked on its input and one that is asleep with a full
+ * pipe behind it as blocked on its output
+ *
+ * a stage that is done is left unreaped (waitid() with
+ * WNOWAIT) until its bytes read and written are taken from
+ * /proc/<pid>/io and is then reaped with wait4() for the
+ * cpu time it used
+ *
+ * the stage that spent the longest not blocked on a pipe is
+ * the one the others were waiting for, the bottleneck
+ */
+
+/* allow us to use 'wait4', 'syscall' and 'F_GETPIPE_SZ' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "parser.h"
+#include "splitter.h"
+#include "process-helper.h"
+#include "jobs.h"
+#include "profile.h"
+
+#define MILLISECONDS_PER_SECOND 1000L
+#define MICROSECONDS_PER_MILLISECOND 1000L
+#define NANOSECONDS_PER_MILLISECOND 1000000L
+
+#define STAGE_RUNNING 0
+#define STAGE_DONE 1
+
+#define NO_PIDFD -1
+#define NOT_A_PIPE -1
+#define NO_STATE '\0'
+
+#define PROC_PATH_SIZE 64
+#define PROC_LINE_SIZE 512
+
+/*
+ * what was found out about one stage of the pipeline,
+ * the times are in milliseconds
+ */
+typedef struct stage_profile {
+  pid_t pid;
+  int pidfd;
+  int state;
+  unsigned long bytes_in;
+  unsigned long bytes_out;
+  long cpu_ms;
+  long blocked_in_ms;
+  long blocked_out_ms;
+  long lifetime_ms;
+  int status;
+} Stage_profile;
+
+/*
+ * define prototypes
+ */
+static long clock_ms(void);
+static char *stage_name(Command *command);
+static char read_stage_state(pid_t pid);
+static long read_pipe_fill(pid_t pid, int fd, long *pipe_size);
+static void read_stage_io(Stage_profile *stage);
+static void sample_stages(Stage_profile *stages, int num_stages,
+  long elapsed_ms);
+static int reap_done_stages(Stage_profile *stages, int num_stages,
+  long start_ms, int *stop_signal);
+static void report_profile(Pipeline *pipeline, Stage_profile *stages,
+  long total_ms);
+
+/*
+ * gets the time from a clock that never jumps
+ */
+static long clock_ms(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * MILLISECONDS_PER_SECOND +
+    now.tv_nsec / NANOSECONDS_PER_MILLISECOND;
+}
+
+/*
+ * gets the name of a stage to show in the report
+ */
+static char *stage_name(Command *command) {
+  if (command->kind == COMMAND_FOR) return FOR_KEYWORD;
+  if (command->kind == COMMAND_WHILE) return WHILE_KEYWORD;
+  if (command->kind == COMMAND_FUNCTION) return FUNCTION_KEYWORD;
+  if (command->kind == COMMAND_FAN_OUT) return FAN_OUT_DELIMITER;
+  if (command->program == NULL) return "-";
+
+  return command->program;
+}
+
+/*
+ * gets the state of a stage (R, S, D, Z, ...) from the
+ * field after its name in /proc/<pid>/stat, the name is
+ * in parentheses and may hold spaces and parentheses
+ */
+static char read_stage_state(pid_t pid) {
+  char path[PROC_PATH_SIZE], line[PROC_LINE_SIZE];
+  char *name_end;
+  long num_read;
+  int fd;
+
+  sprintf(path, "/proc/%d/stat", (int) pid);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return NO_STATE;
+  num_read = read(fd, line, sizeof(line) - 1);
+  close(fd);
+  if (num_read <= 0) return NO_STATE;
+  line[num_read] = '\0';
+
+  name_end = strrchr(line, ')');
+  if (name_end == NULL || name_end[1] == '\0') return NO_STATE;
+
+  return name_end[2];
+}
+
+/*
+ * gets how many bytes are waiting in the pipe a stage
+ * has as fd by opening it again through /proc, which
+ * is closed right away so the stages never notice,
+ * returns NOT_A_PIPE if fd is not a pipe (anymore)
+ */
+static long read_pipe_fill(pid_t pid, int fd, long *pipe_size) {
+  char path[PROC_PATH_SIZE];
+  int pipe_fd, num_waiting;
+
+  sprintf(path, "/proc/%d/fd/%d", (int) pid, fd);
+  pipe_fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (pipe_fd < 0) return NOT_A_PIPE;
+
+  *pipe_size = fcntl(pipe_fd, F_GETPIPE_SZ);
+  if (*pipe_size < 0 || ioctl(pipe_fd, FIONREAD, &num_waiting) < 0) {
+    close(pipe_fd);
+    return NOT_A_PIPE;
+  }
+  close(pipe_fd);
+
+  return num_waiting;
+}
+
+/*
+ * gets the bytes a stage has read and written (with any
+ * system call, not only from and to its pipes)
+ */
+static void read_stage_io(Stage_profile *stage) {
+  char path[PROC_PATH_SIZE], line[PROC_LINE_SIZE];
+  FILE *io;
+
+  sprintf(path, "/proc/%d/io", (int) stage->pid);
+  io = fopen(path, "r");
+  if (io == NULL) return;
+
+  while (fgets(line, sizeof(line), io) != NULL) {
+    sscanf(line, "rchar: %lu", &stage->bytes_in);
+    sscanf(line, "wchar: %lu", &stage->bytes_out);
+  }
+  fclose(io);
+}
+
+/*
+ * looks at how full the pipes are and at which stages are
+ * asleep and counts the time since the last sample as
+ * blocked for the stages that were waiting on a pipe
+ *
+ * pipe i is looked at through its reader (stage i + 1)
+ * or, once that is done, through its writer
+ */
+static void sample_stages(Stage_profile *stages, int num_stages,
+  long elapsed_ms) {
+  long *fills, *sizes;
+  char state;
+  int i;
+
+  fills = malloc(sizeof(long) * num_stages);
+  MEM_CHECK(fills);
+  sizes = malloc(sizeof(long) * num_stages);
+  MEM_CHECK(sizes);
+
+  for (i = 0; i < num_stages - 1; i++) {
+    fills[i] = NOT_A_PIPE;
+    if (stages[i + 1].state == STAGE_RUNNING) {
+      fills[i] = read_pipe_fill(stages[i + 1].pid, STDIN_FILENO, &sizes[i]);
+    } else if (stages[i].state == STAGE_RUNNING) {
+      fills[i] = read_pipe_fill(stages[i].pid, STDOUT_FILENO, &sizes[i]);
+    }
+  }
+
+  for (i = 0; i < num_stages; i++) {
+    if (stages[i].state != STAGE_RUNNING) continue;
+    state = read_stage_state(stages[i].pid);
+    if (state != 'S') continue;
+
+    /* a write only goes through once a whole
+     * page of the pipe is free */
+    if (i > 0 && fills[i - 1] == 0) {
+      stages[i].blocked_in_ms += elapsed_ms;
+    } else if (i < num_stages - 1 && fills[i] != NOT_A_PIPE &&
+      fills[i] + PIPE_BUF > sizes[i]) {
+      stages[i].blocked_out_ms += elapsed_ms;
+    }
+  }
+
+  free(fills);
+  free(sizes);
+}
+
+/*
+ * reaps the stages that are done, taking what they read
+ * and wrote before they are gone, returns PROFILE_STOPPED
+ * (with the signal in stop_signal) if a stage was stopped
+ */
+static int reap_done_stages(Stage_profile *stages, int num_stages,
+  long start_ms, int *stop_signal) {
+  struct rusage usage;
+  siginfo_t info;
+  int i, status;
+
+  for (i = 0; i < num_stages; i++) {
+    if (stages[i].state != STAGE_RUNNING) continue;
+
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, stages[i].pid, &info,
+      WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0) {
+      /* somebody else reaped it, all that is left is how long it ran */
+      if (errno == ECHILD) {
+        stages[i].state = STAGE_DONE;
+        stages[i].lifetime_ms = clock_ms() - start_ms;
+      }
+      continue;
+    }
+    if (info.si_pid != stages[i].pid) continue;
+    if (info.si_code == CLD_STOPPED) {
+      *stop_signal = info.si_status;
+      return PROFILE_STOPPED;
+    }
+
+    read_stage_io(&stages[i]);
+    while (wait4(stages[i].pid, &status, 0, &usage) < 0 && errno == EINTR);
+    stages[i].state = STAGE_DONE;
+    stages[i].lifetime_ms = clock_ms() - start_ms;
+    stages[i].cpu_ms = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      MILLISECONDS_PER_SECOND + (usage.ru_utime.tv_usec +
+      usage.ru_stime.tv_usec) / MICROSECONDS_PER_MILLISECOND;
+    if (WIFEXITED(status)) {
+      stages[i].status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+      stages[i].status = STATUS_SIGNAL_OFFSET + WTERMSIG(status);
+    }
+    if (stages[i].pidfd != NO_PIDFD) {
+      close(stages[i].pidfd);
+      stages[i].pidfd = NO_PIDFD;
+    }
+  }
+
+  return PROFILE_FINISHED;
+}
+
+/*
+ * prints what was found out about each stage and
+ * which stage the others were waiting for
+ */
+static void report_profile(Pipeline *pipeline, Stage_profile *stages,
+  long total_ms) {
+  long busy_ms, most_busy_ms = -1;
+  int i, bottleneck = 0;
+
+  fprintf(stderr, "profile of %d stage%s over %ldms\n",
+    pipeline->num_commands, (pipeline->num_commands == 1) ? "" : "s",
+    total_ms);
+  fprintf(stderr, "%-5s %-16s %12s %12s %8s %12s %12s\n", "stage",
+    "command", "bytes in", "bytes out", "cpu ms", "blocked in", "blocked out");
+  for (i = 0; i < pipeline->num_commands; i++) {
+    fprintf(stderr, "%-5d %-16.16s %12lu %12lu ", i + 1,
+      stage_name(pipeline->commands[i]), stages[i].bytes_in,
+      stages[i].bytes_out);
+    if (stages[i].state == STAGE_DONE) {
+      fprintf(stderr, "%8ld", stages[i].cpu_ms);
+    } else {
+      fprintf(stderr, "%8s", "-");
+    }
+    fprintf(stderr, " %10ldms %10ldms\n", stages[i].blocked_in_ms,
+      stages[i].blocked_out_ms);
+
+    /* a stage that ran as long as another but used more
+     * cpu was the one doing the work */
+    busy_ms = stages[i].lifetime_ms - stages[i].blocked_in_ms -
+      stages[i].blocked_out_ms;
+    if (busy_ms > most_busy_ms || (busy_ms == most_busy_ms &&
+      stages[i].cpu_ms > stages[bottleneck].cpu_ms)) {
+      most_busy_ms = busy_ms;
+      bottleneck = i;
+    }
+  }
+
+  if (pipeline->num_commands > 1) {
+    fprintf(stderr, "bottleneck: stage %d (%s), not blocked on a pipe for\
+ %ldms of %ldms\n", bottleneck + 1,
+      stage_name(pipeline->commands[bottleneck]), most_busy_ms,
+      stages[bottleneck].lifetime_ms);
+  }
+}
+
+/*
+ * watches the stages of a profiled pipeline (pids) until
+ * every one of them is done, reaping them along the way,
+ * and then reports on them, status is set to the exit
+ * status of the last stage
+ *
+ * returns PROFILE_STOPPED if the pipeline was stopped
+ * (with ^Z) in which case it is left stopped and unreaped
+ */
+int profile_pipeline(Pipeline *pipeline, pid_t *pids, int *status) {
+  Stage_profile *stages;
+  struct pollfd *pollfds;
+  long start_ms, last_sample_ms, now_ms;
+  int i, num_pollfds, num_running, stop_signal, result;
+
+  stages = malloc(sizeof(Stage_profile) * pipeline->num_commands);
+  MEM_CHECK(stages);
+  pollfds = malloc(sizeof(struct pollfd) * pipeline->num_commands);
+  MEM_CHECK(pollfds);
+
+  start_ms = clock_ms();
+  for (i = 0; i < pipeline->num_commands; i++) {
+    stages[i].pid = pids[i];
+    stages[i].state = STAGE_RUNNING;
+    stages[i].bytes_in = 0;
+    stages[i].bytes_out = 0;
+    stages[i].cpu_ms = 0;
+    stages[i].blocked_in_ms = 0;
+    stages[i].blocked_out_ms = 0;
+    stages[i].lifetime_ms = 0;
+    stages[i].status = EXIT_SUCCESS;
+
+    /* the pidfds wake the shell up as soon as a stage is
+     * done, without them that waits for the next sample */
+    stages[i].pidfd = syscall(SYS_pidfd_open, pids[i], 0);
+    if (stages[i].pidfd < 0) stages[i].pidfd = NO_PIDFD;
+  }
+
+  last_sample_ms = start_ms;
+  result = PROFILE_FINISHED;
+  num_running = pipeline->num_commands;
+  while (num_running > 0) {
+    num_pollfds = 0;
+    for (i = 0; i < pipeline->num_commands; i++) {
+      if (stages[i].pidfd != NO_PIDFD) {
+        pollfds[num_pollfds].fd = stages[i].pidfd;
+        pollfds[num_pollfds++].events = POLLIN;
+      }
+    }
+    poll(pollfds, num_pollfds, PROFILE_SAMPLE_MS);
+
+    now_ms = clock_ms();
+    sample_stages(stages, pipeline->num_commands, now_ms - last_sample_ms);
+    last_sample_ms = now_ms;
+    enforce_timeouts();
+
+    if (reap_done_stages(stages, pipeline->num_commands, start_ms,
+      &stop_signal) == PROFILE_STOPPED) {
+      result = PROFILE_STOPPED;
+      break;
+    }
+    num_running = 0;
+    for (i = 0; i < pipeline->num_commands; i++) {
+      if (stages[i].state == STAGE_RUNNING) num_running++;
+    }
+  }
+
+  now_ms = clock_ms();
+  for (i = 0; i < pipeline->num_commands; i++) {
+    if (stages[i].pidfd != NO_PIDFD) close(stages[i].pidfd);
+    if (stages[i].state == STAGE_RUNNING) {
+      read_stage_io(&stages[i]);
+      stages[i].lifetime_ms = now_ms - start_ms;
+    }
+  }
+  report_profile(pipeline, stages, now_ms - start_ms);
+
+  if (result == PROFILE_STOPPED) {
+    fprintf(stderr, "non fatal error - pipeline stopped, send SIGCONT to\
+ process group %d to continue it\n", (int) getpgid(pids[0]));
+    *status = STATUS_SIGNAL_OFFSET + stop_signal;
+  } else {
+    *status = stages[pipeline->num_commands - 1].status;
+  }
+  free(pollfds);
+  free(stages);
+
+  return result;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <sys/types.h>
+
+#include "pshell-structs.h"
+
+#define PROFILE_KEYWORD "profile"
+
+/*
+ * how often the stages of a profiled pipeline are
+ * looked at while it runs
+ */
+#define PROFILE_SAMPLE_MS 10
+
+#define PROFILE_FINISHED 0
+#define PROFILE_STOPPED 1
+
+/*
+ * define function for watching a profiled pipeline
+ * until it is done and reporting on its stages
+ */
+int profile_pipeline(Pipeline *pipeline, pid_t *pids, int *status);
+
+#endif
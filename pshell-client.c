@@ -0,0 +1,206 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following program is the thin client of a shell
+ * started with "pshell.x --serve /path/sock", for example:
+ *
+ *   pshell-client.x /path/sock 'make -q | wc -l' [name [args ...]]
+ *
+ * runs the command string in that shell (with $0 set to name
+ * and $1 ... set to args like "pshell.x -c" does) on this
+ * program's stdin, stdout, stderr and working directory and
+ * exits with its status, without starting a shell of its own
+ */
+
+/* allow us to use 'O_DIRECTORY' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "pshell.h"
+#include "serve.h"
+
+/*
+ * the status when there is no shell to run the
+ * command string or it never sent one back
+ */
+#define EXIT_NO_SERVER 255
+
+#define FIRST_STRING_ARGUMENT 2
+
+/*
+ * define prototypes
+ */
+static int connect_to_server(char *socket_path);
+static int send_request(int connection, int cwd_fd, char **strings,
+  int num_strings);
+
+/*
+ * connects to the socket of the shell that serves
+ */
+static int connect_to_server(char *socket_path) {
+  struct sockaddr_un address;
+  int connection;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  connection = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connection < 0) return -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+
+  if (connect(connection, (struct sockaddr *) &address,
+    sizeof(address)) != 0) {
+    close(connection);
+    return -1;
+  }
+
+  return connection;
+}
+
+/*
+ * sends the header with this program's file descriptors
+ * and then the strings, each with its NUL
+ */
+static int send_request(int connection, int cwd_fd, char **strings,
+  int num_strings) {
+  Serve_header header;
+  struct msghdr message;
+  struct iovec *parts;
+  struct cmsghdr *control_message;
+  union {
+    struct cmsghdr align;
+    char space[CMSG_SPACE(sizeof(int) * SERVE_NUM_FDS)];
+  } control;
+  int fds[SERVE_NUM_FDS];
+  size_t length = 0;
+  long num_written;
+  int i, first_part;
+
+  for (i = 0; i < num_strings; i++) length += strlen(strings[i]) + 1;
+  if (length > SERVE_MAX_REQUEST_SIZE) {
+    errno = E2BIG;
+    return -1;
+  }
+  header.length = length;
+
+  fds[STDIN_FILENO] = STDIN_FILENO;
+  fds[STDOUT_FILENO] = STDOUT_FILENO;
+  fds[STDERR_FILENO] = STDERR_FILENO;
+  fds[SERVE_CWD_FD] = cwd_fd;
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  parts = malloc(sizeof(struct iovec) * (num_strings + 1));
+  MEM_CHECK(parts);
+  parts[0].iov_base = &header;
+  parts[0].iov_len = sizeof(header);
+  message.msg_iov = parts;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+  control_message = CMSG_FIRSTHDR(&message);
+  control_message->cmsg_level = SOL_SOCKET;
+  control_message->cmsg_type = SCM_RIGHTS;
+  control_message->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(control_message), fds, sizeof(fds));
+
+  /* the header goes alone so the descriptors arrive with it */
+  while (sendmsg(connection, &message, 0) < 0) {
+    if (errno != EINTR) {
+      free(parts);
+      return -1;
+    }
+  }
+
+  /* the strings go in one writev(), picking up after
+   * wherever a short write left off */
+  for (i = 0; i < num_strings; i++) {
+    parts[i].iov_base = strings[i];
+    parts[i].iov_len = strlen(strings[i]) + 1;
+  }
+  first_part = 0;
+  while (first_part < num_strings) {
+    num_written = writev(connection, parts + first_part,
+      num_strings - first_part);
+    if (num_written < 0 && errno == EINTR) continue;
+    if (num_written < 0) {
+      free(parts);
+      return -1;
+    }
+    while (first_part < num_strings &&
+      (size_t) num_written >= parts[first_part].iov_len) {
+      num_written -= parts[first_part].iov_len;
+      first_part++;
+    }
+    if (first_part < num_strings) {
+      parts[first_part].iov_base =
+        (char *) parts[first_part].iov_base + num_written;
+      parts[first_part].iov_len -= num_written;
+    }
+  }
+
+  free(parts);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int connection, cwd_fd, status;
+  long num_read;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s /path/sock 'line' [name [args ...]]\n",
+      argv[0]);
+    exit(EXIT_BAD_USAGE);
+  }
+
+  cwd_fd = open(".", O_RDONLY | O_DIRECTORY);
+  if (cwd_fd < 0) {
+    fprintf(stderr, "fatal error - could not open the working directory\n");
+    fprintf(stderr, "open() failed with %d\n", errno);
+    exit(EXIT_NO_SERVER);
+  }
+
+  connection = connect_to_server(argv[1]);
+  if (connection < 0) {
+    fprintf(stderr, "fatal error - could not connect to \"%s\"\n", argv[1]);
+    fprintf(stderr, "connect() failed with %d\n", errno);
+    exit(EXIT_NO_SERVER);
+  }
+
+  if (send_request(connection, cwd_fd, argv + FIRST_STRING_ARGUMENT,
+    argc - FIRST_STRING_ARGUMENT) != 0) {
+    fprintf(stderr, "fatal error - could not send the command string\n");
+    fprintf(stderr, "sendmsg() or writev() failed with %d\n", errno);
+    exit(EXIT_NO_SERVER);
+  }
+  close(cwd_fd);
+
+  /* the status comes back once the command string is done */
+  do {
+    num_read = read(connection, &status, sizeof(status));
+  } while (num_read < 0 && errno == EINTR);
+  if (num_read != sizeof(status)) {
+    fprintf(stderr, "fatal error - the shell sent no exit status\n");
+    exit(EXIT_NO_SERVER);
+  }
+
+  close(connection);
+  return status;
+}
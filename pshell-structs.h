@@ -5,19 +5,160 @@
 #ifndef PSHELL_STRUCTS_H
 #define PSHELL_STRUCTS_H
 
+struct block;
+struct substitution;
 struct command;
 struct pipeline;
 struct async_sequence;
 
+/*
+ * the kinds of commands
+ *
+ * a simple command runs a program, the rest are
+ * compound commands that are run by the shell
+ */
+#define COMMAND_SIMPLE 0
+#define COMMAND_FOR 1
+#define COMMAND_WHILE 2
+#define COMMAND_FUNCTION 3
+#define COMMAND_FAN_OUT 4
+#define COMMAND_INVALID 5
+
+/*
+ * a block is a synchronous sequence (an array of
+ * Async_sequence terminated with a NULL pointer)
+ * that was parsed once and may be run many times
+ *
+ * blocks are reference counted because a function
+ * keeps its body alive after the line that
+ * defined it has been cleaned up
+ */
+typedef struct block {
+  int references;
+  struct async_sequence **sync_sequence;
+} Block;
+
+/*
+ * how a command given with the "batch" prefix splits its
+ * arguments, jobs is BATCH_NOT_SET if it was not batched
+ * and keep is BATCH_KEEP_OPTIONS if every batch gets the
+ * leading "-x" options
+ */
+#define BATCH_NOT_SET -1
+#define BATCH_KEEP_OPTIONS -1
+
+typedef struct arg_batch {
+  int jobs;
+  int keep;
+} Arg_batch;
+
+/*
+ * a process substitution, "<( ... )" or ">( ... )" in the
+ * arguments of a command, is a block run with its stdout
+ * (or stdin) on a pipe, the argument it stands for is
+ * replaced with "/dev/fd/N" for the command's end of it
+ */
+#define READ_SUBSTITUTION 0
+#define WRITE_SUBSTITUTION 1
+
+typedef struct substitution {
+  int direction;
+  int argument;
+  struct block *body;
+} Substitution;
+
+/*
+ * assignments are the "NAME=value" words in front
+ * of the program that are only exported to this
+ * command, program is NULL if the command is
+ * nothing but assignments
+ *
+ * for compound commands program is the loop
+ * variable of a "for" or the name of a "function"
+ * and arguments are the words a "for" loops over
+ *
+ * was_quoted[i] is set if arguments[i] was quoted,
+ * the patterns in the words that were not are only
+ * expanded into paths when the command runs (it is
+ * NULL for a copy made by expand_command())
+ *
+ * affinity is the list of cpus given with "pin"
+ * or NULL if the command was not pinned and batch
+ * is how "batch" splits up its arguments
+ *
+ * a fan-out ("|+ ( ... ) ( ... )" at the end of a
+ * pipeline) is a command of its own whose branches
+ * are the blocks its input is passed on to
+ *
+ * substitutions are the process substitutions in
+ * the arguments of a simple command
+ */
 typedef struct command {
+  int kind;
+  char *affinity;
+  Arg_batch batch;
+  int num_assignments;
+  char **assignments;
   char *program;
   int num_args;
   char **arguments;
+  char *was_quoted;
+  struct block *condition;
+  struct block *body;
+  int num_branches;
+  struct block **branches;
+  int num_substitutions;
+  struct substitution *substitutions;
 } Command;
 
+/*
+ * the limits given to a pipeline with the "limit"
+ * prefix, anything that was not given is LIMIT_NOT_SET
+ */
+#define LIMIT_NOT_SET -1
+
+typedef struct resource_limits {
+  long timeout_ms;
+  long memory_bytes;
+  long max_open_files;
+  long cpu_seconds;
+} Resource_limits;
+
+/*
+ * the priority given to a pipeline with the "sched"
+ * prefix (or to a background pipeline by the shell's
+ * options), anything that was not given is PRIORITY_NOT_SET
+ *
+ * io_priority is a best effort level from 0 to 7 or
+ * IO_PRIORITY_IDLE and policy is a SCHED_ policy
+ */
+#define PRIORITY_NOT_SET -1
+
+typedef struct job_priority {
+  int nice;
+  int io_priority;
+  int policy;
+} Job_priority;
+
+/*
+ * whether a pipeline was given the "profile" prefix
+ */
+#define PIPELINE_NOT_PROFILED 0
+#define PIPELINE_PROFILED 1
+
+/*
+ * whether a pipeline was given the "cache" prefix
+ */
+#define PIPELINE_NOT_CACHED 0
+#define PIPELINE_CACHED 1
+
 typedef struct pipeline {
   int num_commands;
   struct command **commands;
+  Resource_limits limits;
+  Job_priority priority;
+  int profile;
+  int cache;
 } Pipeline;
 
 typedef struct async_sequence {
@@ -24,14 +24,26 @@
 #include "pshell.h"
 #include "pshell-structs.h"
 #include "tokenizer.h"
-#include "splitter.h"
+#include "parser.h"
 #include "process-helper.h"
+#include "environment.h"
+#include "shell-options.h"
+#include "history.h"
+#include "control-flow.h"
+#include "input.h"
+#include "glob-expand.h"
+#include "metrics.h"
+#include "serve.h"
+#include "watch.h"
+
+#ifdef ALLOC_COUNT
+#include "alloc-count.h"
+#endif
 
 #define MAX_LINE_SIZE 300
 
-#define SYNC_DELIMITER ";"
-#define ASYNC_DELIMITER "&"
-#define PIPE_DELIMITER "|"
+#define COMMAND_STRING_OPTION "-c"
+#define BLANK_CHARACTERS " \t\r\n"
 
 /* 
  * pull in the current environment
@@ -43,251 +55,179 @@ extern char **environ;
 /*
  * define prototypes
  */
-static Async_sequence **parse_synchronous_command_sequence(Token_list token_list);
-static void cleanup_sync_sequence(Async_sequence **sync_sequence);
+static int run_line(char *line, int is_last_line);
+static int run_command_string(char *commands);
 
 /*
- * takes in a token list and then parses the list into a synchronous sequence
- * of async sequences of pipelines of commands that the shell will have to
- * execute
+ * parses and runs one line of input
+ * returning the status of its last command
  *
- * the function return type "Async_sequence *" means an array of
- * Async_sequence terminated with a NULL pointer which is the same
- * as a sequence of synchronous commands
- *
- * the grammar parsing for this shell DEFINITELY should be done in a more
- * robust way -> but that wasn't really the goal of this project so this
- * fairly rigid and in-extensible system is all we've got
+ * if it is the last line the shell will run its last
+ * command may replace the shell (see process-helper.c)
  */
-static Async_sequence **parse_synchronous_command_sequence(Token_list token_list) {
+static int run_line(char *line, int is_last_line) {
+  Token_list token_list;
   Async_sequence **sync_sequence;
-  Token_list_list split_by_sync_delim, split_by_async_delim, split_by_pipe_delim;
-  int count_sync_sections, count_async_sections, count_pipe_sections, count_args;
-  int i, j, k, l;
-  Async_sequence *async_sequence;
-  Pipeline *pipeline;
-  Command *command;
-  Token_list *token_list_sync, *token_list_async, *token_list_pipeline;
-  Token curr_token;
-
-  /* TODO This function needs to be able to handle cases where people
-   * do this wrong in their input without blowing up */
-
-  /*printf("begin splitting on %s\n", SYNC_DELIMITER);
-  fflush(stdout);*/
-  split_by_sync_delim = split(token_list, SYNC_DELIMITER);
-  /*printf("end splittong on %s\n", SYNC_DELIMITER);
-  fflush(stdout);*/
-  count_sync_sections = count_token_list_list_size(&split_by_sync_delim);
-  /*printf("num sync sections %d\n", count_sync_sections);
-  fflush(stdout);*/
-  sync_sequence = malloc(sizeof(Async_sequence *) * 
-    (count_sync_sections + 1));
-  MEM_CHECK(sync_sequence);
-
-  /* pad the end of the sync sections array
-   * with a NULL pointer to show where it ends */
-  sync_sequence[count_sync_sections] = NULL;
-  for (i = 0; i < count_sync_sections; i++) {
-    token_list_sync = next_token_list(&split_by_sync_delim);
-    async_sequence = malloc(sizeof(Async_sequence));
-    MEM_CHECK(async_sequence);
-    sync_sequence[i] = async_sequence;
-
-    /*printf("begin splitting on %s, loop #%d\n", ASYNC_DELIMITER, i);
-    fflush(stdout);*/
-    split_by_async_delim = split(*token_list_sync, ASYNC_DELIMITER);
-    /*printf("end splitting on %s\n", ASYNC_DELIMITER);
-    fflush(stdout);*/
-    count_async_sections = count_token_list_list_size(&split_by_async_delim);
-    /*printf("num async sections %d\n", count_async_sections);
-    fflush(stdout);*/
-    async_sequence->num_pipelines = count_async_sections;
-    async_sequence->pipelines = malloc(sizeof(Pipeline *) * count_async_sections);
-    MEM_CHECK(async_sequence->pipelines);
-    for (j = 0; j < count_async_sections; j++) {
-      token_list_async = next_token_list(&split_by_async_delim);
-      pipeline = malloc(sizeof(Pipeline));
-      MEM_CHECK(pipeline);
-      async_sequence->pipelines[j] = pipeline;
-
-      /*printf("begin splitting on %s, loop #%d\n", PIPE_DELIMITER, j);
-      fflush(stdout);*/
-      split_by_pipe_delim = split(*token_list_async, PIPE_DELIMITER);
-      /*printf("end splitting on %s\n", PIPE_DELIMITER);
-      fflush(stdout);*/
-      count_pipe_sections = count_token_list_list_size(&split_by_pipe_delim);
-      /*printf("num pipe sections %d\n", count_pipe_sections);      
-      fflush(stdout);*/
-      pipeline->num_commands = count_pipe_sections;
-      pipeline->commands = malloc(sizeof(Command *) * count_pipe_sections);
-      MEM_CHECK(pipeline->commands);
-      for (k = 0; k < count_pipe_sections; k++) {
-        token_list_pipeline = next_token_list(&split_by_pipe_delim);
-        command = malloc(sizeof(Command));
-        MEM_CHECK(command);
-        pipeline->commands[k] = command;
-
-        count_args = count_token_list_size(token_list_pipeline);
-        /*printf("got passed %d args on loop #%d\n", count_args, k);
-        fflush(stdout);
-        printf("head %s iter %s\n", token_list_pipeline->head->data, token_list_pipeline->iterator->data);
-        fflush(stdout);*/
-        curr_token = next_token(token_list_pipeline);
-        command->program = malloc(sizeof(char) *
-          (strlen(curr_token.data) + NUL_TERM_SIZE));
-        /*printf("copying %s into command on loop #%d\n", curr_token.data, k);
-        fflush(stdout);*/
-        strcpy(command->program, curr_token.data);
-        cleanup_token(&curr_token);
-        command->num_args = count_args - 1;
-        command->arguments = malloc(sizeof(char *) *
-          (count_args - 1));
-        MEM_CHECK(command->arguments);
-        for (l = 1; l < count_args; l++) {
-          curr_token = next_token(token_list_pipeline);
-          command->arguments[l - 1] = malloc(sizeof(char) *
-            (strlen(curr_token.data) + NUL_TERM_SIZE));
-          MEM_CHECK(command->arguments[l - 1]);
-          /*printf("copying %s into args position %d on loop #%d\n", curr_token.data, l - 1, l);
-          fflush(stdout);*/
-          strcpy(command->arguments[l - 1], curr_token.data);
-          /*printf("successful copy!\n");
-          fflush(stdout);*/
-          cleanup_token(&curr_token);
-        }
-      }
-      cleanup_token_list_list(&split_by_pipe_delim);
-    }
-    cleanup_token_list_list(&split_by_async_delim);
+  unsigned long parse_start;
+  int status;
+
+#ifdef ALLOC_COUNT
+  /* the counts are printed when the shell
+   * exits so it must not exec() its last command */
+  is_last_line = 0;
+#endif
+
+  count_metric(COUNTER_LINES);
+  parse_start = metrics_clock();
+
+  /* parse the line into tokens */
+  token_list = parse_tokens(line);
+
+  /* a watched line is parsed and run (again and
+   * again) by watch_line() */
+  if (is_watch_line(&token_list)) {
+    remove_first_token(&token_list);
+    observe_metric(HISTOGRAM_PARSE, parse_start);
+    status = watch_line(token_list);
+    cleanup_token_list(&token_list);
+    return status;
+  }
+
+  /* convert the tokens into a synchronous
+   * command sequence */
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  observe_metric(HISTOGRAM_PARSE, parse_start);
+
+  /* execute the commands being given one
+   * async sequence after another */
+  if (is_last_line) {
+    status = execute_last_sync_sequence(sync_sequence);
+  } else {
+    status = execute_sync_sequence(sync_sequence);
   }
-  cleanup_token_list_list(&split_by_sync_delim);
 
-  return sync_sequence;
+  /* don't forget to cleanup the dynamically allocated memory
+   * on each loop */
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+#ifdef ALLOC_COUNT
+  report_line_allocations();
+#endif
+
+  return status;
 }
 
 /*
- * cleans up all the dynamically allocated data for
- * a synchronous command sequence
+ * runs the lines of a "-c" command string
+ *
+ * nothing is set up for this beyond what the lines
+ * themselves use: no input buffer, no history and no
+ * table of the programs in $PATH (one exec does not
+ * pay for scanning every directory of $PATH)
  */
-static void cleanup_sync_sequence(Async_sequence **sync_sequence) {
-  Async_sequence **curr_async_sequence, **tmp_async_sequence;
-  Pipeline **curr_pipeline, **tmp_pipeline;
-  Command **curr_command, **tmp_command;
-  char **curr_arg, **tmp_arg;
-  int i, j, k;
-
-  /* loop through all async sequences */
-  curr_async_sequence = sync_sequence;
-  while (*curr_async_sequence != NULL) {
-    /* loop through all pipelines */
-    curr_pipeline = (*curr_async_sequence)->pipelines;
-    for (i = 0; i < (*curr_async_sequence)->num_pipelines; i++) {    
-      /* loop through all commands */
-      curr_command = (*curr_pipeline)->commands;
-      for (j = 0; j < (*curr_pipeline)->num_commands; j++) {
-        /* loop through all args */
-        curr_arg = (*curr_command)->arguments;
-        for (k = 0; k < (*curr_command)->num_args; k++) {
-          tmp_arg = curr_arg + 1;
-          /*printf("attempting to free %s from current command=%s\n", *curr_arg, (*curr_command)->program);
-          fflush(stdout);*/
-          free(*curr_arg);
-          curr_arg = tmp_arg;
-        }
-
-        /* free the command itself */
-        tmp_command = curr_command + 1;
-        free((*curr_command)->program);
-        free((*curr_command)->arguments);
-        free(*curr_command);
-        curr_command = tmp_command;
-      }
-
-      /* free the pipeline itself */
-      tmp_pipeline = curr_pipeline + 1;
-      free((*curr_pipeline)->commands);
-      free(*curr_pipeline);
-      curr_pipeline = tmp_pipeline;
+static int run_command_string(char *commands) {
+  char *newline, *next;
+  int status = EXIT_SUCCESS;
+
+  while (commands != NULL) {
+    newline = strchr(commands, '\n');
+    next = NULL;
+    if (newline != NULL) {
+      *newline = '\0';
+      next = newline + 1;
     }
 
-    /* free the async sequence itself */
-    tmp_async_sequence = curr_async_sequence + 1;
-    free((*curr_async_sequence)->pipelines);
-    free(*curr_async_sequence);
-    curr_async_sequence = tmp_async_sequence;
+    /* a line followed by nothing but blank lines is the last one */
+    status = run_line(commands, next == NULL ||
+      next[strspn(next, BLANK_CHARACTERS)] == '\0');
+    commands = next;
   }
-  free(sync_sequence);
+
+  return status;
 }
 
-int main() {
+int main(int argc, char **argv) {
   char line[MAX_LINE_SIZE];
-  Token_list token_list;
-  Async_sequence **sync_sequence;
-  Async_sequence **curr_async_sequence;
-  pid_t async_pid;
-  int status;
-  int async_sequence_num;
+  Input_reader input_reader;
+  Serve_request request;
+  int status = EXIT_SUCCESS, interactive;
+
+#ifdef ALLOC_COUNT
+  init_alloc_count();
+#endif
+
+  init_environment(environ);
+
+  /* "pshell.x -c 'line' [name [args ...]]" runs the line with
+   * $0 set to name and $1 ... set to args and then exits */
+  if (argc >= 2 && strcmp(argv[1], COMMAND_STRING_OPTION) == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "fatal error - %s needs a command string\n",
+        COMMAND_STRING_OPTION);
+      exit(EXIT_BAD_USAGE);
+    }
+    if (argc > 3) set_positional_parameters(argv + 3, argc - 4);
+    exit(run_command_string(argv[2]));
+  }
+
+  /* "pshell.x --serve /path/sock" stays up and runs the command
+   * strings of pshell-client.x, each one in a child of its own
+   * that runs it like "-c" does */
+  if (argc >= 2 && strcmp(argv[1], SERVE_OPTION) == 0) {
+    if (argc != 3) {
+      fprintf(stderr, "fatal error - %s needs a socket path\n",
+        SERVE_OPTION);
+      exit(EXIT_BAD_USAGE);
+    }
+    set_shell_option("hashall", OPTION_ON);
+    serve_clients(argv[2], &request);
+    if (request.num_parameters > 0) {
+      set_positional_parameters(request.parameters,
+        request.num_parameters - 1);
+    }
+    exit(run_command_string(request.commands));
+  }
+
+  init_input_reader(&input_reader, STDIN_FILENO);
+  interactive = isatty(STDIN_FILENO);
+
+  /* a shell reading lines keeps a table of the programs
+   * in $PATH so it does not search $PATH for every one */
+  set_shell_option("hashall", OPTION_ON);
+
+  /* only lines typed at a terminal are kept in the
+   * history unless a script asks for it with
+   * "set -o history" */
+  if (interactive) set_shell_option("history", OPTION_ON);
+
+  /* a long running shell can serve its metrics
+   * on the socket named by $PSHELL_METRICS */
+  if (get_environment_variable(METRICS_SOCKET_VARIABLE) != NULL) {
+    init_metrics(get_environment_variable(METRICS_SOCKET_VARIABLE));
+  }
 
   /*
    * read, parse, execute loop
-   * will only break if the exit
-   * command is run in the shell
-   * in which case this program
-   * will quite with a call to exit()
+   * will only break once there is
+   * no more input to read in which
+   * case the shell exits with the
+   * status of the last command
    */
   while (1) {
 
     /* read from stdin */
-    fgets(line, MAX_LINE_SIZE, stdin);
-
-    /*printf("begin token parse\n");    
-    fflush(stdout);*/
-    /* parse the line into tokens */
-    token_list = parse_tokens(line);
-    /*printf("end token parse\n");
-    fflush(stdout);
-
-    printf("begin sequence parse\n");    
-    fflush(stdout);*/
-    /* convert the tokens into a synchronous
-     * command sequence */
-    sync_sequence = parse_synchronous_command_sequence(token_list);
-    /*printf("end sequence parse\n");
-    fflush(stdout);*/
-
-    /* execute the commands being given */
-    curr_async_sequence = sync_sequence;
-    async_sequence_num = 0;
-    while (*curr_async_sequence != NULL) {
-      /* execute all the commands in the async sequence simultaneously
-       * and wait for the last command in the async sequence to
-       * complete before moving on to the next async sequence in
-       * this synchronous sequence
-       *
-       * async_pid is the PID of the last process started in
-       * the async_sequence which will be the procecss that we
-       * must wait for completion
-       * */
-      /*printf("begin exec async sequence #%d\n", async_sequence_num);
-      fflush(stdout);*/
-      async_pid = execute_async_sequence(**curr_async_sequence);
-      /*printf("end exec async sequence #%d\n", async_sequence_num);
-      fflush(stdout);*/
-      waitpid(async_pid, &status, 0);
-
-      /* currently the shell has no support for examining the return state
-       * of the process but eventually we will add support for it */
-
-      curr_async_sequence++;
-      async_sequence_num++;
-    }
+    if (read_input_line(&input_reader, line, MAX_LINE_SIZE) == NULL) break;
 
-    /* don't forget to cleanup the dynamically allocated memory
-     * on each loop */
-    cleanup_sync_sequence(sync_sequence); 
-    cleanup_token_list(&token_list);
+    /* record the line, this never waits on the disk */
+    add_history_line(line);
+
+    status = run_line(line, !interactive &&
+      is_last_input_line(&input_reader));
   }
 
-  exit(EXIT_SUCCESS);
+  cleanup_history();
+  cleanup_glob_cache();
+  cleanup_metrics();
+  exit(status);
 }
@@ -18,6 +18,7 @@
  * EXIT_COULD_NOT_ALLOC_MEMORY = 2 -> call to malloc() failed
  * EXIT_COULD_NOT_FORK = 3 -> system call to fork() failed
  * EXIT_COULD_NOT_EXEC = 4 -> system call to exec() failed
+ * EXIT_BAD_USAGE = 5 -> the shell was given bad arguments
  *
  * NOTE: EXIT_COULD_NOT_EXEC will only be returned by child
  * processes
@@ -27,6 +28,7 @@
 #define EXIT_COULD_NOT_ALLOC_MEMORY 2
 #define EXIT_COULD_NOT_FORK 3
 #define EXIT_COULD_NOT_EXEC 4
+#define EXIT_BAD_USAGE 5
 
 /*
  * macro for checking if a memory allocation
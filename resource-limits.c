@@ -0,0 +1,195 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions handle the "limit" prefix
+ * of a pipeline, for example:
+ *
+ *   limit -t 30s -m 2G -n 1024 cmd | cmd2
+ *
+ * the resource limits are applied with setrlimit()
+ * in each child after fork() and the timeout is
+ * enforced by the shell itself (see jobs.c)
+ */
+
+/* allow us to use 'setrlimit' */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "resource-limits.h"
+
+#define MILLISECONDS_PER_SECOND 1000L
+#define SECONDS_PER_MINUTE 60L
+#define MINUTES_PER_HOUR 60L
+#define BYTES_PER_KILOBYTE 1024L
+
+/*
+ * define prototypes
+ */
+static int parse_number(char *value, long *number, char **suffix);
+static int parse_duration(char *value, long *milliseconds);
+static int parse_size(char *value, long *bytes);
+static void apply_resource_limit(int resource, long value, char *name);
+
+/*
+ * initializes the limits of a pipeline to not set
+ */
+void init_resource_limits(Resource_limits *limits) {
+  if (limits == NULL) return;
+
+  limits->timeout_ms = LIMIT_NOT_SET;
+  limits->memory_bytes = LIMIT_NOT_SET;
+  limits->max_open_files = LIMIT_NOT_SET;
+  limits->cpu_seconds = LIMIT_NOT_SET;
+}
+
+/*
+ * checks if any of the limits of a pipeline are set
+ */
+int has_resource_limits(Resource_limits *limits) {
+  if (limits == NULL) return 0;
+
+  return (limits->timeout_ms != LIMIT_NOT_SET ||
+    limits->memory_bytes != LIMIT_NOT_SET ||
+    limits->max_open_files != LIMIT_NOT_SET ||
+    limits->cpu_seconds != LIMIT_NOT_SET);
+}
+
+/*
+ * reads the non negative number at the start of
+ * a value and points suffix at whatever follows it
+ */
+static int parse_number(char *value, long *number, char **suffix) {
+  errno = 0;
+  *number = strtol(value, suffix, 10);
+  if (errno != 0 || *suffix == value || *number < 0) return LIMIT_NOT_PARSED;
+
+  return LIMIT_PARSED;
+}
+
+/*
+ * parses a duration like "500ms", "30s", "5m" or "2h"
+ * where a number on its own is in seconds
+ */
+static int parse_duration(char *value, long *milliseconds) {
+  char *suffix;
+  long number;
+
+  if (parse_number(value, &number, &suffix) != LIMIT_PARSED) {
+    return LIMIT_NOT_PARSED;
+  }
+
+  if (strcmp(suffix, "ms") == 0) {
+    *milliseconds = number;
+  } else if (strcmp(suffix, "") == 0 || strcmp(suffix, "s") == 0) {
+    *milliseconds = number * MILLISECONDS_PER_SECOND;
+  } else if (strcmp(suffix, "m") == 0) {
+    *milliseconds = number * SECONDS_PER_MINUTE * MILLISECONDS_PER_SECOND;
+  } else if (strcmp(suffix, "h") == 0) {
+    *milliseconds = number * MINUTES_PER_HOUR * SECONDS_PER_MINUTE *
+      MILLISECONDS_PER_SECOND;
+  } else {
+    return LIMIT_NOT_PARSED;
+  }
+
+  return LIMIT_PARSED;
+}
+
+/*
+ * parses a size like "512K", "100M" or "2G"
+ * where a number on its own is in bytes
+ */
+static int parse_size(char *value, long *bytes) {
+  char *suffix;
+  long number;
+
+  if (parse_number(value, &number, &suffix) != LIMIT_PARSED) {
+    return LIMIT_NOT_PARSED;
+  }
+
+  if (strcmp(suffix, "") == 0) {
+    *bytes = number;
+  } else if (strcmp(suffix, "K") == 0 || strcmp(suffix, "k") == 0) {
+    *bytes = number * BYTES_PER_KILOBYTE;
+  } else if (strcmp(suffix, "M") == 0 || strcmp(suffix, "m") == 0) {
+    *bytes = number * BYTES_PER_KILOBYTE * BYTES_PER_KILOBYTE;
+  } else if (strcmp(suffix, "G") == 0 || strcmp(suffix, "g") == 0) {
+    *bytes = number * BYTES_PER_KILOBYTE * BYTES_PER_KILOBYTE *
+      BYTES_PER_KILOBYTE;
+  } else {
+    return LIMIT_NOT_PARSED;
+  }
+
+  return LIMIT_PARSED;
+}
+
+/*
+ * parses one "-x value" option of "limit"
+ * into the limits of a pipeline
+ */
+int parse_limit_option(char *option, char *value, Resource_limits *limits) {
+  char *suffix;
+
+  if (option == NULL || value == NULL || limits == NULL) {
+    return LIMIT_NOT_PARSED;
+  }
+
+  if (strcmp(option, LIMIT_TIMEOUT_OPTION) == 0) {
+    return parse_duration(value, &limits->timeout_ms);
+  } else if (strcmp(option, LIMIT_MEMORY_OPTION) == 0) {
+    return parse_size(value, &limits->memory_bytes);
+  } else if (strcmp(option, LIMIT_FILES_OPTION) == 0) {
+    if (parse_number(value, &limits->max_open_files, &suffix) !=
+      LIMIT_PARSED || *suffix != '\0') {
+      return LIMIT_NOT_PARSED;
+    }
+    return LIMIT_PARSED;
+  } else if (strcmp(option, LIMIT_CPU_OPTION) == 0) {
+    if (parse_duration(value, &limits->cpu_seconds) != LIMIT_PARSED) {
+      return LIMIT_NOT_PARSED;
+    }
+    limits->cpu_seconds /= MILLISECONDS_PER_SECOND;
+    return LIMIT_PARSED;
+  }
+
+  return LIMIT_NOT_PARSED;
+}
+
+/*
+ * sets both the soft and the hard limit
+ * of a resource for the current process
+ */
+static void apply_resource_limit(int resource, long value, char *name) {
+  struct rlimit limit;
+
+  if (value == LIMIT_NOT_SET) return;
+
+  limit.rlim_cur = value;
+  limit.rlim_max = value;
+  if (setrlimit(resource, &limit) != 0) {
+    fprintf(stderr, "non fatal error - could not limit %s\n", name);
+    fprintf(stderr, "setrlimit() failed with %d\n", errno);
+  }
+}
+
+/*
+ * applies the limits of a pipeline to the current process
+ *
+ * this is meant to be called in the child
+ * after fork() and before exec()
+ */
+void apply_resource_limits(Resource_limits *limits) {
+  if (limits == NULL) return;
+
+  apply_resource_limit(RLIMIT_AS, limits->memory_bytes, "memory");
+  apply_resource_limit(RLIMIT_NOFILE, limits->max_open_files, "open files");
+  apply_resource_limit(RLIMIT_CPU, limits->cpu_seconds, "cpu time");
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef RESOURCE_LIMITS_H
+#define RESOURCE_LIMITS_H
+
+#include "pshell-structs.h"
+
+#define LIMIT_KEYWORD "limit"
+
+/*
+ * the options understood by "limit"
+ *
+ * -t -> wall clock timeout for the whole pipeline
+ * -m -> address space of each stage (RLIMIT_AS)
+ * -n -> open files of each stage (RLIMIT_NOFILE)
+ * -c -> cpu seconds of each stage (RLIMIT_CPU)
+ */
+#define LIMIT_TIMEOUT_OPTION "-t"
+#define LIMIT_MEMORY_OPTION "-m"
+#define LIMIT_FILES_OPTION "-n"
+#define LIMIT_CPU_OPTION "-c"
+
+#define LIMIT_PARSED 0
+#define LIMIT_NOT_PARSED 1
+
+/*
+ * define functions for parsing and applying
+ * the limits of a pipeline
+ */
+void init_resource_limits(Resource_limits *limits);
+int has_resource_limits(Resource_limits *limits);
+int parse_limit_option(char *option, char *value, Resource_limits *limits);
+void apply_resource_limits(Resource_limits *limits);
+
+#endif
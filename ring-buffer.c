@@ -0,0 +1,187 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions pass bytes from one thread to
+ * another through a ring buffer without any locks, they
+ * connect the stages of a pipeline that run as threads
+ * inside the shell (see stream-builtins.c)
+ *
+ * the bytes are published with a release store of the
+ * position and read after an acquire load of it, and a
+ * side only makes a system call (a futex wait or wake)
+ * when the ring is empty or full
+ */
+
+/* allow us to use 'syscall' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "pshell.h"
+#include "ring-buffer.h"
+
+#define RING_MASK (RING_SIZE - 1)
+
+/*
+ * define prototypes
+ */
+static void wait_for_event(unsigned int *event, int *waiting,
+  unsigned int *position, unsigned int seen_position, int *closed);
+static void signal_event(unsigned int *event, int *waiting, int force);
+
+/*
+ * makes an empty ring
+ */
+Ring_buffer *create_ring(void) {
+  Ring_buffer *ring;
+
+  ring = malloc(sizeof(Ring_buffer));
+  MEM_CHECK(ring);
+  ring->head = ring->tail = 0;
+  ring->reader_event = ring->writer_event = 0;
+  ring->reader_waiting = ring->writer_waiting = 0;
+  ring->reader_closed = ring->writer_closed = 0;
+
+  return ring;
+}
+
+/*
+ * sleeps until the other side moves its position away
+ * from seen_position or closes its end
+ *
+ * the event count is read before the waiting flag is set
+ * so a signal that comes in between makes the futex wait
+ * return right away instead of being missed
+ */
+static void wait_for_event(unsigned int *event, int *waiting,
+  unsigned int *position, unsigned int seen_position, int *closed) {
+  unsigned int seen;
+
+  seen = __atomic_load_n(event, __ATOMIC_SEQ_CST);
+  __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(position, __ATOMIC_SEQ_CST) == seen_position &&
+    !__atomic_load_n(closed, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+  }
+  __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * wakes the other side if it is waiting (or if force is set)
+ */
+static void signal_event(unsigned int *event, int *waiting, int force) {
+  if (!force && !__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) return;
+
+  __atomic_fetch_add(event, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/*
+ * reads up to size bytes, waiting for at least one, and
+ * returns 0 once the writer has closed the ring and
+ * everything it wrote has been read
+ */
+size_t read_ring(Ring_buffer *ring, char *buffer, size_t size) {
+  unsigned int head, tail, offset;
+  size_t available, first;
+
+  head = ring->head;
+  while (1) {
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (tail != head) break;
+
+    /* the writer may have written its last bytes
+     * between loading tail and seeing it closed */
+    if (__atomic_load_n(&ring->writer_closed, __ATOMIC_ACQUIRE)) {
+      tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+      if (tail != head) break;
+      return 0;
+    }
+
+    wait_for_event(&ring->reader_event, &ring->reader_waiting, &ring->tail,
+      head, &ring->writer_closed);
+  }
+
+  available = tail - head;
+  if (available > size) available = size;
+
+  /* the bytes may wrap around the end of the ring */
+  offset = head & RING_MASK;
+  first = RING_SIZE - offset;
+  if (first > available) first = available;
+  memcpy(buffer, ring->data + offset, first);
+  memcpy(buffer + first, ring->data, available - first);
+
+  __atomic_store_n(&ring->head, head + available, __ATOMIC_SEQ_CST);
+  signal_event(&ring->writer_event, &ring->writer_waiting, 0);
+
+  return available;
+}
+
+/*
+ * writes all of a buffer, waiting for room as needed,
+ * returns RING_CLOSED if the reader stopped reading
+ */
+int write_ring(Ring_buffer *ring, char *buffer, size_t size) {
+  unsigned int head, tail, offset;
+  size_t room, first;
+
+  tail = ring->tail;
+  while (size > 0) {
+    if (__atomic_load_n(&ring->reader_closed, __ATOMIC_ACQUIRE)) {
+      return RING_CLOSED;
+    }
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    room = RING_SIZE - (tail - head);
+    if (room == 0) {
+      wait_for_event(&ring->writer_event, &ring->writer_waiting, &ring->head,
+        head, &ring->reader_closed);
+      continue;
+    }
+    if (room > size) room = size;
+
+    offset = tail & RING_MASK;
+    first = RING_SIZE - offset;
+    if (first > room) first = room;
+    memcpy(ring->data + offset, buffer, first);
+    memcpy(ring->data, buffer + first, room - first);
+
+    tail += room;
+    buffer += room;
+    size -= room;
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+    signal_event(&ring->reader_event, &ring->reader_waiting, 0);
+  }
+
+  return RING_WRITTEN;
+}
+
+/*
+ * marks the end of what the writer will write
+ */
+void close_ring_writer(Ring_buffer *ring) {
+  __atomic_store_n(&ring->writer_closed, 1, __ATOMIC_SEQ_CST);
+  signal_event(&ring->reader_event, &ring->reader_waiting, 1);
+}
+
+/*
+ * tells the writer that nothing more will be read
+ */
+void close_ring_reader(Ring_buffer *ring) {
+  __atomic_store_n(&ring->reader_closed, 1, __ATOMIC_SEQ_CST);
+  signal_event(&ring->writer_event, &ring->writer_waiting, 1);
+}
+
+/*
+ * frees a ring once both sides are done with it
+ */
+void destroy_ring(Ring_buffer *ring) {
+  free(ring);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * the size of a ring, a power of two so the
+ * positions can wrap around with a mask
+ */
+#define RING_SIZE 65536
+
+#define RING_WRITTEN 0
+#define RING_CLOSED 1
+
+/*
+ * a single producer, single consumer byte ring
+ *
+ * the producer only moves tail and the consumer only
+ * moves head, both count up forever (wrapping around
+ * an unsigned int) so tail - head is always the number
+ * of bytes waiting to be read
+ *
+ * a side that finds the ring empty (or full) sets its
+ * waiting flag and sleeps with a futex on its event
+ * count, which the other side bumps whenever it moves
+ * its position or closes while that flag is set
+ *
+ * the two sides are kept on their own cache lines
+ */
+#define RING_CACHE_LINE_SIZE 64
+
+typedef struct ring_buffer {
+  unsigned int head;
+  unsigned int reader_event;
+  int reader_waiting;
+  int reader_closed;
+  char reader_padding[RING_CACHE_LINE_SIZE - 4 * sizeof(int)];
+  unsigned int tail;
+  unsigned int writer_event;
+  int writer_waiting;
+  int writer_closed;
+  char writer_padding[RING_CACHE_LINE_SIZE - 4 * sizeof(int)];
+  char data[RING_SIZE];
+} Ring_buffer;
+
+/*
+ * define functions for passing bytes between
+ * two threads through a ring buffer
+ */
+Ring_buffer *create_ring(void);
+size_t read_ring(Ring_buffer *ring, char *buffer, size_t size);
+int write_ring(Ring_buffer *ring, char *buffer, size_t size);
+void close_ring_writer(Ring_buffer *ring);
+void close_ring_reader(Ring_buffer *ring);
+void destroy_ring(Ring_buffer *ring);
+
+#endif
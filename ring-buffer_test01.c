@@ -0,0 +1,259 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "ring-buffer.h"
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ring-buffer.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * a test that hangs (a side that is never woken)
+ * is killed by SIGALRM after this many seconds
+ */
+#define TEST_TIMEOUT_SECONDS 10
+
+#define BIG_WRITE_SIZE (4 * RING_SIZE)
+
+/*
+ * what a thread on one side of a ring was given
+ * and what it got back
+ */
+typedef struct ring_side {
+  Ring_buffer *ring;
+  char *buffer;
+  size_t size;
+  int result;
+} Ring_side;
+
+/*
+ * fills a buffer with bytes that depend on where they
+ * are in the whole stream so a byte that was read from
+ * the wrong place is noticed
+ */
+static void fill_pattern(char *buffer, size_t size, size_t start) {
+  size_t i;
+
+  for (i = 0; i < size; i++) buffer[i] = (char) ((start + i) % 251);
+}
+
+/*
+ * checks that a buffer holds the bytes fill_pattern() made
+ */
+static int has_pattern(char *buffer, size_t size, size_t start) {
+  size_t i;
+
+  for (i = 0; i < size; i++) {
+    if (buffer[i] != (char) ((start + i) % 251)) return 0;
+  }
+
+  return 1;
+}
+
+/*
+ * reads exactly size bytes, which must already be written
+ */
+static int read_exactly(Ring_buffer *ring, char *buffer, size_t size) {
+  size_t done = 0, got;
+
+  while (done < size) {
+    got = read_ring(ring, buffer + done, size - done);
+    if (got == 0) return 0;
+    done += got;
+  }
+
+  return 1;
+}
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * writes the whole buffer of a side and keeps what
+ * write_ring() returned
+ */
+static void *run_writer(void *argument) {
+  Ring_side *side = argument;
+
+  side->result = write_ring(side->ring, side->buffer, side->size);
+
+  return NULL;
+}
+
+/*
+ * reads once into the buffer of a side and keeps
+ * how many bytes read_ring() returned
+ */
+static void *run_reader(void *argument) {
+  Ring_side *side = argument;
+
+  side->result = (int) read_ring(side->ring, side->buffer, side->size);
+
+  return NULL;
+}
+
+/*
+ * writes and reads back enough bytes that both positions
+ * go past the end of the ring, and again with the
+ * positions about to wrap around an unsigned int
+ */
+static void test_wraparound(char *buffer, char *read_buffer) {
+  Ring_buffer *ring;
+  size_t first_size = RING_SIZE / 2 + RING_SIZE / 8;
+  size_t second_size = RING_SIZE - 100;
+
+  printf("Testing a ring whose data wraps around its end\n");
+  ring = create_ring();
+  fill_pattern(buffer, first_size, 0);
+  if (write_ring(ring, buffer, first_size) != RING_WRITTEN ||
+    !read_exactly(ring, read_buffer, first_size) ||
+    !has_pattern(read_buffer, first_size, 0)) {
+    fail("First pass through the ring not as expected!");
+  }
+  fill_pattern(buffer, second_size, first_size);
+  if (write_ring(ring, buffer, second_size) != RING_WRITTEN ||
+    !read_exactly(ring, read_buffer, second_size) ||
+    !has_pattern(read_buffer, second_size, first_size)) {
+    fail("Bytes that wrapped around the ring not as expected!");
+  }
+  printf("Wrapped bytes as expected!\n");
+  destroy_ring(ring);
+
+  printf("Testing a ring whose positions wrap around UINT_MAX\n");
+  ring = create_ring();
+  ring->head = ring->tail = UINT_MAX - 100;
+  fill_pattern(buffer, RING_SIZE, 0);
+  if (write_ring(ring, buffer, RING_SIZE) != RING_WRITTEN) {
+    fail("Could not fill the ring!");
+  }
+  if (ring->tail - ring->head != RING_SIZE) {
+    fail("Ring not full after its positions wrapped!");
+  }
+  if (!read_exactly(ring, read_buffer, RING_SIZE) ||
+    !has_pattern(read_buffer, RING_SIZE, 0)) {
+    fail("Bytes read after the positions wrapped not as expected!");
+  }
+  printf("Wrapped positions as expected!\n");
+  destroy_ring(ring);
+}
+
+/*
+ * closes the writer with bytes still waiting and the
+ * reader of a ring nothing more will be read from
+ */
+static void test_close(char *buffer, char *read_buffer) {
+  Ring_buffer *ring;
+
+  printf("Testing a ring closed by its writer\n");
+  ring = create_ring();
+  fill_pattern(buffer, 10, 0);
+  write_ring(ring, buffer, 10);
+  close_ring_writer(ring);
+  if (read_ring(ring, read_buffer, RING_SIZE) != 10 ||
+    !has_pattern(read_buffer, 10, 0)) {
+    fail("Bytes written before the close were lost!");
+  }
+  if (read_ring(ring, read_buffer, RING_SIZE) != 0) {
+    fail("Read did not see the end of the ring!");
+  }
+  printf("Writer close as expected!\n");
+  destroy_ring(ring);
+
+  printf("Testing a ring closed by its reader\n");
+  ring = create_ring();
+  close_ring_reader(ring);
+  if (write_ring(ring, buffer, 10) != RING_CLOSED) {
+    fail("Write did not see the reader was gone!");
+  }
+  printf("Reader close as expected!\n");
+  destroy_ring(ring);
+}
+
+/*
+ * blocks each side of a ring in its own thread and checks
+ * that the other side closing wakes it, which is how a
+ * producer feeding "head" finds out "head" is done
+ */
+static void test_wakeups(char *buffer, char *read_buffer) {
+  Ring_buffer *ring;
+  Ring_side side;
+  pthread_t thread;
+
+  printf("Testing a producer blocked on a full ring\n");
+  ring = create_ring();
+  side.ring = ring;
+  side.buffer = buffer;
+  side.size = BIG_WRITE_SIZE;
+  side.result = -1;
+  fill_pattern(buffer, BIG_WRITE_SIZE, 0);
+  if (pthread_create(&thread, NULL, run_writer, &side) != 0) {
+    fail("Could not start the producer!");
+  }
+
+  /* read a bit the way "head -1" would and leave */
+  if (read_ring(ring, read_buffer, 100) == 0 ||
+    !has_pattern(read_buffer, 1, 0)) {
+    fail("Could not read from the producer!");
+  }
+  close_ring_reader(ring);
+  pthread_join(thread, NULL);
+  if (side.result != RING_CLOSED) {
+    fail("Producer did not see the reader was gone!");
+  }
+  printf("Producer woken as expected!\n");
+  destroy_ring(ring);
+
+  printf("Testing a consumer blocked on an empty ring\n");
+  ring = create_ring();
+  side.ring = ring;
+  side.buffer = read_buffer;
+  side.size = RING_SIZE;
+  side.result = -1;
+  if (pthread_create(&thread, NULL, run_reader, &side) != 0) {
+    fail("Could not start the consumer!");
+  }
+  close_ring_writer(ring);
+  pthread_join(thread, NULL);
+  if (side.result != 0) {
+    fail("Consumer did not see the end of the ring!");
+  }
+  printf("Consumer woken as expected!\n");
+  destroy_ring(ring);
+}
+
+/*
+ * runs a ring through wrapping around, being closed from
+ * either side and waking a side that is blocked on it
+ */
+int main() {
+  char *buffer, *read_buffer;
+
+  alarm(TEST_TIMEOUT_SECONDS);
+
+  buffer = malloc(BIG_WRITE_SIZE);
+  read_buffer = malloc(BIG_WRITE_SIZE);
+  if (buffer == NULL || read_buffer == NULL) fail("Out of memory!");
+
+  test_wraparound(buffer, read_buffer);
+  test_close(buffer, read_buffer);
+  test_wakeups(buffer, read_buffer);
+
+  free(buffer);
+  free(read_buffer);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
@@ -0,0 +1,374 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep one warm shell around for
+ * "pshell.x --serve /path/sock" that runs the command strings
+ * clients (pshell-client.x) send it over a unix domain socket,
+ * so a tool that runs the shell tens of thousands of times
+ * does not pay for starting it and warming it up every time
+ *
+ * the shell that serves builds the table of the programs in
+ * $PATH and its environment block once, keeps them current
+ * and forks a child for each client that inherits them, the
+ * child takes the client's stdin, stdout, stderr and working
+ * directory (passed as SCM_RIGHTS along with the request)
+ * and runs the command string like "-c" does, so its last
+ * program replaces the child and nothing a request changes
+ * leaks into the next one
+ *
+ * the shell that serves waits for each child with a pidfd
+ * (next to the socket in one poll()) and sends its exit
+ * status back to its client, so any number of clients can
+ * be served at once
+ */
+
+/* allow us to use 'accept4', 'MSG_CMSG_CLOEXEC' and 'syscall' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "process-helper.h"
+#include "environment.h"
+#include "command-table.h"
+#include "admission.h"
+#include "serve.h"
+
+#define REQUEST_RECEIVED 0
+#define REQUEST_FAILED 1
+
+#define NO_PIDFD -1
+#define FIRST_CLIENT_CAPACITY 16
+
+/*
+ * a client whose command string is being run by the
+ * child pid, connection is where its status goes
+ */
+typedef struct client {
+  pid_t pid;
+  int pidfd;
+  int connection;
+} Client;
+
+static Client *clients = NULL;
+static int num_clients = 0;
+static int client_capacity = 0;
+
+/*
+ * define prototypes
+ */
+static int open_server_socket(char *socket_path);
+static int read_fully(int fd, char *buffer, size_t size);
+static int receive_request(int connection, Serve_request *request);
+static void send_status(int connection, int status);
+static void finish_client(int i);
+static void add_client(pid_t pid, int connection);
+static pid_t start_client(int listen_fd, int connection,
+  Serve_request *request);
+
+/*
+ * makes the socket the clients connect to, one left
+ * behind by an earlier shell is replaced
+ */
+static int open_server_socket(char *socket_path) {
+  struct sockaddr_un address;
+  int listen_fd;
+
+  if (strlen(socket_path) >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) return -1;
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socket_path);
+
+  unlink(socket_path);
+  if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+    listen(listen_fd, SERVE_BACKLOG) != 0) {
+    close(listen_fd);
+    return -1;
+  }
+
+  return listen_fd;
+}
+
+/*
+ * reads exactly size bytes unless the other end goes away
+ */
+static int read_fully(int fd, char *buffer, size_t size) {
+  long num_read;
+
+  while (size > 0) {
+    num_read = read(fd, buffer, size);
+    if (num_read < 0 && errno == EINTR) continue;
+    if (num_read <= 0) return REQUEST_FAILED;
+    buffer += num_read;
+    size -= num_read;
+  }
+
+  return REQUEST_RECEIVED;
+}
+
+/*
+ * reads a request from a client and takes its file
+ * descriptors in place of the shell's own, this is
+ * meant to be called in the child forked for the client
+ */
+static int receive_request(int connection, Serve_request *request) {
+  Serve_header header;
+  struct msghdr message;
+  struct iovec part;
+  struct cmsghdr *control_message;
+  union {
+    struct cmsghdr align;
+    char space[CMSG_SPACE(sizeof(int) * SERVE_NUM_FDS)];
+  } control;
+  int fds[SERVE_NUM_FDS];
+  char *curr, *end;
+  long num_read;
+  int i;
+
+  memset(&message, 0, sizeof(message));
+  part.iov_base = &header;
+  part.iov_len = sizeof(header);
+  message.msg_iov = &part;
+  message.msg_iovlen = 1;
+  message.msg_control = control.space;
+  message.msg_controllen = sizeof(control.space);
+
+  do {
+    num_read = recvmsg(connection, &message, MSG_CMSG_CLOEXEC);
+  } while (num_read < 0 && errno == EINTR);
+  if (num_read < 0) return REQUEST_FAILED;
+  control_message = CMSG_FIRSTHDR(&message);
+  if (control_message == NULL || control_message->cmsg_level != SOL_SOCKET ||
+    control_message->cmsg_type != SCM_RIGHTS ||
+    control_message->cmsg_len != CMSG_LEN(sizeof(int) * SERVE_NUM_FDS)) {
+    return REQUEST_FAILED;
+  }
+  memcpy(fds, CMSG_DATA(control_message), sizeof(fds));
+
+  /* the descriptors were received before the rest of the
+   * header could be checked so they are taken either way */
+  for (i = 0; i < SERVE_CWD_FD; i++) {
+    if (fds[i] != i) {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+  }
+  if (fchdir(fds[SERVE_CWD_FD]) != 0) {
+    fprintf(stderr, "non fatal error - could not change to the client's\
+ working directory\n");
+  }
+  close(fds[SERVE_CWD_FD]);
+
+  if (num_read != sizeof(header) || header.length == 0 || header.length > SERVE_MAX_REQUEST_SIZE) {
+    return REQUEST_FAILED;
+  }
+  if (message.msg_flags & MSG_TRUNC) return REQUEST_FAILED;
+
+  request->commands = malloc(sizeof(char) * header.length);
+  MEM_CHECK(request->commands);
+  if (read_fully(connection, request->commands, header.length) !=
+    REQUEST_RECEIVED || request->commands[header.length - 1] != '\0') {
+    return REQUEST_FAILED;
+  }
+
+  /* the strings after the command string are $0, $1, ... */
+  end = request->commands + header.length;
+  request->num_parameters = 0;
+  for (curr = request->commands; curr < end; curr += strlen(curr) + 1) {
+    request->num_parameters++;
+  }
+  request->num_parameters--;
+  request->parameters = malloc(sizeof(char *) *
+    (request->num_parameters + 1));
+  MEM_CHECK(request->parameters);
+  i = 0;
+  curr = request->commands + strlen(request->commands) + 1;
+  for (; curr < end; curr += strlen(curr) + 1) {
+    request->parameters[i++] = curr;
+  }
+  request->parameters[i] = NULL;
+
+  return REQUEST_RECEIVED;
+}
+
+/*
+ * sends an exit status back to a client, which
+ * may have gone away already
+ */
+static void send_status(int connection, int status) {
+  while (write(connection, &status, sizeof(status)) < 0 && errno == EINTR);
+}
+
+/*
+ * reaps the child of a client that is done, sends
+ * its exit status back and forgets the client
+ */
+static void finish_client(int i) {
+  int wait_status, status;
+
+  while (waitpid(clients[i].pid, &wait_status, 0) < 0 && errno == EINTR);
+  if (WIFEXITED(wait_status)) {
+    status = WEXITSTATUS(wait_status);
+  } else if (WIFSIGNALED(wait_status)) {
+    status = STATUS_SIGNAL_OFFSET + WTERMSIG(wait_status);
+  } else {
+    status = wait_status;
+  }
+
+  send_status(clients[i].connection, status);
+  close(clients[i].connection);
+  if (clients[i].pidfd != NO_PIDFD) close(clients[i].pidfd);
+  clients[i] = clients[--num_clients];
+}
+
+/*
+ * keeps track of the child forked for a client,
+ * without a pidfd it is waited for right away
+ */
+static void add_client(pid_t pid, int connection) {
+  if (num_clients >= client_capacity) {
+    client_capacity = (client_capacity == 0) ? FIRST_CLIENT_CAPACITY :
+      client_capacity * 2;
+    clients = realloc(clients, sizeof(Client) * client_capacity);
+    MEM_CHECK(clients);
+  }
+  clients[num_clients].pid = pid;
+  clients[num_clients].pidfd = syscall(SYS_pidfd_open, pid, 0);
+  clients[num_clients].connection = connection;
+  if (clients[num_clients].pidfd < 0) {
+    clients[num_clients].pidfd = NO_PIDFD;
+    num_clients++;
+    finish_client(num_clients - 1);
+    return;
+  }
+  num_clients++;
+}
+
+/*
+ * forks the child that runs the request of a client that
+ * just connected, the child returns 0 with the request read
+ * and the client's file descriptors in place
+ */
+static pid_t start_client(int listen_fd, int connection,
+  Serve_request *request) {
+  pid_t pid;
+  int i;
+
+  /* the child gets an up to date copy of the table and the
+   * environment block, and anything printed so far is not
+   * printed again by it */
+  refresh_command_table();
+  get_environment_block();
+  fflush(stdout);
+
+  pid = admit_fork();
+  if (pid == 0) {
+    close(listen_fd);
+    for (i = 0; i < num_clients; i++) {
+      close(clients[i].connection);
+      if (clients[i].pidfd != NO_PIDFD) close(clients[i].pidfd);
+    }
+    num_clients = 0;
+    stop_watching_command_table();
+    signal(SIGPIPE, SIG_DFL);
+
+    if (receive_request(connection, request) != REQUEST_RECEIVED) {
+      fprintf(stderr, "non fatal error - could not read the request of\
+ a client\n");
+      exit(EXIT_BAD_USAGE);
+    }
+    close(connection);
+  } else if (pid < 0) {
+    fprintf(stderr, "non fatal error - could not create child process\n");
+    fprintf(stderr, "fork() failed with %d\n", errno);
+    send_status(connection, EXIT_COULD_NOT_FORK);
+    close(connection);
+  }
+
+  return pid;
+}
+
+/*
+ * serves the clients that connect to socket_path until the
+ * shell is killed, this only returns in the child forked for
+ * a client, with its request in request
+ */
+void serve_clients(char *socket_path, Serve_request *request) {
+  struct pollfd *pollfds;
+  int listen_fd, connection, num_pollfds, i;
+  pid_t pid;
+
+  listen_fd = open_server_socket(socket_path);
+  if (listen_fd < 0) {
+    fprintf(stderr, "fatal error - could not serve on \"%s\"\n",
+      socket_path);
+    fprintf(stderr, "socket(), bind() or listen() failed with %d\n", errno);
+    exit(EXIT_BAD_USAGE);
+  }
+
+  /* a client that goes away before its status
+   * is sent must not take the shell with it */
+  signal(SIGPIPE, SIG_IGN);
+
+  /* warm up before the first client shows up */
+  refresh_command_table();
+  get_environment_block();
+
+  while (1) {
+    pollfds = malloc(sizeof(struct pollfd) * (num_clients + 1));
+    MEM_CHECK(pollfds);
+    pollfds[0].fd = listen_fd;
+    pollfds[0].events = POLLIN;
+    num_pollfds = 1;
+    for (i = 0; i < num_clients; i++) {
+      pollfds[num_pollfds].fd = clients[i].pidfd;
+      pollfds[num_pollfds++].events = POLLIN;
+    }
+
+    if (poll(pollfds, num_pollfds, -1) < 0) {
+      free(pollfds);
+      continue;
+    }
+
+    /* backwards since a finished client is
+     * replaced by the last one */
+    for (i = num_pollfds - 1; i > 0; i--) {
+      if (pollfds[i].revents != 0) finish_client(i - 1);
+    }
+
+    if (pollfds[0].revents & POLLIN) {
+      connection = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (connection >= 0) {
+        pid = start_client(listen_fd, connection, request);
+        if (pid == 0) {
+          free(pollfds);
+          free(clients);
+          clients = NULL;
+          return;
+        }
+        if (pid > 0) add_client(pid, connection);
+      }
+    }
+    free(pollfds);
+  }
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#define SERVE_OPTION "--serve"
+
+#define SERVE_BACKLOG 128
+
+/*
+ * the file descriptors a client passes along with its
+ * request: its stdin, stdout, stderr and a descriptor
+ * for its working directory
+ */
+#define SERVE_NUM_FDS 4
+#define SERVE_CWD_FD 3
+
+/*
+ * the most bytes of strings a request may carry
+ */
+#define SERVE_MAX_REQUEST_SIZE 16777216
+
+/*
+ * a request starts with this header, which carries the
+ * client's file descriptors, and goes on with length bytes
+ * of NUL terminated strings: the command string and then
+ * the name and arguments that become $0, $1, ...
+ *
+ * the answer is the exit status as an int
+ */
+typedef struct serve_header {
+  unsigned int length;
+} Serve_header;
+
+/*
+ * a request as the child forked to run it sees it,
+ * parameters point into commands
+ */
+typedef struct serve_request {
+  char *commands;
+  int num_parameters;
+  char **parameters;
+} Serve_request;
+
+/*
+ * define function for serving command strings to clients
+ */
+void serve_clients(char *socket_path, Serve_request *request);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions keep track of the options
+ * that change how the shell runs commands
+ *
+ * they are changed with the "set" builtin:
+ *   set -o name -> turns an option on
+ *   set -o name=value -> gives an option a value
+ *   set +o name -> turns an option off
+ *   set -o -> prints every option
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "shell-options.h"
+
+typedef struct shell_option {
+  char *name;
+  int value;
+} Shell_option;
+
+/*
+ * the table of options in the order
+ * of their OPTION_ index
+ */
+static Shell_option shell_options[NUM_SHELL_OPTIONS] = {
+  {"autopin", OPTION_OFF},
+  {"bgnice", OPTION_OFF},
+  {"bgbatch", OPTION_OFF},
+  {"bgidle", OPTION_OFF},
+  {"history", OPTION_OFF},
+  {"hashall", OPTION_OFF},
+  {"inshell", OPTION_ON},
+  {"uring", OPTION_OFF},
+  {"bgbuffer", OPTION_OFF},
+  {"bgtag", OPTION_OFF},
+  {"prestage", OPTION_ON}
+};
+
+/*
+ * gets the value of an option
+ */
+int get_shell_option(int option) {
+  if (option < 0 || option >= NUM_SHELL_OPTIONS) return OPTION_OFF;
+
+  return shell_options[option].value;
+}
+
+/*
+ * sets the option with the given name
+ */
+int set_shell_option(char *name, int value) {
+  int i;
+
+  if (name == NULL) return OPTION_NOT_SET;
+
+  for (i = 0; i < NUM_SHELL_OPTIONS; i++) {
+    if (strcmp(shell_options[i].name, name) == 0) {
+      shell_options[i].value = value;
+      return OPTION_SET;
+    }
+  }
+
+  return OPTION_NOT_SET;
+}
+
+/*
+ * prints the value of every option
+ */
+void print_shell_options(void) {
+  int i;
+
+  for (i = 0; i < NUM_SHELL_OPTIONS; i++) {
+    printf("%s=%d\n", shell_options[i].name, shell_options[i].value);
+  }
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef SHELL_OPTIONS_H
+#define SHELL_OPTIONS_H
+
+/*
+ * the options that can be changed with "set -o"
+ *
+ * each one is an index into the table of options
+ * so that checking one is just an array lookup
+ */
+#define OPTION_AUTOPIN 0
+#define OPTION_BACKGROUND_NICE 1
+#define OPTION_BACKGROUND_BATCH 2
+#define OPTION_BACKGROUND_IDLE 3
+#define OPTION_HISTORY 4
+#define OPTION_HASH_ALL 5
+#define OPTION_IN_SHELL_STAGES 6
+#define OPTION_URING 7
+#define OPTION_BACKGROUND_BUFFER 8
+#define OPTION_BACKGROUND_TAG 9
+#define OPTION_PRESTAGE 10
+#define NUM_SHELL_OPTIONS 11
+
+#define OPTION_OFF 0
+#define OPTION_ON 1
+
+#define OPTION_SET 0
+#define OPTION_NOT_SET 1
+
+/*
+ * define functions for reading and
+ * changing the options of the shell
+ */
+int get_shell_option(int option);
+int set_shell_option(char *name, int value);
+void print_shell_options(void);
+
+#endif
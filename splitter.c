@@ -51,15 +51,48 @@ static void add_token_list(Token_list_list *token_list_list, Token_list *token_l
   token_list_list->iterator = token_list_node;
 }
 
+/*
+ * checks if a token opens or closes a block of the
+ * form "{ ... }", a process substitution or, after a
+ * fan-out, a branch of the form "( ... )"
+ *
+ * num_groups counts the substitutions and branches
+ * that are open, which a ")" closes
+ */
+static int block_depth_change(Token token, int in_fan_out, int *num_groups) {
+  if (token.was_quoted) return 0;
+  if (strcmp(token.data, OPEN_BLOCK) == 0) return 1;
+  if (strcmp(token.data, CLOSE_BLOCK) == 0) return -1;
+  if (strcmp(token.data, INPUT_SUBSTITUTION) == 0 ||
+    strcmp(token.data, OUTPUT_SUBSTITUTION) == 0 ||
+    (in_fan_out && strcmp(token.data, OPEN_GROUP) == 0)) {
+    (*num_groups)++;
+    return 1;
+  }
+  if (*num_groups > 0 && strcmp(token.data, CLOSE_GROUP) == 0) {
+    (*num_groups)--;
+    return -1;
+  }
+
+  return 0;
+}
+
 /*
  * splits a list of tokens into a list of token lists
  * using a delimiter
+ *
+ * delimiters inside of a "{ ... }" block (or a process
+ * substitution or a branch of a fan-out) are left alone
+ * so that it stays in one piece
  */
 Token_list_list split(Token_list token_list, char delimiter[]) {
   Token_list_list token_list_list;
   Token_list *curr_token_list;
   Token curr_token;
   int in_list = 0;
+  int depth = 0;
+  int in_fan_out = 0;
+  int num_groups = 0;
 
   init_token_list_list(&token_list_list);
 
@@ -74,26 +107,21 @@ Token_list_list split(Token_list token_list, char delimiter[]) {
   begin_iter(&token_list);
   while (has_token(token_list)) {
     curr_token = next_token(&token_list);
-    if (in_list) {
-      if (strcmp(curr_token.data, delimiter) == 0) {
-        add_token_list(&token_list_list, curr_token_list);
-        in_list = 0;
-        curr_token_list = malloc(sizeof(Token_list));
-        MEM_CHECK(curr_token_list);
-        init_token_list(curr_token_list);
-      } else {
-        add_token(curr_token_list, curr_token.data, curr_token.was_quoted);
+    if (depth > 0 || strcmp(curr_token.data, delimiter) != 0) {
+      if (depth == 0 && !curr_token.was_quoted &&
+        strcmp(curr_token.data, FAN_OUT_DELIMITER) == 0) {
+        in_fan_out = 1;
       }
+      depth += block_depth_change(curr_token, in_fan_out, &num_groups);
+      add_token(curr_token_list, curr_token.data, curr_token.was_quoted);
+      in_list = 1;
     } else {
-      if (strcmp(curr_token.data, delimiter) == 0) {
-        add_token_list(&token_list_list, curr_token_list);
-        curr_token_list = malloc(sizeof(Token_list));
-        MEM_CHECK(curr_token_list);
-        init_token_list(curr_token_list);
-      } else {
-        add_token(curr_token_list, curr_token.data, curr_token.was_quoted);
-        in_list = 1;
-      }
+      add_token_list(&token_list_list, curr_token_list);
+      in_list = 0;
+      in_fan_out = 0;
+      curr_token_list = malloc(sizeof(Token_list));
+      MEM_CHECK(curr_token_list);
+      init_token_list(curr_token_list);
     }
 
     cleanup_token(&curr_token);
@@ -101,6 +129,8 @@ Token_list_list split(Token_list token_list, char delimiter[]) {
 
   if (in_list) {
     add_token_list(&token_list_list, curr_token_list);
+  } else {
+    free(curr_token_list);
   }
 
   return token_list_list;
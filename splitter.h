@@ -7,6 +7,29 @@
 
 #include "tokenizer.h"
 
+/*
+ * the tokens that open and close a block, delimiters
+ * inside of a block are not split on
+ */
+#define OPEN_BLOCK "{"
+#define CLOSE_BLOCK "}"
+
+/*
+ * the token that starts a fan-out and the tokens around
+ * each of its branches, after a fan-out the delimiters
+ * inside of a branch are not split on either
+ */
+#define FAN_OUT_DELIMITER "|+"
+#define OPEN_GROUP "("
+#define CLOSE_GROUP ")"
+
+/*
+ * the tokens that start a process substitution, which
+ * ends at a ")" and is not split on either
+ */
+#define INPUT_SUBSTITUTION "<("
+#define OUTPUT_SUBSTITUTION ">("
+
 /*
  * a linked list of token lists
  */
@@ -0,0 +1,157 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following program measures how long shells take to
+ * start, run a "-c" command string and exit, for example:
+ *
+ *   startup-bench.x -n 2000 true ./pshell.x dash
+ *
+ * runs "./pshell.x -c true" and "dash -c true" 2000 times
+ * each (one after the other so they see the same machine)
+ * and prints the mean and fastest time of each shell
+ */
+
+/* allow us to use 'clock_gettime' and 'posix_spawnp' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define ITERATIONS_OPTION "-n"
+#define DEFAULT_ITERATIONS 1000
+#define WARMUP_ITERATIONS 20
+
+#define NANOSECONDS_PER_MICROSECOND 1000.0
+#define MICROSECONDS_PER_SECOND 1000000.0
+
+#define SPAWN_ARGUMENTS_SIZE 4
+
+#define BENCH_SUCCEEDED 0
+#define BENCH_FAILED 1
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static double now_in_microseconds(void);
+static int run_once(char *shell, char *command, double *elapsed);
+static int bench_shell(char *shell, char *command, long iterations);
+
+/*
+ * reads the monotonic clock
+ */
+static double now_in_microseconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec * MICROSECONDS_PER_SECOND +
+    now.tv_nsec / NANOSECONDS_PER_MICROSECOND;
+}
+
+/*
+ * runs "shell -c command" once and waits for it
+ */
+static int run_once(char *shell, char *command, double *elapsed) {
+  char *arguments[SPAWN_ARGUMENTS_SIZE];
+  double start;
+  pid_t pid;
+  int status, error;
+
+  arguments[0] = shell;
+  arguments[1] = "-c";
+  arguments[2] = command;
+  arguments[3] = NULL;
+
+  start = now_in_microseconds();
+  error = posix_spawnp(&pid, shell, NULL, NULL, arguments, environ);
+  if (error != 0) {
+    fprintf(stderr, "non fatal error - could not run %s\n", shell);
+    fprintf(stderr, "posix_spawnp() failed with %d\n", error);
+    return BENCH_FAILED;
+  }
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return BENCH_FAILED;
+  }
+  *elapsed = now_in_microseconds() - start;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    fprintf(stderr, "non fatal error - %s -c \"%s\" did not exit with 0\n",
+      shell, command);
+    return BENCH_FAILED;
+  }
+
+  return BENCH_SUCCEEDED;
+}
+
+/*
+ * runs a shell over and over and prints how long it took
+ */
+static int bench_shell(char *shell, char *command, long iterations) {
+  double elapsed, total = 0, fastest = 0;
+  long i;
+
+  /* let the page cache and the dynamic loader settle */
+  for (i = 0; i < WARMUP_ITERATIONS; i++) {
+    if (run_once(shell, command, &elapsed) != BENCH_SUCCEEDED) {
+      return BENCH_FAILED;
+    }
+  }
+
+  for (i = 0; i < iterations; i++) {
+    if (run_once(shell, command, &elapsed) != BENCH_SUCCEEDED) {
+      return BENCH_FAILED;
+    }
+    total += elapsed;
+    if (i == 0 || elapsed < fastest) fastest = elapsed;
+  }
+
+  printf("%-20s mean %8.1f us  fastest %8.1f us  (%ld runs of -c \"%s\")\n",
+    shell, total / iterations, fastest, iterations, command);
+
+  return BENCH_SUCCEEDED;
+}
+
+int main(int argc, char **argv) {
+  long iterations = DEFAULT_ITERATIONS;
+  int i = 1, status = EXIT_SUCCESS;
+  char *command, *end;
+
+  if (argc > 2 && strcmp(argv[1], ITERATIONS_OPTION) == 0) {
+    iterations = strtol(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || iterations <= 0) {
+      fprintf(stderr, "fatal error - \"%s\" is not a number of runs\n",
+        argv[2]);
+      exit(EXIT_FAILURE);
+    }
+    i = 3;
+  }
+
+  if (argc - i < 2) {
+    fprintf(stderr, "usage: %s [-n runs] command shell [shell ...]\n",
+      argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  command = argv[i++];
+  for (; i < argc; i++) {
+    if (bench_shell(argv[i], command, iterations) != BENCH_SUCCEEDED) {
+      status = EXIT_FAILURE;
+    }
+  }
+
+  exit(status);
+}
@@ -0,0 +1,560 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions run "cat", "head" and "tr" as
+ * threads of the shell when they are stages of a bigger
+ * pipeline, for example:
+ *
+ *   cat log.txt | tr a-z A-Z | head -n 5 | sort
+ *
+ * runs the first three stages inside the shell and only
+ * forks "sort", the stages next to each other pass their
+ * bytes through ring buffers (see ring-buffer.c) instead
+ * of pipes and only a stage next to a real program reads
+ * or writes a file descriptor
+ *
+ * only the simple forms are handled here:
+ *   cat [FILE | -]...
+ *   head [-n N | -N]
+ *   tr SET1 SET2 and tr -d SET1 (with ranges like a-z
+ *   and the escapes \n, \t, \r, \\ and \NNN)
+ * anything else (options, character classes, head of a
+ * file) is left to the real program
+ */
+
+/* allow us to use 'O_CLOEXEC' and 'pthread_sigmask' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "stream-builtins.h"
+#include "ring-buffer.h"
+#include "expansion.h"
+#include "control-flow.h"
+#include "arg-batch.h"
+
+#define STREAM_CAT 1
+#define STREAM_HEAD 2
+#define STREAM_TR 3
+
+#define STREAM_BUFFER_SIZE 65536
+
+#define STREAM_WRITTEN 0
+#define STREAM_STOPPED 1
+
+#define DEFAULT_HEAD_LINES 10
+
+#define TR_KEEP 0
+#define TR_DELETE 1
+#define OCTAL_ESCAPE_DIGITS 3
+
+#define STDIN_NAME "-"
+
+/*
+ * define prototypes
+ */
+static int find_stream_builtin(char *program);
+static int parse_line_count(char *value, long *lines);
+static int parse_head_arguments(Command *expanded, long *lines);
+static int parse_cat_arguments(Command *expanded);
+static int parse_tr_byte(char **set);
+static int parse_tr_set(char *set, unsigned char *bytes);
+static int parse_tr_arguments(Command *expanded, Stream_stage *stage);
+static long read_stream(Stage_stream *stream, char *buffer, size_t size);
+static int write_stream(Stage_stream *stream, char *buffer, size_t size);
+static int copy_stream(Stage_stream *input, Stage_stream *output,
+  char *buffer, int *status);
+static int run_cat(Stream_stage *stage);
+static int run_head(Stream_stage *stage);
+static int run_tr(Stream_stage *stage);
+static void close_streams(Stream_stage *stage);
+static void *run_stream_stage(void *argument);
+
+/*
+ * gets which stream builtin a program is
+ */
+static int find_stream_builtin(char *program) {
+  if (program == NULL) return NOT_A_STREAM_BUILTIN;
+
+  if (strcmp(program, "cat") == 0) return STREAM_CAT;
+  if (strcmp(program, "head") == 0) return STREAM_HEAD;
+  if (strcmp(program, "tr") == 0) return STREAM_TR;
+
+  return NOT_A_STREAM_BUILTIN;
+}
+
+/*
+ * reads a count of lines that is 0 or more
+ */
+static int parse_line_count(char *value, long *lines) {
+  char *end;
+
+  errno = 0;
+  *lines = strtol(value, &end, 10);
+
+  return (errno == 0 && end != value && *end == '\0' && *lines >= 0);
+}
+
+/*
+ * reads "head", "head -n N", "head -nN" and "head -N"
+ */
+static int parse_head_arguments(Command *expanded, long *lines) {
+  char **arguments = expanded->arguments;
+
+  *lines = DEFAULT_HEAD_LINES;
+  if (expanded->num_args == 0) return IS_A_STREAM_BUILTIN;
+
+  if (expanded->num_args == 2 && strcmp(arguments[0], "-n") == 0) {
+    return parse_line_count(arguments[1], lines);
+  }
+  if (expanded->num_args == 1 && strncmp(arguments[0], "-n", 2) == 0) {
+    return parse_line_count(arguments[0] + 2, lines);
+  }
+  if (expanded->num_args == 1 && arguments[0][0] == '-') {
+    return parse_line_count(arguments[0] + 1, lines);
+  }
+
+  return NOT_A_STREAM_BUILTIN;
+}
+
+/*
+ * checks that "cat" is only given files (or "-")
+ */
+static int parse_cat_arguments(Command *expanded) {
+  int i;
+
+  for (i = 0; i < expanded->num_args; i++) {
+    if (expanded->arguments[i][0] == '-' &&
+      strcmp(expanded->arguments[i], STDIN_NAME) != 0) {
+      return NOT_A_STREAM_BUILTIN;
+    }
+  }
+
+  return IS_A_STREAM_BUILTIN;
+}
+
+/*
+ * reads one byte of a "tr" set, handling the
+ * escapes, and moves set past it
+ */
+static int parse_tr_byte(char **set) {
+  int value, i;
+
+  if (**set != '\\' || (*set)[1] == '\0') return (unsigned char) *(*set)++;
+
+  (*set)++;
+  switch (*(*set)++) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case '\\': return '\\';
+    default: break;
+  }
+
+  /* \NNN is up to 3 octal digits */
+  (*set)--;
+  if (**set < '0' || **set > '7') return (unsigned char) *(*set)++;
+  value = 0;
+  for (i = 0; i < OCTAL_ESCAPE_DIGITS && **set >= '0' && **set <= '7'; i++) {
+    value = value * 8 + (*(*set)++ - '0');
+  }
+
+  return value & (NUM_BYTE_VALUES - 1);
+}
+
+/*
+ * turns a "tr" set into the bytes it stands for,
+ * bytes must have room for NUM_BYTE_VALUES times the
+ * length of the set, returns the number of bytes
+ * or -1 if the set uses something not handled here
+ */
+static int parse_tr_set(char *set, unsigned char *bytes) {
+  int num_bytes = 0, first, last;
+
+  /* character classes, equivalence classes and
+   * repeats are left to the real "tr" */
+  if (strstr(set, "[:") != NULL || strstr(set, "[=") != NULL ||
+    (strchr(set, '[') != NULL && strchr(set, '*') != NULL)) {
+    return -1;
+  }
+
+  while (*set != '\0') {
+    first = parse_tr_byte(&set);
+    if (set[0] == '-' && set[1] != '\0') {
+      set++;
+      last = parse_tr_byte(&set);
+      if (last < first) return -1;
+      for (; first <= last; first++) bytes[num_bytes++] = first;
+    } else {
+      bytes[num_bytes++] = first;
+    }
+  }
+
+  return num_bytes;
+}
+
+/*
+ * reads "tr SET1 SET2" into a table that maps every byte
+ * to what it becomes and "tr -d SET1" into one that marks
+ * every byte with TR_KEEP or TR_DELETE
+ */
+static int parse_tr_arguments(Command *expanded, Stream_stage *stage) {
+  unsigned char *from, *to, *table = stage->table;
+  int num_from, num_to, i;
+
+  if (expanded->num_args != 2) return NOT_A_STREAM_BUILTIN;
+  stage->deleting = (strcmp(expanded->arguments[0], "-d") == 0);
+  if (!stage->deleting && (expanded->arguments[0][0] == '-' ||
+    expanded->arguments[1][0] == '-')) {
+    return NOT_A_STREAM_BUILTIN;
+  }
+
+  from = malloc(NUM_BYTE_VALUES * (strlen(expanded->arguments[0]) +
+    strlen(expanded->arguments[1]) + 1));
+  MEM_CHECK(from);
+  to = from + NUM_BYTE_VALUES * (strlen(expanded->arguments[0]) + 1);
+
+  if (stage->deleting) {
+    memset(table, TR_KEEP, NUM_BYTE_VALUES);
+    num_from = parse_tr_set(expanded->arguments[1], from);
+    for (i = 0; i < num_from; i++) table[from[i]] = TR_DELETE;
+  } else {
+    for (i = 0; i < NUM_BYTE_VALUES; i++) table[i] = i;
+    num_from = parse_tr_set(expanded->arguments[0], from);
+    num_to = parse_tr_set(expanded->arguments[1], to);
+
+    /* a short SET2 is padded with its last byte */
+    if (num_to <= 0) num_from = -1;
+    for (i = 0; i < num_from; i++) {
+      table[from[i]] = to[(i < num_to) ? i : num_to - 1];
+    }
+  }
+  free(from);
+
+  return (num_from > 0) ? IS_A_STREAM_BUILTIN : NOT_A_STREAM_BUILTIN;
+}
+
+/*
+ * checks if a command is a cat, head or tr that can run
+ * as a thread and gets it ready to, the command is
+ * expanded here (in the shell, there is no child to do
+ * it) and the stage must be cleaned up with
+ * cleanup_stream_builtin() or finish_stream_builtin()
+ */
+int prepare_stream_builtin(Command *command, Stream_stage *stage) {
+  int supported;
+
+  stage->builtin = NOT_A_STREAM_BUILTIN;
+  if (command->kind != COMMAND_SIMPLE || command->affinity != NULL ||
+    command->num_assignments > 0 || command->num_substitutions > 0 ||
+    is_batched(&command->batch) ||
+    find_stream_builtin(command->program) == NOT_A_STREAM_BUILTIN ||
+    is_shell_command(command)) {
+    return NOT_A_STREAM_BUILTIN;
+  }
+
+  expand_command(command, &stage->expanded);
+  stage->builtin = find_stream_builtin(stage->expanded.program);
+  if (stage->builtin == STREAM_CAT) {
+    supported = parse_cat_arguments(&stage->expanded);
+  } else if (stage->builtin == STREAM_HEAD) {
+    supported = parse_head_arguments(&stage->expanded, &stage->lines);
+  } else if (stage->builtin == STREAM_TR) {
+    supported = parse_tr_arguments(&stage->expanded, stage);
+  } else {
+    supported = NOT_A_STREAM_BUILTIN;
+  }
+  if (!supported) {
+    cleanup_expanded_command(&stage->expanded);
+    stage->builtin = NOT_A_STREAM_BUILTIN;
+    return NOT_A_STREAM_BUILTIN;
+  }
+
+  stage->buffer = malloc(sizeof(char) * STREAM_BUFFER_SIZE);
+  MEM_CHECK(stage->buffer);
+  stage->started = 0;
+  stage->status = EXIT_SUCCESS;
+  set_stage_fd(&stage->input, STDIN_FILENO, 0);
+  set_stage_fd(&stage->output, STDOUT_FILENO, 0);
+
+  return IS_A_STREAM_BUILTIN;
+}
+
+/*
+ * connects a stage to a file descriptor
+ */
+void set_stage_fd(Stage_stream *stream, int fd, int owns_fd) {
+  stream->fd = fd;
+  stream->owns_fd = owns_fd;
+  stream->ring = NULL;
+}
+
+/*
+ * connects a stage to a ring
+ */
+void set_stage_ring(Stage_stream *stream, Ring_buffer *ring) {
+  stream->fd = NO_STREAM_FD;
+  stream->owns_fd = 0;
+  stream->ring = ring;
+}
+
+/*
+ * reads what is available, returns 0 at the end
+ * of the input and -1 if it could not be read
+ */
+static long read_stream(Stage_stream *stream, char *buffer, size_t size) {
+  long num_read;
+
+  if (stream->ring != NULL) return read_ring(stream->ring, buffer, size);
+
+  while ((num_read = read(stream->fd, buffer, size)) < 0 && errno == EINTR);
+
+  return num_read;
+}
+
+/*
+ * writes all of a buffer, returns STREAM_STOPPED if the
+ * stage after this one stopped reading (or if the output
+ * could not be written)
+ */
+static int write_stream(Stage_stream *stream, char *buffer, size_t size) {
+  long num_written;
+
+  if (stream->ring != NULL) {
+    return (write_ring(stream->ring, buffer, size) == RING_WRITTEN) ?
+      STREAM_WRITTEN : STREAM_STOPPED;
+  }
+
+  /* SIGPIPE is blocked in the stage threads so a
+   * reader that went away shows up as EPIPE */
+  while (size > 0) {
+    num_written = write(stream->fd, buffer, size);
+    if (num_written < 0) {
+      if (errno == EINTR) continue;
+      return STREAM_STOPPED;
+    }
+    buffer += num_written;
+    size -= num_written;
+  }
+
+  return STREAM_WRITTEN;
+}
+
+/*
+ * copies an input to an output until the input ends
+ * or the output stops, status is set to EXIT_FAILURE
+ * if either of them failed
+ */
+static int copy_stream(Stage_stream *input, Stage_stream *output,
+  char *buffer, int *status) {
+  long num_read;
+
+  while ((num_read = read_stream(input, buffer, STREAM_BUFFER_SIZE)) > 0) {
+    if (write_stream(output, buffer, num_read) == STREAM_STOPPED) {
+      if (errno != EPIPE && output->ring == NULL) *status = EXIT_FAILURE;
+      return STREAM_STOPPED;
+    }
+  }
+  if (num_read < 0) *status = EXIT_FAILURE;
+
+  return STREAM_WRITTEN;
+}
+
+/*
+ * runs "cat", a missing file is reported
+ * and the rest are still copied
+ */
+static int run_cat(Stream_stage *stage) {
+  Stage_stream file;
+  int status = EXIT_SUCCESS, fd, i;
+
+  if (stage->expanded.num_args == 0) {
+    copy_stream(&stage->input, &stage->output, stage->buffer, &status);
+    return status;
+  }
+
+  for (i = 0; i < stage->expanded.num_args; i++) {
+    if (strcmp(stage->expanded.arguments[i], STDIN_NAME) == 0) {
+      if (copy_stream(&stage->input, &stage->output, stage->buffer,
+        &status) == STREAM_STOPPED) {
+        break;
+      }
+      continue;
+    }
+
+    fd = open(stage->expanded.arguments[i], O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fprintf(stderr, "cat: %s: %s\n", stage->expanded.arguments[i],
+        strerror(errno));
+      status = EXIT_FAILURE;
+      continue;
+    }
+    set_stage_fd(&file, fd, 1);
+    if (copy_stream(&file, &stage->output, stage->buffer,
+      &status) == STREAM_STOPPED) {
+      close(fd);
+      break;
+    }
+    close(fd);
+  }
+
+  return status;
+}
+
+/*
+ * runs "head", which stops reading (so the
+ * stage before it stops too) after its lines
+ */
+static int run_head(Stream_stage *stage) {
+  long lines_left = stage->lines, num_read;
+  char *end, *newline;
+
+  while (lines_left > 0 &&
+    (num_read = read_stream(&stage->input, stage->buffer,
+    STREAM_BUFFER_SIZE)) > 0) {
+    end = stage->buffer;
+    while (lines_left > 0 &&
+      (newline = memchr(end, '\n', stage->buffer + num_read - end)) != NULL) {
+      end = newline + 1;
+      lines_left--;
+    }
+    if (lines_left > 0) end = stage->buffer + num_read;
+
+    if (write_stream(&stage->output, stage->buffer,
+      end - stage->buffer) == STREAM_STOPPED) {
+      break;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+/*
+ * runs "tr", the bytes are mapped (or deleted) in place,
+ * deleting moves whole runs of kept bytes at once so the
+ * bytes are only scanned until the first one to delete
+ */
+static int run_tr(Stream_stage *stage) {
+  unsigned char *table = stage->table, *byte, *kept, *end, *run;
+  long num_read;
+
+  while ((num_read = read_stream(&stage->input, stage->buffer,
+    STREAM_BUFFER_SIZE)) > 0) {
+    end = (unsigned char *) stage->buffer + num_read;
+    kept = (unsigned char *) stage->buffer;
+    if (stage->deleting) {
+      byte = kept;
+      while (byte < end) {
+        for (run = byte; byte < end && table[*byte] == TR_KEEP; byte++);
+        if (kept != run) memmove(kept, run, byte - run);
+        kept += byte - run;
+        for (; byte < end && table[*byte] == TR_DELETE; byte++);
+      }
+    } else {
+      for (byte = kept; byte < end; byte++) *byte = table[*byte];
+      kept = end;
+    }
+
+    if (write_stream(&stage->output, stage->buffer,
+      (char *) kept - stage->buffer) == STREAM_STOPPED) {
+      break;
+    }
+  }
+
+  return (num_read < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * lets the stages on either side know this one is done
+ */
+static void close_streams(Stream_stage *stage) {
+  if (stage->input.ring != NULL) {
+    close_ring_reader(stage->input.ring);
+  } else if (stage->input.owns_fd) {
+    close(stage->input.fd);
+  }
+
+  if (stage->output.ring != NULL) {
+    close_ring_writer(stage->output.ring);
+  } else if (stage->output.owns_fd) {
+    close(stage->output.fd);
+  }
+}
+
+/*
+ * the body of a stage thread
+ */
+static void *run_stream_stage(void *argument) {
+  Stream_stage *stage = argument;
+
+  if (stage->builtin == STREAM_CAT) {
+    stage->status = run_cat(stage);
+  } else if (stage->builtin == STREAM_HEAD) {
+    stage->status = run_head(stage);
+  } else {
+    stage->status = run_tr(stage);
+  }
+  close_streams(stage);
+
+  return NULL;
+}
+
+/*
+ * starts the thread of a stage once its input and output
+ * are connected, if there is no thread for it the stage
+ * fails and its streams are closed right away so the
+ * stages around it still finish
+ */
+int start_stream_builtin(Stream_stage *stage) {
+  sigset_t all_signals, old_signals;
+
+  /* the thread blocks every signal so they keep going
+   * to the shell and a closed pipe shows up as EPIPE */
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  stage->started = (pthread_create(&stage->thread, NULL, run_stream_stage,
+    stage) == 0);
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  if (!stage->started) {
+    fprintf(stderr, "non fatal error - could not start %s in the shell\n",
+      stage->expanded.program);
+    stage->status = EXIT_FAILURE;
+    close_streams(stage);
+    return STREAM_NOT_STARTED;
+  }
+
+  return STREAM_STARTED;
+}
+
+/*
+ * waits for the thread of a stage to finish, cleans
+ * it up and returns its exit status
+ */
+int finish_stream_builtin(Stream_stage *stage) {
+  if (stage->started) pthread_join(stage->thread, NULL);
+  cleanup_stream_builtin(stage);
+
+  return stage->status;
+}
+
+/*
+ * frees what was set up for a stage
+ */
+void cleanup_stream_builtin(Stream_stage *stage) {
+  if (stage->builtin == NOT_A_STREAM_BUILTIN) return;
+
+  cleanup_expanded_command(&stage->expanded);
+  free(stage->buffer);
+  stage->builtin = NOT_A_STREAM_BUILTIN;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef STREAM_BUILTINS_H
+#define STREAM_BUILTINS_H
+
+#include <pthread.h>
+
+#include "pshell-structs.h"
+#include "ring-buffer.h"
+
+#define NOT_A_STREAM_BUILTIN 0
+#define IS_A_STREAM_BUILTIN 1
+
+#define STREAM_STARTED 0
+#define STREAM_NOT_STARTED 1
+
+/*
+ * the bytes of a stage are read from and written to
+ * either a file descriptor or a ring shared with the
+ * stage next to it (fd is NO_STREAM_FD then), owns_fd
+ * is set if the stage closes the fd when it is done
+ */
+#define NO_STREAM_FD -1
+
+typedef struct stage_stream {
+  int fd;
+  int owns_fd;
+  Ring_buffer *ring;
+} Stage_stream;
+
+/*
+ * a stage of a pipeline that runs as a thread of the
+ * shell, everything it needs is set up before the thread
+ * starts since only the shell's main thread allocates
+ *
+ * lines is how many lines "head" prints, table maps each
+ * byte for "tr" (or marks the bytes to delete if it is
+ * deleting), started is
+ * set once the thread is running and status is the exit
+ * status of the stage once it is joined
+ */
+#define NUM_BYTE_VALUES 256
+
+typedef struct stream_stage {
+  int builtin;
+  int started;
+  Command expanded;
+  long lines;
+  unsigned char table[NUM_BYTE_VALUES];
+  int deleting;
+  Stage_stream input;
+  Stage_stream output;
+  char *buffer;
+  int status;
+  pthread_t thread;
+} Stream_stage;
+
+/*
+ * define functions for running cat, head and
+ * tr as threads of the shell inside a pipeline
+ */
+int prepare_stream_builtin(Command *command, Stream_stage *stage);
+int start_stream_builtin(Stream_stage *stage);
+int finish_stream_builtin(Stream_stage *stage);
+void cleanup_stream_builtin(Stream_stage *stage);
+void set_stage_fd(Stage_stream *stream, int fd, int owns_fd);
+void set_stage_ring(Stage_stream *stream, Ring_buffer *ring);
+
+#endif
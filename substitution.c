@@ -0,0 +1,230 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions run the process substitutions of a
+ * command, "diff <( sort a ) <( sort b )" runs each block in
+ * parentheses in a child of its own with its stdout on a pipe
+ * (its stdin for ">( ... )") and the command gets the other
+ * end of that pipe as the argument "/dev/fd/N"
+ *
+ * the pipes are only made right before the stage that runs
+ * the command is forked, which keeps its end and closes the
+ * other, the children for the blocks are forked right after
+ * it (so they can join its process group) and the shell then
+ * closes its copies of both ends, so no other stage of the
+ * pipeline ever has one of them open
+ *
+ * the shell does not wait for a "<( ... )", it is done when
+ * the command stops reading it and ends with the rest of the
+ * pipeline, but it does wait for a ">( ... )" of the pipeline
+ * it waits for since that usually still has output to write
+ * once the command is done
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "process-helper.h"
+#include "process-group.h"
+#include "admission.h"
+#include "substitution.h"
+
+/*
+ * the ">( ... )" children of the pipeline the shell
+ * waits for, which it waits for along with it
+ */
+static pid_t *output_pids = NULL;
+static int num_output_pids = 0;
+static int output_capacity = 0;
+
+/*
+ * define prototypes
+ */
+static int command_end(Substitution *substitution, int *pipe_fds);
+static int body_end(Substitution *substitution, int *pipe_fds);
+static void add_output_pid(pid_t pid);
+
+/*
+ * gets the end of a substitution's pipe that the
+ * command uses and the end that its block uses
+ */
+static int command_end(Substitution *substitution, int *pipe_fds) {
+  return (substitution->direction == READ_SUBSTITUTION) ? pipe_fds[0] :
+    pipe_fds[1];
+}
+
+static int body_end(Substitution *substitution, int *pipe_fds) {
+  return (substitution->direction == READ_SUBSTITUTION) ? pipe_fds[1] :
+    pipe_fds[0];
+}
+
+/*
+ * makes a pipe for each substitution of a command, the two
+ * ends of the pipe of substitution i are at 2i and 2i + 1,
+ * returns NULL if the pipes could not be made
+ */
+int *open_substitution_pipes(Command *command) {
+  int *pipes;
+  int i;
+
+  pipes = malloc(sizeof(int) * 2 * command->num_substitutions);
+  MEM_CHECK(pipes);
+
+  for (i = 0; i < command->num_substitutions; i++) {
+    if (admit_pipe(pipes + 2 * i) != ADMITTED) {
+      fprintf(stderr, "non fatal error - could not create pipe\n");
+      fprintf(stderr, "pipe() failed with %d\n", errno);
+      while (i-- > 0) {
+        close(pipes[2 * i]);
+        close(pipes[2 * i + 1]);
+      }
+      free(pipes);
+      return NULL;
+    }
+  }
+
+  return pipes;
+}
+
+/*
+ * closes the pipes of a command's substitutions
+ * and frees what was allocated for them
+ */
+void close_substitution_pipes(Command *command, int *pipes) {
+  int i;
+
+  for (i = 0; i < 2 * command->num_substitutions; i++) {
+    close(pipes[i]);
+  }
+  free(pipes);
+}
+
+/*
+ * closes the ends of the pipes that the blocks use and
+ * replaces each substitution in the arguments with the
+ * path of the end the command uses, this is meant to be
+ * called in the child forked for the command
+ */
+void use_substitution_pipes(Command *command, int *pipes) {
+  Substitution *substitution;
+  char *path;
+  int i;
+
+  for (i = 0; i < command->num_substitutions; i++) {
+    substitution = &command->substitutions[i];
+    close(body_end(substitution, pipes + 2 * i));
+
+    path = malloc(sizeof(char) * SUBSTITUTION_PATH_SIZE);
+    MEM_CHECK(path);
+    sprintf(path, "/dev/fd/%d", command_end(substitution, pipes + 2 * i));
+    free(command->arguments[substitution->argument]);
+    command->arguments[substitution->argument] = path;
+  }
+  free(pipes);
+}
+
+/*
+ * keeps the pid of a ">( ... )" child to wait for
+ */
+static void add_output_pid(pid_t pid) {
+  if (num_output_pids >= output_capacity) {
+    output_capacity = (output_capacity == 0) ? FIRST_OUTPUT_CAPACITY :
+      output_capacity * 2;
+    output_pids = realloc(output_pids, sizeof(pid_t) * output_capacity);
+    MEM_CHECK(output_pids);
+  }
+  output_pids[num_output_pids++] = pid;
+}
+
+/*
+ * forks a child for each substitution of a command whose
+ * stage was just forked (stage_fds are the pipes between the
+ * stages of its pipeline that the shell still has open) and
+ * closes the shell's ends of their pipes, returns how many
+ * children were started
+ *
+ * the children join the process group of the pipeline and
+ * run their block like a line of their own
+ */
+int start_substitutions(Command *command, int *pipes, int (*stage_fds)[2],
+  int num_stage_pipes, pid_t group, int in_foreground) {
+  Substitution *substitution;
+  pid_t pid;
+  int i, j, fd, num_started = 0;
+
+  for (i = 0; i < command->num_substitutions; i++) {
+    substitution = &command->substitutions[i];
+    pid = admit_fork();
+    if (pid == 0) {
+      join_pipeline_group(group, KEEPS_TERMINAL);
+
+      /* only the block's end of its own pipe stays open,
+       * otherwise the readers of the other pipes would
+       * never see them end */
+      for (j = 0; j < num_stage_pipes; j++) {
+        if (stage_fds[j][0] >= 0) close(stage_fds[j][0]);
+        if (stage_fds[j][1] >= 0) close(stage_fds[j][1]);
+      }
+      for (j = 0; j < command->num_substitutions; j++) {
+        if (j != i) {
+          close(pipes[2 * j]);
+          close(pipes[2 * j + 1]);
+        }
+      }
+      close(command_end(substitution, pipes + 2 * i));
+
+      fd = body_end(substitution, pipes + 2 * i);
+      dup2(fd, (substitution->direction == READ_SUBSTITUTION) ?
+        STDOUT_FILENO : STDIN_FILENO);
+      close(fd);
+
+      exit(execute_last_sync_sequence(substitution->body->sync_sequence));
+    } else if (pid > 0) {
+      add_to_pipeline_group(pid, group, KEEPS_TERMINAL);
+      num_started++;
+      if (in_foreground == PIPELINE_IN_FOREGROUND &&
+        substitution->direction == WRITE_SUBSTITUTION) {
+        add_output_pid(pid);
+      }
+    } else {
+      /* the command sees its end of the pipe end right away */
+      fprintf(stderr, "non fatal error - could not start a process\
+ substitution\n");
+      fprintf(stderr, "fork() failed with %d\n", errno);
+    }
+  }
+  close_substitution_pipes(command, pipes);
+
+  return num_started;
+}
+
+/*
+ * waits for the ">( ... )" children of the pipeline the
+ * shell waited for, a child that was stopped is not
+ * waited for any longer
+ */
+void wait_for_output_substitutions(void) {
+  int i, status;
+
+  for (i = 0; i < num_output_pids; i++) {
+    while (waitpid(output_pids[i], &status, WUNTRACED) < 0 &&
+      errno == EINTR);
+  }
+  num_output_pids = 0;
+}
+
+/*
+ * forgets the ">( ... )" children of a pipeline
+ * that was stopped instead of waiting for them
+ */
+void forget_output_substitutions(void) {
+  num_output_pids = 0;
+}
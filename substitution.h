@@ -0,0 +1,31 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef SUBSTITUTION_H
+#define SUBSTITUTION_H
+
+#include <sys/types.h>
+
+#include "pshell-structs.h"
+
+/*
+ * room for "/dev/fd/" and the number of a file descriptor
+ */
+#define SUBSTITUTION_PATH_SIZE 32
+
+#define FIRST_OUTPUT_CAPACITY 8
+
+/*
+ * define functions for running the process substitutions
+ * of a command along with the stage that runs it
+ */
+int *open_substitution_pipes(Command *command);
+void close_substitution_pipes(Command *command, int *pipes);
+void use_substitution_pipes(Command *command, int *pipes);
+int start_substitutions(Command *command, int *pipes, int (*stage_fds)[2],
+  int num_stage_pipes, pid_t group, int in_foreground);
+void wait_for_output_substitutions(void);
+void forget_output_substitutions(void);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * test for "substitution.h"
+ */
+
+/* allow us to use 'mkdtemp' */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "environment.h"
+#include "process-helper.h"
+
+#define TEST_SUCCEEDED 0
+#define TEST_FAILED 1
+
+/*
+ * a substitution that is never finished is
+ * killed by SIGALRM after this long
+ */
+#define TEST_TIMEOUT_SECONDS 30
+
+#define PATH_SIZE 256
+#define OUTPUT_SIZE 4096
+#define MAX_LINES 16
+
+/*
+ * pull in the current environment
+ *
+ * this variable is defined in unistd.h
+ */
+extern char **environ;
+
+/*
+ * define prototypes
+ */
+static void fail(char *message);
+static int run_line(char *line, char *output);
+static int compare_lines(const void *a, const void *b);
+static void expect_lines(char *line, int expected_status, char *expected[]);
+static int count_open_fds(void);
+
+static char output_path[PATH_SIZE];
+
+static void fail(char *message) {
+  printf("%s\n", message);
+  exit(TEST_FAILED);
+}
+
+/*
+ * runs a line like the shell would with its output
+ * sent to the output file and gets what it printed
+ * along with its exit status
+ */
+static int run_line(char *line, char *output) {
+  Token_list token_list;
+  Async_sequence **sync_sequence;
+  int saved_stdout, fd, status;
+  ssize_t size;
+
+  fflush(stdout);
+  saved_stdout = dup(STDOUT_FILENO);
+  fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (saved_stdout < 0 || fd < 0) fail("Could not capture the output!");
+  dup2(fd, STDOUT_FILENO);
+
+  token_list = parse_tokens(line);
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+  status = execute_sync_sequence(sync_sequence);
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_token_list(&token_list);
+
+  fflush(stdout);
+  dup2(saved_stdout, STDOUT_FILENO);
+  close(saved_stdout);
+  lseek(fd, 0, SEEK_SET);
+  size = read(fd, output, OUTPUT_SIZE - 1);
+  close(fd);
+  output[size < 0 ? 0 : size] = '\0';
+
+  return status;
+}
+
+static int compare_lines(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * checks the exit status of a line and the lines it
+ * printed, which are sorted first since a ">( ... )"
+ * writes to stdout along with the command
+ */
+static void expect_lines(char *line, int expected_status, char *expected[]) {
+  char output[OUTPUT_SIZE], *lines[MAX_LINES], *end;
+  int status, num_lines = 0, i;
+
+  printf("Testing \"%s\"\n", line);
+  status = run_line(line, output);
+  if (status != expected_status) {
+    printf("Expected: status %d, Got: %d\n", expected_status, status);
+    fail("Exit status not as expected!");
+  }
+
+  for (lines[0] = output; *lines[num_lines] != '\0' &&
+    num_lines < MAX_LINES - 1; num_lines++) {
+    end = strchr(lines[num_lines], '\n');
+    if (end == NULL) fail("Output cut short!");
+    *end = '\0';
+    lines[num_lines + 1] = end + 1;
+  }
+  qsort(lines, num_lines, sizeof(char *), compare_lines);
+
+  for (i = 0; expected[i] != NULL; i++) {
+    if (i >= num_lines || strcmp(lines[i], expected[i]) != 0) {
+      printf("Expected: \"%s\", Got: \"%s\"\n", expected[i],
+        (i < num_lines) ? lines[i] : "");
+      fail("Output not as expected!");
+    }
+  }
+  if (i != num_lines) fail("Had too many lines!");
+  printf("Output as expected!\n");
+}
+
+/*
+ * runs fan-outs that copy small and large inputs to
+ * their branches, some of which stop reading early,
+ * and checks what every branch printed
+ */
+/*
+ * counts the fds the test has open, which are the same
+ * before and after a line that leaves none of its
+ * pipes open in the shell
+ */
+static int count_open_fds(void) {
+  DIR *fds;
+  int count = 0;
+
+  fds = opendir("/proc/self/fd");
+  if (fds == NULL) fail("Could not list the open fds!");
+  while (readdir(fds) != NULL) count++;
+  closedir(fds);
+
+  return count;
+}
+
+/*
+ * runs commands that read from and write to process
+ * substitutions and checks their output, their exit
+ * status and that the shell closed every pipe
+ */
+int main() {
+  char directory[] = "/tmp/pshell-substitution-XXXXXX";
+  char *both[] = {"one", "two", NULL};
+  char *none[] = {NULL};
+  char *counted[] = {"100000", NULL};
+  char *teed[] = {"1", "2", "3", "a", "b", "c", NULL};
+  char *piped[] = {"3", NULL};
+  char *changed[] = {"4", NULL};
+  char *diffed[] = {"---", "1c1", "< a", "> b", NULL};
+  int num_fds;
+
+  alarm(TEST_TIMEOUT_SECONDS);
+  init_environment(environ);
+  if (mkdtemp(directory) == NULL) fail("Could not make a directory!");
+  sprintf(output_path, "%s/output", directory);
+  num_fds = count_open_fds();
+
+  expect_lines("cat <( echo one ) <( echo two )", 0, both);
+  expect_lines("diff <( seq 1 3 ) <( seq 1 3 )", 0, none);
+  expect_lines("diff <( echo a ) <( echo b )", 1, diffed);
+  expect_lines("diff <( echo a ) <( echo b ) | grep -c .", 0, changed);
+
+  /* much more than fits in the pipe at once */
+  expect_lines("wc -l <( seq 1 100000 ) | cut -d \" \" -f 1", 0, counted);
+
+  /* a command that stops reading early is not held up */
+  expect_lines("head -n 1 <( seq 1 100000 ) | wc -l | tr 1 3", 0, piped);
+
+  /* the shell waits for what ">( ... )" still writes */
+  expect_lines("seq 1 3 | tee >( tr 1-3 a-c )", 0, teed);
+
+  printf("Testing that no pipe was left open\n");
+  if (count_open_fds() != num_fds) fail("Pipes left open in the shell!");
+  printf("No pipe left open as expected!\n");
+
+  unlink(output_path);
+  rmdir(directory);
+  printf("\n");
+
+  exit(TEST_SUCCEEDED);
+}
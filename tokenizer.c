@@ -73,6 +73,23 @@ void add_token(Token_list *token_list, char *element, int was_quoted) {
   token_list->iterator = token;
 }
 
+/*
+ * removes the first token from a token list
+ */
+void remove_first_token(Token_list *token_list) {
+  Token *head;
+
+  if (token_list == NULL || token_list->head == NULL) return;
+
+  head = token_list->head;
+  token_list->head = head->next;
+  if (token_list->iterator == head) {
+    token_list->iterator = head->next;
+  }
+  free(head->data);
+  free(head);
+}
+
 /*
  * get a token list of all the
  * tokens in the input line
@@ -31,6 +31,7 @@ typedef struct token_list {
  */
 void init_token_list(Token_list *token_list);
 void add_token(Token_list *token_list, char *element, int was_quoted);
+void remove_first_token(Token_list *token_list);
 Token_list parse_tokens(char *line);
 
 
@@ -0,0 +1,606 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+/*
+ * the following functions run a line given the "watch"
+ * prefix again every time the files it uses change, like:
+ *
+ *   watch cc -c *.c ; ./run-tests
+ *
+ * the line is parsed once and the words of its commands
+ * that name files or directories (the paths its patterns
+ * matched among them) are watched with inotify, through
+ * the directories they are in so a file an editor saves
+ * by renaming a new copy over it is still noticed, and
+ * the directory a pattern read is watched for names that
+ * match it, which is the only change that makes the shell
+ * look for the paths it matches again (the patterns are
+ * expanded again every time the line runs)
+ *
+ * a burst of changes is one run once nothing changed for
+ * WATCH_DEBOUNCE_MS, each run is a child in a process group
+ * of its own (which gets the terminal) and a change while
+ * it is still going ends that group and starts it over
+ *
+ * whatever changes while the first run is going is taken
+ * to be written by the line itself (the "-o prog" of a
+ * compiler that is also a word of the line) and is not
+ * watched, otherwise every run would start the next one
+ *
+ * ^C ends the run and stops watching, while the shell is
+ * waiting for a change it takes ^C through a signalfd
+ */
+
+/* allow us to use 'syscall' and 'signalfd' */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+#include "pshell.h"
+#include "pshell-structs.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "process-helper.h"
+#include "process-group.h"
+#include "expansion.h"
+#include "glob-expand.h"
+#include "admission.h"
+#include "jobs.h"
+#include "watch.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+  IN_CREATE | IN_DELETE)
+
+#define EVENT_BUFFER_SIZE 4096
+
+#define NO_FD -1
+
+#define RUN_FINISHED 0
+#define RUN_CHANGED 1
+#define RUN_INTERRUPTED 2
+
+#define CHANGE_SEEN 0
+#define WATCH_INTERRUPTED 1
+
+#define FIRST_RUN 1
+#define LATER_RUN 0
+
+/*
+ * a directory with something in it the line uses: the
+ * names of the files in it, the patterns whose matches
+ * are in it or all of it if a word named it, outputs are
+ * the names the line wrote, which are never watched
+ */
+typedef struct watched_dir {
+  int wd;
+  char *path;
+  int watch_all;
+  int num_names;
+  char **names;
+  int num_patterns;
+  char **patterns;
+  int num_outputs;
+  char **outputs;
+} Watched_dir;
+
+typedef struct watch_set {
+  int inotify_fd;
+  int num_dirs;
+  Watched_dir *dirs;
+  int needs_paths;
+} Watch_set;
+
+/*
+ * define prototypes
+ */
+static char *copy_string(char *string, size_t length);
+static Watched_dir *find_dir(Watch_set *set, char *path);
+static void add_name(int *num_names, char ***names, char *name);
+static int remove_name(int *num_names, char **names, char *name);
+static int has_name(int num_names, char **names, char *name);
+static void add_path(Watch_set *set, char *word);
+static void add_pattern(Watch_set *set, char *word);
+static void add_block_paths(Watch_set *set, Block *block);
+static void add_command_paths(Watch_set *set, Command *command);
+static void add_sync_sequence_paths(Watch_set *set,
+  Async_sequence **sync_sequence);
+static int read_changes(Watch_set *set, int is_first_run);
+static int run_watched(Watch_set *set, Async_sequence **sync_sequence,
+  int is_first_run, int *status);
+static int wait_for_change(Watch_set *set);
+static void let_changes_settle(Watch_set *set);
+static void cleanup_watch_set(Watch_set *set);
+
+/*
+ * checks if a line starts with the "watch" prefix
+ */
+int is_watch_line(Token_list *token_list) {
+  return (token_list->head != NULL && !token_list->head->was_quoted &&
+    strcmp(token_list->head->data, WATCH_KEYWORD) == 0);
+}
+
+/*
+ * copies the first length characters of a string
+ */
+static char *copy_string(char *string, size_t length) {
+  char *copy;
+
+  copy = malloc(sizeof(char) * (length + NUL_TERM_SIZE));
+  MEM_CHECK(copy);
+  memcpy(copy, string, length);
+  copy[length] = '\0';
+
+  return copy;
+}
+
+/*
+ * gets the entry of a directory, which starts being
+ * watched the first time, or NULL if it cannot be
+ */
+static Watched_dir *find_dir(Watch_set *set, char *path) {
+  Watched_dir *dir;
+  int wd, i;
+
+  /* the same directory spelled two ways gets the same wd */
+  wd = inotify_add_watch(set->inotify_fd, path, WATCH_MASK);
+  if (wd < 0) return NULL;
+  for (i = 0; i < set->num_dirs; i++) {
+    if (set->dirs[i].wd == wd) return &set->dirs[i];
+  }
+
+  set->dirs = realloc(set->dirs, sizeof(Watched_dir) * (set->num_dirs + 1));
+  MEM_CHECK(set->dirs);
+  dir = &set->dirs[set->num_dirs++];
+  dir->wd = wd;
+  dir->path = copy_string(path, strlen(path));
+  dir->watch_all = 0;
+  dir->num_names = dir->num_patterns = dir->num_outputs = 0;
+  dir->names = dir->patterns = dir->outputs = NULL;
+
+  return dir;
+}
+
+/*
+ * checks if a name is in a list
+ */
+static int has_name(int num_names, char **names, char *name) {
+  int i;
+
+  for (i = 0; i < num_names; i++) {
+    if (strcmp(names[i], name) == 0) return 1;
+  }
+
+  return 0;
+}
+
+/*
+ * adds a copy of a name to a list unless it is already in it
+ */
+static void add_name(int *num_names, char ***names, char *name) {
+  if (has_name(*num_names, *names, name)) return;
+
+  *names = realloc(*names, sizeof(char *) * (*num_names + 1));
+  MEM_CHECK(*names);
+  (*names)[(*num_names)++] = copy_string(name, strlen(name));
+}
+
+/*
+ * takes a name out of a list, returns 1 if it was there
+ */
+static int remove_name(int *num_names, char **names, char *name) {
+  int i;
+
+  for (i = 0; i < *num_names; i++) {
+    if (strcmp(names[i], name) == 0) {
+      free(names[i]);
+      names[i] = names[--(*num_names)];
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * watches a word of the line if it names a file or a
+ * directory, words with a '$' are left alone since
+ * they only mean something once the line runs
+ */
+static void add_path(Watch_set *set, char *word) {
+  struct stat info;
+  Watched_dir *dir;
+  char *slash, *parent;
+
+  if (strchr(word, '$') != NULL || stat(word, &info) != 0) return;
+
+  if (S_ISDIR(info.st_mode)) {
+    dir = find_dir(set, word);
+    if (dir != NULL) dir->watch_all = 1;
+    return;
+  }
+  if (!S_ISREG(info.st_mode)) return;
+
+  slash = strrchr(word, '/');
+  if (slash == NULL) {
+    dir = find_dir(set, ".");
+  } else {
+    parent = copy_string(word, (slash == word) ? 1 : slash - word);
+    dir = find_dir(set, parent);
+    free(parent);
+  }
+  if (dir == NULL) return;
+
+  word = (slash == NULL) ? word : slash + 1;
+  if (!has_name(dir->num_outputs, dir->outputs, word)) {
+    add_name(&dir->num_names, &dir->names, word);
+  }
+}
+
+/*
+ * watches the directory a pattern reads for names that
+ * match it, only a pattern in the last part of a path
+ * is followed (not one in the directories before it)
+ */
+static void add_pattern(Watch_set *set, char *word) {
+  Watched_dir *dir;
+  char *slash, *parent;
+
+  slash = strrchr(word, '/');
+  if (slash == NULL) {
+    dir = find_dir(set, ".");
+  } else {
+    parent = copy_string(word, (slash == word) ? 1 : slash - word);
+    dir = has_glob_characters(parent) ? NULL : find_dir(set, parent);
+    free(parent);
+  }
+  if (dir != NULL) add_name(&dir->num_patterns, &dir->patterns,
+    (slash == NULL) ? word : slash + 1);
+}
+
+/*
+ * watches the paths of the commands of a block
+ */
+static void add_block_paths(Watch_set *set, Block *block) {
+  if (block != NULL) add_sync_sequence_paths(set, block->sync_sequence);
+}
+
+/*
+ * watches the program of a command if it is given as a
+ * path, its arguments (the paths a pattern matches now
+ * for one that is a pattern) and the paths of its blocks
+ */
+static void add_command_paths(Watch_set *set, Command *command) {
+  Glob_matches matches;
+  int i, j;
+
+  if (command->kind == COMMAND_SIMPLE && command->program != NULL &&
+    strchr(command->program, '/') != NULL) {
+    add_path(set, command->program);
+  }
+  for (i = 0; i < command->num_args; i++) {
+    if (is_pattern_argument(command, i) &&
+      expand_glob(command->arguments[i], &matches) == GLOB_MATCHED) {
+      for (j = 0; j < matches.num_paths; j++) {
+        add_path(set, matches.paths[j]);
+      }
+      cleanup_glob_matches(&matches);
+    } else {
+      add_path(set, command->arguments[i]);
+    }
+  }
+
+  add_block_paths(set, command->condition);
+  add_block_paths(set, command->body);
+  for (i = 0; i < command->num_branches; i++) {
+    add_block_paths(set, command->branches[i]);
+  }
+  for (i = 0; i < command->num_substitutions; i++) {
+    add_block_paths(set, command->substitutions[i].body);
+  }
+}
+
+/*
+ * watches the paths of every command of a synchronous sequence
+ */
+static void add_sync_sequence_paths(Watch_set *set,
+  Async_sequence **sync_sequence) {
+  Async_sequence **curr;
+  Pipeline *pipeline;
+  int i, j;
+
+  for (curr = sync_sequence; *curr != NULL; curr++) {
+    for (i = 0; i < (*curr)->num_pipelines; i++) {
+      pipeline = (*curr)->pipelines[i];
+      for (j = 0; j < pipeline->num_commands; j++) {
+        add_command_paths(set, pipeline->commands[j]);
+      }
+    }
+  }
+}
+
+/*
+ * reads the events inotify has and returns how many of
+ * them were changes to something the line uses, in the
+ * first run those are written by the line itself so they
+ * stop being watched instead
+ */
+static int read_changes(Watch_set *set, int is_first_run) {
+  char buffer[EVENT_BUFFER_SIZE];
+  struct inotify_event *event;
+  Watched_dir *dir;
+  char *curr;
+  ssize_t size;
+  int num_changes = 0, i, j;
+
+  while ((size = read(set->inotify_fd, buffer, EVENT_BUFFER_SIZE)) > 0) {
+    for (curr = buffer; curr < buffer + size;
+      curr += sizeof(struct inotify_event) + event->len) {
+      event = (struct inotify_event *) curr;
+
+      dir = NULL;
+      for (i = 0; i < set->num_dirs; i++) {
+        if (set->dirs[i].wd == event->wd) dir = &set->dirs[i];
+      }
+      if (dir == NULL) continue;
+
+      if (dir->watch_all) {
+        if (is_first_run) dir->watch_all = 0;
+        else num_changes++;
+        continue;
+      }
+      if (event->len == 0) continue;
+
+      if (is_first_run) {
+        if (remove_name(&dir->num_names, dir->names, event->name)) {
+          add_name(&dir->num_outputs, &dir->outputs, event->name);
+        }
+      } else {
+        for (j = 0; j < dir->num_names; j++) {
+          if (strcmp(dir->names[j], event->name) == 0) num_changes++;
+        }
+      }
+      for (j = 0; j < dir->num_patterns; j++) {
+        if (event->name[0] == '.' && dir->patterns[j][0] != '.') continue;
+        if (fnmatch(dir->patterns[j], event->name, 0) != 0) continue;
+        if (is_first_run) {
+          remove_name(&dir->num_patterns, dir->patterns, dir->patterns[j]);
+          j--;
+        } else {
+          set->needs_paths = 1;
+          num_changes++;
+        }
+      }
+    }
+  }
+
+  return num_changes;
+}
+
+/*
+ * runs the line in a child in a process group of its own
+ * and waits for it while looking for changes, a change
+ * ends the run early, returns RUN_FINISHED with the exit
+ * status of the line in status, RUN_CHANGED or
+ * RUN_INTERRUPTED if it was ended with ^C
+ */
+static int run_watched(Watch_set *set, Async_sequence **sync_sequence,
+  int is_first_run, int *status) {
+  struct pollfd pollfds[2];
+  int gets_terminal, pidfd, wait_status, result;
+  pid_t pid, group;
+
+  gets_terminal = shell_owns_terminal() ? GETS_TERMINAL : KEEPS_TERMINAL;
+  fflush(stdout);
+
+  pid = admit_fork();
+  if (pid == 0) {
+    join_pipeline_group(NEW_PROCESS_GROUP, gets_terminal);
+    exit(execute_last_sync_sequence(sync_sequence));
+  } else if (pid < 0) {
+    fprintf(stderr, "non fatal error - could not create child process\n");
+    fprintf(stderr, "fork() failed with %d\n", errno);
+    *status = EXIT_COULD_NOT_FORK;
+    return RUN_INTERRUPTED;
+  }
+  group = add_to_pipeline_group(pid, NEW_PROCESS_GROUP, gets_terminal);
+
+  /* without a pidfd the run cannot be ended early */
+  result = RUN_FINISHED;
+  pidfd = syscall(SYS_pidfd_open, pid, 0);
+  pollfds[0].fd = pidfd;
+  pollfds[0].events = POLLIN;
+  pollfds[1].fd = set->inotify_fd;
+  pollfds[1].events = POLLIN;
+  while (pidfd >= 0) {
+    if (poll(pollfds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    enforce_timeouts();
+    if (pollfds[0].revents != 0) break;
+    if (read_changes(set, is_first_run) > 0) {
+      /* the run is still to be waited for, so its group
+       * is only ended (and reaped) once that is done */
+      if (group > NEW_PROCESS_GROUP) {
+        kill(-group, SIGTERM);
+        kill(-group, SIGCONT);
+      }
+      result = RUN_CHANGED;
+      break;
+    }
+  }
+  if (pidfd >= 0) close(pidfd);
+
+  while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR);
+  end_pipeline_group(group);
+  reclaim_terminal();
+
+  /* what the first run wrote only shows up now */
+  if (is_first_run) read_changes(set, FIRST_RUN);
+
+  if (result == RUN_CHANGED) return RUN_CHANGED;
+  if (WIFSIGNALED(wait_status) && WTERMSIG(wait_status) == SIGINT) {
+    *status = STATUS_SIGNAL_OFFSET + SIGINT;
+    return RUN_INTERRUPTED;
+  }
+  *status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) :
+    STATUS_SIGNAL_OFFSET + WTERMSIG(wait_status);
+
+  return RUN_FINISHED;
+}
+
+/*
+ * waits for a change to something the line uses, ^C is
+ * blocked and read from a signalfd meanwhile since the
+ * shell has the terminal, returns CHANGE_SEEN or
+ * WATCH_INTERRUPTED
+ */
+static int wait_for_change(Watch_set *set) {
+  struct pollfd pollfds[2];
+  struct signalfd_siginfo info;
+  sigset_t interrupt, old_mask;
+  int result = CHANGE_SEEN;
+
+  sigemptyset(&interrupt);
+  sigaddset(&interrupt, SIGINT);
+  sigprocmask(SIG_BLOCK, &interrupt, &old_mask);
+
+  pollfds[0].fd = signalfd(NO_FD, &interrupt, SFD_CLOEXEC);
+  pollfds[0].events = POLLIN;
+  pollfds[1].fd = set->inotify_fd;
+  pollfds[1].events = POLLIN;
+
+  while (1) {
+    if (poll(pollfds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      result = WATCH_INTERRUPTED;
+      break;
+    }
+    enforce_timeouts();
+    if (pollfds[0].revents != 0) {
+      while (read(pollfds[0].fd, &info, sizeof(info)) < 0 && errno == EINTR);
+      result = WATCH_INTERRUPTED;
+      break;
+    }
+    if (read_changes(set, LATER_RUN) > 0) break;
+  }
+
+  if (pollfds[0].fd >= 0) close(pollfds[0].fd);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  return result;
+}
+
+/*
+ * waits until nothing the line uses has changed
+ * for WATCH_DEBOUNCE_MS
+ */
+static void let_changes_settle(Watch_set *set) {
+  struct pollfd pollfd;
+
+  pollfd.fd = set->inotify_fd;
+  pollfd.events = POLLIN;
+  while (poll(&pollfd, 1, WATCH_DEBOUNCE_MS) != 0) {
+    read_changes(set, LATER_RUN);
+  }
+}
+
+/*
+ * stops watching and frees the watched directories
+ */
+static void cleanup_watch_set(Watch_set *set) {
+  int i, j;
+
+  for (i = 0; i < set->num_dirs; i++) {
+    for (j = 0; j < set->dirs[i].num_names; j++) {
+      free(set->dirs[i].names[j]);
+    }
+    for (j = 0; j < set->dirs[i].num_patterns; j++) {
+      free(set->dirs[i].patterns[j]);
+    }
+    for (j = 0; j < set->dirs[i].num_outputs; j++) {
+      free(set->dirs[i].outputs[j]);
+    }
+    free(set->dirs[i].names);
+    free(set->dirs[i].patterns);
+    free(set->dirs[i].outputs);
+    free(set->dirs[i].path);
+  }
+  free(set->dirs);
+  if (set->inotify_fd >= 0) close(set->inotify_fd);
+}
+
+/*
+ * runs the tokens of a line that followed "watch" and then
+ * runs them again whenever what they use changes, until
+ * ^C, returns the exit status of the last run
+ */
+int watch_line(Token_list token_list) {
+  Async_sequence **sync_sequence;
+  Watch_set set;
+  Token *token;
+  int status = EXIT_SUCCESS, result, is_first_run;
+
+  sync_sequence = parse_synchronous_command_sequence(token_list);
+
+  set.num_dirs = 0;
+  set.dirs = NULL;
+  set.needs_paths = 0;
+  set.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (set.inotify_fd >= 0) {
+    for (token = token_list.head; token != NULL; token = token->next) {
+      if (!token->was_quoted && has_glob_characters(token->data) &&
+        strchr(token->data, '$') == NULL) {
+        add_pattern(&set, token->data);
+      }
+    }
+    add_sync_sequence_paths(&set, sync_sequence);
+  }
+
+  if (set.num_dirs == 0) {
+    fprintf(stderr, "non fatal error - found no files to watch, running the\
+ line once\n");
+    status = execute_sync_sequence(sync_sequence);
+    cleanup_sync_sequence(sync_sequence);
+    cleanup_watch_set(&set);
+    return status;
+  }
+
+  is_first_run = FIRST_RUN;
+  while (1) {
+    result = run_watched(&set, sync_sequence, is_first_run, &status);
+    is_first_run = LATER_RUN;
+    if (result == RUN_INTERRUPTED) break;
+    if (result == RUN_FINISHED && wait_for_change(&set) != CHANGE_SEEN) {
+      status = STATUS_SIGNAL_OFFSET + SIGINT;
+      break;
+    }
+    let_changes_settle(&set);
+
+    /* a pattern may match other paths now */
+    if (set.needs_paths) {
+      add_sync_sequence_paths(&set, sync_sequence);
+      set.needs_paths = 0;
+    }
+  }
+
+  cleanup_sync_sequence(sync_sequence);
+  cleanup_watch_set(&set);
+  set_last_status(status);
+
+  return status;
+}
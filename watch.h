@@ -0,0 +1,26 @@
+/*
+ * Copyright Davis Cook 2017
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "tokenizer.h"
+
+#define WATCH_KEYWORD "watch"
+
+/*
+ * how long the files of a watched line have to stay
+ * unchanged before it is run again, so a burst of
+ * changes (an editor saving, a checkout) is one run
+ */
+#define WATCH_DEBOUNCE_MS 100
+
+/*
+ * define functions for running a line again
+ * whenever the files it uses change
+ */
+int is_watch_line(Token_list *token_list);
+int watch_line(Token_list token_list);
+
+#endif